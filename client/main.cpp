@@ -91,6 +91,8 @@ public:
         metrics_collector = make_unique<MetricsCollector>("../logs");
         rabbitmq_sender = make_unique<RabbitMQSender>(
             rabbitmq_host, 5672, "guest", "guest", "hardware_metrics", "software_metrics");
+        rabbitmq_sender->setPayloadFormat(
+            RabbitMQSender::parsePayloadFormat(ConfigManager::loadSetting("payload_format", "json")));
 
         // Connect to RabbitMQ
         rabbitmq_sender->connect();
@@ -6,11 +6,22 @@
 
 class RabbitMQSender {
 public:
+    // Wire format of published metrics; the server accepts both and picks
+    // the decoder from the message content_type
+    enum class PayloadFormat {
+        Json,
+        Protobuf
+    };
+
     RabbitMQSender(const std::string& hostname, int port,
                    const std::string& username, const std::string& password,
                    const std::string& hw_queue_name, const std::string& sw_queue_name);
     ~RabbitMQSender();
 
+    // "json" or "protobuf", anything else falls back to JSON
+    static PayloadFormat parsePayloadFormat(const std::string& name);
+    void setPayloadFormat(PayloadFormat format);
+
     bool connect();
     void disconnect();
 
@@ -21,6 +32,8 @@ private:
     bool sendMessage(const std::string& queue_name, const std::string& message);
     std::string serializeHardwareMetrics(const MetricsCollector::HardwareMetrics& metrics);
     std::string serializeSoftwareMetrics(const MetricsCollector::SoftwareMetrics& metrics);
+    std::string serializeHardwareMetricsProtobuf(const MetricsCollector::HardwareMetrics& metrics);
+    std::string serializeSoftwareMetricsProtobuf(const MetricsCollector::SoftwareMetrics& metrics);
     bool checkAMQPResponse(amqp_rpc_reply_t x, const char* context);
 
     std::string hostname_, username_, password_;
@@ -29,4 +42,5 @@ private:
     amqp_connection_state_t conn_;
     int channel_;
     bool connected_;
+    PayloadFormat payload_format_;
 };
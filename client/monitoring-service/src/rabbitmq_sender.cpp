@@ -3,19 +3,35 @@
 #include <amqp_framing.h>
 #include <nlohmann/json.hpp>
 #include <amqp_tcp_socket.h>
+#include <charconv>
+#include "monitoring.pb.h"
 
 RabbitMQSender::RabbitMQSender(const std::string& hostname, int port,
                              const std::string& username, const std::string& password,
                              const std::string& hw_queue_name, const std::string& sw_queue_name)
     : hostname_(hostname), port_(port), username_(username), password_(password),
       hw_queue_name_(hw_queue_name), sw_queue_name_(sw_queue_name),
-      conn_(nullptr), channel_(1), connected_(false) {
+      conn_(nullptr), channel_(1), connected_(false), payload_format_(PayloadFormat::Json) {
 }
 
 RabbitMQSender::~RabbitMQSender() {
     disconnect();
 }
 
+RabbitMQSender::PayloadFormat RabbitMQSender::parsePayloadFormat(const std::string& name) {
+    if (name == "protobuf") {
+        return PayloadFormat::Protobuf;
+    }
+    if (!name.empty() && name != "json") {
+        std::cerr << "Unknown payload format '" << name << "', using json" << std::endl;
+    }
+    return PayloadFormat::Json;
+}
+
+void RabbitMQSender::setPayloadFormat(PayloadFormat format) {
+    payload_format_ = format;
+}
+
 bool RabbitMQSender::connect() {
     // Create connection
     conn_ = amqp_new_connection();
@@ -95,7 +111,9 @@ bool RabbitMQSender::sendHardwareMetrics(const MetricsCollector::HardwareMetrics
         }
     }
 
-    std::string message = serializeHardwareMetrics(metrics);
+    std::string message = payload_format_ == PayloadFormat::Protobuf
+        ? serializeHardwareMetricsProtobuf(metrics)
+        : serializeHardwareMetrics(metrics);
     return sendMessage(hw_queue_name_, message);
 }
 
@@ -105,15 +123,24 @@ bool RabbitMQSender::sendSoftwareMetrics(const MetricsCollector::SoftwareMetrics
         return false;
     }
     
-    std::string message = serializeSoftwareMetrics(metrics);
+    std::string message = payload_format_ == PayloadFormat::Protobuf
+        ? serializeSoftwareMetricsProtobuf(metrics)
+        : serializeSoftwareMetrics(metrics);
     return sendMessage(sw_queue_name_, message);
 }
 
 bool RabbitMQSender::sendMessage(const std::string& queue_name, const std::string& message) {
     amqp_basic_properties_t props;
     props._flags = AMQP_BASIC_CONTENT_TYPE_FLAG | AMQP_BASIC_DELIVERY_MODE_FLAG;
-    props.content_type = amqp_cstring_bytes("application/json");
+    props.content_type = amqp_cstring_bytes(payload_format_ == PayloadFormat::Protobuf
+                                            ? "application/x-protobuf"
+                                            : "application/json");
     props.delivery_mode = 2; // persistent delivery
+
+    // Protobuf bodies may contain NUL bytes, so pass the length explicitly
+    amqp_bytes_t body;
+    body.len = message.size();
+    body.bytes = const_cast<char*>(message.data());
     
     // Publish message
     int status = amqp_basic_publish(conn_, channel_,
@@ -122,7 +149,7 @@ bool RabbitMQSender::sendMessage(const std::string& queue_name, const std::strin
                                   0, // mandatory
                                   0, // immediate
                                   &props,
-                                  amqp_cstring_bytes(message.c_str()));
+                                  body);
     amqp_rpc_reply_t reply = amqp_get_rpc_reply(conn_);
     if (!checkAMQPResponse(reply, "Publishing message")) {
         return false;
@@ -175,6 +202,48 @@ std::string RabbitMQSender::serializeSoftwareMetrics(const MetricsCollector::Sof
     return json.dump();
 }
 
+std::string RabbitMQSender::serializeHardwareMetricsProtobuf(const MetricsCollector::HardwareMetrics& metrics) {
+    monitoring::HardwareMetrics message;
+    message.set_device_id(metrics.device_id);
+    message.set_readable_date(metrics.readable_date);
+    message.set_cpu_percent(metrics.cpu_usage);
+    message.set_memory_percent(metrics.memory_usage);
+    message.set_disk_percent(metrics.disk_usage_root);
+    message.set_usb_devices(metrics.usb_data);
+
+    // gpio_state is kept as text by the collector ("error" when unavailable)
+    int gpio_state = 0;
+    const char* gpio_end = metrics.gpio_state.data() + metrics.gpio_state.size();
+    auto res = std::from_chars(metrics.gpio_state.data(), gpio_end, gpio_state);
+    if (res.ec == std::errc() && res.ptr == gpio_end) {
+        message.set_gpio_state(gpio_state);
+    }
+
+    message.set_kernel_version(metrics.kernel_version);
+    message.set_hardware_model(metrics.hardware_model);
+    message.set_firmware_version(metrics.firmware_version);
+    return message.SerializeAsString();
+}
+
+std::string RabbitMQSender::serializeSoftwareMetricsProtobuf(const MetricsCollector::SoftwareMetrics& metrics) {
+    monitoring::SoftwareMetrics message;
+    message.set_device_id(metrics.device_id);
+    message.set_readable_date(metrics.readable_date);
+    message.set_ip_address(metrics.ip_address);
+    message.set_uptime(metrics.uptime);
+    message.set_network_status(metrics.network_status);
+    message.set_os_version(metrics.os_version);
+    for (const auto& [name, version] : metrics.applications) {
+        auto* app = message.add_applications();
+        app->set_name(name);
+        app->set_version(version);
+    }
+    for (const auto& [name, status] : metrics.services) {
+        (*message.mutable_services())[name] = status;
+    }
+    return message.SerializeAsString();
+}
+
 bool RabbitMQSender::checkAMQPResponse(amqp_rpc_reply_t x, const char* context) {
     switch (x.reply_type) {
         case AMQP_RESPONSE_NORMAL:
@@ -12,6 +12,7 @@ private:
     static const std::string CONFIG_DIR;
     static const std::string DEVICE_CONFIG_FILE;
     static const std::string CREDENTIALS_FILE;
+    static const std::string CLIENT_CONFIG_FILE;
 
 public:
     // Device information management
@@ -23,6 +24,9 @@ public:
     static bool loadCredentials(std::string& hostname, std::string& password);
     static bool clearCredentials();
     
+    // Agent settings (key=value lines in client.conf)
+    static std::string loadSetting(const std::string& key, const std::string& default_value);
+    
     // Configuration file management
     static bool createConfigDir();
     static bool configExists();
@@ -9,6 +9,7 @@
 const std::string ConfigManager::CONFIG_DIR = "../config/";
 const std::string ConfigManager::DEVICE_CONFIG_FILE = CONFIG_DIR + "device.conf";
 const std::string ConfigManager::CREDENTIALS_FILE = CONFIG_DIR + "credentials.conf";
+const std::string ConfigManager::CLIENT_CONFIG_FILE = CONFIG_DIR + "client.conf";
 
 bool ConfigManager::createConfigDir() {
     try {
@@ -69,6 +70,27 @@ bool ConfigManager::loadDeviceInfo(const std::string& hostname, std::string& dev
     return (stored_hostname == hostname && !device_id.empty());
 }
 
+std::string ConfigManager::loadSetting(const std::string& key, const std::string& default_value) {
+    std::ifstream file(CLIENT_CONFIG_FILE);
+    if (!file.is_open()) {
+        return default_value;
+    }
+    
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        
+        size_t pos = line.find('=');
+        if (pos != std::string::npos && line.substr(0, pos) == key) {
+            return line.substr(pos + 1);
+        }
+    }
+    
+    return default_value;
+}
+
 bool ConfigManager::saveCredentials(const std::string& hostname, const std::string& password) {
     if (!createConfigDir()) {
         return false;
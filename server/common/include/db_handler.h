@@ -2,6 +2,8 @@
 #include <mysql/mysql.h>
 #include <string>
 #include <vector>
+#include <memory>
+#include "mysql_connection_pool.h"
 
 struct DeviceData {
     int id = 0;
@@ -18,14 +20,14 @@ struct DeviceData {
 
 class DBHandler {
 public:
-    DBHandler();
+    explicit DBHandler(std::shared_ptr<MySQLConnectionPool> pool);
     ~DBHandler();
     
-    MYSQL* getConnection();
+    // Borrow a pooled connection for statements not covered below
+    MySQLConnectionPool::Lease connection();
+
     bool executeQuery(const std::string& query);
     MYSQL_RES* executeSelect(const std::string& query);
-    std::string getLastError();
-    void clearPreviousResults();
 
     // Device management methods
     bool authenticateDevice(const std::string& hostname, const std::string& password);
@@ -43,10 +45,6 @@ public:
     MYSQL_RES* Query(const std::string& query);
 
 private:
-    MYSQL* conn;
-    std::string host = "127.0.0.1";
-    std::string user = "root";
-    std::string pass = "root";
-    std::string db_name = "IOTSHADOW";
+    std::shared_ptr<MySQLConnectionPool> pool_;
     std::string hashPassword(const std::string& password);
 };
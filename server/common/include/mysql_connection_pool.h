@@ -0,0 +1,131 @@
+#pragma once
+#include <mysql/mysql.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <cstdint>
+#include "prepared_statement_cache.h"
+
+struct MySQLPoolOptions {
+    std::string host = "127.0.0.1";
+    std::string user = "root";
+    std::string password = "root";
+    std::string database = "IOTSHADOW";
+    unsigned int port = 3306;
+
+    // Connections opened up front / upper bound on open connections
+    size_t min_size = 2;
+    size_t max_size = 16;
+
+    // How long acquire() waits for a free connection before giving up
+    std::chrono::milliseconds acquire_timeout{5000};
+
+    // Idle connections unused for longer than this are pinged before reuse
+    std::chrono::milliseconds health_check_interval{30000};
+};
+
+// One pooled connection and the statements prepared on it
+class MySQLConnection {
+public:
+    MYSQL* handle() { return mysql_; }
+    PreparedStatementCache& statements() { return statements_; }
+
+    // Run a plain query, logging failures
+    bool execute(const std::string& query);
+
+    // Connection-level failure of the last statement (server gone, lost, ...)
+    bool lost() const;
+
+private:
+    friend class MySQLConnectionPool;
+
+    MYSQL* mysql_ = nullptr;
+    PreparedStatementCache statements_;
+    std::chrono::steady_clock::time_point last_used_;
+    bool broken_ = false;
+};
+
+// Connections shared by every service. Each caller borrows a connection
+// for the duration of its work, so concurrent RPCs run on separate sockets.
+class MySQLConnectionPool {
+public:
+    // Borrowed connection, returned to the pool when destroyed
+    class Lease {
+    public:
+        Lease() = default;
+        Lease(MySQLConnectionPool* pool, MySQLConnection* conn) : pool_(pool), conn_(conn) {}
+        Lease(Lease&& other) noexcept;
+        Lease& operator=(Lease&& other) noexcept;
+        ~Lease();
+
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        explicit operator bool() const { return conn_ != nullptr; }
+        MySQLConnection* operator->() const { return conn_; }
+        MySQLConnection& operator*() const { return *conn_; }
+
+        // Close the connection instead of reusing it (after a connection error)
+        void markBroken();
+
+    private:
+        MySQLConnectionPool* pool_ = nullptr;
+        MySQLConnection* conn_ = nullptr;
+
+        void release();
+    };
+
+    struct Stats {
+        size_t open;                // connections currently open
+        size_t idle;                // open and not borrowed
+        uint64_t acquired;          // successful acquire() calls
+        uint64_t waited;            // ...that had to wait for a connection
+        uint64_t timeouts;          // acquire() calls that gave up
+        uint64_t reconnects;        // connections replaced after a failure
+        uint64_t total_wait_us;     // time spent waiting in acquire()
+        uint64_t max_wait_us;
+    };
+
+    explicit MySQLConnectionPool(const MySQLPoolOptions& options = MySQLPoolOptions());
+    ~MySQLConnectionPool();
+
+    MySQLConnectionPool(const MySQLConnectionPool&) = delete;
+    MySQLConnectionPool& operator=(const MySQLConnectionPool&) = delete;
+
+    // Create the database if needed and open min_size connections
+    bool initialize();
+
+    // Borrow a connection; the lease is empty if none became available in time
+    Lease acquire();
+
+    Stats getStats() const;
+
+private:
+    MySQLPoolOptions options_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable available_;
+    std::vector<std::unique_ptr<MySQLConnection>> connections_;
+    std::vector<MySQLConnection*> idle_;
+    size_t opening_;    // connections being opened outside the lock
+
+    std::atomic<uint64_t> acquired_;
+    std::atomic<uint64_t> waited_;
+    std::atomic<uint64_t> timeouts_;
+    std::atomic<uint64_t> reconnects_;
+    std::atomic<uint64_t> total_wait_us_;
+    std::atomic<uint64_t> max_wait_us_;
+
+    bool open(MySQLConnection& conn, bool select_database = true);
+    void close(MySQLConnection& conn);
+
+    // Ping a connection that has been idle for a while, reopening it if dead
+    bool ensureHealthy(MySQLConnection& conn);
+
+    void release(MySQLConnection* conn);
+    void recordWait(std::chrono::steady_clock::duration waited);
+};
@@ -0,0 +1,87 @@
+#pragma once
+#include <mysql/mysql.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+// Parameters of one statement execution, bound with the binary protocol.
+// Strings are bound by reference and must outlive the execution.
+class StatementParams {
+public:
+    StatementParams() = default;
+    explicit StatementParams(size_t expected) { params_.reserve(expected); }
+
+    StatementParams& add(const std::string& value);
+    StatementParams& add(int32_t value);
+    StatementParams& add(int64_t value);
+    StatementParams& add(double value);
+    StatementParams& addNull();
+
+    // DATETIME(3) value from milliseconds since the epoch, in UTC
+    StatementParams& addDateTime(int64_t epoch_ms);
+
+    size_t size() const { return params_.size(); }
+
+    // Bind array for mysql_stmt_bind_param, valid until the next add()
+    MYSQL_BIND* binds();
+
+private:
+    struct Param {
+        enum_field_types type;
+        const std::string* text = nullptr;
+        long long integer = 0;
+        double real = 0.0;
+        MYSQL_TIME time{};
+        unsigned long length = 0;
+        bool is_null = false;
+    };
+
+    std::vector<Param> params_;
+    std::vector<MYSQL_BIND> binds_;
+};
+
+// Prepared statements of one connection, prepared on first use and cached
+// by statement id. Not thread-safe: use it from whoever owns the connection.
+class PreparedStatementCache {
+public:
+    // Result rows as text, NULL columns read as empty strings
+    using Row = std::vector<std::string>;
+
+    explicit PreparedStatementCache(MYSQL* conn = nullptr);
+    ~PreparedStatementCache();
+
+    PreparedStatementCache(const PreparedStatementCache&) = delete;
+    PreparedStatementCache& operator=(const PreparedStatementCache&) = delete;
+
+    // Close every statement and switch to another connection (after a reconnect)
+    void reset(MYSQL* conn);
+
+    // Run a statement that returns no rows
+    bool execute(const std::string& id, const char* sql, StatementParams& params,
+                 uint64_t* affected_rows = nullptr, uint64_t* insert_id = nullptr);
+
+    // Run a statement and collect all its rows
+    bool query(const std::string& id, const char* sql, StatementParams& params, std::vector<Row>& rows);
+
+    // Error of the last failed call
+    const std::string& lastError() const { return last_error_; }
+
+    // mysql_stmt_errno of the last failed call, 0 if it failed before reaching the server
+    unsigned int lastErrno() const { return last_errno_; }
+
+private:
+    MYSQL* conn_;
+    std::unordered_map<std::string, MYSQL_STMT*> statements_;
+    std::string last_error_;
+    unsigned int last_errno_;
+
+    MYSQL_STMT* prepare(const std::string& id, const char* sql);
+
+    // Bind and execute, re-preparing once if the server invalidated the statement
+    MYSQL_STMT* run(const std::string& id, const char* sql, StatementParams& params);
+
+    bool fail(MYSQL_STMT* stmt, const std::string& id);
+    void discard(const std::string& id);
+    bool fetchRows(MYSQL_STMT* stmt, std::vector<Row>& rows);
+};
@@ -6,62 +6,35 @@
 #include <iomanip>
 #include <regex>
 
-DBHandler::DBHandler() {
-    conn = mysql_init(nullptr);
-    if (!conn) {
-        throw std::runtime_error("MySQL initialization failed");
-    }
-    // Connect without database first
-    if (!mysql_real_connect(conn, host.c_str(), user.c_str(), pass.c_str(), nullptr, 3306, nullptr, 0)) {
-        std::string err = mysql_error(conn);
-        mysql_close(conn);
-        throw std::runtime_error("MySQL connection failed: " + err);
-    }
-    // Create database if not exists
-    if (mysql_query(conn, "CREATE DATABASE IF NOT EXISTS IOTSHADOW")) {
-        std::string error = mysql_error(conn);
-        mysql_close(conn);
-        throw std::runtime_error("Failed to create database: " + error);
-    }
-    // Select the database
-    if (mysql_select_db(conn, db_name.c_str())) {
-        std::string error = mysql_error(conn);
-        mysql_close(conn);
-        throw std::runtime_error("Failed to select database: " + error);
+DBHandler::DBHandler(std::shared_ptr<MySQLConnectionPool> pool) : pool_(std::move(pool)) {
+    if (!pool_) {
+        throw std::runtime_error("MySQL connection pool is not initialized");
     }
     InitializeDatabase();
 }
 
-DBHandler::~DBHandler() {
-    if (conn) {
-        mysql_close(conn);
-    }
-}
+DBHandler::~DBHandler() = default;
 
-MYSQL* DBHandler::getConnection() {
+MySQLConnectionPool::Lease DBHandler::connection() {
+    MySQLConnectionPool::Lease conn = pool_->acquire();
     if (!conn) {
-        throw std::runtime_error("MySQL connection is not initialized");
+        std::cerr << "No MySQL connection available" << std::endl;
     }
-    clearPreviousResults();
     return conn;
 }
 
 bool DBHandler::executeQuery(const std::string& query) {
-    clearPreviousResults();
-    if (mysql_query(conn, query.c_str()) != 0) {
-        std::cerr << "MySQL query error: " << mysql_error(conn) << std::endl;
-        return false;
-    }
-    return true;
+    auto conn = connection();
+    return conn && conn->execute(query);
 }
 
 MYSQL_RES* DBHandler::executeSelect(const std::string& query) {
-    clearPreviousResults();
-    if (mysql_query(conn, query.c_str()) != 0) {
-        std::cerr << "MySQL query error: " << mysql_error(conn) << std::endl;
+    auto conn = connection();
+    if (!conn || !conn->execute(query)) {
         return nullptr;
     }
-    return mysql_store_result(conn);
+    // The stored result no longer needs the connection
+    return mysql_store_result(conn->handle());
 }
 
 bool DBHandler::InitializeDatabase() {
@@ -109,159 +82,137 @@ bool DBHandler::InitializeDatabase() {
 }
 
 bool DBHandler::Execute(const std::string& query) {
-    if (mysql_query(conn, query.c_str())) {
-        std::cerr << "MySQL query failed: " << mysql_error(conn) << std::endl;
-        return false;
-    }
-    return true;
+    return executeQuery(query);
 }
 
 MYSQL_RES* DBHandler::Query(const std::string& query) {
-    if (mysql_query(conn, query.c_str())) {
-        std::cerr << "MySQL query failed: " << mysql_error(conn) << std::endl;
-        return nullptr;
-    }
-    return mysql_store_result(conn);
+    return executeSelect(query);
+}
+
+static const char* const SELECT_DEVICE_COLUMNS =
+    "SELECT id, hostname, user, location, hardware_type, os_type, created_at, updated_at FROM devices";
+
+static DeviceData deviceFromRow(const PreparedStatementCache::Row& row) {
+    DeviceData device;
+    device.id = std::stoi(row[0]);
+    device.hostname = row[1];
+    device.user = row[2];
+    device.location = row[3];
+    device.hardware_type = row[4];
+    device.os_type = row[5];
+    device.created_at = row[6];
+    device.updated_at = row[7];
+    return device;
 }
 
 bool DBHandler::authenticateDevice(const std::string& hostname, const std::string& password) {
-    char escaped_hostname[hostname.length()*2+1];
-    mysql_real_escape_string(conn, escaped_hostname, hostname.c_str(), hostname.length());
-    std::string query = "SELECT password_hash FROM devices WHERE hostname = '" + std::string(escaped_hostname) + "'";
-    MYSQL_RES* result = executeSelect(query);
-    if (!result) return false;
-    MYSQL_ROW row = mysql_fetch_row(result);
-    if (!row) {
-        mysql_free_result(result);
+    auto conn = connection();
+    if (!conn) return false;
+    StatementParams params(1);
+    params.add(hostname);
+    std::vector<PreparedStatementCache::Row> rows;
+    if (!conn->statements().query("devices.password_hash",
+                                  "SELECT password_hash FROM devices WHERE hostname = ?", params, rows) ||
+        rows.empty()) {
         return false;
     }
-    std::string stored_hash = row[0];
-    mysql_free_result(result);
-    return stored_hash == hashPassword(password);
+    return rows[0][0] == hashPassword(password);
 }
 
 std::vector<DeviceData> DBHandler::getAllDevices() {
+    auto conn = connection();
+    if (!conn) return {};
+    static const std::string query = SELECT_DEVICE_COLUMNS;
     std::vector<DeviceData> devices;
-    const char* query = "SELECT id, hostname, user, location, hardware_type, os_type, created_at, updated_at FROM devices";
-    MYSQL_RES* result = executeSelect(query);
-    if (!result) return devices;
-    MYSQL_ROW row;
-    while ((row = mysql_fetch_row(result))) {
-        DeviceData device;
-        device.id = std::stoi(row[0]);
-        device.hostname = row[1] ? row[1] : "";
-        device.user = row[2] ? row[2] : "";
-        device.location = row[3] ? row[3] : "";
-        device.hardware_type = row[4] ? row[4] : "";
-        device.os_type = row[5] ? row[5] : "";
-        device.created_at = row[6] ? row[6] : "";
-        device.updated_at = row[7] ? row[7] : "";
-        devices.push_back(device);
+    StatementParams params;
+    std::vector<PreparedStatementCache::Row> rows;
+    if (!conn->statements().query("devices.all", query.c_str(), params, rows)) return devices;
+    devices.reserve(rows.size());
+    for (const auto& row : rows) {
+        devices.push_back(deviceFromRow(row));
     }
-    mysql_free_result(result);
     return devices;
 }
 
 DeviceData DBHandler::getDeviceById(int device_id) {
-    DeviceData device;
-    std::string query = "SELECT id, hostname, user, location, hardware_type, os_type, created_at, updated_at FROM devices WHERE id = " + std::to_string(device_id);
-    MYSQL_RES* result = executeSelect(query);
-    if (!result) return device;
-    MYSQL_ROW row = mysql_fetch_row(result);
-    if (row) {
-        device.id = std::stoi(row[0]);
-        device.hostname = row[1] ? row[1] : "";
-        device.user = row[2] ? row[2] : "";
-        device.location = row[3] ? row[3] : "";
-        device.hardware_type = row[4] ? row[4] : "";
-        device.os_type = row[5] ? row[5] : "";
-        device.created_at = row[6] ? row[6] : "";
-        device.updated_at = row[7] ? row[7] : "";
+    auto conn = connection();
+    if (!conn) return DeviceData();
+    static const std::string query = std::string(SELECT_DEVICE_COLUMNS) + " WHERE id = ?";
+    StatementParams params(1);
+    params.add(static_cast<int32_t>(device_id));
+    std::vector<PreparedStatementCache::Row> rows;
+    if (!conn->statements().query("devices.by_id", query.c_str(), params, rows) || rows.empty()) {
+        return DeviceData();
     }
-    mysql_free_result(result);
-    return device;
+    return deviceFromRow(rows[0]);
 }
 
 DeviceData DBHandler::getDeviceByHostname(const std::string& hostname) {
-    DeviceData device;
-    char escaped_hostname[hostname.length()*2+1];
-    mysql_real_escape_string(conn, escaped_hostname, hostname.c_str(), hostname.length());
-    std::string query = "SELECT id, hostname, user, location, hardware_type, os_type, created_at, updated_at FROM devices WHERE hostname = '" + std::string(escaped_hostname) + "'";
-    MYSQL_RES* result = executeSelect(query);
-    if (!result) return device;
-    MYSQL_ROW row = mysql_fetch_row(result);
-    if (row) {
-        device.id = std::stoi(row[0]);
-        device.hostname = row[1] ? row[1] : "";
-        device.user = row[2] ? row[2] : "";
-        device.location = row[3] ? row[3] : "";
-        device.hardware_type = row[4] ? row[4] : "";
-        device.os_type = row[5] ? row[5] : "";
-        device.created_at = row[6] ? row[6] : "";
-        device.updated_at = row[7] ? row[7] : "";
+    auto conn = connection();
+    if (!conn) return DeviceData();
+    static const std::string query = std::string(SELECT_DEVICE_COLUMNS) + " WHERE hostname = ?";
+    StatementParams params(1);
+    params.add(hostname);
+    std::vector<PreparedStatementCache::Row> rows;
+    if (!conn->statements().query("devices.by_hostname", query.c_str(), params, rows) || rows.empty()) {
+        return DeviceData();
     }
-    mysql_free_result(result);
-    return device;
+    return deviceFromRow(rows[0]);
 }
 
 bool DBHandler::hostnameExists(const std::string& hostname) {
-    char escaped_hostname[hostname.length()*2+1];
-    mysql_real_escape_string(conn, escaped_hostname, hostname.c_str(), hostname.length());
-    std::string query = "SELECT COUNT(*) FROM devices WHERE hostname = '" + std::string(escaped_hostname) + "'";
-    MYSQL_RES* result = executeSelect(query);
-    if (!result) return false;
-    MYSQL_ROW row = mysql_fetch_row(result);
-    bool exists = row && std::stoi(row[0]) > 0;
-    mysql_free_result(result);
-    return exists;
+    auto conn = connection();
+    if (!conn) return false;
+    StatementParams params(1);
+    params.add(hostname);
+    std::vector<PreparedStatementCache::Row> rows;
+    if (!conn->statements().query("devices.count_hostname",
+                                  "SELECT COUNT(*) FROM devices WHERE hostname = ?", params, rows)) {
+        return false;
+    }
+    return !rows.empty() && std::stoi(rows[0][0]) > 0;
 }
 
 int DBHandler::addDevice(const DeviceData& device) {
-    char escaped_hostname[device.hostname.length()*2+1];
-    char escaped_user[device.user.length()*2+1];
-    char escaped_location[device.location.length()*2+1];
-    char escaped_hw_type[device.hardware_type.length()*2+1];
-    char escaped_os_type[device.os_type.length()*2+1];
-    mysql_real_escape_string(conn, escaped_hostname, device.hostname.c_str(), device.hostname.length());
-    mysql_real_escape_string(conn, escaped_user, device.user.c_str(), device.user.length());
-    mysql_real_escape_string(conn, escaped_location, device.location.c_str(), device.location.length());
-    mysql_real_escape_string(conn, escaped_hw_type, device.hardware_type.c_str(), device.hardware_type.length());
-    mysql_real_escape_string(conn, escaped_os_type, device.os_type.c_str(), device.os_type.length());
+    auto conn = connection();
+    if (!conn) return 0;
     std::string hashed_password = hashPassword(device.password_hash);
-    std::string query = "INSERT INTO devices (hostname, password_hash, user, location, hardware_type, os_type) VALUES ('" +
-        std::string(escaped_hostname) + "', '" +
-        hashed_password + "', '" +
-        std::string(escaped_user) + "', '" +
-        std::string(escaped_location) + "', '" +
-        std::string(escaped_hw_type) + "', '" +
-        std::string(escaped_os_type) + "')";
-    if (!executeQuery(query)) {
+    StatementParams params(6);
+    params.add(device.hostname)
+          .add(hashed_password)
+          .add(device.user)
+          .add(device.location)
+          .add(device.hardware_type)
+          .add(device.os_type);
+    uint64_t insert_id = 0;
+    if (!conn->statements().execute("devices.insert",
+                                    "INSERT INTO devices (hostname, password_hash, user, location, hardware_type, os_type) "
+                                    "VALUES (?, ?, ?, ?, ?, ?)", params, nullptr, &insert_id)) {
         return 0;
     }
-    return mysql_insert_id(conn);
+    return static_cast<int>(insert_id);
 }
 
 bool DBHandler::deleteDevice(int device_id) {
-    std::string query = "DELETE FROM devices WHERE id = " + std::to_string(device_id);
-    return executeQuery(query);
+    auto conn = connection();
+    if (!conn) return false;
+    StatementParams params(1);
+    params.add(static_cast<int32_t>(device_id));
+    return conn->statements().execute("devices.delete", "DELETE FROM devices WHERE id = ?", params);
 }
 
 bool DBHandler::updateDevice(int device_id, const DeviceData& device) {
-    char escaped_user[device.user.length()*2+1];
-    char escaped_location[device.location.length()*2+1];
-    char escaped_hw_type[device.hardware_type.length()*2+1];
-    char escaped_os_type[device.os_type.length()*2+1];
-    mysql_real_escape_string(conn, escaped_user, device.user.c_str(), device.user.length());
-    mysql_real_escape_string(conn, escaped_location, device.location.c_str(), device.location.length());
-    mysql_real_escape_string(conn, escaped_hw_type, device.hardware_type.c_str(), device.hardware_type.length());
-    mysql_real_escape_string(conn, escaped_os_type, device.os_type.c_str(), device.os_type.length());
-    std::string query = "UPDATE devices SET "
-        "user = '" + std::string(escaped_user) + "', "
-        "location = '" + std::string(escaped_location) + "', "
-        "hardware_type = '" + std::string(escaped_hw_type) + "', "
-        "os_type = '" + std::string(escaped_os_type) + "' "
-        "WHERE id = " + std::to_string(device_id);
-    return executeQuery(query);
+    auto conn = connection();
+    if (!conn) return false;
+    StatementParams params(5);
+    params.add(device.user)
+          .add(device.location)
+          .add(device.hardware_type)
+          .add(device.os_type)
+          .add(static_cast<int32_t>(device_id));
+    return conn->statements().execute("devices.update",
+                                      "UPDATE devices SET user = ?, location = ?, hardware_type = ?, os_type = ? WHERE id = ?",
+                                      params);
 }
 
 std::string DBHandler::hashPassword(const std::string& password) {
@@ -290,20 +241,3 @@ std::string DBHandler::hashPassword(const std::string& password) {
     }
     return ss.str();
 }
-
-std::string DBHandler::getLastError() {
-    return mysql_error(conn);
-}
-
-void DBHandler::clearPreviousResults() {
-    MYSQL_RES* result;
-    while ((result = mysql_store_result(conn)) != nullptr) {
-        mysql_free_result(result);
-    }
-    while (mysql_next_result(conn) == 0) {
-        result = mysql_store_result(conn);
-        if (result) {
-            mysql_free_result(result);
-        }
-    }
-}
@@ -0,0 +1,255 @@
+#include "../include/mysql_connection_pool.h"
+#include <mysql/errmsg.h>
+#include <iostream>
+#include <algorithm>
+
+static bool isConnectionError(unsigned int error) {
+    return error == CR_SERVER_LOST || error == CR_SERVER_GONE_ERROR || error == CR_CONN_HOST_ERROR;
+}
+
+bool MySQLConnection::execute(const std::string& query) {
+    if (mysql_query(mysql_, query.c_str())) {
+        std::cerr << "MySQL query failed: " << mysql_error(mysql_) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool MySQLConnection::lost() const {
+    return !mysql_ || isConnectionError(mysql_errno(mysql_)) || isConnectionError(statements_.lastErrno());
+}
+
+MySQLConnectionPool::Lease::Lease(Lease&& other) noexcept : pool_(other.pool_), conn_(other.conn_) {
+    other.pool_ = nullptr;
+    other.conn_ = nullptr;
+}
+
+MySQLConnectionPool::Lease& MySQLConnectionPool::Lease::operator=(Lease&& other) noexcept {
+    if (this != &other) {
+        release();
+        pool_ = other.pool_;
+        conn_ = other.conn_;
+        other.pool_ = nullptr;
+        other.conn_ = nullptr;
+    }
+    return *this;
+}
+
+MySQLConnectionPool::Lease::~Lease() {
+    release();
+}
+
+void MySQLConnectionPool::Lease::markBroken() {
+    if (conn_) {
+        conn_->broken_ = true;
+    }
+}
+
+void MySQLConnectionPool::Lease::release() {
+    if (pool_ && conn_) {
+        pool_->release(conn_);
+    }
+    pool_ = nullptr;
+    conn_ = nullptr;
+}
+
+MySQLConnectionPool::MySQLConnectionPool(const MySQLPoolOptions& options)
+    : options_(options), opening_(0),
+      acquired_(0), waited_(0), timeouts_(0), reconnects_(0), total_wait_us_(0), max_wait_us_(0) {
+    if (options_.max_size == 0) options_.max_size = 1;
+    options_.min_size = std::min(options_.min_size, options_.max_size);
+}
+
+MySQLConnectionPool::~MySQLConnectionPool() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& conn : connections_) {
+        close(*conn);
+    }
+    connections_.clear();
+    idle_.clear();
+}
+
+bool MySQLConnectionPool::initialize() {
+    // Connect without a database first so it can be created
+    MySQLConnection bootstrap;
+    if (!open(bootstrap, false)) {
+        return false;
+    }
+    bool created = bootstrap.execute("CREATE DATABASE IF NOT EXISTS " + options_.database);
+    close(bootstrap);
+    if (!created) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (connections_.size() < options_.min_size) {
+        auto conn = std::make_unique<MySQLConnection>();
+        if (!open(*conn)) {
+            break;
+        }
+        idle_.push_back(conn.get());
+        connections_.push_back(std::move(conn));
+    }
+
+    std::cout << "MySQL pool ready with " << connections_.size() << " connection(s), max "
+              << options_.max_size << std::endl;
+    return !connections_.empty();
+}
+
+MySQLConnectionPool::Lease MySQLConnectionPool::acquire() {
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + options_.acquire_timeout;
+    bool waited = false;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        if (!idle_.empty()) {
+            MySQLConnection* conn = idle_.back();
+            idle_.pop_back();
+
+            lock.unlock();
+            bool healthy = ensureHealthy(*conn);
+            lock.lock();
+
+            if (healthy) {
+                acquired_++;
+                if (waited) {
+                    recordWait(std::chrono::steady_clock::now() - start);
+                }
+                return Lease(this, conn);
+            }
+
+            // Could not be reopened: drop the slot and try the next one
+            connections_.erase(std::remove_if(connections_.begin(), connections_.end(),
+                                              [conn](const auto& c) { return c.get() == conn; }),
+                               connections_.end());
+            continue;
+        }
+
+        if (connections_.size() + opening_ < options_.max_size) {
+            opening_++;
+            lock.unlock();
+            auto conn = std::make_unique<MySQLConnection>();
+            bool opened = open(*conn);
+            lock.lock();
+            opening_--;
+
+            if (!opened) {
+                // Database unreachable: fail now rather than hold the caller
+                available_.notify_one();
+                timeouts_++;
+                return Lease();
+            }
+
+            MySQLConnection* raw = conn.get();
+            connections_.push_back(std::move(conn));
+            acquired_++;
+            if (waited) {
+                recordWait(std::chrono::steady_clock::now() - start);
+            }
+            return Lease(this, raw);
+        }
+
+        waited = true;
+        if (available_.wait_until(lock, deadline) == std::cv_status::timeout && idle_.empty()) {
+            timeouts_++;
+            recordWait(std::chrono::steady_clock::now() - start);
+            std::cerr << "Timed out waiting for a MySQL connection (" << connections_.size()
+                      << " in use)" << std::endl;
+            return Lease();
+        }
+    }
+}
+
+void MySQLConnectionPool::release(MySQLConnection* conn) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (conn->broken_ || conn->lost()) {
+            // Replaced by a fresh connection on the next acquire()
+            close(*conn);
+            reconnects_++;
+            connections_.erase(std::remove_if(connections_.begin(), connections_.end(),
+                                              [conn](const auto& c) { return c.get() == conn; }),
+                               connections_.end());
+        } else {
+            conn->last_used_ = std::chrono::steady_clock::now();
+            idle_.push_back(conn);
+        }
+    }
+    available_.notify_one();
+}
+
+bool MySQLConnectionPool::ensureHealthy(MySQLConnection& conn) {
+    auto idle_for = std::chrono::steady_clock::now() - conn.last_used_;
+    if (conn.mysql_ && idle_for < options_.health_check_interval) {
+        return true;
+    }
+    if (conn.mysql_ && mysql_ping(conn.mysql_) == 0) {
+        return true;
+    }
+
+    close(conn);
+    reconnects_++;
+    return open(conn);
+}
+
+bool MySQLConnectionPool::open(MySQLConnection& conn, bool select_database) {
+    conn.mysql_ = mysql_init(nullptr);
+    if (!conn.mysql_) {
+        std::cerr << "MySQL initialization failed" << std::endl;
+        return false;
+    }
+
+    unsigned int timeout = 5;
+    mysql_options(conn.mysql_, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+
+    if (!mysql_real_connect(conn.mysql_, options_.host.c_str(), options_.user.c_str(),
+                            options_.password.c_str(),
+                            select_database ? options_.database.c_str() : nullptr,
+                            options_.port, nullptr, 0)) {
+        std::cerr << "MySQL connection failed: " << mysql_error(conn.mysql_) << std::endl;
+        mysql_close(conn.mysql_);
+        conn.mysql_ = nullptr;
+        return false;
+    }
+
+    conn.statements_.reset(conn.mysql_);
+    conn.last_used_ = std::chrono::steady_clock::now();
+    conn.broken_ = false;
+    return true;
+}
+
+void MySQLConnectionPool::close(MySQLConnection& conn) {
+    conn.statements_.reset(nullptr);
+    if (conn.mysql_) {
+        mysql_close(conn.mysql_);
+        conn.mysql_ = nullptr;
+    }
+}
+
+void MySQLConnectionPool::recordWait(std::chrono::steady_clock::duration waited) {
+    uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(waited).count();
+    waited_++;
+    total_wait_us_ += us;
+
+    uint64_t max = max_wait_us_.load();
+    while (us > max && !max_wait_us_.compare_exchange_weak(max, us)) {
+    }
+}
+
+MySQLConnectionPool::Stats MySQLConnectionPool::getStats() const {
+    Stats stats;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats.open = connections_.size();
+        stats.idle = idle_.size();
+    }
+    stats.acquired = acquired_;
+    stats.waited = waited_;
+    stats.timeouts = timeouts_;
+    stats.reconnects = reconnects_;
+    stats.total_wait_us = total_wait_us_;
+    stats.max_wait_us = max_wait_us_;
+    return stats;
+}
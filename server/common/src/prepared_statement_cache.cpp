@@ -0,0 +1,296 @@
+#include "../include/prepared_statement_cache.h"
+#include <mysql/errmsg.h>
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <ctime>
+
+// Server errors after which the statement has to be prepared again
+static const unsigned int ER_UNKNOWN_STMT_HANDLER_CODE = 1243;
+static const unsigned int ER_NEED_REPREPARE_CODE = 1615;
+
+StatementParams& StatementParams::add(const std::string& value) {
+    Param param;
+    param.type = MYSQL_TYPE_STRING;
+    param.text = &value;
+    param.length = value.size();
+    params_.push_back(param);
+    return *this;
+}
+
+StatementParams& StatementParams::add(int32_t value) {
+    return add(static_cast<int64_t>(value));
+}
+
+StatementParams& StatementParams::add(int64_t value) {
+    Param param;
+    param.type = MYSQL_TYPE_LONGLONG;
+    param.integer = value;
+    params_.push_back(param);
+    return *this;
+}
+
+StatementParams& StatementParams::add(double value) {
+    Param param;
+    param.type = MYSQL_TYPE_DOUBLE;
+    param.real = value;
+    params_.push_back(param);
+    return *this;
+}
+
+StatementParams& StatementParams::addNull() {
+    Param param;
+    param.type = MYSQL_TYPE_NULL;
+    param.is_null = true;
+    params_.push_back(param);
+    return *this;
+}
+
+StatementParams& StatementParams::addDateTime(int64_t epoch_ms) {
+    time_t seconds = static_cast<time_t>(epoch_ms / 1000);
+    int64_t millis = epoch_ms % 1000;
+    if (millis < 0) {
+        seconds--;
+        millis += 1000;
+    }
+
+    struct tm utc;
+    gmtime_r(&seconds, &utc);
+
+    Param param;
+    param.type = MYSQL_TYPE_DATETIME;
+    param.time.year = utc.tm_year + 1900;
+    param.time.month = utc.tm_mon + 1;
+    param.time.day = utc.tm_mday;
+    param.time.hour = utc.tm_hour;
+    param.time.minute = utc.tm_min;
+    param.time.second = utc.tm_sec;
+    param.time.second_part = static_cast<unsigned long>(millis) * 1000;
+    param.time.time_type = MYSQL_TIMESTAMP_DATETIME;
+    params_.push_back(param);
+    return *this;
+}
+
+MYSQL_BIND* StatementParams::binds() {
+    binds_.assign(params_.size(), MYSQL_BIND());
+
+    for (size_t i = 0; i < params_.size(); i++) {
+        Param& param = params_[i];
+        MYSQL_BIND& bind = binds_[i];
+        std::memset(&bind, 0, sizeof(bind));
+        bind.buffer_type = param.type;
+
+        switch (param.type) {
+            case MYSQL_TYPE_STRING:
+                bind.buffer = const_cast<char*>(param.text->data());
+                bind.buffer_length = param.length;
+                bind.length = &param.length;
+                break;
+            case MYSQL_TYPE_LONGLONG:
+                bind.buffer = &param.integer;
+                break;
+            case MYSQL_TYPE_DOUBLE:
+                bind.buffer = &param.real;
+                break;
+            case MYSQL_TYPE_DATETIME:
+                bind.buffer = &param.time;
+                bind.buffer_length = sizeof(MYSQL_TIME);
+                break;
+            default:
+                bind.is_null = &param.is_null;
+                break;
+        }
+    }
+
+    return binds_.empty() ? nullptr : binds_.data();
+}
+
+PreparedStatementCache::PreparedStatementCache(MYSQL* conn) : conn_(conn), last_errno_(0) {
+}
+
+PreparedStatementCache::~PreparedStatementCache() {
+    reset(nullptr);
+}
+
+void PreparedStatementCache::reset(MYSQL* conn) {
+    for (auto& [id, stmt] : statements_) {
+        mysql_stmt_close(stmt);
+    }
+    statements_.clear();
+    conn_ = conn;
+    last_error_.clear();
+    last_errno_ = 0;
+}
+
+MYSQL_STMT* PreparedStatementCache::prepare(const std::string& id, const char* sql) {
+    auto it = statements_.find(id);
+    if (it != statements_.end()) {
+        return it->second;
+    }
+
+    if (!conn_) {
+        last_error_ = "No MySQL connection available";
+        last_errno_ = 0;
+        return nullptr;
+    }
+
+    MYSQL_STMT* stmt = mysql_stmt_init(conn_);
+    if (!stmt) {
+        last_error_ = "Failed to allocate statement " + id;
+        last_errno_ = 0;
+        return nullptr;
+    }
+
+    if (mysql_stmt_prepare(stmt, sql, std::strlen(sql))) {
+        last_error_ = "Failed to prepare " + id + ": " + mysql_stmt_error(stmt);
+        last_errno_ = mysql_stmt_errno(stmt);
+        std::cerr << last_error_ << std::endl;
+        mysql_stmt_close(stmt);
+        return nullptr;
+    }
+
+    statements_.emplace(id, stmt);
+    return stmt;
+}
+
+MYSQL_STMT* PreparedStatementCache::run(const std::string& id, const char* sql, StatementParams& params) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        MYSQL_STMT* stmt = prepare(id, sql);
+        if (!stmt) {
+            return nullptr;
+        }
+
+        if (mysql_stmt_param_count(stmt) != params.size()) {
+            last_error_ = "Statement " + id + " expects " + std::to_string(mysql_stmt_param_count(stmt)) +
+                          " parameters, got " + std::to_string(params.size());
+            last_errno_ = 0;
+            std::cerr << last_error_ << std::endl;
+            return nullptr;
+        }
+
+        if (mysql_stmt_bind_param(stmt, params.binds()) == 0 && mysql_stmt_execute(stmt) == 0) {
+            return stmt;
+        }
+
+        unsigned int error = mysql_stmt_errno(stmt);
+        fail(stmt, id);
+        if (error != ER_UNKNOWN_STMT_HANDLER_CODE && error != ER_NEED_REPREPARE_CODE) {
+            return nullptr;
+        }
+    }
+    return nullptr;
+}
+
+bool PreparedStatementCache::execute(const std::string& id, const char* sql, StatementParams& params,
+                                     uint64_t* affected_rows, uint64_t* insert_id) {
+    MYSQL_STMT* stmt = run(id, sql, params);
+    if (!stmt) {
+        return false;
+    }
+
+    if (affected_rows) *affected_rows = mysql_stmt_affected_rows(stmt);
+    if (insert_id) *insert_id = mysql_stmt_insert_id(stmt);
+    return true;
+}
+
+bool PreparedStatementCache::query(const std::string& id, const char* sql, StatementParams& params,
+                                   std::vector<Row>& rows) {
+    MYSQL_STMT* stmt = run(id, sql, params);
+    if (!stmt) {
+        return false;
+    }
+    return fetchRows(stmt, rows) || fail(stmt, id);
+}
+
+bool PreparedStatementCache::fetchRows(MYSQL_STMT* stmt, std::vector<Row>& rows) {
+    MYSQL_RES* metadata = mysql_stmt_result_metadata(stmt);
+    if (!metadata) {
+        return true;
+    }
+
+    // Let the client compute column widths so every value fits its buffer
+    bool update_max_length = true;
+    mysql_stmt_attr_set(stmt, STMT_ATTR_UPDATE_MAX_LENGTH, &update_max_length);
+    if (mysql_stmt_store_result(stmt)) {
+        mysql_free_result(metadata);
+        return false;
+    }
+
+    unsigned int columns = mysql_num_fields(metadata);
+    MYSQL_FIELD* fields = mysql_fetch_fields(metadata);
+
+    std::vector<std::vector<char>> buffers(columns);
+    std::vector<unsigned long> lengths(columns);
+    std::unique_ptr<bool[]> nulls(new bool[columns]());
+    std::unique_ptr<bool[]> errors(new bool[columns]());
+    std::vector<MYSQL_BIND> binds(columns);
+
+    for (unsigned int i = 0; i < columns; i++) {
+        // Numbers and dates have no max_length worth trusting, 64 covers them
+        buffers[i].resize(std::max<unsigned long>(fields[i].max_length, 64) + 1);
+        std::memset(&binds[i], 0, sizeof(MYSQL_BIND));
+        binds[i].buffer_type = MYSQL_TYPE_STRING;
+        binds[i].buffer = buffers[i].data();
+        binds[i].buffer_length = buffers[i].size();
+        binds[i].length = &lengths[i];
+        binds[i].is_null = &nulls[i];
+        binds[i].error = &errors[i];
+    }
+
+    bool ok = mysql_stmt_bind_result(stmt, binds.data()) == 0;
+
+    int status = 0;
+    while (ok && ((status = mysql_stmt_fetch(stmt)) == 0 || status == MYSQL_DATA_TRUNCATED)) {
+        Row row(columns);
+        for (unsigned int i = 0; i < columns; i++) {
+            if (nulls[i]) {
+                continue;
+            }
+            if (lengths[i] <= buffers[i].size()) {
+                row[i].assign(buffers[i].data(), lengths[i]);
+                continue;
+            }
+
+            // Value longer than the computed width: fetch it again in full
+            row[i].resize(lengths[i]);
+            MYSQL_BIND column;
+            std::memset(&column, 0, sizeof(column));
+            column.buffer_type = MYSQL_TYPE_STRING;
+            column.buffer = row[i].data();
+            column.buffer_length = lengths[i];
+            ok = mysql_stmt_fetch_column(stmt, &column, i, 0) == 0;
+        }
+        rows.push_back(std::move(row));
+    }
+    if (ok && status == 1) {
+        ok = false;
+    }
+
+    mysql_stmt_free_result(stmt);
+    mysql_free_result(metadata);
+    return ok;
+}
+
+bool PreparedStatementCache::fail(MYSQL_STMT* stmt, const std::string& id) {
+    last_error_ = "Statement " + id + " failed: " + mysql_stmt_error(stmt);
+    last_errno_ = mysql_stmt_errno(stmt);
+    std::cerr << last_error_ << std::endl;
+
+    // A statement the server no longer knows has to be prepared again
+    if (last_errno_ == ER_UNKNOWN_STMT_HANDLER_CODE || last_errno_ == ER_NEED_REPREPARE_CODE ||
+        last_errno_ == CR_SERVER_LOST || last_errno_ == CR_SERVER_GONE_ERROR) {
+        discard(id);
+    } else {
+        mysql_stmt_reset(stmt);
+    }
+    return false;
+}
+
+void PreparedStatementCache::discard(const std::string& id) {
+    auto it = statements_.find(id);
+    if (it != statements_.end()) {
+        mysql_stmt_close(it->second);
+        statements_.erase(it);
+    }
+}
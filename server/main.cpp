@@ -8,6 +8,9 @@
 // Include all service headers
 #include "monitoring.grpc.pb.h"
 #include "rabbitmq_consumer.h"
+#include "metrics_schema.h"
+#include "mysql_metrics_storage.h"
+#include "time_series_storage.h"
 #include "metrics_analyzer.h"
 #include "alert_manager.h"
 #include "ProvisionServiceImpl.h"
@@ -133,6 +136,57 @@ struct ServerConfig {
     std::string hw_queue = "hardware_metrics";
     std::string sw_queue = "software_metrics";
     
+    // Ingest worker pool (0 workers = one per hardware thread)
+    size_t ingest_workers = 0;
+    size_t ingest_queue_capacity = 1024;
+    
+    // Broker flow control and cumulative acks
+    uint16_t rabbitmq_prefetch = 2048;
+    size_t ack_batch_size = 64;
+    int ack_flush_interval_ms = 200;
+    
+    // MySQL, shared by every service through one connection pool
+    std::string mysql_host = "127.0.0.1";
+    unsigned int mysql_port = 3306;
+    std::string mysql_username = "root";
+    std::string mysql_password = "root";
+    std::string mysql_database = "IOTSHADOW";
+    size_t db_pool_min = 2;
+    size_t db_pool_max = 16;
+    int db_pool_acquire_timeout_ms = 5000;
+    
+    // Metrics backend: "mysql", or "tsdb" for the embedded time-series store
+    std::string metrics_backend = "mysql";
+    
+    // Metrics retention, in daily partitions
+    int metrics_retention_days = 30;
+    int metrics_partitions_ahead = 3;
+    
+    // Local spool for metrics MySQL cannot take (empty disables it)
+    std::string metrics_spool_path = "/var/lib/iotshadow/spool";
+    
+    // Columnar archive of expired metrics partitions (empty disables it)
+    std::string metrics_archive_path = "/var/lib/iotshadow/archive";
+    
+    // Alert thresholds; threshold_rules rows override the file
+    std::string thresholds_path = "config/thresholds.json";
+    
+    // Alert rules in the rule language of AlertRuleSet
+    std::string alert_rules_path = "config/alert_rules.json";
+    
+    // How often the thresholds and alert rules are checked for changes
+    int config_reload_seconds = 30;
+    
+    // Alert hysteresis, cooldowns, reminders and per-device rate limits
+    AlertPolicy alert_policy;
+    
+    // When a device that stopped reporting is stale / offline
+    PresencePolicy presence_policy;
+    
+    // Embedded time-series store
+    std::string tsdb_path = "/var/lib/iotshadow/tsdb";
+    int tsdb_retention_days = 365;
+    
     // File paths
     std::string ota_updates_path = "/home/manar/IOTSHADOW/ota-update-service/server/updates/app";
     
@@ -145,6 +199,11 @@ private:
     ServerConfig config_;
     std::unique_ptr<AlertManager> alert_manager_;
     std::unique_ptr<MetricsAnalyzer> metrics_analyzer_;
+    std::shared_ptr<MySQLConnectionPool> db_pool_;
+    std::unique_ptr<MetricsSchema> metrics_schema_;
+    std::shared_ptr<MetricsSpool> metrics_spool_;
+    std::shared_ptr<ColumnarArchive> metrics_archive_;
+    std::shared_ptr<MetricsStorage> metrics_storage_;
     std::unique_ptr<RabbitMQConsumer> rabbitmq_consumer_;
     std::shared_ptr<DBHandler> db_manager_;
     std::shared_ptr<JWTUtils> jwt_manager_;
@@ -159,32 +218,78 @@ public:
         try {
             std::cout << "⚙️ [SERVER] Initializing unified gRPC server..." << std::endl;
 
+            MySQLPoolOptions pool_options;
+            pool_options.host = config_.mysql_host;
+            pool_options.port = config_.mysql_port;
+            pool_options.user = config_.mysql_username;
+            pool_options.password = config_.mysql_password;
+            pool_options.database = config_.mysql_database;
+            pool_options.min_size = config_.db_pool_min;
+            pool_options.max_size = config_.db_pool_max;
+            pool_options.acquire_timeout = std::chrono::milliseconds(config_.db_pool_acquire_timeout_ms);
+
+            db_pool_ = std::make_shared<MySQLConnectionPool>(pool_options);
+            if (!db_pool_->initialize()) {
+                std::cerr << "❌ [ERROR] Failed to connect to MySQL" << std::endl;
+                return false;
+            }
+
+            db_manager_ = std::make_shared<DBHandler>(db_pool_);
+
+            if (!InitializeMetricsStorage()) {
+                return false;
+            }
+
             alert_manager_ = std::make_unique<AlertManager>();
             metrics_analyzer_ = std::make_unique<MetricsAnalyzer>(
-                alert_manager_.get() );
+                alert_manager_.get(), config_.alert_policy, config_.presence_policy);
+            RestoreDeviceStates();
+            if (!metrics_analyzer_->loadThresholds(config_.thresholds_path, db_pool_)) {
+                std::cerr << "⚠️ [SERVER] Using default alert thresholds" << std::endl;
+            }
+            // The shipped rules file is the only copy of the default rules
+            if (!metrics_analyzer_->loadAlertRules(config_.alert_rules_path)) {
+                std::cerr << "❌ [ERROR] Failed to load the alert rules from " << config_.alert_rules_path
+                          << std::endl;
+                return false;
+            }
+            metrics_analyzer_->startReload(std::chrono::seconds(config_.config_reload_seconds));
+            metrics_analyzer_->startPresence();
             
+            ConsumerOptions consumer_options;
+            consumer_options.worker_count = config_.ingest_workers;
+            consumer_options.worker_queue_capacity = config_.ingest_queue_capacity;
+            consumer_options.prefetch_count = config_.rabbitmq_prefetch;
+            consumer_options.ack_batch_size = config_.ack_batch_size;
+            consumer_options.ack_flush_interval = std::chrono::milliseconds(config_.ack_flush_interval_ms);
+
             rabbitmq_consumer_ = std::make_unique<RabbitMQConsumer>(
                 config_.rabbitmq_host, config_.rabbitmq_port,
                 config_.rabbitmq_username, config_.rabbitmq_password,
-                config_.hw_queue, config_.sw_queue);
+                config_.hw_queue, config_.sw_queue, metrics_storage_, consumer_options);
 
             // Améliorer les callbacks pour traiter les métriques
-            auto hw_callback = [this](const std::string& device_id, const nlohmann::json& metrics) {
-                std::cout << "[DEBUG] Processing HW metrics from device: " << device_id << std::endl;
+            // The analyzer updates the device state and raises alerts in one pass
+            auto hw_callback = [this](const HardwareSample& sample) {
+                std::cout << "[DEBUG] Processing HW metrics from device: " << sample.device_id << std::endl;
                 
-                metrics_analyzer_->processHardwareMetrics(device_id, metrics);
-                
-                // Générer des alertes basées sur les métriques reçues
-                GenerateMetricsBasedAlerts(device_id, metrics, "HARDWARE");
+                try {
+                    metrics_analyzer_->processHardwareMetrics(sample);
+                } catch (const std::exception& e) {
+                    std::cout << "[ERROR] Exception generating HARDWARE alerts for device "
+                              << sample.device_id << ": " << e.what() << std::endl;
+                }
             };
 
-            auto sw_callback = [this](const std::string& device_id, const nlohmann::json& metrics) {
-                std::cout << "[DEBUG] Processing SW metrics from device: " << device_id << std::endl;
+            auto sw_callback = [this](const SoftwareSample& sample) {
+                std::cout << "[DEBUG] Processing SW metrics from device: " << sample.device_id << std::endl;
                 
-                metrics_analyzer_->processSoftwareMetrics(device_id, metrics);
-                
-                // Générer des alertes basées sur les métriques reçues
-                GenerateMetricsBasedAlerts(device_id, metrics, "SOFTWARE");
+                try {
+                    metrics_analyzer_->processSoftwareMetrics(sample);
+                } catch (const std::exception& e) {
+                    std::cout << "[ERROR] Exception generating SOFTWARE alerts for device "
+                              << sample.device_id << ": " << e.what() << std::endl;
+                }
             };
 
             if (!rabbitmq_consumer_->start(hw_callback, sw_callback)) {
@@ -192,10 +297,9 @@ public:
                 return false;
             }
 
-            db_manager_ = std::make_shared<DBHandler>();
             jwt_manager_ = std::make_shared<JWTUtils>();
 
-            ota_service_ = std::make_unique<OTAUpdateService>(config_.ota_updates_path);
+            ota_service_ = std::make_unique<OTAUpdateService>(config_.ota_updates_path, db_manager_);
             if (!ota_service_->InitializeDatabase()) {
                 std::cerr << "❌ [ERROR] Failed to initialize OTA database" << std::endl;
                 return false;
@@ -252,81 +356,113 @@ public:
             rabbitmq_consumer_->stop();
         }
         
+        if (metrics_schema_) {
+            metrics_schema_->stop();
+        }
+        
+        if (metrics_analyzer_) {
+            metrics_analyzer_->stopReload();
+            metrics_analyzer_->stopPresence();
+        }
+        
+        if (metrics_spool_) {
+            auto stats = metrics_spool_->getStats();
+            std::cout << "📊 [SERVER] Metrics spool: " << stats.pending_rows << " rows pending ("
+                      << stats.bytes / 1024 << " KiB), " << stats.spooled_rows << " spooled, "
+                      << stats.replayed_rows << " replayed" << std::endl;
+        }
+        
+        if (db_pool_) {
+            auto stats = db_pool_->getStats();
+            std::cout << "📊 [SERVER] MySQL pool: " << stats.open << " open, " << stats.acquired
+                      << " acquired, " << stats.waited << " waited (max " << stats.max_wait_us
+                      << " us), " << stats.timeouts << " timeouts, " << stats.reconnects
+                      << " reconnects" << std::endl;
+        }
+        
         std::cout << "🛑 [SERVER] Shutdown complete" << std::endl;
     }
 
 
 private:
-    void GenerateMetricsBasedAlerts(const std::string& device_id, 
-                               const nlohmann::json& metrics, 
-                               const std::string& type) {
-    try {
-        if (type == "HARDWARE") {
-            // CPU Usage Analysis
-            if (metrics.contains("cpu_usage")) {
-                std::string cpu_usage = metrics["cpu_usage"].get<std::string>();
-                metrics_analyzer_->analyzeCpuUsage(device_id, cpu_usage);
-            }
-            
-            // Memory Usage Analysis
-            if (metrics.contains("memory_usage")) {
-                std::string memory_usage = metrics["memory_usage"].get<std::string>();
-                metrics_analyzer_->analyzeMemoryUsage(device_id, memory_usage);
-            }
-            
-            // Disk Usage Analysis
-            if (metrics.contains("disk_usage")) {
-                std::string disk_usage = metrics["disk_usage"].get<std::string>();
-                metrics_analyzer_->analyzeDiskUsage(device_id, disk_usage);
-            }
-            
-            // USB State Analysis
-            if (metrics.contains("usb_state")) {
-                std::string usb_state = metrics["usb_state"].get<std::string>();
-                metrics_analyzer_->analyzeUsbState(device_id, usb_state);
-            }
-            
-            // GPIO State Analysis
-            if (metrics.contains("gpio_state")) {
-                int current_gpio_state = metrics["gpio_state"].get<int>();
-                
-                // Get previous GPIO state from device state
-                auto device_state = metrics_analyzer_->getDeviceState(device_id);
-                int previous_gpio_state = device_state.gpio_state;
-                
-                metrics_analyzer_->analyzeGpioState(device_id, current_gpio_state, previous_gpio_state);
+    // Devices keep their last known state across restarts; known before the
+    // thresholds are compiled, so their per-device rules apply at once
+    void RestoreDeviceStates() {
+        auto mysql_storage = std::dynamic_pointer_cast<MySQLMetricsStorage>(metrics_storage_);
+        if (!mysql_storage) {
+            return;
+        }
+
+        std::vector<DeviceLatestState> states;
+        if (!mysql_storage->queryLatestStates(states)) {
+            std::cerr << "⚠️ [SERVER] Failed to restore the device states" << std::endl;
+            return;
+        }
+        for (const auto& state : states) {
+            metrics_analyzer_->restoreDeviceState(state.hardware, state.software);
+        }
+        std::cout << "📈 [SERVER] Restored the state of " << states.size() << " device(s)" << std::endl;
+    }
+
+    bool InitializeMetricsStorage() {
+        if (config_.metrics_backend == "tsdb") {
+            TimeSeriesOptions tsdb_options;
+            tsdb_options.directory = config_.tsdb_path;
+            tsdb_options.retention_days = config_.tsdb_retention_days;
+
+            auto tsdb = std::make_shared<TimeSeriesStorage>(tsdb_options);
+            if (!tsdb->open()) {
+                std::cerr << "❌ [ERROR] Failed to open the time-series store" << std::endl;
+                return false;
             }
+            metrics_storage_ = tsdb;
+            std::cout << "📈 [SERVER] Metrics stored in " << config_.tsdb_path << std::endl;
+            return true;
         }
-        
-        if (type == "SOFTWARE") {
-            // Network Status Analysis
-            if (metrics.contains("network_status")) {
-                std::string network_status = metrics["network_status"].get<std::string>();
-                metrics_analyzer_->analyzeNetworkStatus(device_id, network_status);
+
+        if (config_.metrics_backend != "mysql") {
+            std::cerr << "❌ [ERROR] Unknown metrics backend: " << config_.metrics_backend << std::endl;
+            return false;
+        }
+
+        RetentionOptions retention;
+        retention.retention_days = config_.metrics_retention_days;
+        retention.partitions_ahead = config_.metrics_partitions_ahead;
+
+        if (!config_.metrics_archive_path.empty()) {
+            ArchiveOptions archive_options;
+            archive_options.directory = config_.metrics_archive_path;
+
+            metrics_archive_ = std::make_shared<ColumnarArchive>(archive_options);
+            if (!metrics_archive_->open()) {
+                std::cerr << "❌ [ERROR] Failed to open the metrics archive" << std::endl;
+                return false;
             }
-            
-            // Services Analysis
-            if (metrics.contains("services")) {
-                std::map<std::string, std::string> services_map;
-                auto services = metrics["services"];
-                
-                // Convert JSON object to map
-                for (auto& [service, status] : services.items()) {
-                    services_map[service] = status.get<std::string>();
-                }
-                
-                // CORRECTION: Passer le services_map au lieu de rien
-                metrics_analyzer_->analyzeServices(device_id, services_map);
+        }
+
+        metrics_schema_ = std::make_unique<MetricsSchema>(db_pool_, retention, metrics_archive_);
+        if (!metrics_schema_->migrate()) {
+            std::cerr << "❌ [ERROR] Failed to migrate the metrics schema" << std::endl;
+            return false;
+        }
+        metrics_schema_->start();
+
+        if (!config_.metrics_spool_path.empty()) {
+            SpoolOptions spool_options;
+            spool_options.directory = config_.metrics_spool_path;
+
+            metrics_spool_ = std::make_shared<MetricsSpool>(spool_options);
+            if (!metrics_spool_->open()) {
+                std::cerr << "❌ [ERROR] Failed to open the metrics spool" << std::endl;
+                return false;
             }
         }
-        
-        std::cout << "[DEBUG] Generated alerts for " << type << " metrics from device: " << device_id << std::endl;
-        
-    } catch (const std::exception& e) {
-        std::cout << "[ERROR] Exception generating " << type << " alerts for device " 
-                  << device_id << ": " << e.what() << std::endl;
+
+        metrics_storage_ = std::make_shared<MySQLMetricsStorage>(db_pool_, WriteBufferOptions(), metrics_spool_,
+                                                                  metrics_archive_);
+        return true;
     }
-}
+
 };
 
 ServerConfig LoadConfiguration() {
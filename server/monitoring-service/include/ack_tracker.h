@@ -0,0 +1,64 @@
+#pragma once
+
+#include <set>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Tracks completion of deliveries on one AMQP channel so they can be
+// acknowledged cumulatively (basic.ack with multiple=1).
+// Workers finish messages out of order; only the highest delivery tag below
+// which every message is complete may be acked. Deliveries that could not be
+// processed are rejected one by one (basic.nack) before an ack covers them.
+class AckTracker {
+public:
+    AckTracker(size_t batch_size, std::chrono::milliseconds flush_interval);
+
+    // A delivery was handed to a worker; returns the current generation
+    uint64_t dispatched();
+
+    // A delivery finished processing (thread-safe). Completions from an older
+    // generation (a connection that has since been replaced) are ignored.
+    // Returns true when a full batch is ready to be acked.
+    bool complete(uint64_t delivery_tag, uint64_t generation);
+
+    // A delivery will not be processed and must go back to the broker
+    // (thread-safe); it no longer holds back the acks of later ones.
+    // Returns false for an older generation.
+    bool reject(uint64_t delivery_tag, uint64_t generation);
+
+    // Move the rejected tags not sent yet to tags; acks stay below them
+    // until they are taken
+    void takeRejected(std::vector<uint64_t>& tags);
+
+    // Highest contiguous completed tag if a flush is due (batch size reached,
+    // flush interval elapsed or force set), 0 if nothing should be acked now
+    uint64_t takeAckable(bool force = false);
+
+    // Deliveries dispatched but not completed yet
+    size_t inFlight() const;
+
+    // True while some delivery is in flight or completed but not acked
+    bool hasPending() const;
+
+    // Forget all state and start a new generation,
+    // delivery tags restart at 1 on a new channel
+    void reset();
+
+private:
+    bool completeLocked(uint64_t delivery_tag);
+
+    size_t batch_size_;
+    std::chrono::milliseconds flush_interval_;
+
+    mutable std::mutex mutex_;
+    uint64_t next_expected_;          // lowest tag not completed yet
+    uint64_t last_acked_;             // highest tag already acked
+    std::set<uint64_t> out_of_order_; // completed tags above next_expected_
+    std::set<uint64_t> rejected_;     // rejected tags not sent yet
+    std::chrono::steady_clock::time_point last_flush_;
+    uint64_t generation_;
+    std::atomic<size_t> in_flight_;
+};
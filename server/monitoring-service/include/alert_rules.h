@@ -0,0 +1,164 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <filesystem>
+#include <unordered_map>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+#include "telemetry_sample.h"
+#include "fleet_sweep.h"
+#include "metric_statistics.h"
+
+// Alert rules compiled from a small expression language, e.g.
+//   cpu > 90 for 3 samples
+//   service["ssh"] != "active"
+//   usb != "none" and not contains(usb, "1d6b")
+// Operands are numbers, "strings" and sample fields:
+//   hardware  cpu memory disk gpio gpio_previous usb kernel_version
+//             hardware_model firmware_version, the device's thresholds
+//             cpu_warning cpu_critical memory_warning ... disk_critical,
+//             and how unusual the sample is for the device (see
+//             MetricStatistics): cpu_zscore cpu_baseline memory_zscore ...
+//   software  network ip_address os_version uptime service["name"]
+// with + -, == != < <= > >=, and / or / not (also && || !), parentheses and
+// contains(text, "part") / starts_with(text, "prefix"). A rule reads either
+// hardware or software fields and is only evaluated on samples that carry
+// all of them, z-scores only once the device has enough history; a service
+// missing from the list reads as "".
+// "for N samples" makes a rule fire only after its condition held for N
+// consecutive samples of the device.
+// Each rule compiles to a flat stack program; a rule set is immutable.
+class AlertRuleSet {
+public:
+    enum class Severity : uint8_t {
+        Info,
+        Warning,
+        Critical
+    };
+
+    enum class Source : uint8_t {
+        Hardware,
+        Software
+    };
+
+    // A sample and what its rules may read besides it
+    struct Sample {
+        Source source;
+        const HardwareSample* hardware = nullptr;
+        const SoftwareSample* software = nullptr;
+        int previous_gpio_state = -1;
+        const MetricThreshold* thresholds = nullptr;   // cpu, memory, disk
+        const MetricStatistics::Score* scores = nullptr;  // cpu, memory, disk
+    };
+
+private:
+    struct Instruction {
+        uint8_t op;
+        uint8_t field;
+        uint32_t operand;   // jump target or constant index
+        double number;
+    };
+
+public:
+    struct Rule {
+        std::string type;
+        Severity severity = Severity::Warning;
+        std::string description;
+        std::string recommendation;
+        std::string command;
+        std::string expression;
+        std::string key;            // type and description; rules sharing it are one alert
+
+        Source source = Source::Hardware;
+        uint32_t required = 0;      // presence bits of the fields read
+        uint32_t samples = 1;       // consecutive samples the condition must hold
+        uint32_t counter = 0;       // slot in the device's counters, if samples > 1
+        std::vector<Instruction> program;
+    };
+
+    // Compile {"rules": [{"type", "when", "severity", "description",
+    // "recommendation", "command"}, ...]}; the whole set fails on any error
+    static std::shared_ptr<const AlertRuleSet> compile(const nlohmann::json& config, uint64_t version,
+                                                       std::string& error);
+
+    // Append the rules of the sample's source that hold to fired, and those
+    // checked that do not to cleared. counters holds counterCount()
+    // consecutive-sample counts of the device, or is null.
+    void evaluate(const Sample& sample, uint16_t* counters, std::vector<const Rule*>& fired,
+                  std::vector<const Rule*>* cleared = nullptr) const;
+
+    size_t size() const { return rules_.size(); }
+    size_t counterCount() const { return counters_; }
+    uint64_t version() const { return version_; }
+
+private:
+    uint64_t version_ = 0;
+    size_t counters_ = 0;
+    std::vector<Rule> rules_;
+    std::vector<std::string> texts_;   // string constants of all programs
+
+    bool holds(const Rule& rule, const Sample& sample) const;
+
+    friend class RuleCompiler;
+};
+
+// Keeps the current AlertRuleSet, hot-reloaded from a JSON file and swapped
+// in atomically, and the per-device counters of "for N samples" rules
+class AlertRuleEngine {
+public:
+    AlertRuleEngine();
+    ~AlertRuleEngine();
+
+    AlertRuleEngine(const AlertRuleEngine&) = delete;
+    AlertRuleEngine& operator=(const AlertRuleEngine&) = delete;
+
+    // Load the rules file; on failure the current rules stay in use, none
+    // before the first load
+    bool load(const std::string& path);
+    bool reloadIfChanged();
+
+    void start(std::chrono::seconds interval);
+    void stop();
+
+    std::shared_ptr<const AlertRuleSet> current() const { return std::atomic_load(&rules_); }
+
+    // Evaluate the current rules for a sample of a device (a DeviceStateStore
+    // index). Fired rules stay valid as long as the returned set is held.
+    std::shared_ptr<const AlertRuleSet> evaluate(uint32_t device, const AlertRuleSet::Sample& sample,
+                                                 std::vector<const AlertRuleSet::Rule*>& fired,
+                                                 std::vector<const AlertRuleSet::Rule*>* cleared = nullptr);
+
+private:
+    static constexpr size_t COUNTER_SHARDS = 64;
+
+    struct Counters {
+        uint64_t version = 0;
+        std::vector<uint16_t> counts;
+    };
+
+    struct CounterShard {
+        std::mutex mutex;
+        std::unordered_map<uint32_t, Counters> devices;
+    };
+
+    std::shared_ptr<const AlertRuleSet> rules_;   // std::atomic_load / std::atomic_store
+    CounterShard counter_shards_[COUNTER_SHARDS];
+
+    std::mutex load_mutex_;
+    std::string path_;
+    std::filesystem::file_time_type file_time_;
+    uint64_t version_;
+
+    std::thread reload_thread_;
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    bool running_;
+
+    bool loadLocked();
+};
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+#include <chrono>
+#include <cstdint>
+#include "fleet_sweep.h"
+
+// When a standing condition is worth another alert
+struct AlertPolicy {
+    // A metric leaves a level only this many percentage points below it
+    float hysteresis = 5.0f;
+
+    // Consecutive samples without the condition before an alert ends
+    uint32_t clear_samples = 3;
+
+    // An ended alert that comes back within the cooldown is only sent
+    // again if it is more severe than last time
+    std::chrono::seconds cooldown{300};
+
+    // A standing alert is repeated at this interval
+    std::chrono::seconds reminder{3600};
+
+    // Token buckets per device: alerts of any kind, and corrective
+    // commands, which are dropped from alerts while their bucket is empty
+    uint32_t alert_burst = 10;
+    std::chrono::seconds alert_refill{60};
+    uint32_t command_burst = 2;
+    std::chrono::seconds command_refill{900};
+};
+
+// Per-(device, alert) state machines that turn a stream of conditions,
+// observed on every sample, into alerts on state changes and reminders.
+// Devices are DeviceStateStore indices; their state lives in sharded maps.
+class AlertSuppressor {
+public:
+    enum Level : uint8_t {
+        CLEAR = 0,
+        INFO = 1,
+        WARNING = 2,
+        CRITICAL = 3
+    };
+
+    struct Decision {
+        bool send = false;
+        bool with_command = false;
+    };
+
+private:
+    struct TokenBucket {
+        float tokens;
+        int64_t updated_ms;
+
+        bool take(uint32_t burst, std::chrono::seconds refill, int64_t now_ms);
+    };
+
+    struct AlertState {
+        std::string key;
+        Level level = CLEAR;
+        Level sent_level = CLEAR;
+        uint32_t clear_samples = 0;
+        int64_t sent_ms = 0;
+        bool sent = false;
+        bool pending = false;   // due, but the device was out of tokens
+    };
+
+    struct DeviceState {
+        TokenBucket alerts;
+        TokenBucket commands;
+        std::vector<AlertState> alerts_by_key;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<uint32_t, DeviceState> devices;
+    };
+
+public:
+    // The alert state of one device, locked while held
+    class Device {
+    public:
+        Device(Device&&) = default;
+
+        // The level of a metric, with the hysteresis of the level it is at
+        Level metricLevel(const std::string& key, float value, const MetricThreshold& threshold) const;
+
+        // Record the condition's level on this sample and decide whether to
+        // alert. CLEAR for a condition that was checked and does not hold.
+        Decision observe(const std::string& key, Level level, bool has_command);
+
+    private:
+        friend class AlertSuppressor;
+
+        Device(const AlertPolicy& policy, std::unique_lock<std::mutex> lock, DeviceState* state, int64_t now_ms)
+            : policy_(policy), lock_(std::move(lock)), state_(state), now_ms_(now_ms) {}
+
+        const AlertPolicy& policy_;
+        std::unique_lock<std::mutex> lock_;
+        DeviceState* state_;   // nullptr: not tracked, everything is sent
+        int64_t now_ms_;
+
+        AlertState* find(const std::string& key) const;
+    };
+
+    explicit AlertSuppressor(const AlertPolicy& policy = AlertPolicy());
+
+    AlertSuppressor(const AlertSuppressor&) = delete;
+    AlertSuppressor& operator=(const AlertSuppressor&) = delete;
+
+    // Lock a device's state; now_ms is a monotonic time
+    Device device(uint32_t index, int64_t now_ms);
+
+private:
+    static constexpr size_t SHARDS = 64;
+
+    AlertPolicy policy_;
+    Shard shards_[SHARDS];
+};
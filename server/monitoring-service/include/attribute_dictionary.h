@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include "telemetry_sample.h"
+#include "../../common/include/mysql_connection_pool.h"
+
+// Interns slowly-changing attribute strings (usb state, kernel version,
+// hardware model, firmware and OS versions, application lists and service
+// maps) into attribute_dictionary and caches string -> id, so sample rows
+// only carry small integer ids. Owned by the storage flusher, not thread-safe.
+class AttributeDictionary {
+public:
+    explicit AttributeDictionary(size_t max_cached = 100000);
+
+    // Give every value an id, interning new ones. Runs in autocommit mode,
+    // outside of any batch transaction, so a cached id is never rolled back.
+    bool resolve(MySQLConnection& conn, const std::vector<const std::string*>& values);
+
+    // Id of a resolved value; 0 for the empty string or a value not resolved
+    uint32_t id(const std::string& value) const;
+
+    size_t cachedCount() const { return ids_.size(); }
+
+    // Canonical text of a sample's application list and service map (JSON,
+    // sorted by name), so the same set always maps to the same id
+    static std::string applicationsValue(const SoftwareSample& sample);
+    static std::string servicesValue(const SoftwareSample& sample);
+
+private:
+    std::unordered_map<std::string, uint32_t> ids_;
+    size_t max_cached_;
+
+    // SQL by statement id
+    std::unordered_map<std::string, std::string> sql_;
+
+    const std::string& statementSql(const std::string& id, const char* head, const char* item, size_t items,
+                                     const char* tail);
+};
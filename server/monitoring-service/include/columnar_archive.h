@@ -0,0 +1,122 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include "metrics_storage.h"
+
+struct ArchiveOptions {
+    // Directory of the archive files
+    std::string directory = "archive";
+    // Rows per row group, the unit reads skip or decode
+    size_t group_rows = 65536;
+    // zstd level of the column blocks, when built with zstd
+    int compression_level = 3;
+};
+
+// Cold tier of the metrics tables: expired daily partitions are exported to
+// columnar files on local disk before they are dropped.
+// A file holds row groups sorted by (device_id, ts). Each column of a group
+// is encoded for its type (dictionary and run lengths for text,
+// delta-of-delta for timestamps, deltas of hundredths for percentages, run
+// lengths for integers) and compressed with zstd when the build has it.
+// Group headers carry their device and time range, so a read for one device
+// decodes only the groups that can hold it, and only the columns it needs.
+class ColumnarArchive {
+public:
+    enum class ColumnType : uint8_t {
+        Text = 1,
+        Timestamp = 2,      // ms since the epoch
+        Percent = 3,        // two decimals, as DECIMAL(5,2)
+        Integer = 4
+    };
+
+    struct Column {
+        std::string name;
+        ColumnType type;
+    };
+
+    // Column values as text, as read from MySQL; an empty value is NULL
+    using Row = std::vector<std::string>;
+
+    // Builds one archive file. It only becomes visible, replacing a file of
+    // the same name, once finish() succeeded.
+    class Writer {
+    public:
+        ~Writer();
+
+        Writer(const Writer&) = delete;
+        Writer& operator=(const Writer&) = delete;
+
+        // Write one row group; rows sorted by (device_id, ts)
+        bool append(const std::vector<Row>& rows, std::string& error);
+
+        bool finish(std::string& error);
+
+    private:
+        friend class ColumnarArchive;
+
+        ColumnarArchive* archive_;
+        std::string table_;
+        std::string path_;
+        std::string temp_path_;
+        std::vector<Column> columns_;
+        int fd_;
+        size_t offset_;
+        uint64_t rows_;
+        uint32_t groups_;
+        int64_t min_ts_;
+        int64_t max_ts_;
+
+        Writer(ColumnarArchive* archive, const std::string& table, const std::string& path,
+               const std::vector<Column>& columns);
+
+        std::string schema() const;
+        bool write(const std::string& data, std::string& error);
+    };
+
+    explicit ColumnarArchive(const ArchiveOptions& options = ArchiveOptions());
+
+    ColumnarArchive(const ColumnarArchive&) = delete;
+    ColumnarArchive& operator=(const ColumnarArchive&) = delete;
+
+    // Create the directory and index the existing files
+    bool open();
+
+    const std::string& directory() const { return options_.directory; }
+    size_t groupRows() const { return options_.group_rows; }
+
+    // Start the file of one partition of a table. The first two columns
+    // have to be device_id (Text) and ts (Timestamp).
+    std::unique_ptr<Writer> create(const std::string& table, const std::string& partition,
+                                   const std::vector<Column>& columns, std::string& error);
+
+    // Hardware points of a device with from_ms <= timestamp < to_ms, in file order
+    bool readHardware(const std::string& device_id, int64_t from_ms, int64_t to_ms,
+                      std::vector<HardwarePoint>& points);
+
+private:
+    struct FileInfo {
+        std::string table;
+        std::string path;
+        int64_t min_ts;
+        int64_t max_ts;
+    };
+
+    ArchiveOptions options_;
+
+    mutable std::mutex mutex_;
+    std::map<std::string, FileInfo> files_;  // by path
+
+    void add(const FileInfo& file);
+
+    // Read the header of an archive file
+    static bool readInfo(const std::string& path, FileInfo& info, std::string& error);
+
+    // Decode the requested columns of the groups of one device in [from_ms, to_ms)
+    static bool readFile(const std::string& path, const std::string& device_id, int64_t from_ms, int64_t to_ms,
+                         std::vector<HardwarePoint>& points, std::string& error);
+};
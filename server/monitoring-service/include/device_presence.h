@@ -0,0 +1,143 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include "device_state_store.h"
+
+// When a device that stopped reporting counts as stale or offline
+struct PresencePolicy {
+    // Interval assumed until a device's own samples tell, and the bounds of
+    // the learned one; samples closer together than min_interval count as one
+    std::chrono::milliseconds expected_interval{60000};
+    std::chrono::milliseconds min_interval{1000};
+    std::chrono::milliseconds max_interval{3600000};
+
+    // Expected intervals without a sample before a device is stale / offline
+    float stale_factor = 3.0f;
+    float offline_factor = 10.0f;
+
+    // Resolution of the timers
+    std::chrono::milliseconds tick{1000};
+};
+
+// Presence of every device, indexed like the DeviceStateStore.
+// Each device has a timer in a hierarchical timer wheel (4 levels of 64
+// slots, cascading down as time passes) that runs out when it misses its
+// expected interval. A sample only stores its time: the timer is not moved
+// but checked when it runs out, and re-armed for the latest sample then, so
+// the cost per sample is O(1) and lock-free while the device is online.
+// Times are monotonic milliseconds.
+class DevicePresence {
+public:
+    enum class Status : uint8_t {
+        Unknown,    // never seen
+        Online,
+        Stale,
+        Offline
+    };
+    static constexpr size_t STATUS_COUNT = 4;
+
+    struct Transition {
+        uint32_t device;    // DeviceStateStore index
+        Status from;
+        Status to;
+        int64_t silent_ms;  // since the device's last sample
+    };
+
+    struct Presence {
+        Status status = Status::Unknown;
+        int64_t silent_ms = 0;
+        int64_t expected_interval_ms = 0;
+    };
+
+    explicit DevicePresence(const PresencePolicy& policy = PresencePolicy(), size_t max_devices = size_t(1) << 24);
+    ~DevicePresence();
+
+    DevicePresence(const DevicePresence&) = delete;
+    DevicePresence& operator=(const DevicePresence&) = delete;
+
+    // A sample of the device arrived; returns its status before it.
+    // Devices are updated by one ingest worker at a time.
+    Status seen(uint32_t device, int64_t now_ms);
+
+    // Run the timers due by now_ms, appending the devices whose status changed
+    void advance(int64_t now_ms, std::vector<Transition>& transitions);
+
+    // false for a device never seen
+    bool get(uint32_t device, int64_t now_ms, Presence& presence) const;
+
+    // Devices with a status, and how many there are
+    std::vector<uint32_t> devices(Status status) const;
+    size_t count(Status status) const;
+
+    // Advance every tick; on_change runs on that thread
+    void start(std::function<void(const std::vector<Transition>&)> on_change);
+    void stop();
+
+    static int64_t nowMs();
+
+private:
+    static constexpr size_t LEVELS = 4;
+    static constexpr size_t SLOT_BITS = 6;
+    static constexpr size_t SLOTS = size_t(1) << SLOT_BITS;
+    static constexpr uint16_t NO_SLOT = UINT16_MAX;
+
+    // Learning rate of the expected interval
+    static constexpr float ALPHA = 0.1f;
+
+    struct Entry {
+        // Written by the device's ingest worker, read by the wheel
+        std::atomic<int64_t> last_seen_ms{0};
+        std::atomic<float> interval_ms{0};
+        std::atomic<uint8_t> status{0};
+
+        // Timer, under wheel_mutex_
+        uint64_t deadline = 0;          // in ticks
+        uint32_t next = DeviceStateStore::NO_DEVICE;
+        uint32_t prev = DeviceStateStore::NO_DEVICE;
+        uint16_t slot = NO_SLOT;
+    };
+
+    PresencePolicy policy_;
+    int64_t tick_ms_;
+
+    size_t max_chunks_;
+    std::unique_ptr<std::atomic<Entry*>[]> chunks_;
+    std::atomic<size_t> size_;      // highest device seen + 1, under wheel_mutex_
+    std::mutex grow_mutex_;
+
+    // The wheel: lists of devices linked through their entries
+    std::mutex wheel_mutex_;
+    uint32_t heads_[LEVELS * SLOTS];
+    uint64_t current_tick_;         // next tick to run
+    bool started_;
+    std::atomic<size_t> counts_[STATUS_COUNT];
+
+    std::thread tick_thread_;
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    bool running_;
+
+    Entry* entry(uint32_t device) const;
+    Entry* allocate(uint32_t device);
+
+    uint64_t ticks(int64_t ms) const { return static_cast<uint64_t>((ms + tick_ms_ - 1) / tick_ms_); }
+
+    void arm(uint32_t device, Entry& e, int64_t due_ms);
+    void link(uint32_t device, Entry& e);
+    uint32_t detach(size_t slot);
+
+    // Move the expected interval toward a gap between samples
+    void learn(Entry& e, int64_t gap_ms);
+
+    // A device's timer ran out
+    void expire(uint32_t device, Entry& e, int64_t now_ms, std::vector<Transition>& transitions);
+    void setStatus(Entry& e, Status from, Status to);
+};
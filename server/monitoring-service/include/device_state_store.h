@@ -0,0 +1,156 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include "telemetry_sample.h"
+
+// Text attributes of a device, shared between snapshots until one changes
+struct DeviceAttributes {
+    std::string usb_state;
+    std::string ip_address;
+    std::string network_status;
+    std::map<std::string, std::string> services;
+};
+
+// Last known state of a device
+struct DeviceState {
+    // Hardware metrics, in percent; NaN until reported
+    double cpu_usage = std::nan("");
+    double memory_usage = std::nan("");
+    double disk_usage = std::nan("");
+    int gpio_state = 0;
+
+    // Sample times, ms since the epoch to the second; 0 until reported
+    int64_t last_hw_update_ms = 0;
+    int64_t last_sw_update_ms = 0;
+
+    // nullptr until a text attribute is reported
+    std::shared_ptr<const DeviceAttributes> attributes;
+};
+
+// Fleet state in struct-of-arrays form.
+// Device ids are interned into dense indices; the numeric metrics of device
+// i are element i of typed columns, allocated in cache-aligned chunks that
+// never move, so a fleet-wide pass walks contiguous floats. Sample times are
+// kept as 32-bit seconds and ids are packed into shared blocks, so a device
+// costs about 52 bytes plus its id and index slot (see the columns below).
+// Only text attributes are separate objects.
+// Ids are found through sharded open-addressing tables of indices, each
+// with its own lock, which is only taken exclusively to add a device.
+// Each device has a sequence lock over its numeric values: readers retry
+// instead of blocking and never see a half-applied sample. Text attributes
+// are published read-copy-update.
+class DeviceStateStore {
+public:
+    static constexpr uint32_t NO_DEVICE = UINT32_MAX;
+    static constexpr size_t CHUNK_DEVICES = 4096;
+
+    enum class Metric : uint8_t { Cpu = 0, Memory = 1, Disk = 2 };
+    static constexpr size_t METRIC_COUNT = 3;
+
+    static constexpr size_t MAX_ID_LENGTH = UINT16_MAX;
+
+    // shards is rounded up to a power of two
+    explicit DeviceStateStore(size_t max_devices = size_t(1) << 24, size_t shards = 64);
+    ~DeviceStateStore();
+
+    DeviceStateStore(const DeviceStateStore&) = delete;
+    DeviceStateStore& operator=(const DeviceStateStore&) = delete;
+
+    // Index of a device, assigned on first use; NO_DEVICE once max_devices
+    // are known or for an id longer than MAX_ID_LENGTH
+    uint32_t intern(const std::string& device_id);
+
+    // Index of a known device, NO_DEVICE otherwise
+    uint32_t find(const std::string& device_id) const;
+
+    // Valid as long as the store
+    std::string_view deviceId(uint32_t index) const;
+
+    // Devices are indexed 0 .. size() - 1
+    size_t size() const { return count_.load(std::memory_order_acquire); }
+
+    // Apply a sample to a device; a missing time stands for now.
+    // Returns the GPIO state before the sample.
+    int updateHardware(uint32_t index, const HardwareSample& sample);
+    void updateSoftware(uint32_t index, const SoftwareSample& sample);
+
+    // Consistent state of a device; false if it is unknown
+    bool get(uint32_t index, DeviceState& state) const;
+    bool get(const std::string& device_id, DeviceState& state) const;
+
+    // Sorted ids of all known devices
+    std::vector<std::string> deviceIds() const;
+
+    // Values of a metric for the devices of the chunk starting at first, a
+    // multiple of CHUNK_DEVICES below size(); NaN where none was reported.
+    // Read without the sequence locks, for fleet-wide passes: each value is
+    // one that was reported, the metrics of a device may be from
+    // consecutive samples.
+    const float* column(Metric metric, uint32_t first) const;
+
+private:
+    // Columns of CHUNK_DEVICES devices
+    struct alignas(64) Chunk {
+        std::atomic<uint32_t> sequence[CHUNK_DEVICES];     // odd while a writer updates the device
+        std::atomic<float> cpu[CHUNK_DEVICES];
+        std::atomic<float> memory[CHUNK_DEVICES];
+        std::atomic<float> disk[CHUNK_DEVICES];
+        std::atomic<int32_t> gpio[CHUNK_DEVICES];
+        std::atomic<uint32_t> hw_time[CHUNK_DEVICES];     // see toSeconds()
+        std::atomic<uint32_t> sw_time[CHUNK_DEVICES];
+        std::shared_ptr<const DeviceAttributes> attributes[CHUNK_DEVICES];  // std::atomic_load / atomic_store
+        const char* ids[CHUNK_DEVICES];                   // 16-bit length and bytes, in id_blocks_
+
+        Chunk();
+    };
+
+    // Open-addressing table of device indices
+    struct Shard {
+        mutable std::shared_mutex mutex;
+        std::vector<uint32_t> slots;
+        size_t used = 0;
+    };
+
+    size_t max_chunks_;
+    std::unique_ptr<std::atomic<Chunk*>[]> chunks_;
+    std::atomic<size_t> count_;
+    std::mutex grow_mutex_;     // serializes adding devices
+
+    // Ids, appended under grow_mutex_ to blocks that never move
+    static constexpr size_t ID_BLOCK_SIZE = 65536;
+    std::vector<std::unique_ptr<char[]>> id_blocks_;
+    size_t id_block_used_;
+
+    std::vector<Shard> shards_;
+    size_t shard_bits_;
+
+    Chunk& chunk(uint32_t index) const { return *chunks_[index / CHUNK_DEVICES].load(std::memory_order_acquire); }
+
+    // Copy an id to the blocks, under grow_mutex_
+    const char* storeId(const std::string& device_id);
+
+    // Seconds since 2020-01-01 UTC, 0 for no time; times before are clamped
+    static uint32_t toSeconds(int64_t ms);
+    static int64_t fromSeconds(uint32_t seconds);
+
+    Shard& shard(size_t hash);
+    const Shard& shard(size_t hash) const;
+    uint32_t lookup(const Shard& shard, size_t hash, const std::string& device_id) const;
+    void insert(Shard& shard, size_t hash, uint32_t index);
+
+    // Take the device's sequence lock, returning the even value it had
+    uint32_t beginWrite(uint32_t index);
+    void endWrite(uint32_t index, uint32_t sequence);
+
+    // Copy of the text attributes of a device, to change and publish
+    std::shared_ptr<DeviceAttributes> copyAttributes(uint32_t index) const;
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include "device_state_store.h"
+
+// Warning and critical levels of one metric
+struct MetricThreshold {
+    float warning;
+    float critical;
+};
+
+class ThresholdTable;
+
+// Fleet-wide threshold evaluation over the metric columns of a
+// DeviceStateStore against the per-device columns of a ThresholdTable.
+// Each pass compares whole columns with SIMD (AVX when the build targets
+// it, SSE2 otherwise) and only looks at single devices whose level is or
+// was above normal. The level of every device is kept
+// between passes, so a pass reports the devices that changed level as well
+// as the full breach lists.
+// Not thread-safe; callers serialize run().
+class FleetThresholdSweep {
+public:
+    using Metric = DeviceStateStore::Metric;
+    static constexpr size_t METRIC_COUNT = DeviceStateStore::METRIC_COUNT;
+
+    enum Level : uint8_t {
+        NORMAL = 0,
+        WARNING = 1,
+        CRITICAL = 2
+    };
+
+    struct Transition {
+        uint32_t device;    // DeviceStateStore index
+        Metric metric;
+        Level from;
+        Level to;
+        float value;
+    };
+
+    struct Result {
+        std::vector<Transition> transitions;
+        // Devices at warning / critical level, by metric
+        std::vector<uint32_t> warning[METRIC_COUNT];
+        std::vector<uint32_t> critical[METRIC_COUNT];
+        size_t devices = 0;
+        std::chrono::microseconds duration{0};
+    };
+
+    Result run(const DeviceStateStore& store, const ThresholdTable& thresholds);
+
+private:
+    std::vector<uint8_t> levels_[METRIC_COUNT];
+    // Devices above normal per chunk; quiet chunks are swept on values alone
+    std::vector<uint32_t> active_[METRIC_COUNT];
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+
+// Pool of ingest workers, each owning a bounded FIFO queue.
+// Jobs are routed by device_id, so all messages of one device are handled
+// by the same worker in arrival order while different devices run in parallel.
+class IngestWorkerPool {
+public:
+    using Job = std::function<void()>;
+
+    // Counters exported per worker
+    struct WorkerStats {
+        size_t queue_depth;
+        uint64_t processed;
+    };
+
+    // worker_count == 0 means one worker per hardware thread
+    IngestWorkerPool(size_t worker_count, size_t queue_capacity);
+    ~IngestWorkerPool();
+
+    // Start worker threads
+    void start();
+
+    // Let workers drain their queues, then join them
+    void stop();
+
+    // Queue a job on the worker owning device_id.
+    // Blocks while that queue is full; returns false if the pool is stopped.
+    bool submit(const std::string& device_id, Job job);
+
+    size_t workerCount() const;
+
+    std::vector<WorkerStats> getStats() const;
+
+private:
+    struct Worker {
+        std::deque<Job> queue;
+        mutable std::mutex mutex;
+        std::condition_variable not_empty;
+        std::condition_variable not_full;
+        std::atomic<size_t> depth{0};
+        std::atomic<uint64_t> processed{0};
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    size_t queue_capacity_;
+    std::atomic<bool> running_;
+
+    void run(Worker& worker);
+    size_t workerIndex(const std::string& device_id) const;
+};
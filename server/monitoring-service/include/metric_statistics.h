@@ -0,0 +1,114 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include "device_state_store.h"
+
+// Rolling statistics of one metric of one device; about 350 bytes, updated
+// in O(1) per sample
+struct MetricWindow {
+    static constexpr size_t SIZE = 32;
+    static constexpr size_t HOURS = 24;
+
+    // The latest SIZE values and their running sums
+    float values[SIZE];
+    uint16_t head;
+    uint16_t count;
+    double sum;
+    double sum_squares;
+
+    uint32_t samples;           // seen in total, 0 for an unused slot
+    float last;
+
+    // Exponentially weighted mean and variance
+    float mean;
+    float variance;
+
+    // Exponentially weighted mean of each hour of the day (UTC)
+    float seasonal[HOURS];
+    uint8_t seasonal_samples[HOURS];
+
+    // Exponentially weighted squared deviation from the baseline the
+    // anomaly score is taken against
+    float residual_variance;
+
+    // P-square markers estimating the 95th percentile
+    float heights[5];
+    float desired[5];
+    int32_t positions[5];
+};
+
+// Rolling statistics and anomaly scores of the cpu/memory/disk metrics of
+// every device, indexed like the DeviceStateStore. Windows are allocated
+// in chunks of DeviceStateStore::CHUNK_DEVICES devices as devices appear,
+// so memory grows with the fleet and not with the sample rate.
+// A sample is scored against the device's baseline before it is added:
+// the mean of its hour of day once that hour was seen often enough, the
+// overall moving mean until then.
+class MetricStatistics {
+public:
+    using Metric = DeviceStateStore::Metric;
+    static constexpr size_t METRIC_COUNT = DeviceStateStore::METRIC_COUNT;
+
+    // Samples before a device is scored at all, and per hour of the day
+    // before that hour's mean becomes the baseline
+    static constexpr uint32_t MIN_SAMPLES = 30;
+    static constexpr uint8_t MIN_SEASONAL_SAMPLES = 10;
+
+    // Weights of a new sample in the moving and the hourly averages
+    static constexpr float ALPHA = 0.05f;
+    static constexpr float SEASONAL_ALPHA = 0.2f;
+
+    // Lower bound of the deviation a z-score divides by, in percentage
+    // points, so a flat metric does not turn noise into anomalies
+    static constexpr float MIN_STDDEV = 0.5f;
+
+    // How unusual a sample was; NaN until the device has enough history
+    struct Score {
+        float zscore = NAN;
+        float baseline = NAN;
+    };
+
+    struct Summary {
+        uint32_t samples = 0;
+        float last = NAN;
+        // Over the latest MetricWindow::SIZE samples
+        float window_mean = NAN;
+        float window_stddev = NAN;
+        float window_min = NAN;
+        float window_max = NAN;
+        // Exponentially weighted
+        float mean = NAN;
+        float stddev = NAN;
+        float p95 = NAN;
+    };
+
+    explicit MetricStatistics(size_t max_devices = size_t(1) << 24);
+    ~MetricStatistics();
+
+    MetricStatistics(const MetricStatistics&) = delete;
+    MetricStatistics& operator=(const MetricStatistics&) = delete;
+
+    // Score a sample of a device (a DeviceStateStore index) and add it
+    Score update(uint32_t device, Metric metric, float value, int64_t timestamp_ms);
+
+    // false if the device has no samples of the metric
+    bool summary(uint32_t device, Metric metric, Summary& summary) const;
+
+private:
+    static constexpr size_t LOCK_STRIPES = 1024;
+
+    size_t max_chunks_;
+    std::unique_ptr<std::atomic<MetricWindow*>[]> chunks_[METRIC_COUNT];
+    std::mutex grow_mutex_;
+
+    // Devices are updated by one ingest worker at a time; the locks keep
+    // summaries from reading a window mid-update
+    mutable std::mutex locks_[LOCK_STRIPES];
+
+    MetricWindow* window(uint32_t device, Metric metric) const;
+    MetricWindow* allocate(uint32_t device, Metric metric);
+};
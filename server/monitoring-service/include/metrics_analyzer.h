@@ -4,75 +4,141 @@
 #include <map>
 #include <vector>
 #include <mutex>
-#include <nlohmann/json.hpp>
+#include <memory>
+#include <chrono>
+#include "telemetry_sample.h"
+#include "device_state_store.h"
+#include "fleet_sweep.h"
+#include "threshold_manager.h"
+#include "alert_rules.h"
+#include "metric_statistics.h"
+#include "alert_suppressor.h"
+#include "device_presence.h"
 
 // Forward declaration
 class AlertManager;
 
 class MetricsAnalyzer {
 public:
-    // Structure for storing device state
-    struct DeviceState {
-        // Hardware metrics
-        std::string cpu_usage;
-        std::string memory_usage;
-        std::string disk_usage;
-        std::string usb_state;
-        int gpio_state;
-        
-        // Software metrics
-        std::string ip_address;
-        std::string network_status;
-        std::map<std::string, std::string> services;
-        
-        // Timestamps
-        std::string last_hw_update;
-        std::string last_sw_update;
-    };
+    using DeviceState = ::DeviceState;
     
     // Constructor
-    MetricsAnalyzer(AlertManager* alert_manager);
+    MetricsAnalyzer(AlertManager* alert_manager, const AlertPolicy& alert_policy = AlertPolicy(),
+                    const PresencePolicy& presence_policy = PresencePolicy());
+    ~MetricsAnalyzer();
     
-    // Process hardware metrics from a device
-    void processHardwareMetrics(const std::string& device_id, const nlohmann::json& metrics);
+    // Update the device's state from a sample and raise its alerts, in one pass
+    void processHardwareMetrics(const HardwareSample& sample);
     
     // Process software metrics from a device
-    void processSoftwareMetrics(const std::string& device_id, const nlohmann::json& metrics);
-        // Analyze CPU usage
-    void analyzeCpuUsage(const std::string& device_id, const std::string& cpu_usage);
+    void processSoftwareMetrics(const SoftwareSample& sample);
     
-    // Analyze memory usage
-    void analyzeMemoryUsage(const std::string& device_id, const std::string& memory_usage);
+    // Seed a device's state with its last stored samples, e.g. at startup;
+    // samples with no time are skipped and no alerts are raised
+    void restoreDeviceState(const HardwareSample& hardware, const SoftwareSample& software);
+        // Analyze CPU usage (percentage)
+    void analyzeCpuUsage(const std::string& device_id, double cpu_usage);
     
-    // Analyze disk usage
-    void analyzeDiskUsage(const std::string& device_id, const std::string& disk_usage);
+    // Analyze memory usage (percentage)
+    void analyzeMemoryUsage(const std::string& device_id, double memory_usage);
     
-    // Analyze USB state
-    void analyzeUsbState(const std::string& device_id, const std::string& usb_state);
+    // Analyze disk usage (percentage)
+    void analyzeDiskUsage(const std::string& device_id, double disk_usage);
     
-    // Analyze GPIO state
-    void analyzeGpioState(const std::string& device_id, int current_gpio_state, int previous_gpio_state) ;
+    // Get the current state of a device; text attributes are shared, not copied
+    DeviceState getDeviceState(const std::string& device_id) const;
     
-    // Analyze network status
-    void analyzeNetworkStatus(const std::string& device_id, const std::string& status);  // <- this line
+    // Get all known device IDs
+    std::vector<std::string> getAllDeviceIds() const;
     
-    // Analyze services
-    void analyzeServices(const std::string& device_id, const std::map<std::string, std::string>& services);
+    // Rolling statistics of a device's metric; false without samples
+    bool getMetricStatistics(const std::string& device_id, DeviceStateStore::Metric metric,
+                             MetricStatistics::Summary& summary) const;
     
-    // Get the current state of a device
-    DeviceState getDeviceState(const std::string& device_id);
+    // Whether a device is still reporting; false for a device never seen
+    bool getDevicePresence(const std::string& device_id, DevicePresence::Presence& presence) const;
     
-    // Get all known device IDs
-    std::vector<std::string> getAllDeviceIds();
+    // Sorted ids of the devices with a presence status
+    std::vector<std::string> getDevicesByPresence(DevicePresence::Status status) const;
+    
+    // Evaluate the cpu/memory/disk thresholds over the whole fleet at once,
+    // e.g. after the thresholds changed. Devices that rose to warning or
+    // critical since the last sweep are alerted; all breaches are returned.
+    FleetThresholdSweep::Result sweepThresholds();
+    
+    // Device id of a sweep result index
+    std::string_view deviceId(uint32_t index) const { return device_states_.deviceId(index); }
+    
+    // Load the thresholds from the file and, with a pool, the threshold_rules
+    // table; the built-in defaults apply until a load succeeds
+    bool loadThresholds(const std::string& path, std::shared_ptr<MySQLConnectionPool> pool = nullptr);
+    
+    // Load the alert rules (see AlertRuleSet), as shipped in
+    // config/alert_rules.json; no rules apply until a load succeeds
+    bool loadAlertRules(const std::string& path);
+    
+    // Reload changed thresholds and alert rules in the background; the
+    // fleet is swept against new thresholds
+    void startReload(std::chrono::seconds interval);
+    void stopReload();
+    
+    // Watch for devices that stop reporting, alerting DEVICE_STALE and
+    // DEVICE_OFFLINE, and DEVICE_ONLINE when they come back
+    void startPresence();
+    void stopPresence();
 
 private:
     AlertManager* alert_manager_;
-    nlohmann::json thresholds_;
     
-    // Device states
-    std::map<std::string, DeviceState> device_states_;
-    std::mutex devices_mutex_;
+    // Device states, columns indexed by interned device id
+    DeviceStateStore device_states_;
+    
+    // Rolling statistics and anomaly scores, indexed like device_states_
+    MetricStatistics statistics_;
+    
+    // Compiled per-device thresholds, replaced as a whole on reload
+    ThresholdManager thresholds_{device_states_};
+    
+    // Compiled alert rules, replaced as a whole on reload
+    AlertRuleEngine alert_rules_;
+    
+    // Fleet-wide threshold sweep and the levels it last saw
+    FleetThresholdSweep sweep_;
+    std::mutex sweep_mutex_;
+    
+    // Per-device timers of when each device is due to report
+    DevicePresence presence_;
+    
+    // Decides which standing conditions are worth an alert
+    AlertSuppressor alert_suppressor_;
+    
+    // An alert decided on while the device's alert state is locked, sent after
+    struct PendingAlert {
+        AlertSuppressor::Level level;
+        std::string type;
+        std::string description;
+        std::string recommendation;
+        std::string command;
+    };
+    
+    void analyzeUsage(const std::string& device_id, DeviceStateStore::Metric metric, double usage);
+    
+    // Threshold check of a metric against thresholds already looked up
+    void analyzeUsage(AlertSuppressor::Device& alerts, DeviceStateStore::Metric metric, double usage,
+                      const MetricThreshold& threshold, std::vector<PendingAlert>& outgoing);
+    
+    // Evaluate the alert rules for a sample of a device
+    void evaluateRules(uint32_t index, AlertSuppressor::Device& alerts, const AlertRuleSet::Sample& sample,
+                       std::vector<PendingAlert>& outgoing);
+    
+    void sendAlerts(const std::string& device_id, const std::vector<PendingAlert>& outgoing);
+    
+    // Alert a change of a device's presence
+    void sendPresenceAlert(const std::string& device_id, DevicePresence::Status from, DevicePresence::Status to,
+                           int64_t silent_ms);
+    
+    static int64_t nowMs();
     
-    // Helper to extract percentage value from string
-    float extractPercentage(const std::string& percentage_str);
+    // Helper to format a percentage value as "12.34%"
+    static std::string formatPercentage(double value);
 };
\ No newline at end of file
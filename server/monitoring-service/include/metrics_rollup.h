@@ -0,0 +1,104 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <array>
+#include <utility>
+#include <cstdint>
+#include "telemetry_sample.h"
+
+// Distribution of one percentage metric: exact count/sum/min/max and a
+// histogram of 1% bins for percentiles. Bins make partial aggregates
+// mergeable, so a bucket can be continued after a restart.
+class PercentDistribution {
+public:
+    static constexpr size_t BINS = 101;
+
+    void add(double value);
+    void merge(const PercentDistribution& other);
+
+    uint64_t count() const { return count_; }
+    double min() const { return min_; }
+    double max() const { return max_; }
+    double avg() const { return count_ ? sum_ / count_ : 0.0; }
+
+    // Nearest-rank percentile (q in [0, 1]), accurate to the 1% bin
+    double percentile(double q) const;
+
+    // Sparse binary form of the bins: [non-empty bins][bin, count]...
+    void encodeBins(std::string& out) const;
+
+    // Restore from stored bins and aggregates; false if the data is malformed
+    bool decode(const char*& data, const char* end, double min, double max, double avg);
+
+private:
+    std::array<uint32_t, BINS> bins_{};
+    uint64_t count_ = 0;
+    double sum_ = 0.0;
+    double min_ = 0.0;
+    double max_ = 0.0;
+};
+
+// Per-device rollups of cpu, memory and disk at 1 minute, 1 hour and 1 day,
+// updated incrementally from every hardware sample. Not thread-safe: owned
+// by the storage flusher, which writes changed buckets with each batch.
+class MetricsRollup {
+public:
+    enum Level : size_t {
+        Minute,
+        Hour,
+        Day,
+        LevelCount
+    };
+
+    struct Bucket {
+        std::string device_id;
+        int64_t start_ms = 0;
+        uint64_t samples = 0;
+        PercentDistribution cpu;
+        PercentDistribution memory;
+        PercentDistribution disk;
+
+        // Changed since it was last written
+        bool dirty = false;
+        // Merged with the row an earlier run may have stored
+        bool loaded = false;
+
+        // Bins of the three metrics, in that order
+        std::string encodeHistogram() const;
+        bool mergeStored(uint64_t stored_samples, const std::string& histogram,
+                         const std::array<double, 9>& min_max_avg);
+    };
+
+    static int64_t resolutionMs(Level level);
+    static const char* tableName(Level level);
+
+    // Buckets starting before started_ms may already have a stored row
+    explicit MetricsRollup(int64_t started_ms);
+
+    // Account a sample in its bucket at every level
+    void add(const HardwareSample& sample);
+
+    // Buckets that have to be merged with their stored row before writing
+    std::vector<Bucket*> bucketsToLoad(Level level);
+
+    // Buckets changed since the last markWritten()
+    std::vector<const Bucket*> dirtyBuckets(Level level) const;
+
+    // The dirty buckets were committed
+    void markWritten();
+
+    // Forget written buckets that ended more than one resolution before now_ms
+    void evict(int64_t now_ms);
+
+    size_t bucketCount() const;
+
+private:
+    using Key = std::pair<std::string, int64_t>;
+
+    std::array<std::map<Key, Bucket>, LevelCount> buckets_;
+
+    // Per level: buckets starting before this may have a stored row
+    std::array<int64_t, LevelCount> stored_before_;
+};
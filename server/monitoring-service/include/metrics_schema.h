@@ -0,0 +1,118 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include "../../common/include/mysql_connection_pool.h"
+#include "columnar_archive.h"
+
+// Retention of the time-partitioned metrics tables
+struct RetentionOptions {
+    // Daily partitions entirely older than this are dropped
+    int retention_days = 30;
+    // Daily partitions created ahead of time, so inserts never land in the
+    // catch-all partition
+    int partitions_ahead = 3;
+    // How often partitions are added and expired ones dropped
+    std::chrono::minutes maintenance_interval{60};
+};
+
+// Versioned schema of the metrics tables.
+// Migrations are applied in order and recorded in schema_version; a
+// migration that failed partway is safe to apply again. Sample
+// tables are range-partitioned by day on their DATETIME(3) sample time, so
+// retention drops whole partitions instead of deleting rows. With an archive,
+// expired sample partitions are exported to it before they are dropped.
+class MetricsSchema {
+public:
+    MetricsSchema(std::shared_ptr<MySQLConnectionPool> pool, const RetentionOptions& options = RetentionOptions(),
+                  std::shared_ptr<ColumnarArchive> archive = nullptr);
+    ~MetricsSchema();
+
+    MetricsSchema(const MetricsSchema&) = delete;
+    MetricsSchema& operator=(const MetricsSchema&) = delete;
+
+    // Bring the schema to the latest version
+    bool migrate();
+
+    // Version recorded in schema_version, -1 if it could not be read
+    int currentVersion();
+
+    // Start / stop the background partition maintenance
+    void start();
+    void stop();
+
+    // Add upcoming daily partitions and drop expired ones, once
+    bool runMaintenance();
+
+private:
+    struct Migration {
+        int version;
+        const char* description;
+        bool (MetricsSchema::*apply)(MySQLConnection& conn);
+    };
+
+    // A partition and the exclusive upper bound of its range ("YYYY-MM-DD",
+    // empty for the MAXVALUE partition)
+    struct Partition {
+        std::string name;
+        std::string upper_bound;
+    };
+
+    std::shared_ptr<MySQLConnectionPool> pool_;
+    RetentionOptions options_;
+    std::shared_ptr<ColumnarArchive> archive_;
+
+    std::thread maintenance_thread_;
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    bool running_;
+
+    static const std::vector<Migration>& migrations();
+
+    // Version 1: typed columns, (device_id, ts) index, daily partitions
+    bool createPartitionedTables(MySQLConnection& conn);
+
+    // Version 2: per-device cpu/memory/disk rollups
+    bool createRollupTables(MySQLConnection& conn);
+
+    // Version 3: one row per (device_id, ts), existing duplicates removed
+    bool addSampleKeys(MySQLConnection& conn);
+
+    // Version 4: device_latest_state, seeded from the stored samples
+    bool createLatestStateTable(MySQLConnection& conn);
+
+    // Version 5: attribute strings moved into attribute_dictionary
+    bool createAttributeDictionary(MySQLConnection& conn);
+
+    // Version 6: threshold_rules, read by ThresholdManager
+    bool createThresholdRules(MySQLConnection& conn);
+
+    void maintenanceLoop();
+
+    // Migrations check what an earlier, failed attempt already did
+    bool tableExists(MySQLConnection& conn, const std::string& table);
+    bool indexExists(MySQLConnection& conn, const std::string& table, const std::string& index);
+    bool columnExists(MySQLConnection& conn, const std::string& table, const std::string& column);
+    bool listPartitions(MySQLConnection& conn, const std::string& table, std::vector<Partition>& partitions);
+    bool ensurePartitions(MySQLConnection& conn, const std::string& table);
+    bool dropExpiredPartitions(MySQLConnection& conn, const std::string& table);
+
+    // Export the rows of one partition, [lower_bound, upper_bound), to the archive
+    bool archivePartition(MySQLConnection& conn, const std::string& table, const Partition& partition,
+                          const std::string& lower_bound);
+
+    // Partition clause covering everything before today, the next days and the future
+    std::string initialPartitions() const;
+
+    static int64_t today();
+    static std::string dayString(int64_t day);
+    static std::string partitionName(int64_t day);
+    // Epoch milliseconds of a "YYYY-MM-DD" day, 0 if empty
+    static int64_t dayMs(const std::string& day);
+};
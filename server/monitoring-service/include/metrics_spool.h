@@ -0,0 +1,126 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include "telemetry_sample.h"
+
+struct SpoolOptions {
+    // Directory of the segment files and the replay position
+    std::string directory = "spool";
+    // A new segment file is started once the current one reaches this size
+    size_t segment_bytes = 64 << 20;
+    // Appends are refused once the segment files take this much
+    size_t max_bytes = static_cast<size_t>(4) << 30;
+};
+
+// Samples of one write-behind batch
+struct SpoolBatch {
+    std::vector<HardwareSample> hardware;
+    std::vector<SoftwareSample> software;
+
+    // Start time of the storage run whose rollups already hold these
+    // hardware samples, 0 when they still have to be added on replay
+    int64_t rollups_run = 0;
+
+    size_t size() const { return hardware.size() + software.size(); }
+};
+
+// Durable local write-ahead spool for metrics MySQL could not take.
+// Batches are appended as checksummed records to numbered segment files and
+// synced before append() returns. They are read back oldest first; the
+// replay position is synced after every pop() and fully replayed segments
+// are deleted. A torn record left by a crash is cut off on open().
+//
+// Appends and replay come from a single thread; getStats() may be called
+// from any thread.
+class MetricsSpool {
+public:
+    struct Stats {
+        size_t pending_rows;            // spooled and not replayed yet
+        size_t pending_batches;
+        size_t bytes;                   // size of the segment files
+        size_t segments;
+        uint64_t spooled_rows;          // since open()
+        uint64_t replayed_rows;         // since open()
+        double replay_rows_per_sec;     // over the last few seconds of replay
+    };
+
+    explicit MetricsSpool(const SpoolOptions& options = SpoolOptions());
+    ~MetricsSpool();
+
+    MetricsSpool(const MetricsSpool&) = delete;
+    MetricsSpool& operator=(const MetricsSpool&) = delete;
+
+    // Create the directory, validate the segments and restore the replay position
+    bool open();
+
+    const std::string& directory() const { return options_.directory; }
+
+    // Append a batch and sync it; false if it could not be made durable
+    bool append(const SpoolBatch& batch);
+
+    // Nothing left to replay
+    bool empty() const;
+
+    // Read the oldest batch not replayed yet; false when there is none
+    bool front(SpoolBatch& batch);
+
+    // The batch returned by front() was written, move past it
+    void pop();
+
+    Stats getStats() const;
+
+private:
+    struct Segment {
+        size_t bytes = 0;
+        size_t rows = 0;        // not replayed yet
+        size_t batches = 0;     // not replayed yet
+    };
+
+    SpoolOptions options_;
+
+    mutable std::mutex mutex_;
+    std::map<uint64_t, Segment> segments_;
+    size_t total_bytes_;
+    size_t pending_rows_;
+    size_t pending_batches_;
+
+    // Append position
+    int write_fd_;
+    uint64_t write_seq_;
+
+    // Replay position and the size of the record front() returned
+    int read_fd_;
+    uint64_t read_seq_;
+    size_t read_offset_;
+    size_t front_bytes_;
+    size_t front_rows_;
+    int position_fd_;
+
+    uint64_t spooled_rows_;
+    uint64_t replayed_rows_;
+    std::chrono::steady_clock::time_point last_replay_;
+    std::chrono::steady_clock::time_point rate_window_start_;
+    uint64_t rate_window_rows_;
+    double replay_rate_;
+
+    std::string segmentPath(uint64_t seq) const;
+
+    // Count the valid records of a segment from offset on, cutting off the rest
+    bool scanSegment(uint64_t seq, size_t offset, Segment& segment);
+
+    bool openWriteSegment();
+    bool openReadSegment();
+    void closeRead();
+    void removeSegment(uint64_t seq);
+
+    bool loadPosition(uint64_t& seq, size_t& offset);
+    bool savePosition();
+
+    // Read the record at offset; false if it is missing or corrupt
+    bool readRecord(int fd, size_t offset, size_t limit, std::string& payload, uint32_t& rows, size_t& bytes);
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <cmath>
+#include "telemetry_sample.h"
+
+// One point of a device's hardware history, NaN where a value was missing
+struct HardwarePoint {
+    int64_t timestamp_ms = 0;
+    double cpu_usage = std::nan("");
+    double memory_usage = std::nan("");
+    double disk_usage = std::nan("");
+};
+
+// Where the ingest path writes metrics. Writes are asynchronous: a sample
+// counts as stored once its completion reports true.
+class MetricsStorage {
+public:
+    // Called once the sample is durably stored (true), or when the storage
+    // is closed before it could be written (false)
+    using Completion = std::function<void(bool committed)>;
+
+    virtual ~MetricsStorage() = default;
+
+    // Queue a sample; blocks while the storage is saturated.
+    // Returns false (without calling done) once the storage is closed.
+    virtual bool insertHardwareInfo(const HardwareSample& sample, Completion done = nullptr) = 0;
+    virtual bool insertSoftwareInfo(const SoftwareSample& sample, Completion done = nullptr) = 0;
+
+    // Stop accepting samples, make a last write attempt and fail what is left
+    virtual void close() = 0;
+
+    // Samples accepted but not stored yet
+    virtual size_t bufferedRows() const = 0;
+
+    // Hardware points of a device with from_ms <= timestamp < to_ms, oldest first.
+    // The only history read; readers go through it rather than the tables so
+    // that archived days are included. Nothing in the server reads history yet.
+    virtual bool queryHardware(const std::string& device_id, int64_t from_ms, int64_t to_ms,
+                               std::vector<HardwarePoint>& points) = 0;
+};
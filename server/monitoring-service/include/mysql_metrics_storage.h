@@ -1,22 +1,210 @@
 #pragma once
-#include <nlohmann/json.hpp>
+#include "metrics_storage.h"
+#include "metrics_rollup.h"
+#include "metrics_spool.h"
+#include "recent_sample_filter.h"
+#include "attribute_dictionary.h"
+#include "columnar_archive.h"
+#include "../../common/include/mysql_connection_pool.h"
 #include <string>
+#include <memory>
+#include <vector>
+#include <unordered_map>
 #include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <thread>
+#include <chrono>
+#include <cstdint>
 
-class MySQLMetricsStorage {
+// Write-behind buffer limits
+struct WriteBufferOptions {
+    // Flush once this many rows are buffered...
+    size_t batch_rows = 1000;
+    // ...or once the oldest buffered row is this old
+    std::chrono::milliseconds flush_interval{100};
+    // Inserts block while this many rows are waiting to be committed
+    size_t max_buffered_rows = 20000;
+    // Rows per multi-row INSERT statement within a flush transaction
+    size_t rows_per_statement = 500;
+    // Recent sample times remembered per device to drop duplicates early
+    size_t dedup_window = 32;
+};
+
+// Newest stored samples of a device; a timestamp of 0 means none was stored
+struct DeviceLatestState {
+    HardwareSample hardware;
+    SoftwareSample software;
+};
+
+// Stores metrics through a write-behind buffer: rows are collected and
+// committed by a flusher thread as multi-row INSERTs in one transaction.
+// Minute/hour/day rollups and device_latest_state are upserted in the same
+// transaction, once per device and batch.
+// With a spool, batches MySQL cannot take are kept on local disk and count
+// as stored; later batches queue up behind them until the flusher has
+// replayed the spool in order.
+// With an archive, range queries also read the days already moved out of
+// MySQL into it.
+class MySQLMetricsStorage : public MetricsStorage {
 public:
-    MySQLMetricsStorage();
+    explicit MySQLMetricsStorage(std::shared_ptr<MySQLConnectionPool> pool,
+                                 const WriteBufferOptions& options = WriteBufferOptions(),
+                                 std::shared_ptr<MetricsSpool> spool = nullptr,
+                                 std::shared_ptr<ColumnarArchive> archive = nullptr);
     ~MySQLMetricsStorage();
 
-    bool insertHardwareInfo(const nlohmann::json& metrics);
-    bool insertSoftwareInfo(const nlohmann::json& metrics);
-    bool reconnect();
-    bool initDatabase();
+    // Buffer a row; blocks while the buffer is full. Completions run on the
+    // flusher thread once the transaction holding the row is committed.
+    // A sample seen recently for the same device and time completes at once.
+    bool insertHardwareInfo(const HardwareSample& sample, Completion done = nullptr) override;
+    bool insertSoftwareInfo(const SoftwareSample& sample, Completion done = nullptr) override;
+
+    void close() override;
+
+    // Rows buffered or being written
+    size_t bufferedRows() const override;
+
+    // Range scan on the (device_id, ts) index, merged with the archived days
+    bool queryHardware(const std::string& device_id, int64_t from_ms, int64_t to_ms,
+                       std::vector<HardwarePoint>& points) override;
+
+    // One row per device from device_latest_state, ordered by device id
+    bool queryLatestStates(std::vector<DeviceLatestState>& states);
+
     bool executeQuery(const std::string& query);
 
 private:
-    void* conn_; // Use MYSQL* if you include <mysql/mysql.h>
-    std::mutex mysql_mutex_;
-    std::string escapeSqlString(const std::string& input);
+    struct HardwareRow {
+        HardwareSample sample;
+        Completion done;
+    };
+
+    struct SoftwareRow {
+        SoftwareSample sample;
+        Completion done;
+
+        // Dictionary values of the application list and service map
+        std::string applications{};
+        std::string services{};
+    };
+
+    // Rows taken by the flusher for one transaction
+    struct Batch {
+        std::vector<HardwareRow> hardware;
+        std::vector<SoftwareRow> software;
+        bool rollups_counted = false;   // hardware is in rollups_ or was stored before
+
+        size_t size() const { return hardware.size() + software.size(); }
+    };
+
+    struct InsertStatement;
+    static const InsertStatement HARDWARE_INSERT;
+    static const InsertStatement SOFTWARE_INSERT;
+    static const InsertStatement SERVICES_INSERT;
+    static const InsertStatement APPLICATIONS_INSERT;
+    static const InsertStatement LATEST_HARDWARE_UPSERT;
+    static const InsertStatement LATEST_SOFTWARE_UPSERT;
+    static const InsertStatement ROLLUP_INSERTS[MetricsRollup::LevelCount];
+
+    std::shared_ptr<MySQLConnectionPool> pool_;
+
+    // Start of this run, tells spooled batches already in rollups_ apart
+    int64_t started_ms_;
+
+    // Multi-row insert and lookup SQL by statement id, only used by the flusher
+    std::unordered_map<std::string, std::string> insert_sql_;
+
+    // Open rollup buckets, only used by the flusher
+    MetricsRollup rollups_;
+
+    // Attribute string ids, only used by the flusher
+    AttributeDictionary attributes_;
+
+    WriteBufferOptions options_;
+
+    // Spool and replay state, only used by the flusher
+    std::shared_ptr<MetricsSpool> spool_;
+    std::chrono::steady_clock::time_point replay_retry_at_;
+    std::chrono::milliseconds replay_backoff_;
+    bool replay_front_counted_;  // hardware of the spool's front batch is in rollups_
+    std::chrono::steady_clock::time_point replay_reported_;
+
+    // Cold tier of expired partitions, read by range queries
+    std::shared_ptr<ColumnarArchive> archive_;
+
+    // Write-behind buffer
+    mutable std::mutex buffer_mutex_;
+    std::condition_variable buffer_ready_;
+    std::condition_variable buffer_space_;
+    Batch buffer_;
+    size_t buffered_rows_;  // buffer_ plus the batch being written
+    std::chrono::steady_clock::time_point oldest_row_;
+    bool closed_;
+
+    // Duplicate samples dropped before buffering, guarded by buffer_mutex_
+    RecentSampleFilter recent_hardware_;
+    RecentSampleFilter recent_software_;
+    uint64_t duplicates_dropped_;
+
+    std::thread flusher_;
+
+    // Returns false when the storage was closed while waiting for space
+    bool waitForSpace(std::unique_lock<std::mutex>& lock);
+
+    void flushLoop();
+
+    // Commit a batch, spooling it or retrying while the database is unreachable
+    void writeBatch(Batch& batch, bool last_attempt);
+
+    // Commit a batch whose rows are in rollups_; false if the database is unreachable
+    bool commit(Batch& batch);
+
+    // Intern the attribute strings of a batch ahead of its transaction
+    bool resolveAttributes(MySQLConnection& conn, Batch& batch);
+
+    // Add the hardware samples of a batch to the rollups once, skipping
+    // those hardware_info already holds: their upsert replaces a stored
+    // sample that is in the stored rollups already
+    bool countRollups(MySQLConnection& conn, Batch& batch);
+
+    // Id of an attribute string, or its text when it has none (interning failed)
+    void bindAttribute(StatementParams& params, const std::string& value, bool present);
+
+    // Try the whole batch in one transaction; connection_lost tells a
+    // transient failure from rows the server rejected
+    bool commitBatch(MySQLConnection& conn, const Batch& batch, bool& connection_lost);
+
+    // Fall back to one row at a time so a single bad row does not block the
+    // rest; false if the connection was lost on the way
+    bool commitRowByRow(MySQLConnection& conn, Batch& batch);
+
+    // Append a batch to the spool; rollups_run as in SpoolBatch
+    bool spoolBatch(const Batch& batch, int64_t rollups_run);
+
+    // Replay spooled batches for up to one flush interval
+    void replaySpool();
+
+    // Rows per INSERT for the remaining rows of a batch
+    size_t statementRows(size_t remaining) const;
+    const std::string& insertSql(const InsertStatement& statement, size_t rows, const std::string& id);
+
+    // Insert count rows as multi-row statements; bind adds the values of row i
+    bool insertRows(MySQLConnection& conn, const InsertStatement& statement, size_t count,
+                    const std::function<void(StatementParams&, size_t)>& bind);
+
+    bool insertHardware(MySQLConnection& conn, const HardwareRow* rows, size_t count);
+
+    // Sample rows followed by their service and application rows
+    bool insertSoftware(MySQLConnection& conn, const SoftwareRow* rows, size_t count);
+
+    // Upsert the newest sample of every device into device_latest_state
+    bool writeLatestState(MySQLConnection& conn, const std::vector<const HardwareSample*>& hardware,
+                          const std::vector<const SoftwareSample*>& software);
+
+    // Merge buckets with rows stored by an earlier run, then upsert the changed ones
+    bool loadRollups(MySQLConnection& conn);
+    bool writeRollups(MySQLConnection& conn);
 
+    static void complete(Batch& batch, bool committed);
 };
@@ -5,61 +5,138 @@
 #include <functional>
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <vector>
+#include <chrono>
 #include <amqp.h>
 #include <amqp_tcp_socket.h>
-#include <nlohmann/json.hpp>
+#include "telemetry_sample.h"
+#include "ingest_worker_pool.h"
+#include "ack_tracker.h"
+#include "metrics_storage.h"
 
+// Tuning knobs for the consumer
+struct ConsumerOptions {
+    // Number of ingest workers (0 = one per hardware thread)
+    size_t worker_count = 0;
+    // Maximum number of queued messages per worker before the consumer blocks
+    size_t worker_queue_capacity = 1024;
+    // Unacknowledged deliveries the broker may push per channel (basic.qos).
+    // Messages stay unacked until their rows are committed, so this must be
+    // well above the storage batch size for batches to fill up.
+    uint16_t prefetch_count = 2048;
+    // Cumulative ack once this many deliveries are complete...
+    size_t ack_batch_size = 64;
+    // ...or once this much time has passed since the previous ack
+    std::chrono::milliseconds ack_flush_interval{200};
+    // Reconnect delay, doubled after every failed attempt up to the maximum
+    std::chrono::milliseconds reconnect_initial_backoff{500};
+    std::chrono::milliseconds reconnect_max_backoff{30000};
+};
+
+// Consumes every metrics queue over a single AMQP connection, one channel
+// per queue, from one epoll-driven event loop thread.
 class RabbitMQConsumer {
 public:
     // Callback for when hardware metrics are received
-    using HardwareMetricsCallback = std::function<void(const std::string& device_id,
-                                                     const nlohmann::json& metrics)>;
-    
+    using HardwareMetricsCallback = std::function<void(const HardwareSample& sample)>;
+
     // Callback for when software metrics are received
-    using SoftwareMetricsCallback = std::function<void(const std::string& device_id,
-                                                     const nlohmann::json& metrics)>;
-    
+    using SoftwareMetricsCallback = std::function<void(const SoftwareSample& sample)>;
+
     RabbitMQConsumer(const std::string& hostname, int port,
                     const std::string& username, const std::string& password,
-                    const std::string& hw_queue_name, const std::string& sw_queue_name);
+                    const std::string& hw_queue_name, const std::string& sw_queue_name,
+                    std::shared_ptr<MetricsStorage> storage,
+                    const ConsumerOptions& options = ConsumerOptions());
     ~RabbitMQConsumer();
-    
-    // Initialize connection and start consumers
+
+    // Start the event loop; it connects (and reconnects) in the background
     bool start(HardwareMetricsCallback hw_callback, SoftwareMetricsCallback sw_callback);
-    
-    // Stop consumers and close connection
+
+    // Stop consuming, let in-flight messages finish and close the connection
     void stop();
-    
+
+    // Ingest counters: queue depth and processed messages per worker
+    std::vector<IngestWorkerPool::WorkerStats> getIngestStats() const;
+
 private:
+    // A consumed queue and the channel it is bound to
+    struct Subscription {
+        using Handler = void (RabbitMQConsumer::*)(Subscription&, const amqp_envelope_t&);
+
+        Subscription(const std::string& queue, amqp_channel_t ch, Handler h, size_t ack_batch,
+                     std::chrono::milliseconds ack_interval)
+            : queue_name(queue), channel(ch), handler(h), acks(ack_batch, ack_interval) {}
+
+        std::string queue_name;
+        amqp_channel_t channel;
+        Handler handler;
+        AckTracker acks;
+        std::vector<uint64_t> rejected;     // reused by flushAcks
+    };
+
     std::string hostname_;
     int port_;
     std::string username_;
     std::string password_;
-    std::string hw_queue_name_;
-    std::string sw_queue_name_;
-    
+    ConsumerOptions options_;
+
+    // Committed rows are what allows a delivery to be acked
+    std::shared_ptr<MetricsStorage> storage_;
+
     // Callback functions
     HardwareMetricsCallback hw_callback_;
     SoftwareMetricsCallback sw_callback_;
-    
+
     // Connection state
-    amqp_connection_state_t hw_conn_;
-    amqp_connection_state_t sw_conn_;
-    int hw_channel_;
-    int sw_channel_;
-    
-    // Consumer threads
-    std::thread hw_thread_;
-    std::thread sw_thread_;
+    amqp_connection_state_t conn_;
+    std::vector<std::unique_ptr<Subscription>> subscriptions_;
+
+    // Workers running analysis and storage off the event loop
+    IngestWorkerPool worker_pool_;
+
+    // Event loop
+    std::thread loop_thread_;
+    int epoll_fd_;
+    int wakeup_fd_;
     std::atomic<bool> running_;
-    
+
     // Helper for checking AMQP responses
     bool checkAMQPResponse(amqp_rpc_reply_t x, const char* context);
-    
-    // Thread functions
-    void consumeHardwareMetrics();
-    void consumeSoftwareMetrics();
-    
-    // Connect to RabbitMQ
-    amqp_connection_state_t connectToRabbitMQ(const std::string& queue_name, int& channel);
-};
\ No newline at end of file
+
+    // Event loop thread: connect, consume until error or stop, back off, repeat
+    void run();
+
+    // Wait on the socket and the wakeup fd; returns false if the connection broke
+    bool eventLoop();
+
+    // Consume every complete frame currently readable without blocking
+    bool readAvailable();
+
+    // Handle a frame that is not a delivery (channel/connection close, ...)
+    bool handleUnexpectedFrame();
+
+    // Route a delivery to the handler of its channel
+    void dispatch(const amqp_envelope_t& envelope);
+
+    // Per-queue message handlers
+    void handleHardwareMessage(Subscription& sub, const amqp_envelope_t& envelope);
+    void handleSoftwareMessage(Subscription& sub, const amqp_envelope_t& envelope);
+
+    // Requeue rejected deliveries and cumulatively acknowledge what the
+    // workers have finished, if due; returns false if the connection broke
+    bool flushAcks(Subscription& sub, bool force = false);
+
+    // Wait for in-flight messages to finish so their acks can still be sent;
+    // returns false if the connection broke
+    bool drainInFlight();
+
+    // Interrupt epoll_wait / backoff sleep
+    void wakeLoop();
+    void waitForWakeup(std::chrono::milliseconds timeout);
+
+    // Open the connection and one channel per subscription
+    bool openConnection();
+    void closeConnection(bool graceful);
+};
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+// Exact filter of recently seen (device, sample time) keys, used to drop
+// redelivered and retried samples before they reach the database.
+// Per device it remembers the last `window` sample times; a duplicate older
+// than that is left to the unique key of the table. Not thread-safe.
+class RecentSampleFilter {
+public:
+    explicit RecentSampleFilter(size_t window = 32);
+
+    // True if the key was seen recently, otherwise it is remembered
+    bool seen(const std::string& device_id, int64_t timestamp_ms);
+
+    size_t deviceCount() const { return devices_.size(); }
+
+private:
+    struct Recent {
+        std::vector<int64_t> times;   // ring of the last sample times
+        size_t next = 0;
+    };
+
+    size_t window_;
+    std::unordered_map<std::string, Recent> devices_;
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "telemetry_sample.h"
+
+// Decoder for telemetry messages.
+// JSON is read in a single pass straight from the delivery body and fills a
+// typed sample without building a DOM; unknown fields are skipped, escaped
+// strings are the only ones that need a decode buffer. Protobuf payloads use
+// the HardwareMetrics / SoftwareMetrics messages of monitoring.proto.
+class TelemetryParser {
+public:
+    // Wire format of a message, taken from its AMQP content_type
+    enum class Format {
+        Json,
+        Protobuf
+    };
+
+    // "application/x-protobuf" selects protobuf; anything else (including no
+    // content type, as sent by older agents) is treated as JSON
+    static Format formatFromContentType(const char* content_type, size_t len);
+
+    // Decode a message of either format into a sample
+    static bool parseHardware(Format format, const char* data, size_t len, HardwareSample& sample, std::string& error);
+    static bool parseSoftware(Format format, const char* data, size_t len, SoftwareSample& sample, std::string& error);
+
+    // Decode a hardware metrics message, error is set when false is returned
+    static bool parseHardware(const char* data, size_t len, HardwareSample& sample, std::string& error);
+
+    // Decode a software metrics message, error is set when false is returned
+    static bool parseSoftware(const char* data, size_t len, SoftwareSample& sample, std::string& error);
+
+    // Decode a protobuf HardwareMetrics / SoftwareMetrics message
+    static bool parseHardwareProtobuf(const char* data, size_t len, HardwareSample& sample, std::string& error);
+    static bool parseSoftwareProtobuf(const char* data, size_t len, SoftwareSample& sample, std::string& error);
+
+    // Milliseconds since the epoch of a "YYYY-MM-DD_HH-MM-SS" date followed by
+    // its UTC offset ("Z", "+02:00"), -1 if malformed or without an offset
+    static int64_t parseReadableDate(std::string_view text);
+};
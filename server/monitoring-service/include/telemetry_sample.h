@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <utility>
+#include <cmath>
+
+// Typed hardware metrics of one message, decoded once on the ingest path
+// and shared by analysis and storage.
+struct HardwareSample {
+    std::string device_id;
+    std::string readable_date;
+
+    // Sample time in ms since the epoch (UTC), from readable_date when it
+    // carries a UTC offset, else the time of receipt
+    int64_t timestamp_ms = 0;
+
+    // Percentages, NaN when the field was missing or invalid
+    double cpu_usage = std::nan("");
+    double memory_usage = std::nan("");
+    double disk_usage = std::nan("");
+
+    std::string usb_state;
+    bool has_usb_state = false;
+
+    int gpio_state = 0;
+    bool has_gpio_state = false;
+
+    std::string kernel_version;
+    std::string hardware_model;
+    std::string firmware_version;
+};
+
+// Typed software metrics of one message
+struct SoftwareSample {
+    struct Application {
+        std::string name;
+        std::string version;
+    };
+
+    std::string device_id;
+    std::string readable_date;
+    int64_t timestamp_ms = 0;
+    std::string ip_address;
+    std::string uptime;
+    std::string network_status;
+    std::string os_version;
+
+    std::vector<Application> applications;
+
+    // service name -> status, in message order
+    std::vector<std::pair<std::string, std::string>> services;
+    bool has_services = false;
+};
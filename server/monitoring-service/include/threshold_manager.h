@@ -0,0 +1,82 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <filesystem>
+#include "threshold_table.h"
+#include "../../common/include/mysql_connection_pool.h"
+
+// Loads threshold rules and keeps the compiled ThresholdTable current.
+// Rules come from a JSON file, e.g.
+//   { "cpu": { "warning": 80, "critical": 95 }, ...,
+//     "hardware_types": { "rpi4": { "cpu": { "warning": 85 } } },
+//     "locations": { "plant-2": { ... } },
+//     "devices": { "gateway-17": { ... } } }
+// and, with a connection pool, from the threshold_rules table, whose rows
+// override file rules of the same scope; the table is created if missing,
+// whatever the metrics backend. Locations and hardware types of devices
+// come from the devices table, keyed by devices.id.
+// A background thread recompiles when the file or either table changes and
+// swaps the new table in atomically; readers load the current table without
+// locking and never wait for a reload.
+class ThresholdManager {
+public:
+    explicit ThresholdManager(DeviceStateStore& store);
+    ~ThresholdManager();
+
+    ThresholdManager(const ThresholdManager&) = delete;
+    ThresholdManager& operator=(const ThresholdManager&) = delete;
+
+    // Load the rules and publish them. On failure the current table, the
+    // built-in defaults at first, stays in use.
+    bool load(const std::string& path, std::shared_ptr<MySQLConnectionPool> pool = nullptr);
+
+    // Reload if the file or the tables changed since the last load, or
+    // recompile if devices were added to the store since
+    bool reloadIfChanged();
+
+    // Check for changes every interval; on_change runs on that thread after
+    // a new table was published
+    void start(std::chrono::seconds interval, std::function<void()> on_change = nullptr);
+    void stop();
+
+    std::shared_ptr<const ThresholdTable> current() const { return std::atomic_load(&table_); }
+
+    // Create the threshold_rules table if it does not exist
+    static bool createTable(MySQLConnection& conn);
+
+private:
+    DeviceStateStore& store_;
+    std::shared_ptr<const ThresholdTable> table_;   // std::atomic_load / std::atomic_store
+
+    // Sources and what they looked like at the last load
+    std::mutex load_mutex_;
+    std::string path_;
+    std::shared_ptr<MySQLConnectionPool> pool_;
+    std::filesystem::file_time_type file_time_;
+    std::string db_fingerprint_;
+
+    // What the current table was compiled from
+    std::vector<ThresholdRule> rules_;
+    std::vector<DeviceProfile> profiles_;
+    size_t compiled_devices_ = 0;
+    uint64_t version_;
+
+    std::thread reload_thread_;
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    bool running_;
+
+    bool loadLocked();
+    void compileLocked();
+
+    bool readFile(std::vector<ThresholdRule>& rules);
+    bool readDatabase(std::vector<ThresholdRule>& rules, std::vector<DeviceProfile>& devices);
+    bool readFingerprint(std::string& fingerprint);
+};
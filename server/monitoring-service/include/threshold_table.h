@@ -0,0 +1,79 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cmath>
+#include <cstdint>
+#include "device_state_store.h"
+#include "fleet_sweep.h"
+
+// One threshold setting; NaN fields leave the value of the broader scope
+struct ThresholdRule {
+    // Narrower scopes win: device > location > hardware_type > global
+    enum class Scope : uint8_t {
+        Global = 0,
+        HardwareType = 1,
+        Location = 2,
+        Device = 3
+    };
+
+    Scope scope = Scope::Global;
+    std::string value;  // hardware type, location or device id; empty for Global
+    DeviceStateStore::Metric metric = DeviceStateStore::Metric::Cpu;
+    float warning = NAN;
+    float critical = NAN;
+};
+
+// Where a device sits in the scope hierarchy
+struct DeviceProfile {
+    std::string device_id;
+    std::string location;
+    std::string hardware_type;
+};
+
+// Thresholds compiled from rules: every device's resolved values are
+// precomputed into float columns indexed by its DeviceStateStore index, so
+// a check is an array read and the fleet sweep compares whole columns.
+// Devices without a rule of their own use the global values. Immutable once
+// compiled; new versions replace it as a whole.
+class ThresholdTable {
+public:
+    using Metric = DeviceStateStore::Metric;
+    static constexpr size_t METRIC_COUNT = DeviceStateStore::METRIC_COUNT;
+
+    // Used for metrics without a global rule
+    static const MetricThreshold DEFAULTS[METRIC_COUNT];
+
+    // Resolve the rules for the devices. Only devices the store already
+    // knows get a row; profiles do not add devices to it.
+    static std::shared_ptr<const ThresholdTable> compile(const std::vector<ThresholdRule>& rules,
+                                                         const std::vector<DeviceProfile>& devices,
+                                                         const DeviceStateStore& store, uint64_t version);
+
+    // Thresholds of a device index; NO_DEVICE and unknown devices get the global ones
+    MetricThreshold get(uint32_t index, Metric metric) const;
+    const MetricThreshold& global(Metric metric) const { return global_[static_cast<size_t>(metric)]; }
+
+    // Threshold columns of the devices of the store chunk starting at first
+    const float* warning(Metric metric, uint32_t first) const;
+    const float* critical(Metric metric, uint32_t first) const;
+
+    uint64_t version() const { return version_; }
+
+    // Devices with a resolved row, all others use the global thresholds
+    size_t devices() const { return devices_; }
+
+private:
+    uint64_t version_ = 0;
+    size_t devices_ = 0;
+    MetricThreshold global_[METRIC_COUNT];
+
+    // By device index, padded to whole chunks
+    std::vector<float> warning_[METRIC_COUNT];
+    std::vector<float> critical_[METRIC_COUNT];
+
+    // One chunk of the global values, for chunks past devices_
+    std::vector<float> global_warning_[METRIC_COUNT];
+    std::vector<float> global_critical_[METRIC_COUNT];
+};
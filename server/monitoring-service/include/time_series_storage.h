@@ -0,0 +1,98 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include "metrics_storage.h"
+#include "tsdb_segment.h"
+
+struct TimeSeriesOptions {
+    // Directory holding one segment file per block
+    std::string directory = "tsdb";
+    // Time covered by one segment file
+    std::chrono::hours block_duration{24};
+    // Blocks ending longer ago than this are deleted
+    int retention_days = 365;
+    // Buffered samples are written and synced at least this often
+    std::chrono::milliseconds flush_interval{200};
+    // Inserts block while this many samples are waiting to be written
+    size_t max_buffered_rows = 20000;
+    // A closed block is compacted once it ended this long ago
+    std::chrono::minutes compaction_delay{10};
+};
+
+// Embedded time-series backend for single-box installations.
+// Hardware samples are written as compressed cpu/memory/disk series into
+// one append-only segment per time block; range queries only decode the
+// chunks of the requested device that overlap the range. Software samples
+// carry no numeric series and are not kept by this backend.
+class TimeSeriesStorage : public MetricsStorage {
+public:
+    explicit TimeSeriesStorage(const TimeSeriesOptions& options = TimeSeriesOptions());
+    ~TimeSeriesStorage();
+
+    // Create the directory and load existing blocks, then start writing
+    bool open();
+
+    bool insertHardwareInfo(const HardwareSample& sample, Completion done = nullptr) override;
+    bool insertSoftwareInfo(const SoftwareSample& sample, Completion done = nullptr) override;
+
+    void close() override;
+
+    size_t bufferedRows() const override;
+
+    bool queryHardware(const std::string& device_id, int64_t from_ms, int64_t to_ms,
+                       std::vector<HardwarePoint>& points) override;
+
+    // Bytes used by all blocks
+    size_t diskUsage() const;
+
+private:
+    struct Pending {
+        std::string device_id;
+        SeriesPoint point;
+        Completion done;
+    };
+
+    TimeSeriesOptions options_;
+    int64_t block_ms_;
+
+    // Write buffer
+    mutable std::mutex buffer_mutex_;
+    std::condition_variable buffer_ready_;
+    std::condition_variable buffer_space_;
+    std::vector<Pending> buffer_;
+    size_t buffered_rows_;  // buffer_ plus the batch being written
+    bool opened_;
+    bool closed_;
+    std::thread flusher_;
+
+    // Blocks by start time; segments are replaced on compaction while
+    // readers keep the previous one alive
+    mutable std::shared_mutex segments_mutex_;
+    std::map<int64_t, std::shared_ptr<TsdbSegment>> segments_;
+
+    std::atomic<bool> software_notice_;
+    std::chrono::steady_clock::time_point last_maintenance_;
+
+    void flushLoop();
+
+    // Append and sync a batch, retrying while the disk refuses it
+    void writeBatch(std::vector<Pending>& batch, bool last_attempt);
+    bool appendBatch(const std::vector<Pending>& batch);
+
+    // Compact closed blocks and delete expired ones
+    void maintain();
+
+    std::shared_ptr<TsdbSegment> segment(int64_t block_start, std::string& error);
+    std::string segmentPath(int64_t block_start) const;
+
+    static void complete(std::vector<Pending>& batch, bool committed);
+};
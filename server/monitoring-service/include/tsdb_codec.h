@@ -0,0 +1,90 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Compression of hardware series as in Facebook's Gorilla paper:
+// timestamps as delta-of-delta, values as the XOR with the previous value.
+// Regular one-minute samples cost about a bit per timestamp, unchanged
+// values one bit each.
+
+class BitWriter {
+public:
+    void writeBit(bool bit);
+    void writeBits(uint64_t value, int count);
+
+    const std::string& bytes() const { return bytes_; }
+    size_t bitCount() const { return bits_; }
+
+private:
+    std::string bytes_;
+    size_t bits_ = 0;
+};
+
+class BitReader {
+public:
+    BitReader(const char* data, size_t len) : data_(data), len_(len) {}
+
+    // Reads past the end fail instead of returning garbage
+    bool readBit(bool& bit);
+    bool readBits(int count, uint64_t& value);
+
+private:
+    const char* data_;
+    size_t len_;
+    size_t bit_ = 0;
+};
+
+// One point of a series: timestamp and the cpu, memory and disk values
+struct SeriesPoint {
+    int64_t timestamp_ms;
+    double values[3];
+};
+
+class SeriesEncoder {
+public:
+    void append(const SeriesPoint& point);
+
+    size_t count() const { return count_; }
+    const std::string& bytes() const { return writer_.bytes(); }
+
+private:
+    BitWriter writer_;
+    size_t count_ = 0;
+
+    int64_t prev_ts_ = 0;
+    int64_t prev_delta_ = 0;
+
+    uint64_t prev_values_[3] = {0, 0, 0};
+    int prev_leading_[3] = {-1, -1, -1};
+    int prev_trailing_[3] = {0, 0, 0};
+
+    void appendValue(size_t column, double value);
+};
+
+class SeriesDecoder {
+public:
+    SeriesDecoder(const char* data, size_t len, size_t count) : reader_(data, len), remaining_(count) {}
+
+    // False at the end of the series or on corrupt data
+    bool next(SeriesPoint& point);
+
+private:
+    BitReader reader_;
+    size_t remaining_;
+    bool first_ = true;
+
+    int64_t prev_ts_ = 0;
+    int64_t prev_delta_ = 0;
+
+    uint64_t prev_values_[3] = {0, 0, 0};
+    int prev_leading_[3] = {0, 0, 0};
+    int prev_meaningful_[3] = {0, 0, 0};
+
+    bool readValue(size_t column, double& value);
+};
+
+// CRC-32 (IEEE) used to detect torn or corrupt chunks
+uint32_t crc32(const void* data, size_t len, uint32_t crc = 0);
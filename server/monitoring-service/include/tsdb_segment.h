@@ -0,0 +1,87 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <shared_mutex>
+#include <cstdint>
+#include "tsdb_codec.h"
+
+// One time block of the embedded time-series store: an append-only,
+// memory-mapped file of compressed chunks, each holding sorted points of
+// one device. A per-device index of the chunks is rebuilt from the chunk
+// headers when the file is opened; a torn chunk at the end is ignored and
+// overwritten by the next append.
+//
+// Appends, sync() and compaction come from a single writer thread; reads
+// may run concurrently from any thread.
+class TsdbSegment {
+public:
+    // Open the file of block [start_ms, end_ms), creating it if needed
+    static std::shared_ptr<TsdbSegment> open(const std::string& path, int64_t start_ms, int64_t end_ms,
+                                             std::string& error);
+
+    // Open an existing file, taking the block range from its header
+    static std::shared_ptr<TsdbSegment> load(const std::string& path, std::string& error);
+
+    ~TsdbSegment();
+
+    TsdbSegment(const TsdbSegment&) = delete;
+    TsdbSegment& operator=(const TsdbSegment&) = delete;
+
+    const std::string& path() const { return path_; }
+    int64_t startMs() const { return start_ms_; }
+    int64_t endMs() const { return end_ms_; }
+
+    // Bytes in use
+    size_t size() const;
+
+    // Append a chunk of one device's points, sorted by time.
+    // Not durable before sync().
+    bool append(const std::string& device_id, const std::vector<SeriesPoint>& points, std::string& error);
+
+    // Write appended chunks to disk
+    bool sync(std::string& error);
+
+    // Points of a device with from_ms <= timestamp < to_ms, in chunk order
+    void read(const std::string& device_id, int64_t from_ms, int64_t to_ms, std::vector<SeriesPoint>& points) const;
+
+    // Some device has more than one chunk, compaction would merge them
+    bool fragmented() const;
+
+    // Rewrite the block with one chunk per device (duplicates removed) and
+    // atomically replace the file; returns the segment of the new file
+    std::shared_ptr<TsdbSegment> compact(std::string& error) const;
+
+private:
+    struct ChunkRef {
+        size_t offset;      // of the chunk header
+        uint32_t count;
+        int64_t min_ts;
+        int64_t max_ts;
+    };
+
+    std::string path_;
+    int64_t start_ms_;
+    int64_t end_ms_;
+
+    char* data_;
+    size_t capacity_;
+    size_t used_;
+    size_t synced_;
+
+    std::unordered_map<std::string, std::vector<ChunkRef>> index_;
+    mutable std::shared_mutex mutex_;
+
+    TsdbSegment(const std::string& path, int64_t start_ms, int64_t end_ms);
+
+    // Map the file at the given size, growing it if needed
+    bool map(size_t capacity, std::string& error);
+    void unmap();
+
+    // Rebuild the index from the chunk headers
+    void scan();
+
+    void decodeChunk(const ChunkRef& chunk, std::vector<SeriesPoint>& points) const;
+};
@@ -0,0 +1,102 @@
+#include "ack_tracker.h"
+#include <algorithm>
+
+AckTracker::AckTracker(size_t batch_size, std::chrono::milliseconds flush_interval)
+    : batch_size_(batch_size > 0 ? batch_size : 1), flush_interval_(flush_interval),
+      next_expected_(1), last_acked_(0),
+      last_flush_(std::chrono::steady_clock::now()), generation_(0), in_flight_(0) {
+}
+
+uint64_t AckTracker::dispatched() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    in_flight_++;
+    return generation_;
+}
+
+bool AckTracker::complete(uint64_t delivery_tag, uint64_t generation) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (generation != generation_) {
+        return false;
+    }
+    return completeLocked(delivery_tag);
+}
+
+bool AckTracker::reject(uint64_t delivery_tag, uint64_t generation) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (generation != generation_) {
+        return false;
+    }
+    rejected_.insert(delivery_tag);
+    completeLocked(delivery_tag);
+    return true;
+}
+
+void AckTracker::takeRejected(std::vector<uint64_t>& tags) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tags.assign(rejected_.begin(), rejected_.end());
+    rejected_.clear();
+}
+
+bool AckTracker::completeLocked(uint64_t delivery_tag) {
+
+    if (delivery_tag == next_expected_) {
+        next_expected_++;
+        // Pull in any later tags that were already finished
+        while (!out_of_order_.empty() && *out_of_order_.begin() == next_expected_) {
+            out_of_order_.erase(out_of_order_.begin());
+            next_expected_++;
+        }
+    } else if (delivery_tag > next_expected_) {
+        out_of_order_.insert(delivery_tag);
+    }
+
+    in_flight_--;
+    return next_expected_ - 1 - last_acked_ >= batch_size_;
+}
+
+uint64_t AckTracker::takeAckable(bool force) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // An ack past a rejected tag not sent yet would acknowledge it
+    uint64_t ackable = next_expected_ - 1;
+    if (!rejected_.empty()) {
+        ackable = std::min(ackable, *rejected_.begin() - 1);
+    }
+    if (ackable <= last_acked_) {
+        return 0;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    bool due = force ||
+               ackable - last_acked_ >= batch_size_ ||
+               now - last_flush_ >= flush_interval_;
+    if (!due) {
+        return 0;
+    }
+
+    last_acked_ = ackable;
+    last_flush_ = now;
+    return ackable;
+}
+
+size_t AckTracker::inFlight() const {
+    return in_flight_;
+}
+
+bool AckTracker::hasPending() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return in_flight_ > 0 || next_expected_ - 1 > last_acked_ || !rejected_.empty();
+}
+
+void AckTracker::reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    next_expected_ = 1;
+    last_acked_ = 0;
+    out_of_order_.clear();
+    rejected_.clear();
+    last_flush_ = std::chrono::steady_clock::now();
+    generation_++;
+    in_flight_ = 0;
+}
@@ -0,0 +1,803 @@
+#include "alert_rules.h"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+
+namespace fs = std::filesystem;
+using Source = AlertRuleSet::Source;
+
+namespace {
+
+enum Op : uint8_t {
+    NUMBER,
+    TEXT,
+    FIELD,
+    SERVICE,
+    LT,
+    LE,
+    GT,
+    GE,
+    EQ,
+    NE,
+    TEXT_EQ,
+    TEXT_NE,
+    CONTAINS,
+    STARTS_WITH,
+    ADD,
+    SUBTRACT,
+    NEGATE,
+    NOT,
+    JUMP_IF_FALSE,   // keeps the operand when jumping, pops it otherwise
+    JUMP_IF_TRUE
+};
+
+// Fields a sample may lack; a rule only runs when all it reads are there
+enum Presence : uint32_t {
+    HAS_CPU = 1 << 0,
+    HAS_MEMORY = 1 << 1,
+    HAS_DISK = 1 << 2,
+    HAS_USB = 1 << 3,
+    HAS_GPIO = 1 << 4,
+    HAS_NETWORK = 1 << 5,
+    HAS_SERVICES = 1 << 6,
+    HAS_CPU_SCORE = 1 << 7,
+    HAS_MEMORY_SCORE = 1 << 8,
+    HAS_DISK_SCORE = 1 << 9
+};
+
+enum Field : uint8_t {
+    CPU,
+    MEMORY,
+    DISK,
+    GPIO,
+    GPIO_PREVIOUS,
+    USB,
+    KERNEL_VERSION,
+    HARDWARE_MODEL,
+    FIRMWARE_VERSION,
+    CPU_WARNING,
+    CPU_CRITICAL,
+    MEMORY_WARNING,
+    MEMORY_CRITICAL,
+    DISK_WARNING,
+    DISK_CRITICAL,
+    CPU_ZSCORE,
+    CPU_BASELINE,
+    MEMORY_ZSCORE,
+    MEMORY_BASELINE,
+    DISK_ZSCORE,
+    DISK_BASELINE,
+    NETWORK,
+    IP_ADDRESS,
+    OS_VERSION,
+    UPTIME
+};
+
+enum class Type {
+    Invalid,
+    Number,
+    Text,
+    Bool
+};
+
+struct FieldInfo {
+    const char* name;
+    Field field;
+    Type type;
+    Source source;
+    uint32_t presence;
+};
+
+const FieldInfo FIELDS[] = {
+    {"cpu", CPU, Type::Number, Source::Hardware, HAS_CPU},
+    {"memory", MEMORY, Type::Number, Source::Hardware, HAS_MEMORY},
+    {"disk", DISK, Type::Number, Source::Hardware, HAS_DISK},
+    {"gpio", GPIO, Type::Number, Source::Hardware, HAS_GPIO},
+    {"gpio_previous", GPIO_PREVIOUS, Type::Number, Source::Hardware, HAS_GPIO},
+    {"usb", USB, Type::Text, Source::Hardware, HAS_USB},
+    {"kernel_version", KERNEL_VERSION, Type::Text, Source::Hardware, 0},
+    {"hardware_model", HARDWARE_MODEL, Type::Text, Source::Hardware, 0},
+    {"firmware_version", FIRMWARE_VERSION, Type::Text, Source::Hardware, 0},
+    {"cpu_warning", CPU_WARNING, Type::Number, Source::Hardware, 0},
+    {"cpu_critical", CPU_CRITICAL, Type::Number, Source::Hardware, 0},
+    {"memory_warning", MEMORY_WARNING, Type::Number, Source::Hardware, 0},
+    {"memory_critical", MEMORY_CRITICAL, Type::Number, Source::Hardware, 0},
+    {"disk_warning", DISK_WARNING, Type::Number, Source::Hardware, 0},
+    {"disk_critical", DISK_CRITICAL, Type::Number, Source::Hardware, 0},
+    {"cpu_zscore", CPU_ZSCORE, Type::Number, Source::Hardware, HAS_CPU_SCORE},
+    {"cpu_baseline", CPU_BASELINE, Type::Number, Source::Hardware, HAS_CPU_SCORE},
+    {"memory_zscore", MEMORY_ZSCORE, Type::Number, Source::Hardware, HAS_MEMORY_SCORE},
+    {"memory_baseline", MEMORY_BASELINE, Type::Number, Source::Hardware, HAS_MEMORY_SCORE},
+    {"disk_zscore", DISK_ZSCORE, Type::Number, Source::Hardware, HAS_DISK_SCORE},
+    {"disk_baseline", DISK_BASELINE, Type::Number, Source::Hardware, HAS_DISK_SCORE},
+    {"network", NETWORK, Type::Text, Source::Software, HAS_NETWORK},
+    {"ip_address", IP_ADDRESS, Type::Text, Source::Software, 0},
+    {"os_version", OS_VERSION, Type::Text, Source::Software, 0},
+    {"uptime", UPTIME, Type::Text, Source::Software, 0},
+};
+
+constexpr size_t MAX_STACK = 16;
+constexpr size_t MAX_NESTING = 64;
+constexpr uint32_t MAX_SAMPLES = 65535;
+
+struct Value {
+    double number;
+    const std::string* text;
+};
+
+const std::string EMPTY;
+
+Value fieldValue(uint8_t field, const AlertRuleSet::Sample& sample) {
+    const HardwareSample* hw = sample.hardware;
+    const SoftwareSample* sw = sample.software;
+    switch (field) {
+        case CPU:              return {hw->cpu_usage, nullptr};
+        case MEMORY:           return {hw->memory_usage, nullptr};
+        case DISK:             return {hw->disk_usage, nullptr};
+        case GPIO:             return {static_cast<double>(hw->gpio_state), nullptr};
+        case GPIO_PREVIOUS:    return {static_cast<double>(sample.previous_gpio_state), nullptr};
+        case USB:              return {0, &hw->usb_state};
+        case KERNEL_VERSION:   return {0, &hw->kernel_version};
+        case HARDWARE_MODEL:   return {0, &hw->hardware_model};
+        case FIRMWARE_VERSION: return {0, &hw->firmware_version};
+        case CPU_WARNING:      return {sample.thresholds[0].warning, nullptr};
+        case CPU_CRITICAL:     return {sample.thresholds[0].critical, nullptr};
+        case MEMORY_WARNING:   return {sample.thresholds[1].warning, nullptr};
+        case MEMORY_CRITICAL:  return {sample.thresholds[1].critical, nullptr};
+        case DISK_WARNING:     return {sample.thresholds[2].warning, nullptr};
+        case DISK_CRITICAL:    return {sample.thresholds[2].critical, nullptr};
+        case CPU_ZSCORE:       return {sample.scores[0].zscore, nullptr};
+        case CPU_BASELINE:     return {sample.scores[0].baseline, nullptr};
+        case MEMORY_ZSCORE:    return {sample.scores[1].zscore, nullptr};
+        case MEMORY_BASELINE:  return {sample.scores[1].baseline, nullptr};
+        case DISK_ZSCORE:      return {sample.scores[2].zscore, nullptr};
+        case DISK_BASELINE:    return {sample.scores[2].baseline, nullptr};
+        case NETWORK:          return {0, &sw->network_status};
+        case IP_ADDRESS:       return {0, &sw->ip_address};
+        case OS_VERSION:       return {0, &sw->os_version};
+        case UPTIME:           return {0, &sw->uptime};
+    }
+    return {0, &EMPTY};
+}
+
+uint32_t presentFields(const AlertRuleSet::Sample& sample) {
+    uint32_t present = 0;
+    if (sample.source == Source::Hardware) {
+        const HardwareSample& hw = *sample.hardware;
+        if (!std::isnan(hw.cpu_usage)) present |= HAS_CPU;
+        if (!std::isnan(hw.memory_usage)) present |= HAS_MEMORY;
+        if (!std::isnan(hw.disk_usage)) present |= HAS_DISK;
+        if (hw.has_usb_state) present |= HAS_USB;
+        if (hw.has_gpio_state) present |= HAS_GPIO;
+        if (sample.scores) {
+            if (!std::isnan(sample.scores[0].zscore)) present |= HAS_CPU_SCORE;
+            if (!std::isnan(sample.scores[1].zscore)) present |= HAS_MEMORY_SCORE;
+            if (!std::isnan(sample.scores[2].zscore)) present |= HAS_DISK_SCORE;
+        }
+    } else {
+        const SoftwareSample& sw = *sample.software;
+        if (!sw.network_status.empty()) present |= HAS_NETWORK;
+        if (sw.has_services) present |= HAS_SERVICES;
+    }
+    return present;
+}
+
+bool parseSeverity(const std::string& name, AlertRuleSet::Severity& severity) {
+    if (name == "info") severity = AlertRuleSet::Severity::Info;
+    else if (name == "warning") severity = AlertRuleSet::Severity::Warning;
+    else if (name == "critical") severity = AlertRuleSet::Severity::Critical;
+    else return false;
+    return true;
+}
+
+std::string jsonText(const nlohmann::json& object, const char* field) {
+    auto it = object.find(field);
+    return it != object.end() && it->is_string() ? it->get<std::string>() : std::string();
+}
+
+} // namespace
+
+// Recursive descent over one "when" expression, emitting a stack program
+class RuleCompiler {
+public:
+    RuleCompiler(AlertRuleSet& set, AlertRuleSet::Rule& rule)
+        : set_(set), rule_(rule), has_source_(false), depth_(0), max_depth_(0), nesting_(0) {}
+
+    bool compile(std::string& error) {
+        if (!tokenize()) {
+            error = error_;
+            return false;
+        }
+
+        Type type = parseOr();
+        if (type != Type::Invalid && type != Type::Bool) {
+            fail("the condition is not true/false");
+        }
+        if (error_.empty() && acceptWord("for")) {
+            parseSamples();
+        }
+        if (error_.empty() && peek().kind != Token::End) {
+            fail("unexpected '" + peek().text + "'");
+        }
+        if (error_.empty() && !has_source_) {
+            fail("the condition reads no sample field");
+        }
+        if (error_.empty() && max_depth_ > MAX_STACK) {
+            fail("the condition is nested too deeply");
+        }
+        error = error_;
+        return error_.empty();
+    }
+
+private:
+    using Instruction = AlertRuleSet::Instruction;
+
+    struct Token {
+        enum Kind { End, Word, Number, String, Symbol } kind;
+        std::string text;
+        double number;
+    };
+
+    AlertRuleSet& set_;
+    AlertRuleSet::Rule& rule_;
+    std::vector<Token> tokens_;
+    size_t next_ = 0;
+    bool has_source_;
+    size_t depth_;
+    size_t max_depth_;
+    size_t nesting_;
+    std::string error_;
+
+    Type fail(const std::string& message) {
+        if (error_.empty()) {
+            error_ = message;
+        }
+        return Type::Invalid;
+    }
+
+    bool tokenize() {
+        const std::string& s = rule_.expression;
+        size_t i = 0;
+        while (i < s.size()) {
+            char c = s[i];
+            if (std::isspace(static_cast<unsigned char>(c))) {
+                i++;
+            } else if (std::isalpha(static_cast<unsigned char>(c)) || c == '_') {
+                size_t start = i;
+                while (i < s.size() && (std::isalnum(static_cast<unsigned char>(s[i])) || s[i] == '_')) i++;
+                tokens_.push_back({Token::Word, s.substr(start, i - start), 0});
+            } else if (std::isdigit(static_cast<unsigned char>(c)) || c == '.') {
+                char* end = nullptr;
+                double number = std::strtod(s.c_str() + i, &end);
+                if (end == s.c_str() + i) {
+                    fail("invalid number");
+                    return false;
+                }
+                size_t start = i;
+                i = end - s.c_str();
+                tokens_.push_back({Token::Number, s.substr(start, i - start), number});
+            } else if (c == '"') {
+                std::string text;
+                for (i++; i < s.size() && s[i] != '"'; i++) {
+                    if (s[i] == '\\' && i + 1 < s.size()) i++;
+                    text += s[i];
+                }
+                if (i >= s.size()) {
+                    fail("unterminated string");
+                    return false;
+                }
+                i++;
+                tokens_.push_back({Token::String, text, 0});
+            } else {
+                static const char* const SYMBOLS[] = {"==", "!=", "<=", ">=", "&&", "||",
+                                                      "<", ">", "!", "(", ")", "[", "]", ",", "+", "-"};
+                const char* match = nullptr;
+                for (const char* symbol : SYMBOLS) {
+                    if (s.compare(i, std::char_traits<char>::length(symbol), symbol) == 0) {
+                        match = symbol;
+                        break;
+                    }
+                }
+                if (!match) {
+                    fail(std::string("unexpected character '") + c + "'");
+                    return false;
+                }
+                tokens_.push_back({Token::Symbol, match, 0});
+                i += tokens_.back().text.size();
+            }
+        }
+        tokens_.push_back({Token::End, "end of condition", 0});
+        return true;
+    }
+
+    const Token& peek() const { return tokens_[next_]; }
+
+    bool accept(Token::Kind kind, const char* text) {
+        if (peek().kind == kind && peek().text == text) {
+            next_++;
+            return true;
+        }
+        return false;
+    }
+    bool acceptWord(const char* word) { return accept(Token::Word, word); }
+    bool acceptSymbol(const char* symbol) { return accept(Token::Symbol, symbol); }
+
+    bool expectSymbol(const char* symbol) {
+        if (acceptSymbol(symbol)) {
+            return true;
+        }
+        fail(std::string("expected '") + symbol + "' before '" + peek().text + "'");
+        return false;
+    }
+
+    void emit(uint8_t op, int stack_change, uint8_t field = 0, uint32_t operand = 0, double number = 0) {
+        rule_.program.push_back({op, field, operand, number});
+        depth_ += stack_change;
+        max_depth_ = std::max(max_depth_, depth_);
+    }
+
+    uint32_t text(const std::string& value) {
+        set_.texts_.push_back(value);
+        return static_cast<uint32_t>(set_.texts_.size() - 1);
+    }
+
+    bool useSource(Source source) {
+        if (has_source_ && rule_.source != source) {
+            fail("the condition mixes hardware and software fields");
+            return false;
+        }
+        has_source_ = true;
+        rule_.source = source;
+        return true;
+    }
+
+    // or_expr := and_expr { ("or" | "||") and_expr }
+    Type parseOr() {
+        if (++nesting_ > MAX_NESTING) {
+            return fail("the condition is nested too deeply");
+        }
+        Type type = parseAnd();
+        while (type != Type::Invalid && (acceptWord("or") || acceptSymbol("||"))) {
+            type = parseJunction(JUMP_IF_TRUE, type, &RuleCompiler::parseAnd);
+        }
+        nesting_--;
+        return type;
+    }
+
+    // and_expr := not_expr { ("and" | "&&") not_expr }
+    Type parseAnd() {
+        Type type = parseNot();
+        while (type != Type::Invalid && (acceptWord("and") || acceptSymbol("&&"))) {
+            type = parseJunction(JUMP_IF_FALSE, type, &RuleCompiler::parseNot);
+        }
+        return type;
+    }
+
+    // The right side only runs when the left one does not decide
+    Type parseJunction(uint8_t jump, Type left, Type (RuleCompiler::*parseRight)()) {
+        if (left != Type::Bool) {
+            return fail("'and' / 'or' need true/false operands");
+        }
+        size_t at = rule_.program.size();
+        emit(jump, -1);
+        Type right = (this->*parseRight)();
+        if (right != Type::Bool) {
+            return fail("'and' / 'or' need true/false operands");
+        }
+        rule_.program[at].operand = static_cast<uint32_t>(rule_.program.size());
+        return Type::Bool;
+    }
+
+    // not_expr := ("not" | "!") not_expr | comparison
+    Type parseNot() {
+        if (acceptWord("not") || acceptSymbol("!")) {
+            if (++nesting_ > MAX_NESTING) {
+                return fail("the condition is nested too deeply");
+            }
+            Type type = parseNot();
+            nesting_--;
+            if (type != Type::Bool) {
+                return fail("'not' needs a true/false operand");
+            }
+            emit(NOT, 0);
+            return Type::Bool;
+        }
+        return parseComparison();
+    }
+
+    // comparison := sum [ ("==" | "!=" | "<" | "<=" | ">" | ">=") sum ]
+    Type parseComparison() {
+        Type left = parseSum();
+        if (left == Type::Invalid || peek().kind != Token::Symbol) {
+            return left;
+        }
+
+        static const std::pair<const char*, Op> COMPARISONS[] = {
+            {"==", EQ}, {"!=", NE}, {"<", LT}, {"<=", LE}, {">", GT}, {">=", GE},
+        };
+        for (const auto& [symbol, op] : COMPARISONS) {
+            if (!acceptSymbol(symbol)) {
+                continue;
+            }
+            Type right = parseSum();
+            if (right == Type::Invalid) {
+                return right;
+            }
+            if (left != right || left == Type::Bool) {
+                return fail(std::string("cannot compare with '") + symbol + "' here");
+            }
+            if (left == Type::Text) {
+                if (op != EQ && op != NE) {
+                    return fail(std::string("text cannot be compared with '") + symbol + "'");
+                }
+                emit(op == EQ ? TEXT_EQ : TEXT_NE, -1);
+            } else {
+                emit(op, -1);
+            }
+            return Type::Bool;
+        }
+        return left;
+    }
+
+    // sum := operand { ("+" | "-") operand }
+    Type parseSum() {
+        Type type = parseOperand();
+        while (type != Type::Invalid && peek().kind == Token::Symbol &&
+               (peek().text == "+" || peek().text == "-")) {
+            bool add = peek().text == "+";
+            next_++;
+            if (type != Type::Number || parseOperand() != Type::Number) {
+                return fail("'+' / '-' need numbers");
+            }
+            emit(add ? ADD : SUBTRACT, -1);
+        }
+        return type;
+    }
+
+    // operand := ["-"] number | "text" | field | service["name"] | function(args) | ( or_expr )
+    Type parseOperand() {
+        if (acceptSymbol("-")) {
+            if (++nesting_ > MAX_NESTING) {
+                return fail("the condition is nested too deeply");
+            }
+            Type type = parseOperand();
+            nesting_--;
+            if (type != Type::Number) {
+                return fail("'-' needs a number");
+            }
+            emit(NEGATE, 0);
+            return Type::Number;
+        }
+
+        Token token = peek();
+        next_++;
+
+        if (token.kind == Token::Number) {
+            emit(NUMBER, 1, 0, 0, token.number);
+            return Type::Number;
+        }
+        if (token.kind == Token::String) {
+            emit(TEXT, 1, 0, text(token.text));
+            return Type::Text;
+        }
+        if (token.kind == Token::Symbol && token.text == "(") {
+            Type type = parseOr();
+            return type != Type::Invalid && expectSymbol(")") ? type : Type::Invalid;
+        }
+        if (token.kind != Token::Word) {
+            return fail("unexpected '" + token.text + "'");
+        }
+
+        if ((token.text == "contains" || token.text == "starts_with") && acceptSymbol("(")) {
+            Type haystack = parseOr();
+            if (haystack == Type::Invalid || !expectSymbol(",")) return Type::Invalid;
+            Type needle = parseOr();
+            if (needle == Type::Invalid || !expectSymbol(")")) return Type::Invalid;
+            if (haystack != Type::Text || needle != Type::Text) {
+                return fail(token.text + "() needs text operands");
+            }
+            emit(token.text == "contains" ? CONTAINS : STARTS_WITH, -1);
+            return Type::Bool;
+        }
+
+        if (token.text == "service") {
+            if (!expectSymbol("[")) return Type::Invalid;
+            if (peek().kind != Token::String) {
+                return fail("service[] needs a quoted service name");
+            }
+            std::string name = peek().text;
+            next_++;
+            if (!expectSymbol("]") || !useSource(Source::Software)) return Type::Invalid;
+            rule_.required |= HAS_SERVICES;
+            emit(SERVICE, 1, 0, text(name));
+            return Type::Text;
+        }
+
+        for (const auto& info : FIELDS) {
+            if (token.text == info.name) {
+                if (!useSource(info.source)) return Type::Invalid;
+                rule_.required |= info.presence;
+                emit(FIELD, 1, info.field);
+                return info.type;
+            }
+        }
+        return fail("unknown field '" + token.text + "'");
+    }
+
+    // "for" N ("sample" | "samples")
+    void parseSamples() {
+        const Token& count = peek();
+        if (count.kind != Token::Number || count.number < 1 || count.number > MAX_SAMPLES ||
+            count.number != static_cast<uint32_t>(count.number)) {
+            fail("'for' needs a whole number of samples");
+            return;
+        }
+        rule_.samples = static_cast<uint32_t>(count.number);
+        next_++;
+        if (!acceptWord("samples") && !acceptWord("sample")) {
+            fail("expected 'samples' after 'for " + count.text + "'");
+        }
+    }
+};
+
+std::shared_ptr<const AlertRuleSet> AlertRuleSet::compile(const nlohmann::json& config, uint64_t version,
+                                                          std::string& error) {
+    auto set = std::make_shared<AlertRuleSet>();
+    set->version_ = version;
+
+    auto rules = config.find("rules");
+    if (!config.is_object() || rules == config.end() || !rules->is_array()) {
+        error = "expected {\"rules\": [...]}";
+        return nullptr;
+    }
+
+    for (const auto& object : *rules) {
+        std::string where = "rule " + std::to_string(set->rules_.size() + 1);
+        if (!object.is_object()) {
+            error = where + ": not an object";
+            return nullptr;
+        }
+
+        Rule rule;
+        rule.type = jsonText(object, "type");
+        rule.expression = jsonText(object, "when");
+        rule.description = jsonText(object, "description");
+        rule.recommendation = jsonText(object, "recommendation");
+        rule.command = jsonText(object, "command");
+        if (!rule.type.empty()) {
+            where += " (" + rule.type + ")";
+        }
+        if (rule.type.empty() || rule.expression.empty()) {
+            error = where + ": \"type\" and \"when\" are required";
+            return nullptr;
+        }
+        std::string severity = jsonText(object, "severity");
+        if (!severity.empty() && !parseSeverity(severity, rule.severity)) {
+            error = where + ": unknown severity '" + severity + "'";
+            return nullptr;
+        }
+
+        RuleCompiler compiler(*set, rule);
+        std::string message;
+        if (!compiler.compile(message)) {
+            error = where + ": " + message + " in '" + rule.expression + "'";
+            return nullptr;
+        }
+        if (rule.samples > 1) {
+            rule.counter = static_cast<uint32_t>(set->counters_++);
+        }
+        rule.key = rule.type + '\n' + rule.description;
+        set->rules_.push_back(std::move(rule));
+    }
+    return set;
+}
+
+void AlertRuleSet::evaluate(const Sample& sample, uint16_t* counters, std::vector<const Rule*>& fired,
+                            std::vector<const Rule*>* cleared) const {
+    uint32_t present = presentFields(sample);
+    for (const auto& rule : rules_) {
+        if (rule.source != sample.source || (rule.required & present) != rule.required) {
+            continue;
+        }
+        bool condition = holds(rule, sample);
+
+        if (rule.samples > 1) {
+            if (!counters) {
+                continue;
+            }
+            uint16_t& count = counters[rule.counter];
+            if (!condition) {
+                count = 0;
+            } else if (count < rule.samples) {
+                count++;
+            }
+            condition = count >= rule.samples;
+        }
+
+        if (condition) {
+            fired.push_back(&rule);
+        } else if (cleared) {
+            cleared->push_back(&rule);
+        }
+    }
+}
+
+bool AlertRuleSet::holds(const Rule& rule, const Sample& sample) const {
+    Value stack[MAX_STACK];
+    size_t top = 0;
+
+    const Instruction* program = rule.program.data();
+    size_t size = rule.program.size();
+    for (size_t pc = 0; pc < size; pc++) {
+        const Instruction& in = program[pc];
+        switch (in.op) {
+            case NUMBER:
+                stack[top++] = {in.number, nullptr};
+                break;
+            case TEXT:
+                stack[top++] = {0, &texts_[in.operand]};
+                break;
+            case FIELD:
+                stack[top++] = fieldValue(in.field, sample);
+                break;
+            case SERVICE: {
+                const std::string& name = texts_[in.operand];
+                const std::string* status = &EMPTY;
+                for (const auto& service : sample.software->services) {
+                    if (service.first == name) {
+                        status = &service.second;
+                        break;
+                    }
+                }
+                stack[top++] = {0, status};
+                break;
+            }
+            case LT: top--; stack[top - 1] = {stack[top - 1].number < stack[top].number ? 1.0 : 0.0, nullptr}; break;
+            case LE: top--; stack[top - 1] = {stack[top - 1].number <= stack[top].number ? 1.0 : 0.0, nullptr}; break;
+            case GT: top--; stack[top - 1] = {stack[top - 1].number > stack[top].number ? 1.0 : 0.0, nullptr}; break;
+            case GE: top--; stack[top - 1] = {stack[top - 1].number >= stack[top].number ? 1.0 : 0.0, nullptr}; break;
+            case EQ: top--; stack[top - 1] = {stack[top - 1].number == stack[top].number ? 1.0 : 0.0, nullptr}; break;
+            case NE: top--; stack[top - 1] = {stack[top - 1].number != stack[top].number ? 1.0 : 0.0, nullptr}; break;
+            case TEXT_EQ:
+                top--;
+                stack[top - 1] = {*stack[top - 1].text == *stack[top].text ? 1.0 : 0.0, nullptr};
+                break;
+            case TEXT_NE:
+                top--;
+                stack[top - 1] = {*stack[top - 1].text != *stack[top].text ? 1.0 : 0.0, nullptr};
+                break;
+            case CONTAINS:
+                top--;
+                stack[top - 1] = {stack[top - 1].text->find(*stack[top].text) != std::string::npos ? 1.0 : 0.0,
+                                  nullptr};
+                break;
+            case STARTS_WITH:
+                top--;
+                stack[top - 1] = {stack[top - 1].text->compare(0, stack[top].text->size(), *stack[top].text) == 0
+                                      ? 1.0 : 0.0,
+                                  nullptr};
+                break;
+            case ADD: top--; stack[top - 1].number += stack[top].number; break;
+            case SUBTRACT: top--; stack[top - 1].number -= stack[top].number; break;
+            case NEGATE: stack[top - 1].number = -stack[top - 1].number; break;
+            case NOT:
+                stack[top - 1].number = stack[top - 1].number != 0 ? 0.0 : 1.0;
+                break;
+            case JUMP_IF_FALSE:
+                if (stack[top - 1].number == 0) pc = in.operand - 1;
+                else top--;
+                break;
+            case JUMP_IF_TRUE:
+                if (stack[top - 1].number != 0) pc = in.operand - 1;
+                else top--;
+                break;
+        }
+    }
+    return top == 1 && stack[0].number != 0;
+}
+
+AlertRuleEngine::AlertRuleEngine()
+    : rules_(std::make_shared<AlertRuleSet>()), version_(0), running_(false) {
+}
+
+AlertRuleEngine::~AlertRuleEngine() {
+    stop();
+}
+
+bool AlertRuleEngine::load(const std::string& path) {
+    std::lock_guard<std::mutex> lock(load_mutex_);
+    path_ = path;
+    return loadLocked();
+}
+
+bool AlertRuleEngine::reloadIfChanged() {
+    std::lock_guard<std::mutex> lock(load_mutex_);
+    if (path_.empty()) {
+        return false;
+    }
+    std::error_code ec;
+    auto time = fs::last_write_time(path_, ec);
+    return !ec && time != file_time_ && loadLocked();
+}
+
+bool AlertRuleEngine::loadLocked() {
+    std::error_code ec;
+    auto file_time = fs::last_write_time(path_, ec);
+
+    std::ifstream in(path_);
+    if (!in) {
+        std::cerr << "Cannot open alert rules file " << path_ << std::endl;
+        return false;
+    }
+    auto config = nlohmann::json::parse(in, nullptr, false);
+    if (config.is_discarded()) {
+        std::cerr << "Invalid alert rules file " << path_ << std::endl;
+        file_time_ = file_time;
+        return false;
+    }
+
+    std::string error;
+    auto rules = AlertRuleSet::compile(config, ++version_, error);
+    file_time_ = file_time;
+    if (!rules) {
+        std::cerr << "Invalid alert rules file " << path_ << ": " << error << std::endl;
+        return false;
+    }
+
+    std::atomic_store(&rules_, rules);
+    std::cout << "Alert rules version " << rules->version() << ": " << rules->size() << " rule(s)" << std::endl;
+    return true;
+}
+
+std::shared_ptr<const AlertRuleSet> AlertRuleEngine::evaluate(uint32_t device, const AlertRuleSet::Sample& sample,
+                                                              std::vector<const AlertRuleSet::Rule*>& fired,
+                                                              std::vector<const AlertRuleSet::Rule*>* cleared) {
+    auto rules = current();
+    if (rules->counterCount() == 0 || device == DeviceStateStore::NO_DEVICE) {
+        rules->evaluate(sample, nullptr, fired, cleared);
+        return rules;
+    }
+
+    // Counters start over with every new rule set
+    CounterShard& shard = counter_shards_[device % COUNTER_SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    Counters& counters = shard.devices[device];
+    if (counters.version != rules->version() || counters.counts.size() != rules->counterCount()) {
+        counters.version = rules->version();
+        counters.counts.assign(rules->counterCount(), 0);
+    }
+    rules->evaluate(sample, counters.counts.data(), fired, cleared);
+    return rules;
+}
+
+void AlertRuleEngine::start(std::chrono::seconds interval) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_) return;
+    running_ = true;
+
+    reload_thread_ = std::thread([this, interval]() {
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                if (wakeup_.wait_for(lock, interval, [this]() { return !running_; })) {
+                    return;
+                }
+            }
+            reloadIfChanged();
+        }
+    });
+}
+
+void AlertRuleEngine::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) return;
+        running_ = false;
+    }
+    wakeup_.notify_all();
+    if (reload_thread_.joinable()) {
+        reload_thread_.join();
+    }
+}
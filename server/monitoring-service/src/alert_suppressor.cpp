@@ -0,0 +1,116 @@
+#include "alert_suppressor.h"
+#include <algorithm>
+
+bool AlertSuppressor::TokenBucket::take(uint32_t burst, std::chrono::seconds refill, int64_t now_ms) {
+    int64_t refill_ms = std::chrono::duration_cast<std::chrono::milliseconds>(refill).count();
+    if (refill_ms > 0 && now_ms > updated_ms) {
+        tokens = std::min<float>(burst, tokens + static_cast<float>(now_ms - updated_ms) / refill_ms);
+    }
+    updated_ms = now_ms;
+    if (tokens < 1) {
+        return false;
+    }
+    tokens -= 1;
+    return true;
+}
+
+AlertSuppressor::AlertSuppressor(const AlertPolicy& policy) : policy_(policy) {
+}
+
+AlertSuppressor::Device AlertSuppressor::device(uint32_t index, int64_t now_ms) {
+    if (index == DeviceStateStore::NO_DEVICE) {
+        return Device(policy_, std::unique_lock<std::mutex>(), nullptr, now_ms);
+    }
+
+    Shard& shard = shards_[index % SHARDS];
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    auto [it, inserted] = shard.devices.try_emplace(index);
+    if (inserted) {
+        it->second.alerts = {static_cast<float>(policy_.alert_burst), now_ms};
+        it->second.commands = {static_cast<float>(policy_.command_burst), now_ms};
+    }
+    return Device(policy_, std::move(lock), &it->second, now_ms);
+}
+
+AlertSuppressor::AlertState* AlertSuppressor::Device::find(const std::string& key) const {
+    for (auto& state : state_->alerts_by_key) {
+        if (state.key == key) {
+            return &state;
+        }
+    }
+    return nullptr;
+}
+
+AlertSuppressor::Level AlertSuppressor::Device::metricLevel(const std::string& key, float value,
+                                                            const MetricThreshold& threshold) const {
+    const AlertState* state = state_ ? find(key) : nullptr;
+    Level current = state ? state->level : CLEAR;
+
+    if (value >= threshold.critical || (current >= CRITICAL && value > threshold.critical - policy_.hysteresis)) {
+        return CRITICAL;
+    }
+    if (value >= threshold.warning || (current >= WARNING && value > threshold.warning - policy_.hysteresis)) {
+        return WARNING;
+    }
+    return CLEAR;
+}
+
+AlertSuppressor::Decision AlertSuppressor::Device::observe(const std::string& key, Level level, bool has_command) {
+    Decision decision;
+    if (!state_) {
+        decision.send = level != CLEAR;
+        decision.with_command = has_command;
+        return decision;
+    }
+
+    AlertState* state = find(key);
+    if (!state) {
+        if (level == CLEAR) {
+            return decision;
+        }
+        state_->alerts_by_key.push_back(AlertState{key});
+        state = &state_->alerts_by_key.back();
+    }
+
+    int64_t cooldown_ms = std::chrono::duration_cast<std::chrono::milliseconds>(policy_.cooldown).count();
+    int64_t reminder_ms = std::chrono::duration_cast<std::chrono::milliseconds>(policy_.reminder).count();
+    int64_t since_sent = now_ms_ - state->sent_ms;
+
+    if (level == CLEAR) {
+        // Ends only after clear_samples clear samples in a row
+        if (state->level != CLEAR && ++state->clear_samples >= policy_.clear_samples) {
+            state->level = CLEAR;
+            state->pending = false;
+        }
+        return decision;
+    }
+    state->clear_samples = 0;
+
+    bool due;
+    if (state->level == CLEAR) {
+        // Coming back soon after the last alert is only news if it is worse
+        due = !state->sent || since_sent >= cooldown_ms || level > state->sent_level;
+    } else if (level != state->level) {
+        due = true;
+    } else {
+        due = state->pending || since_sent >= reminder_ms;
+    }
+    state->level = level;
+    if (!due) {
+        return decision;
+    }
+
+    // Out of tokens: sent with a later sample
+    if (!state_->alerts.take(policy_.alert_burst, policy_.alert_refill, now_ms_)) {
+        state->pending = true;
+        return decision;
+    }
+    decision.send = true;
+    decision.with_command = has_command && state_->commands.take(policy_.command_burst, policy_.command_refill, now_ms_);
+
+    state->pending = false;
+    state->sent = true;
+    state->sent_level = level;
+    state->sent_ms = now_ms_;
+    return decision;
+}
@@ -0,0 +1,139 @@
+#include "attribute_dictionary.h"
+#include <nlohmann/json.hpp>
+#include <iostream>
+#include <algorithm>
+#include <unordered_set>
+#include <cstdlib>
+
+// Values per INSERT / SELECT; smaller statements use powers of two
+static const size_t MAX_VALUES_PER_STATEMENT = 64;
+
+static size_t chunkSize(size_t remaining) {
+    if (remaining >= MAX_VALUES_PER_STATEMENT) {
+        return MAX_VALUES_PER_STATEMENT;
+    }
+    size_t count = 1;
+    while (count * 2 <= remaining) {
+        count *= 2;
+    }
+    return count;
+}
+
+AttributeDictionary::AttributeDictionary(size_t max_cached) : max_cached_(std::max<size_t>(max_cached, 1)) {
+}
+
+uint32_t AttributeDictionary::id(const std::string& value) const {
+    auto it = ids_.find(value);
+    return it == ids_.end() ? 0 : it->second;
+}
+
+const std::string& AttributeDictionary::statementSql(const std::string& id, const char* head, const char* item,
+                                                     size_t items, const char* tail) {
+    std::string& sql = sql_[id];
+    if (sql.empty()) {
+        sql = head;
+        for (size_t i = 0; i < items; i++) {
+            if (i > 0) sql += ",";
+            sql += item;
+        }
+        sql += tail;
+    }
+    return sql;
+}
+
+bool AttributeDictionary::resolve(MySQLConnection& conn, const std::vector<const std::string*>& values) {
+    // Rarely reached, a fleet has few distinct attribute values
+    if (ids_.size() + values.size() > max_cached_) {
+        ids_.clear();
+    }
+
+    std::vector<const std::string*> missing;
+    std::unordered_set<std::string> seen;
+    for (const std::string* value : values) {
+        if (!value->empty() && ids_.find(*value) == ids_.end() && seen.insert(*value).second) {
+            missing.push_back(value);
+        }
+    }
+    if (missing.empty()) {
+        return true;
+    }
+
+    // Values are unique by hash; a value another server interned first is kept
+    for (size_t i = 0; i < missing.size();) {
+        size_t count = chunkSize(missing.size() - i);
+        std::string id = "attribute_dictionary.insert." + std::to_string(count);
+        const std::string& sql = statementSql(id, "INSERT IGNORE INTO attribute_dictionary (value) VALUES ", "(?)",
+                                              count, "");
+
+        StatementParams params(count);
+        for (size_t end = i + count; i < end; i++) {
+            params.add(*missing[i]);
+        }
+        if (!conn.statements().execute(id, sql.c_str(), params)) {
+            std::cerr << "Failed to intern attributes: " << conn.statements().lastError() << std::endl;
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < missing.size();) {
+        size_t count = chunkSize(missing.size() - i);
+        std::string id = "attribute_dictionary.select." + std::to_string(count);
+        const std::string& sql = statementSql(id, "SELECT id, value FROM attribute_dictionary WHERE value_hash IN (",
+                                              "UNHEX(SHA2(?, 256))", count, ")");
+
+        StatementParams params(count);
+        for (size_t end = i + count; i < end; i++) {
+            params.add(*missing[i]);
+        }
+        std::vector<PreparedStatementCache::Row> rows;
+        if (!conn.statements().query(id, sql.c_str(), params, rows)) {
+            std::cerr << "Failed to look up attributes: " << conn.statements().lastError() << std::endl;
+            return false;
+        }
+        for (const auto& row : rows) {
+            ids_[row[1]] = static_cast<uint32_t>(std::strtoul(row[0].c_str(), nullptr, 10));
+        }
+    }
+
+    for (const std::string* value : missing) {
+        if (ids_.find(*value) == ids_.end()) {
+            std::cerr << "Attribute value was not interned: " << value->substr(0, 64) << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string AttributeDictionary::applicationsValue(const SoftwareSample& sample) {
+    if (sample.applications.empty()) {
+        return std::string();
+    }
+
+    std::vector<const SoftwareSample::Application*> sorted;
+    sorted.reserve(sample.applications.size());
+    for (const auto& app : sample.applications) {
+        sorted.push_back(&app);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const auto* a, const auto* b) {
+        return a->name != b->name ? a->name < b->name : a->version < b->version;
+    });
+
+    nlohmann::json list = nlohmann::json::array();
+    for (const auto* app : sorted) {
+        list.push_back({app->name, app->version});
+    }
+    return list.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+}
+
+std::string AttributeDictionary::servicesValue(const SoftwareSample& sample) {
+    if (!sample.has_services) {
+        return std::string();
+    }
+
+    // Object keys come out sorted; a repeated service keeps its last status
+    nlohmann::json services = nlohmann::json::object();
+    for (const auto& service : sample.services) {
+        services[service.first] = service.second;
+    }
+    return services.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+}
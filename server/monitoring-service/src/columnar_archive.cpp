@@ -0,0 +1,774 @@
+#include "columnar_archive.h"
+#include "tsdb_codec.h"
+#include <iostream>
+#include <algorithm>
+#include <filesystem>
+#include <unordered_map>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// On-disk structures are written in host byte order
+const char FILE_MAGIC[8] = {'I', 'O', 'T', 'C', 'O', 'L', '0', '1'};
+const uint32_t GROUP_MAGIC = 0x50524752;  // "RGRP"
+const char* const FILE_SUFFIX = ".col";
+const char* const TEMP_SUFFIX = ".col.tmp";
+
+struct FileHeader {
+    char magic[8];
+    uint32_t columns;
+    uint32_t schema_len;    // bytes of column descriptions following the header
+    uint32_t groups;
+    uint32_t reserved;
+    uint64_t rows;
+    int64_t min_ts;
+    int64_t max_ts;
+    uint32_t crc;           // of the fields above and the schema
+    uint32_t reserved2;
+};
+
+struct GroupHeader {
+    uint32_t magic;
+    uint32_t rows;
+    int64_t min_ts;
+    int64_t max_ts;
+    uint32_t payload_len;   // column blocks
+    uint32_t crc;           // of the device range and the payload
+    uint16_t first_device_len;
+    uint16_t last_device_len;
+    uint32_t reserved;
+};
+
+enum Codec : uint8_t {
+    CODEC_NONE = 0,
+    CODEC_ZSTD = 1
+};
+
+struct BlockHeader {
+    uint8_t codec;
+    uint8_t type;
+    uint16_t reserved;
+    uint32_t raw_len;
+    uint32_t stored_len;
+};
+
+static_assert(sizeof(FileHeader) == 56, "unexpected FileHeader layout");
+static_assert(sizeof(GroupHeader) == 40, "unexpected GroupHeader layout");
+static_assert(sizeof(BlockHeader) == 12, "unexpected BlockHeader layout");
+
+// Blocks larger than this are treated as corrupt
+const uint32_t MAX_BLOCK = 256u << 20;
+
+std::string systemError(const std::string& what, const std::string& path) {
+    return what + " " + path + ": " + std::strerror(errno);
+}
+
+bool writeAll(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = ::write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool readAll(int fd, size_t offset, char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = ::pread(fd, data, len, static_cast<off_t>(offset));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (n == 0) {
+            return false;
+        }
+        data += n;
+        offset += static_cast<size_t>(n);
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+void syncDirectory(const std::string& directory) {
+    int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd >= 0) {
+        fsync(fd);
+        ::close(fd);
+    }
+}
+
+template <typename T>
+void putRaw(std::string& out, T value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void putVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+uint64_t zigzag(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+int64_t unzigzag(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+class VarintReader {
+public:
+    VarintReader(const char* data, size_t len) : p_(data), end_(data + len), ok_(true) {}
+
+    uint64_t next() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (p_ >= end_) break;
+            uint8_t byte = static_cast<uint8_t>(*p_++);
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) return value;
+        }
+        ok_ = false;
+        return 0;
+    }
+
+    bool bytes(size_t len, std::string& out) {
+        if (static_cast<size_t>(end_ - p_) < len) {
+            ok_ = false;
+            return false;
+        }
+        out.assign(p_, len);
+        p_ += len;
+        return true;
+    }
+
+    bool ok() const { return ok_; }
+
+private:
+    const char* p_;
+    const char* end_;
+    bool ok_;
+};
+
+// NULL is 0, so values at or above zero move up by one
+int64_t nullableCode(const std::string& text, bool percent) {
+    if (text.empty()) return 0;
+    int64_t value = percent ? std::llround(std::strtod(text.c_str(), nullptr) * 100)
+                            : std::strtoll(text.c_str(), nullptr, 10);
+    return value >= 0 ? value + 1 : value;
+}
+
+double percentValue(int64_t code) {
+    if (code == 0) return std::nan("");
+    return static_cast<double>(code > 0 ? code - 1 : code) / 100.0;
+}
+
+void encodeText(const std::vector<ColumnarArchive::Row>& rows, size_t column, std::string& out) {
+    // Index 0 is NULL; dictionary entries in first-seen order from 1
+    std::unordered_map<std::string, uint32_t> index;
+    std::vector<const std::string*> dictionary;
+    std::vector<uint32_t> codes;
+    codes.reserve(rows.size());
+    for (const auto& row : rows) {
+        const std::string& value = row[column];
+        if (value.empty()) {
+            codes.push_back(0);
+            continue;
+        }
+        auto inserted = index.emplace(value, static_cast<uint32_t>(dictionary.size() + 1));
+        if (inserted.second) dictionary.push_back(&inserted.first->first);
+        codes.push_back(inserted.first->second);
+    }
+
+    putVarint(out, dictionary.size());
+    for (const auto* value : dictionary) {
+        putVarint(out, value->size());
+        out.append(*value);
+    }
+
+    // Sorted by device, so runs are long
+    for (size_t i = 0; i < codes.size();) {
+        size_t run = 1;
+        while (i + run < codes.size() && codes[i + run] == codes[i]) run++;
+        putVarint(out, codes[i]);
+        putVarint(out, run);
+        i += run;
+    }
+}
+
+void encodeTimestamps(const std::vector<ColumnarArchive::Row>& rows, size_t column, std::string& out) {
+    // Samples of a device come at a steady interval, the second difference is mostly 0
+    int64_t previous = 0;
+    int64_t previous_delta = 0;
+    for (size_t i = 0; i < rows.size(); i++) {
+        int64_t ts = std::strtoll(rows[i][column].c_str(), nullptr, 10);
+        int64_t delta = ts - previous;
+        putVarint(out, zigzag(i == 0 ? ts : delta - previous_delta));
+        previous = ts;
+        previous_delta = delta;
+    }
+}
+
+void encodePercents(const std::vector<ColumnarArchive::Row>& rows, size_t column, std::string& out) {
+    int64_t previous = 0;
+    for (const auto& row : rows) {
+        int64_t code = nullableCode(row[column], true);
+        putVarint(out, zigzag(code - previous));
+        previous = code;
+    }
+}
+
+void encodeIntegers(const std::vector<ColumnarArchive::Row>& rows, size_t column, std::string& out) {
+    for (size_t i = 0; i < rows.size();) {
+        int64_t code = nullableCode(rows[i][column], false);
+        size_t run = 1;
+        while (i + run < rows.size() && nullableCode(rows[i + run][column], false) == code) run++;
+        putVarint(out, zigzag(code));
+        putVarint(out, run);
+        i += run;
+    }
+}
+
+// Dictionary and codes of a text column
+bool decodeText(const std::string& raw, size_t rows, std::vector<std::string>& dictionary,
+                std::vector<uint32_t>& codes) {
+    VarintReader reader(raw.data(), raw.size());
+    uint64_t entries = reader.next();
+    if (!reader.ok() || entries > rows) return false;
+
+    dictionary.assign(1, std::string());
+    for (uint64_t i = 0; i < entries; i++) {
+        std::string value;
+        if (!reader.bytes(reader.next(), value)) return false;
+        dictionary.push_back(std::move(value));
+    }
+
+    codes.clear();
+    codes.reserve(rows);
+    while (codes.size() < rows) {
+        uint64_t code = reader.next();
+        uint64_t run = reader.next();
+        if (!reader.ok() || code > entries || run == 0 || run > rows - codes.size()) return false;
+        codes.insert(codes.end(), run, static_cast<uint32_t>(code));
+    }
+    return true;
+}
+
+bool decodeTimestamps(const std::string& raw, size_t rows, std::vector<int64_t>& values) {
+    VarintReader reader(raw.data(), raw.size());
+    values.resize(rows);
+    int64_t previous = 0;
+    int64_t previous_delta = 0;
+    for (size_t i = 0; i < rows; i++) {
+        int64_t value = unzigzag(reader.next());
+        int64_t delta = i == 0 ? value : previous_delta + value;
+        values[i] = i == 0 ? value : previous + delta;
+        previous_delta = values[i] - previous;
+        previous = values[i];
+    }
+    return reader.ok();
+}
+
+bool decodePercents(const std::string& raw, size_t rows, std::vector<double>& values) {
+    VarintReader reader(raw.data(), raw.size());
+    values.resize(rows);
+    int64_t code = 0;
+    for (size_t i = 0; i < rows; i++) {
+        code += unzigzag(reader.next());
+        values[i] = percentValue(code);
+    }
+    return reader.ok();
+}
+
+void appendBlock(ColumnarArchive::ColumnType type, const std::string& raw, int level, std::string& out) {
+    BlockHeader header{};
+    header.codec = CODEC_NONE;
+    header.type = static_cast<uint8_t>(type);
+    header.raw_len = static_cast<uint32_t>(raw.size());
+
+#ifdef HAVE_ZSTD
+    std::string compressed(ZSTD_compressBound(raw.size()), '\0');
+    size_t size = ZSTD_compress(&compressed[0], compressed.size(), raw.data(), raw.size(), level);
+    if (!ZSTD_isError(size) && size < raw.size()) {
+        header.codec = CODEC_ZSTD;
+        header.stored_len = static_cast<uint32_t>(size);
+        putRaw(out, header);
+        out.append(compressed.data(), size);
+        return;
+    }
+#else
+    (void)level;
+#endif
+
+    header.stored_len = header.raw_len;
+    putRaw(out, header);
+    out.append(raw);
+}
+
+// Walks the column blocks of a group payload
+class BlockReader {
+public:
+    explicit BlockReader(const std::string& payload) : payload_(payload), offset_(0) {}
+
+    // Header and position of the next block; false at the end or on a damaged payload
+    bool next(BlockHeader& header, size_t& data_offset) {
+        if (payload_.size() - offset_ < sizeof(BlockHeader)) return false;
+        std::memcpy(&header, payload_.data() + offset_, sizeof(header));
+        data_offset = offset_ + sizeof(header);
+        if (header.stored_len > payload_.size() - data_offset || header.raw_len > MAX_BLOCK) return false;
+        offset_ = data_offset + header.stored_len;
+        return true;
+    }
+
+    bool decompress(const BlockHeader& header, size_t data_offset, std::string& raw, std::string& error) const {
+        const char* data = payload_.data() + data_offset;
+        if (header.codec == CODEC_NONE) {
+            if (header.stored_len != header.raw_len) {
+                error = "damaged column block";
+                return false;
+            }
+            raw.assign(data, header.stored_len);
+            return true;
+        }
+#ifdef HAVE_ZSTD
+        if (header.codec == CODEC_ZSTD) {
+            raw.resize(header.raw_len);
+            size_t size = ZSTD_decompress(&raw[0], raw.size(), data, header.stored_len);
+            if (ZSTD_isError(size) || size != header.raw_len) {
+                error = "damaged zstd column block";
+                return false;
+            }
+            return true;
+        }
+#endif
+        error = "column codec " + std::to_string(header.codec) + " is not supported by this build";
+        return false;
+    }
+
+private:
+    const std::string& payload_;
+    size_t offset_;
+};
+
+} // namespace
+
+ColumnarArchive::Writer::Writer(ColumnarArchive* archive, const std::string& table, const std::string& path,
+                                const std::vector<Column>& columns)
+    : archive_(archive), table_(table), path_(path), temp_path_(path + ".tmp"), columns_(columns), fd_(-1),
+      offset_(0), rows_(0), groups_(0), min_ts_(INT64_MAX), max_ts_(INT64_MIN) {}
+
+ColumnarArchive::Writer::~Writer() {
+    // Not finished: the partial file never replaces anything
+    if (fd_ >= 0) {
+        ::close(fd_);
+        ::unlink(temp_path_.c_str());
+    }
+}
+
+bool ColumnarArchive::Writer::write(const std::string& data, std::string& error) {
+    if (!writeAll(fd_, data.data(), data.size())) {
+        error = systemError("Cannot write", temp_path_);
+        return false;
+    }
+    offset_ += data.size();
+    return true;
+}
+
+std::string ColumnarArchive::Writer::schema() const {
+    std::string schema;
+    for (const auto& column : columns_) {
+        putRaw(schema, static_cast<uint8_t>(column.type));
+        putRaw(schema, static_cast<uint8_t>(column.name.size()));
+        schema.append(column.name);
+    }
+    return schema;
+}
+
+bool ColumnarArchive::Writer::append(const std::vector<Row>& rows, std::string& error) {
+    if (fd_ < 0) {
+        error = "archive file " + path_ + " is not open";
+        return false;
+    }
+    if (rows.empty()) {
+        return true;
+    }
+    for (const auto& row : rows) {
+        if (row.size() != columns_.size()) {
+            error = "row of " + std::to_string(row.size()) + " values for " + std::to_string(columns_.size()) + " columns";
+            return false;
+        }
+    }
+
+    const std::string& first_device = rows.front()[0];
+    const std::string& last_device = rows.back()[0];
+    if (first_device.size() > UINT16_MAX || last_device.size() > UINT16_MAX) {
+        error = "device id too long for the archive";
+        return false;
+    }
+
+    std::string payload;
+    std::string raw;
+    for (size_t c = 0; c < columns_.size(); c++) {
+        raw.clear();
+        switch (columns_[c].type) {
+            case ColumnType::Text:      encodeText(rows, c, raw); break;
+            case ColumnType::Timestamp: encodeTimestamps(rows, c, raw); break;
+            case ColumnType::Percent:   encodePercents(rows, c, raw); break;
+            case ColumnType::Integer:   encodeIntegers(rows, c, raw); break;
+        }
+        appendBlock(columns_[c].type, raw, archive_->options_.compression_level, payload);
+    }
+
+    GroupHeader header{};
+    header.magic = GROUP_MAGIC;
+    header.rows = static_cast<uint32_t>(rows.size());
+    header.min_ts = INT64_MAX;
+    header.max_ts = INT64_MIN;
+    for (const auto& row : rows) {
+        int64_t ts = std::strtoll(row[1].c_str(), nullptr, 10);
+        header.min_ts = std::min(header.min_ts, ts);
+        header.max_ts = std::max(header.max_ts, ts);
+    }
+    header.payload_len = static_cast<uint32_t>(payload.size());
+    header.first_device_len = static_cast<uint16_t>(first_device.size());
+    header.last_device_len = static_cast<uint16_t>(last_device.size());
+
+    std::string devices = first_device + last_device;
+    header.crc = crc32(payload.data(), payload.size(), crc32(devices.data(), devices.size()));
+
+    std::string group;
+    putRaw(group, header);
+    group.append(devices);
+    group.append(payload);
+    if (!write(group, error)) {
+        return false;
+    }
+
+    rows_ += rows.size();
+    groups_++;
+    min_ts_ = std::min(min_ts_, header.min_ts);
+    max_ts_ = std::max(max_ts_, header.max_ts);
+    return true;
+}
+
+bool ColumnarArchive::Writer::finish(std::string& error) {
+    if (fd_ < 0) {
+        error = "archive file " + path_ + " is not open";
+        return false;
+    }
+
+    std::string columns = schema();
+    FileHeader header{};
+    std::memcpy(header.magic, FILE_MAGIC, sizeof(header.magic));
+    header.columns = static_cast<uint32_t>(columns_.size());
+    header.schema_len = static_cast<uint32_t>(columns.size());
+    header.groups = groups_;
+    header.rows = rows_;
+    header.min_ts = rows_ > 0 ? min_ts_ : 0;
+    header.max_ts = rows_ > 0 ? max_ts_ : 0;
+    header.crc = crc32(columns.data(), columns.size(), crc32(&header, offsetof(FileHeader, crc)));
+
+    // The header is only complete now; groups were written after its space
+    if (::pwrite(fd_, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)) ||
+        fsync(fd_) != 0) {
+        error = systemError("Cannot write", temp_path_);
+        return false;
+    }
+    ::close(fd_);
+    fd_ = -1;
+
+    if (::rename(temp_path_.c_str(), path_.c_str()) != 0) {
+        error = systemError("Cannot replace", path_);
+        ::unlink(temp_path_.c_str());
+        return false;
+    }
+    syncDirectory(archive_->options_.directory);
+
+    archive_->add(FileInfo{table_, path_, header.min_ts, header.max_ts});
+    return true;
+}
+
+ColumnarArchive::ColumnarArchive(const ArchiveOptions& options) : options_(options) {
+    if (options_.group_rows == 0) options_.group_rows = 65536;
+}
+
+bool ColumnarArchive::open() {
+    std::error_code ec;
+    fs::create_directories(options_.directory, ec);
+    if (ec) {
+        std::cerr << "Cannot create archive directory " << options_.directory << ": " << ec.message() << std::endl;
+        return false;
+    }
+
+    size_t count = 0;
+    size_t bytes = 0;
+    for (const auto& entry : fs::directory_iterator(options_.directory, ec)) {
+        std::string name = entry.path().filename().string();
+        std::string path = entry.path().string();
+
+        // Leftover of an export interrupted by a crash
+        if (name.size() > strlen(TEMP_SUFFIX) &&
+            name.compare(name.size() - strlen(TEMP_SUFFIX), strlen(TEMP_SUFFIX), TEMP_SUFFIX) == 0) {
+            fs::remove(entry.path(), ec);
+            continue;
+        }
+        if (name.size() <= strlen(FILE_SUFFIX) ||
+            name.compare(name.size() - strlen(FILE_SUFFIX), strlen(FILE_SUFFIX), FILE_SUFFIX) != 0) {
+            continue;
+        }
+
+        FileInfo info;
+        std::string error;
+        if (!readInfo(path, info, error)) {
+            std::cerr << "Skipping archive file: " << error << std::endl;
+            continue;
+        }
+        add(info);
+        count++;
+        bytes += static_cast<size_t>(entry.file_size(ec));
+    }
+    if (ec) {
+        std::cerr << "Cannot list " << options_.directory << ": " << ec.message() << std::endl;
+        return false;
+    }
+
+    std::cout << "Metrics archive " << options_.directory << ": " << count << " file(s), "
+              << bytes / 1024 << " KiB" << std::endl;
+    return true;
+}
+
+void ColumnarArchive::add(const FileInfo& file) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    files_[file.path] = file;
+}
+
+std::unique_ptr<ColumnarArchive::Writer> ColumnarArchive::create(const std::string& table, const std::string& partition,
+                                                                 const std::vector<Column>& columns, std::string& error) {
+    if (columns.size() < 2 || columns[0].type != ColumnType::Text || columns[1].type != ColumnType::Timestamp) {
+        error = "archive columns have to start with the device id and the timestamp";
+        return nullptr;
+    }
+    for (const auto& column : columns) {
+        if (column.name.size() > UINT8_MAX) {
+            error = "column name " + column.name + " too long";
+            return nullptr;
+        }
+    }
+
+    std::string path = (fs::path(options_.directory) / (table + "-" + partition + FILE_SUFFIX)).string();
+    std::unique_ptr<Writer> writer(new Writer(this, table, path, columns));
+
+    writer->fd_ = ::open(writer->temp_path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (writer->fd_ < 0) {
+        error = systemError("Cannot create", writer->temp_path_);
+        return nullptr;
+    }
+
+    // Space for the header, written by finish(), and the column descriptions
+    std::string placeholder(sizeof(FileHeader), '\0');
+    if (!writer->write(placeholder + writer->schema(), error)) {
+        return nullptr;
+    }
+    return writer;
+}
+
+bool ColumnarArchive::readInfo(const std::string& path, FileInfo& info, std::string& error) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        error = systemError("Cannot open", path);
+        return false;
+    }
+
+    FileHeader header;
+    std::string schema;
+    bool valid = readAll(fd, 0, reinterpret_cast<char*>(&header), sizeof(header)) &&
+                 std::memcmp(header.magic, FILE_MAGIC, sizeof(header.magic)) == 0 && header.schema_len < 65536;
+    if (valid) {
+        schema.resize(header.schema_len);
+        valid = readAll(fd, sizeof(header), &schema[0], schema.size()) &&
+                header.crc == crc32(schema.data(), schema.size(), crc32(&header, offsetof(FileHeader, crc)));
+    }
+    ::close(fd);
+
+    if (!valid) {
+        error = "invalid archive file " + path;
+        return false;
+    }
+
+    // Named <table>-<partition>.col
+    std::string name = fs::path(path).filename().string();
+    info.table = name.substr(0, name.rfind('-'));
+    info.path = path;
+    info.min_ts = header.min_ts;
+    info.max_ts = header.max_ts;
+    return true;
+}
+
+bool ColumnarArchive::readHardware(const std::string& device_id, int64_t from_ms, int64_t to_ms,
+                                   std::vector<HardwarePoint>& points) {
+    std::vector<std::string> paths;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& [path, file] : files_) {
+            if (file.table == "hardware_info" && file.max_ts >= from_ms && file.min_ts < to_ms) {
+                paths.push_back(path);
+            }
+        }
+    }
+
+    bool ok = true;
+    for (const auto& path : paths) {
+        std::string error;
+        if (!readFile(path, device_id, from_ms, to_ms, points, error)) {
+            std::cerr << "Archive read failed: " << error << std::endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+bool ColumnarArchive::readFile(const std::string& path, const std::string& device_id, int64_t from_ms, int64_t to_ms,
+                               std::vector<HardwarePoint>& points, std::string& error) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        error = systemError("Cannot open", path);
+        return false;
+    }
+
+    FileHeader header;
+    std::string schema;
+    if (!readAll(fd, 0, reinterpret_cast<char*>(&header), sizeof(header)) || header.schema_len >= 65536) {
+        ::close(fd);
+        error = "invalid archive file " + path;
+        return false;
+    }
+    schema.resize(header.schema_len);
+    if (!readAll(fd, sizeof(header), &schema[0], schema.size())) {
+        ::close(fd);
+        error = "invalid archive file " + path;
+        return false;
+    }
+
+    // Column positions of the values a hardware point needs, -1 if absent
+    int cpu = -1, memory = -1, disk = -1;
+    size_t offset = 0;
+    for (uint32_t c = 0; c < header.columns && offset + 2 <= schema.size(); c++) {
+        size_t len = static_cast<uint8_t>(schema[offset + 1]);
+        std::string name = schema.substr(offset + 2, len);
+        offset += 2 + len;
+        if (name == "cpu_usage") cpu = static_cast<int>(c);
+        else if (name == "memory_usage") memory = static_cast<int>(c);
+        else if (name == "disk_usage") disk = static_cast<int>(c);
+    }
+
+    offset = sizeof(header) + header.schema_len;
+    bool ok = true;
+    std::string devices;
+    std::string payload;
+    std::string raw;
+    std::vector<std::string> dictionary;
+    std::vector<uint32_t> codes;
+    std::vector<int64_t> timestamps;
+    std::vector<double> values[3];
+
+    for (uint32_t g = 0; g < header.groups; g++) {
+        GroupHeader group;
+        if (!readAll(fd, offset, reinterpret_cast<char*>(&group), sizeof(group)) || group.magic != GROUP_MAGIC) {
+            error = "damaged row group in " + path;
+            ok = false;
+            break;
+        }
+        size_t devices_len = group.first_device_len + group.last_device_len;
+        size_t payload_offset = offset + sizeof(group) + devices_len;
+        offset = payload_offset + group.payload_len;
+
+        if (group.max_ts < from_ms || group.min_ts >= to_ms) {
+            continue;
+        }
+        devices.resize(devices_len);
+        if (!readAll(fd, payload_offset - devices_len, &devices[0], devices_len)) {
+            error = "damaged row group in " + path;
+            ok = false;
+            break;
+        }
+        if (device_id < devices.substr(0, group.first_device_len) ||
+            device_id > devices.substr(group.first_device_len)) {
+            continue;
+        }
+
+        payload.resize(group.payload_len);
+        if (!readAll(fd, payload_offset, &payload[0], payload.size()) ||
+            group.crc != crc32(payload.data(), payload.size(), crc32(devices.data(), devices.size()))) {
+            error = "damaged row group in " + path;
+            ok = false;
+            break;
+        }
+
+        // Only the device, time and percentage columns are decoded
+        BlockReader blocks(payload);
+        BlockHeader block;
+        size_t data_offset;
+        bool decoded = true;
+        bool present = true;
+        for (int c = 0; decoded && present && blocks.next(block, data_offset); c++) {
+            int target = c == cpu ? 0 : c == memory ? 1 : c == disk ? 2 : -1;
+            if (c > 1 && target < 0) {
+                continue;
+            }
+            decoded = blocks.decompress(block, data_offset, raw, error);
+            if (!decoded) break;
+
+            if (c == 0) {
+                decoded = decodeText(raw, group.rows, dictionary, codes);
+                present = std::find(dictionary.begin() + 1, dictionary.end(), device_id) != dictionary.end();
+            } else if (c == 1) {
+                decoded = decodeTimestamps(raw, group.rows, timestamps);
+            } else {
+                decoded = decodePercents(raw, group.rows, values[target]);
+            }
+        }
+        if (!decoded || codes.size() != group.rows || (present && timestamps.size() != group.rows)) {
+            if (error.empty()) error = "damaged column block in " + path;
+            ok = false;
+            break;
+        }
+        if (!present) {
+            continue;
+        }
+
+        uint32_t code = static_cast<uint32_t>(std::find(dictionary.begin() + 1, dictionary.end(), device_id) -
+                                              dictionary.begin());
+        int columns[3] = {cpu, memory, disk};
+        for (size_t i = 0; i < group.rows; i++) {
+            if (codes[i] != code || timestamps[i] < from_ms || timestamps[i] >= to_ms) {
+                continue;
+            }
+            HardwarePoint point;
+            point.timestamp_ms = timestamps[i];
+            double* targets[3] = {&point.cpu_usage, &point.memory_usage, &point.disk_usage};
+            for (int v = 0; v < 3; v++) {
+                if (columns[v] >= 0) *targets[v] = values[v][i];
+            }
+            points.push_back(point);
+        }
+    }
+
+    ::close(fd);
+    return ok;
+}
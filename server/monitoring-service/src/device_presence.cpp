@@ -0,0 +1,300 @@
+#include "device_presence.h"
+#include <algorithm>
+
+DevicePresence::DevicePresence(const PresencePolicy& policy, size_t max_devices)
+    : policy_(policy),
+      tick_ms_(std::max<int64_t>(policy.tick.count(), 1)),
+      size_(0),
+      current_tick_(0),
+      started_(false),
+      running_(false) {
+    max_devices = std::min<size_t>(std::max<size_t>(max_devices, 1), DeviceStateStore::NO_DEVICE);
+    max_chunks_ = (max_devices + DeviceStateStore::CHUNK_DEVICES - 1) / DeviceStateStore::CHUNK_DEVICES;
+    chunks_.reset(new std::atomic<Entry*>[max_chunks_]);
+    for (size_t i = 0; i < max_chunks_; i++) {
+        chunks_[i].store(nullptr, std::memory_order_relaxed);
+    }
+    std::fill(heads_, heads_ + LEVELS * SLOTS, DeviceStateStore::NO_DEVICE);
+    for (auto& count : counts_) {
+        count.store(0, std::memory_order_relaxed);
+    }
+}
+
+DevicePresence::~DevicePresence() {
+    stop();
+    for (size_t i = 0; i < max_chunks_; i++) {
+        delete[] chunks_[i].load(std::memory_order_relaxed);
+    }
+}
+
+int64_t DevicePresence::nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+DevicePresence::Entry* DevicePresence::entry(uint32_t device) const {
+    size_t chunk = device / DeviceStateStore::CHUNK_DEVICES;
+    if (chunk >= max_chunks_) {
+        return nullptr;
+    }
+    Entry* entries = chunks_[chunk].load(std::memory_order_acquire);
+    return entries ? entries + device % DeviceStateStore::CHUNK_DEVICES : nullptr;
+}
+
+DevicePresence::Entry* DevicePresence::allocate(uint32_t device) {
+    size_t chunk = device / DeviceStateStore::CHUNK_DEVICES;
+    if (chunk >= max_chunks_) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(grow_mutex_);
+    Entry* entries = chunks_[chunk].load(std::memory_order_relaxed);
+    if (!entries) {
+        entries = new Entry[DeviceStateStore::CHUNK_DEVICES];
+        chunks_[chunk].store(entries, std::memory_order_release);
+    }
+    return entries + device % DeviceStateStore::CHUNK_DEVICES;
+}
+
+DevicePresence::Status DevicePresence::seen(uint32_t device, int64_t now_ms) {
+    if (device == DeviceStateStore::NO_DEVICE) {
+        return Status::Unknown;
+    }
+    Entry* e = entry(device);
+    if (!e && !(e = allocate(device))) {
+        return Status::Unknown;
+    }
+
+    // Stored before the status is read, so the wheel either sees this
+    // sample or its status change is seen here
+    int64_t previous = e->last_seen_ms.load(std::memory_order_relaxed);
+    e->last_seen_ms.store(now_ms);
+    Status status = static_cast<Status>(e->status.load());
+
+    if (status == Status::Online) {
+        learn(*e, now_ms - previous);
+        return status;
+    }
+
+    std::lock_guard<std::mutex> lock(wheel_mutex_);
+    status = static_cast<Status>(e->status.load());
+    if (status == Status::Online) {
+        return status;
+    }
+    if (!started_) {
+        current_tick_ = static_cast<uint64_t>(now_ms / tick_ms_);
+        started_ = true;
+    }
+    if (status == Status::Unknown) {
+        if (size_.load(std::memory_order_relaxed) <= device) {
+            size_.store(size_t(device) + 1, std::memory_order_release);
+        }
+        e->interval_ms.store(static_cast<float>(policy_.expected_interval.count()), std::memory_order_relaxed);
+    } else if (status == Status::Stale) {
+        // Only late, so the interval was too short; an outage says nothing
+        learn(*e, now_ms - previous);
+    }
+    setStatus(*e, status, Status::Online);
+
+    // A stale device's timer is still armed and re-armed when it runs out
+    if (e->slot == NO_SLOT) {
+        arm(device, *e, now_ms + static_cast<int64_t>(e->interval_ms.load() * policy_.stale_factor));
+    }
+    return status;
+}
+
+void DevicePresence::learn(Entry& e, int64_t gap_ms) {
+    if (gap_ms < policy_.min_interval.count()) {
+        return;
+    }
+    float interval = e.interval_ms.load(std::memory_order_relaxed);
+    gap_ms = std::min<int64_t>(gap_ms, policy_.max_interval.count());
+    e.interval_ms.store(interval + ALPHA * (gap_ms - interval), std::memory_order_relaxed);
+}
+
+void DevicePresence::advance(int64_t now_ms, std::vector<Transition>& transitions) {
+    std::lock_guard<std::mutex> lock(wheel_mutex_);
+    uint64_t target = static_cast<uint64_t>(now_ms / tick_ms_);
+    if (!started_) {
+        current_tick_ = target;
+        started_ = true;
+        return;
+    }
+
+    while (current_tick_ <= target) {
+        // Each time a level wraps around, the next slot of the level above
+        // is spread over the levels below
+        size_t index = current_tick_ & (SLOTS - 1);
+        for (size_t level = 1; index == 0 && level < LEVELS; level++) {
+            index = (current_tick_ >> (SLOT_BITS * level)) & (SLOTS - 1);
+            uint32_t device = detach(level * SLOTS + index);
+            while (device != DeviceStateStore::NO_DEVICE) {
+                Entry& e = *entry(device);
+                uint32_t next = e.next;
+                link(device, e);
+                device = next;
+            }
+        }
+
+        // Timers re-armed while these run land in later ticks
+        uint32_t device = detach(current_tick_ & (SLOTS - 1));
+        current_tick_++;
+        while (device != DeviceStateStore::NO_DEVICE) {
+            Entry& e = *entry(device);
+            uint32_t next = e.next;
+            expire(device, e, now_ms, transitions);
+            device = next;
+        }
+    }
+}
+
+void DevicePresence::expire(uint32_t device, Entry& e, int64_t now_ms, std::vector<Transition>& transitions) {
+    Status status = static_cast<Status>(e.status.load());
+    int64_t last_seen_ms = e.last_seen_ms.load();
+    float interval = e.interval_ms.load(std::memory_order_relaxed);
+    int64_t stale_ms = static_cast<int64_t>(interval * policy_.stale_factor);
+    int64_t offline_ms = static_cast<int64_t>(interval * policy_.offline_factor);
+
+    int64_t silent_ms = now_ms - last_seen_ms;
+    Status to = silent_ms < stale_ms ? Status::Online : silent_ms < offline_ms ? Status::Stale : Status::Offline;
+
+    if (to != status) {
+        e.status.store(static_cast<uint8_t>(to));
+        if (status == Status::Online && e.last_seen_ms.load() != last_seen_ms) {
+            // A sample arrived while the device was read as silent
+            e.status.store(static_cast<uint8_t>(Status::Online));
+            arm(device, e, e.last_seen_ms.load() + stale_ms);
+            return;
+        }
+        setStatus(e, status, to);
+        transitions.push_back({device, status, to, silent_ms});
+    }
+
+    // Offline devices wait for their next sample
+    if (to == Status::Online) {
+        arm(device, e, last_seen_ms + stale_ms);
+    } else if (to == Status::Stale) {
+        arm(device, e, last_seen_ms + offline_ms);
+    }
+}
+
+void DevicePresence::setStatus(Entry& e, Status from, Status to) {
+    e.status.store(static_cast<uint8_t>(to));
+    if (from != Status::Unknown) {
+        counts_[static_cast<size_t>(from)].fetch_sub(1, std::memory_order_relaxed);
+    }
+    counts_[static_cast<size_t>(to)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void DevicePresence::arm(uint32_t device, Entry& e, int64_t due_ms) {
+    e.deadline = std::max(ticks(due_ms), current_tick_);
+    link(device, e);
+}
+
+void DevicePresence::link(uint32_t device, Entry& e) {
+    // The level whose slots are as long as the time left; the top level's
+    // range bounds how far ahead a timer can be
+    e.deadline = std::max(e.deadline, current_tick_);
+    uint64_t delta = e.deadline - current_tick_;
+    size_t level = 0;
+    while (level < LEVELS - 1 && delta >= (uint64_t(1) << (SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+    if (delta >= (uint64_t(1) << (SLOT_BITS * LEVELS))) {
+        e.deadline = current_tick_ + (uint64_t(1) << (SLOT_BITS * LEVELS)) - 1;
+    }
+
+    size_t slot = level * SLOTS + ((e.deadline >> (SLOT_BITS * level)) & (SLOTS - 1));
+    e.slot = static_cast<uint16_t>(slot);
+    e.prev = DeviceStateStore::NO_DEVICE;
+    e.next = heads_[slot];
+    if (e.next != DeviceStateStore::NO_DEVICE) {
+        entry(e.next)->prev = device;
+    }
+    heads_[slot] = device;
+}
+
+uint32_t DevicePresence::detach(size_t slot) {
+    // Entries keep their next links for the caller to walk
+    uint32_t head = heads_[slot];
+    heads_[slot] = DeviceStateStore::NO_DEVICE;
+    for (uint32_t device = head; device != DeviceStateStore::NO_DEVICE;) {
+        Entry& e = *entry(device);
+        e.slot = NO_SLOT;
+        e.prev = DeviceStateStore::NO_DEVICE;
+        device = e.next;
+    }
+    return head;
+}
+
+bool DevicePresence::get(uint32_t device, int64_t now_ms, Presence& presence) const {
+    const Entry* e = device == DeviceStateStore::NO_DEVICE ? nullptr : entry(device);
+    if (!e) {
+        return false;
+    }
+    Status status = static_cast<Status>(e->status.load());
+    if (status == Status::Unknown) {
+        return false;
+    }
+    presence.status = status;
+    presence.silent_ms = std::max<int64_t>(now_ms - e->last_seen_ms.load(), 0);
+    presence.expected_interval_ms = static_cast<int64_t>(e->interval_ms.load(std::memory_order_relaxed));
+    return true;
+}
+
+std::vector<uint32_t> DevicePresence::devices(Status status) const {
+    std::vector<uint32_t> result;
+    size_t size = size_.load(std::memory_order_acquire);
+    for (size_t first = 0; first < size; first += DeviceStateStore::CHUNK_DEVICES) {
+        const Entry* entries = chunks_[first / DeviceStateStore::CHUNK_DEVICES].load(std::memory_order_acquire);
+        if (!entries) {
+            continue;
+        }
+        size_t end = std::min(size - first, DeviceStateStore::CHUNK_DEVICES);
+        for (size_t i = 0; i < end; i++) {
+            if (static_cast<Status>(entries[i].status.load(std::memory_order_relaxed)) == status) {
+                result.push_back(static_cast<uint32_t>(first + i));
+            }
+        }
+    }
+    return result;
+}
+
+size_t DevicePresence::count(Status status) const {
+    return counts_[static_cast<size_t>(status)].load(std::memory_order_relaxed);
+}
+
+void DevicePresence::start(std::function<void(const std::vector<Transition>&)> on_change) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_) return;
+    running_ = true;
+
+    tick_thread_ = std::thread([this, on_change]() {
+        std::vector<Transition> transitions;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                if (wakeup_.wait_for(lock, std::chrono::milliseconds(tick_ms_), [this]() { return !running_; })) {
+                    return;
+                }
+            }
+            transitions.clear();
+            advance(nowMs(), transitions);
+            if (!transitions.empty() && on_change) {
+                on_change(transitions);
+            }
+        }
+    });
+}
+
+void DevicePresence::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) return;
+        running_ = false;
+    }
+    wakeup_.notify_all();
+    if (tick_thread_.joinable()) {
+        tick_thread_.join();
+    }
+}
@@ -0,0 +1,310 @@
+#include "device_state_store.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+static int64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Columns are handed out as plain floats for vectorized passes
+static_assert(sizeof(std::atomic<float>) == sizeof(float) && alignof(std::atomic<float>) == alignof(float) &&
+              std::atomic<float>::is_always_lock_free, "std::atomic<float> is not a plain float");
+
+// 2020-01-01T00:00:00Z; 32-bit seconds from there last until 2156
+static constexpr int64_t TIME_BASE_MS = 1577836800000;
+
+static std::string_view idView(const char* stored) {
+    uint16_t length;
+    std::memcpy(&length, stored, sizeof(length));
+    return std::string_view(stored + sizeof(length), length);
+}
+
+DeviceStateStore::Chunk::Chunk() {
+    for (size_t i = 0; i < CHUNK_DEVICES; i++) {
+        sequence[i].store(0, std::memory_order_relaxed);
+        cpu[i].store(NAN, std::memory_order_relaxed);
+        memory[i].store(NAN, std::memory_order_relaxed);
+        disk[i].store(NAN, std::memory_order_relaxed);
+        gpio[i].store(0, std::memory_order_relaxed);
+        hw_time[i].store(0, std::memory_order_relaxed);
+        sw_time[i].store(0, std::memory_order_relaxed);
+        ids[i] = nullptr;
+    }
+}
+
+DeviceStateStore::DeviceStateStore(size_t max_devices, size_t shards)
+    : count_(0), id_block_used_(ID_BLOCK_SIZE), shard_bits_(0) {
+    max_devices = std::min<size_t>(std::max<size_t>(max_devices, 1), NO_DEVICE);
+    max_chunks_ = (max_devices + CHUNK_DEVICES - 1) / CHUNK_DEVICES;
+    chunks_.reset(new std::atomic<Chunk*>[max_chunks_]);
+    for (size_t i = 0; i < max_chunks_; i++) {
+        chunks_[i].store(nullptr, std::memory_order_relaxed);
+    }
+
+    while ((size_t(1) << shard_bits_) < shards) shard_bits_++;
+    shards_ = std::vector<Shard>(size_t(1) << shard_bits_);
+}
+
+DeviceStateStore::~DeviceStateStore() {
+    for (size_t i = 0; i < max_chunks_; i++) {
+        delete chunks_[i].load(std::memory_order_relaxed);
+    }
+}
+
+DeviceStateStore::Shard& DeviceStateStore::shard(size_t hash) {
+    return shards_[hash & (shards_.size() - 1)];
+}
+
+const DeviceStateStore::Shard& DeviceStateStore::shard(size_t hash) const {
+    return shards_[hash & (shards_.size() - 1)];
+}
+
+uint32_t DeviceStateStore::lookup(const Shard& shard, size_t hash, const std::string& device_id) const {
+    if (shard.slots.empty()) {
+        return NO_DEVICE;
+    }
+    size_t mask = shard.slots.size() - 1;
+    for (size_t slot = (hash >> shard_bits_) & mask; shard.slots[slot] != NO_DEVICE; slot = (slot + 1) & mask) {
+        uint32_t index = shard.slots[slot];
+        if (idView(chunk(index).ids[index % CHUNK_DEVICES]) == device_id) {
+            return index;
+        }
+    }
+    return NO_DEVICE;
+}
+
+void DeviceStateStore::insert(Shard& shard, size_t hash, uint32_t index) {
+    // Kept at most half full so probes stay short
+    if ((shard.used + 1) * 2 > shard.slots.size()) {
+        std::vector<uint32_t> old;
+        old.swap(shard.slots);
+        shard.slots.assign(std::max<size_t>(64, old.size() * 2), NO_DEVICE);
+        shard.used = 0;
+        for (uint32_t existing : old) {
+            if (existing != NO_DEVICE) {
+                insert(shard, std::hash<std::string_view>()(deviceId(existing)), existing);
+            }
+        }
+    }
+
+    size_t mask = shard.slots.size() - 1;
+    size_t slot = (hash >> shard_bits_) & mask;
+    while (shard.slots[slot] != NO_DEVICE) {
+        slot = (slot + 1) & mask;
+    }
+    shard.slots[slot] = index;
+    shard.used++;
+}
+
+uint32_t DeviceStateStore::find(const std::string& device_id) const {
+    size_t hash = std::hash<std::string>()(device_id);
+    const Shard& target = shard(hash);
+    std::shared_lock<std::shared_mutex> lock(target.mutex);
+    return lookup(target, hash, device_id);
+}
+
+uint32_t DeviceStateStore::intern(const std::string& device_id) {
+    if (device_id.size() > MAX_ID_LENGTH) {
+        return NO_DEVICE;
+    }
+    size_t hash = std::hash<std::string>()(device_id);
+    Shard& target = shard(hash);
+    {
+        std::shared_lock<std::shared_mutex> lock(target.mutex);
+        uint32_t index = lookup(target, hash, device_id);
+        if (index != NO_DEVICE) {
+            return index;
+        }
+    }
+
+    // New device: its columns are set up before the index is published
+    std::lock_guard<std::mutex> grow(grow_mutex_);
+    std::unique_lock<std::shared_mutex> lock(target.mutex);
+    uint32_t index = lookup(target, hash, device_id);
+    if (index != NO_DEVICE) {
+        return index;
+    }
+
+    size_t next = count_.load(std::memory_order_relaxed);
+    if (next >= max_chunks_ * CHUNK_DEVICES) {
+        return NO_DEVICE;
+    }
+    if (!chunks_[next / CHUNK_DEVICES].load(std::memory_order_relaxed)) {
+        chunks_[next / CHUNK_DEVICES].store(new Chunk(), std::memory_order_release);
+    }
+
+    index = static_cast<uint32_t>(next);
+    chunk(index).ids[index % CHUNK_DEVICES] = storeId(device_id);
+    insert(target, hash, index);
+    count_.store(next + 1, std::memory_order_release);
+    return index;
+}
+
+std::string_view DeviceStateStore::deviceId(uint32_t index) const {
+    return idView(chunk(index).ids[index % CHUNK_DEVICES]);
+}
+
+const char* DeviceStateStore::storeId(const std::string& device_id) {
+    uint16_t length = static_cast<uint16_t>(device_id.size());
+    size_t size = sizeof(length) + length;
+    if (id_block_used_ + size > ID_BLOCK_SIZE) {
+        id_blocks_.emplace_back(new char[std::max(size, ID_BLOCK_SIZE)]);
+        id_block_used_ = 0;
+    }
+    char* stored = id_blocks_.back().get() + id_block_used_;
+    std::memcpy(stored, &length, sizeof(length));
+    std::memcpy(stored + sizeof(length), device_id.data(), length);
+    id_block_used_ += size;
+    return stored;
+}
+
+uint32_t DeviceStateStore::toSeconds(int64_t ms) {
+    if (ms <= TIME_BASE_MS) {
+        return 1;
+    }
+    return static_cast<uint32_t>(std::min<int64_t>((ms - TIME_BASE_MS) / 1000, UINT32_MAX));
+}
+
+int64_t DeviceStateStore::fromSeconds(uint32_t seconds) {
+    return seconds ? TIME_BASE_MS + int64_t(seconds) * 1000 : 0;
+}
+
+uint32_t DeviceStateStore::beginWrite(uint32_t index) {
+    auto& sequence = chunk(index).sequence[index % CHUNK_DEVICES];
+    uint32_t value = sequence.load(std::memory_order_relaxed);
+    while (true) {
+        if (!(value & 1) &&
+            sequence.compare_exchange_weak(value, value + 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+            // Values written next must not become visible before the odd sequence
+            std::atomic_thread_fence(std::memory_order_release);
+            return value;
+        }
+        if (value & 1) {
+            std::this_thread::yield();
+            value = sequence.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void DeviceStateStore::endWrite(uint32_t index, uint32_t sequence) {
+    chunk(index).sequence[index % CHUNK_DEVICES].store(sequence + 2, std::memory_order_release);
+}
+
+std::shared_ptr<DeviceAttributes> DeviceStateStore::copyAttributes(uint32_t index) const {
+    auto current = std::atomic_load(&chunk(index).attributes[index % CHUNK_DEVICES]);
+    return current ? std::make_shared<DeviceAttributes>(*current) : std::make_shared<DeviceAttributes>();
+}
+
+int DeviceStateStore::updateHardware(uint32_t index, const HardwareSample& sample) {
+    Chunk& c = chunk(index);
+    size_t i = index % CHUNK_DEVICES;
+
+    uint32_t sequence = beginWrite(index);
+    int previous_gpio = c.gpio[i].load(std::memory_order_relaxed);
+
+    if (!std::isnan(sample.cpu_usage)) c.cpu[i].store(static_cast<float>(sample.cpu_usage), std::memory_order_relaxed);
+    if (!std::isnan(sample.memory_usage)) c.memory[i].store(static_cast<float>(sample.memory_usage), std::memory_order_relaxed);
+    if (!std::isnan(sample.disk_usage)) c.disk[i].store(static_cast<float>(sample.disk_usage), std::memory_order_relaxed);
+    if (sample.has_gpio_state) c.gpio[i].store(sample.gpio_state, std::memory_order_relaxed);
+    c.hw_time[i].store(toSeconds(sample.timestamp_ms ? sample.timestamp_ms : nowMs()), std::memory_order_relaxed);
+
+    // Attributes are only copied when they change
+    if (sample.has_usb_state) {
+        auto current = std::atomic_load(&c.attributes[i]);
+        if (!current || current->usb_state != sample.usb_state) {
+            auto changed = copyAttributes(index);
+            changed->usb_state = sample.usb_state;
+            std::atomic_store(&c.attributes[i], std::shared_ptr<const DeviceAttributes>(std::move(changed)));
+        }
+    }
+
+    endWrite(index, sequence);
+    return previous_gpio;
+}
+
+void DeviceStateStore::updateSoftware(uint32_t index, const SoftwareSample& sample) {
+    Chunk& c = chunk(index);
+    size_t i = index % CHUNK_DEVICES;
+
+    uint32_t sequence = beginWrite(index);
+    c.sw_time[i].store(toSeconds(sample.timestamp_ms ? sample.timestamp_ms : nowMs()), std::memory_order_relaxed);
+
+    auto current = std::atomic_load(&c.attributes[i]);
+    std::map<std::string, std::string> services;
+    if (sample.has_services) {
+        services.insert(sample.services.begin(), sample.services.end());
+    }
+    bool ip_changed = !sample.ip_address.empty() && (!current || current->ip_address != sample.ip_address);
+    bool status_changed = !sample.network_status.empty() &&
+                          (!current || current->network_status != sample.network_status);
+    bool services_changed = sample.has_services && (!current || current->services != services);
+
+    if (ip_changed || status_changed || services_changed) {
+        auto changed = copyAttributes(index);
+        if (ip_changed) changed->ip_address = sample.ip_address;
+        if (status_changed) changed->network_status = sample.network_status;
+        if (services_changed) changed->services = std::move(services);
+        std::atomic_store(&c.attributes[i], std::shared_ptr<const DeviceAttributes>(std::move(changed)));
+    }
+
+    endWrite(index, sequence);
+}
+
+bool DeviceStateStore::get(uint32_t index, DeviceState& state) const {
+    if (index >= size()) {
+        return false;
+    }
+    const Chunk& c = chunk(index);
+    size_t i = index % CHUNK_DEVICES;
+
+    while (true) {
+        uint32_t before = c.sequence[i].load(std::memory_order_acquire);
+        if (before & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        state.cpu_usage = c.cpu[i].load(std::memory_order_relaxed);
+        state.memory_usage = c.memory[i].load(std::memory_order_relaxed);
+        state.disk_usage = c.disk[i].load(std::memory_order_relaxed);
+        state.gpio_state = c.gpio[i].load(std::memory_order_relaxed);
+        state.last_hw_update_ms = fromSeconds(c.hw_time[i].load(std::memory_order_relaxed));
+        state.last_sw_update_ms = fromSeconds(c.sw_time[i].load(std::memory_order_relaxed));
+        state.attributes = std::atomic_load(&c.attributes[i]);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (c.sequence[i].load(std::memory_order_relaxed) == before) {
+            return true;
+        }
+    }
+}
+
+bool DeviceStateStore::get(const std::string& device_id, DeviceState& state) const {
+    uint32_t index = find(device_id);
+    return index != NO_DEVICE && get(index, state);
+}
+
+std::vector<std::string> DeviceStateStore::deviceIds() const {
+    size_t count = size();
+    std::vector<std::string> ids;
+    ids.reserve(count);
+    for (uint32_t index = 0; index < count; index++) {
+        ids.emplace_back(deviceId(index));
+    }
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+const float* DeviceStateStore::column(Metric metric, uint32_t first) const {
+    const Chunk& c = chunk(first);
+    switch (metric) {
+        case Metric::Cpu:    return reinterpret_cast<const float*>(c.cpu);
+        case Metric::Memory: return reinterpret_cast<const float*>(c.memory);
+        case Metric::Disk:   return reinterpret_cast<const float*>(c.disk);
+    }
+    return nullptr;
+}
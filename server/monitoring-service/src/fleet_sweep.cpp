@@ -0,0 +1,118 @@
+#include "fleet_sweep.h"
+#include "threshold_table.h"
+#include <algorithm>
+#include <cstring>
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+struct ColumnSweep {
+    const float* values;
+    uint8_t* levels;
+    uint32_t* active;   // devices of the chunk above normal
+    uint32_t first;     // store index of values[0]
+    FleetThresholdSweep::Metric metric;
+    const float* warning;   // per device, warning <= critical
+    const float* critical;
+    FleetThresholdSweep::Result* result;
+
+    // Settle the devices of a block with a warning (or critical) bit set or a
+    // level above normal from the previous pass
+    void settle(size_t offset, size_t lanes, unsigned warning_mask, unsigned critical_mask) const {
+        for (size_t lane = 0; lane < lanes; lane++) {
+            size_t i = offset + lane;
+            auto level = (critical_mask >> lane) & 1 ? FleetThresholdSweep::CRITICAL
+                         : (warning_mask >> lane) & 1 ? FleetThresholdSweep::WARNING
+                                                      : FleetThresholdSweep::NORMAL;
+            uint32_t device = first + static_cast<uint32_t>(i);
+            size_t m = static_cast<size_t>(metric);
+
+            if (level == FleetThresholdSweep::WARNING) {
+                result->warning[m].push_back(device);
+            } else if (level == FleetThresholdSweep::CRITICAL) {
+                result->critical[m].push_back(device);
+            }
+            if (levels[i] != level) {
+                result->transitions.push_back({device, metric, static_cast<FleetThresholdSweep::Level>(levels[i]),
+                                               level, values[i]});
+                if (!levels[i]) ++*active;
+                if (!level) --*active;
+                levels[i] = level;
+            }
+        }
+    }
+
+    void run(size_t count) const {
+        // Without devices above normal the previous levels need not be read
+        bool quiet = *active == 0;
+        size_t i = 0;
+
+#if defined(__AVX__)
+        for (; i + 8 <= count; i += 8) {
+            // NaN (not reported) compares false
+            __m256 v = _mm256_loadu_ps(values + i);
+            unsigned over = static_cast<unsigned>(
+                _mm256_movemask_ps(_mm256_cmp_ps(v, _mm256_loadu_ps(warning + i), _CMP_GE_OQ)));
+            uint64_t previous = 0;
+            if (!quiet) std::memcpy(&previous, levels + i, sizeof(previous));
+            if (!over && !previous) continue;
+            unsigned critical_mask = static_cast<unsigned>(
+                _mm256_movemask_ps(_mm256_cmp_ps(v, _mm256_loadu_ps(critical + i), _CMP_GE_OQ)));
+            settle(i, 8, over, critical_mask);
+        }
+#elif defined(__SSE2__)
+        for (; i + 4 <= count; i += 4) {
+            // NaN (not reported) compares false
+            __m128 v = _mm_loadu_ps(values + i);
+            unsigned over = static_cast<unsigned>(_mm_movemask_ps(_mm_cmpge_ps(v, _mm_loadu_ps(warning + i))));
+            uint32_t previous = 0;
+            if (!quiet) std::memcpy(&previous, levels + i, sizeof(previous));
+            if (!over && !previous) continue;
+            unsigned critical_mask = static_cast<unsigned>(
+                _mm_movemask_ps(_mm_cmpge_ps(v, _mm_loadu_ps(critical + i))));
+            settle(i, 4, over, critical_mask);
+        }
+#endif
+
+        for (; i < count; i++) {
+            unsigned over = values[i] >= warning[i] ? 1 : 0;
+            if (!over && !levels[i]) continue;
+            settle(i, 1, over, values[i] >= critical[i] ? 1 : 0);
+        }
+    }
+};
+
+} // namespace
+
+FleetThresholdSweep::Result FleetThresholdSweep::run(const DeviceStateStore& store, const ThresholdTable& thresholds) {
+    auto started = std::chrono::steady_clock::now();
+
+    Result result;
+    result.devices = store.size();
+    size_t chunks = (result.devices + DeviceStateStore::CHUNK_DEVICES - 1) / DeviceStateStore::CHUNK_DEVICES;
+    for (size_t m = 0; m < METRIC_COUNT; m++) {
+        levels_[m].resize(result.devices, NORMAL);
+        active_[m].resize(chunks, 0);
+    }
+
+    for (size_t m = 0; m < METRIC_COUNT; m++) {
+        ColumnSweep sweep;
+        sweep.metric = static_cast<Metric>(m);
+        sweep.result = &result;
+
+        for (size_t first = 0; first < result.devices; first += DeviceStateStore::CHUNK_DEVICES) {
+            sweep.first = static_cast<uint32_t>(first);
+            sweep.values = store.column(sweep.metric, sweep.first);
+            sweep.warning = thresholds.warning(sweep.metric, sweep.first);
+            sweep.critical = thresholds.critical(sweep.metric, sweep.first);
+            sweep.levels = levels_[m].data() + first;
+            sweep.active = &active_[m][first / DeviceStateStore::CHUNK_DEVICES];
+            sweep.run(std::min(DeviceStateStore::CHUNK_DEVICES, result.devices - first));
+        }
+    }
+
+    result.duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started);
+    return result;
+}
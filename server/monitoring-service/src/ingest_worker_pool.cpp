@@ -0,0 +1,117 @@
+#include "ingest_worker_pool.h"
+#include <iostream>
+
+IngestWorkerPool::IngestWorkerPool(size_t worker_count, size_t queue_capacity)
+    : queue_capacity_(queue_capacity > 0 ? queue_capacity : 1), running_(false) {
+    if (worker_count == 0) {
+        worker_count = std::thread::hardware_concurrency();
+        if (worker_count == 0) worker_count = 1;
+    }
+
+    workers_.reserve(worker_count);
+    for (size_t i = 0; i < worker_count; ++i) {
+        workers_.push_back(std::make_unique<Worker>());
+    }
+}
+
+IngestWorkerPool::~IngestWorkerPool() {
+    stop();
+}
+
+void IngestWorkerPool::start() {
+    if (running_) return;
+    running_ = true;
+
+    for (auto& worker : workers_) {
+        Worker* w = worker.get();
+        w->thread = std::thread([this, w]() { run(*w); });
+    }
+
+    std::cout << "Ingest worker pool started with " << workers_.size()
+              << " workers (queue capacity " << queue_capacity_ << ")" << std::endl;
+}
+
+void IngestWorkerPool::stop() {
+    if (!running_) return;
+    running_ = false;
+
+    for (auto& worker : workers_) {
+        {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+        }
+        worker->not_empty.notify_all();
+        worker->not_full.notify_all();
+    }
+
+    for (auto& worker : workers_) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+}
+
+bool IngestWorkerPool::submit(const std::string& device_id, Job job) {
+    Worker& worker = *workers_[workerIndex(device_id)];
+
+    std::unique_lock<std::mutex> lock(worker.mutex);
+    worker.not_full.wait(lock, [&]() {
+        return !running_ || worker.queue.size() < queue_capacity_;
+    });
+    if (!running_) return false;
+
+    worker.queue.push_back(std::move(job));
+    worker.depth = worker.queue.size();
+    lock.unlock();
+
+    worker.not_empty.notify_one();
+    return true;
+}
+
+size_t IngestWorkerPool::workerCount() const {
+    return workers_.size();
+}
+
+std::vector<IngestWorkerPool::WorkerStats> IngestWorkerPool::getStats() const {
+    std::vector<WorkerStats> stats;
+    stats.reserve(workers_.size());
+
+    for (const auto& worker : workers_) {
+        stats.push_back({worker->depth.load(), worker->processed.load()});
+    }
+
+    return stats;
+}
+
+void IngestWorkerPool::run(Worker& worker) {
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(worker.mutex);
+            worker.not_empty.wait(lock, [&]() {
+                return !running_ || !worker.queue.empty();
+            });
+
+            // On stop, finish whatever is already queued before exiting
+            if (worker.queue.empty()) {
+                return;
+            }
+
+            job = std::move(worker.queue.front());
+            worker.queue.pop_front();
+            worker.depth = worker.queue.size();
+        }
+        worker.not_full.notify_one();
+
+        try {
+            job();
+        } catch (const std::exception& e) {
+            std::cerr << "Ingest job failed: " << e.what() << std::endl;
+        }
+
+        worker.processed++;
+    }
+}
+
+size_t IngestWorkerPool::workerIndex(const std::string& device_id) const {
+    return std::hash<std::string>{}(device_id) % workers_.size();
+}
@@ -0,0 +1,208 @@
+#include "metric_statistics.h"
+#include <algorithm>
+
+namespace {
+
+constexpr float QUANTILE = 0.95f;
+
+// Desired marker position increments of the P-square algorithm
+constexpr float INCREMENTS[5] = {0, QUANTILE / 2, QUANTILE, (1 + QUANTILE) / 2, 1};
+
+int hourOfDay(int64_t timestamp_ms) {
+    int64_t hour = (timestamp_ms / 3600000) % 24;
+    return static_cast<int>(hour < 0 ? hour + 24 : hour);
+}
+
+void addQuantile(MetricWindow& w, float value) {
+    float* q = w.heights;
+    int32_t* n = w.positions;
+
+    // The first five samples seed the markers
+    if (w.samples <= 5) {
+        q[w.samples - 1] = value;
+        if (w.samples == 5) {
+            std::sort(q, q + 5);
+            for (int i = 0; i < 5; i++) {
+                n[i] = i + 1;
+            }
+            w.desired[0] = 1;
+            w.desired[1] = 1 + 2 * QUANTILE;
+            w.desired[2] = 1 + 4 * QUANTILE;
+            w.desired[3] = 3 + 2 * QUANTILE;
+            w.desired[4] = 5;
+        }
+        return;
+    }
+
+    int k;
+    if (value < q[0]) {
+        q[0] = value;
+        k = 0;
+    } else if (value >= q[4]) {
+        q[4] = std::max(q[4], value);
+        k = 3;
+    } else {
+        k = 0;
+        while (k < 3 && value >= q[k + 1]) k++;
+    }
+    for (int i = k + 1; i < 5; i++) {
+        n[i]++;
+    }
+    for (int i = 0; i < 5; i++) {
+        w.desired[i] += INCREMENTS[i];
+    }
+
+    // Move the middle markers toward their desired positions
+    for (int i = 1; i < 4; i++) {
+        float d = w.desired[i] - n[i];
+        if ((d >= 1 && n[i + 1] - n[i] > 1) || (d <= -1 && n[i - 1] - n[i] < -1)) {
+            int s = d > 0 ? 1 : -1;
+            float parabolic = q[i] + static_cast<float>(s) / (n[i + 1] - n[i - 1]) *
+                                         ((n[i] - n[i - 1] + s) * (q[i + 1] - q[i]) / (n[i + 1] - n[i]) +
+                                          (n[i + 1] - n[i] - s) * (q[i] - q[i - 1]) / (n[i] - n[i - 1]));
+            if (q[i - 1] < parabolic && parabolic < q[i + 1]) {
+                q[i] = parabolic;
+            } else {
+                q[i] += s * (q[i + s] - q[i]) / (n[i + s] - n[i]);
+            }
+            n[i] += s;
+        }
+    }
+}
+
+float quantile(const MetricWindow& w) {
+    if (w.samples >= 5) {
+        return w.heights[2];
+    }
+    // Nearest rank over the few samples there are
+    float sorted[5];
+    std::copy(w.heights, w.heights + w.samples, sorted);
+    std::sort(sorted, sorted + w.samples);
+    size_t rank = static_cast<size_t>(std::ceil(QUANTILE * w.samples));
+    return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+} // namespace
+
+MetricStatistics::MetricStatistics(size_t max_devices) {
+    max_devices = std::min<size_t>(std::max<size_t>(max_devices, 1), DeviceStateStore::NO_DEVICE);
+    max_chunks_ = (max_devices + DeviceStateStore::CHUNK_DEVICES - 1) / DeviceStateStore::CHUNK_DEVICES;
+    for (auto& chunks : chunks_) {
+        chunks.reset(new std::atomic<MetricWindow*>[max_chunks_]);
+        for (size_t i = 0; i < max_chunks_; i++) {
+            chunks[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+}
+
+MetricStatistics::~MetricStatistics() {
+    for (auto& chunks : chunks_) {
+        for (size_t i = 0; i < max_chunks_; i++) {
+            delete[] chunks[i].load(std::memory_order_relaxed);
+        }
+    }
+}
+
+MetricWindow* MetricStatistics::window(uint32_t device, Metric metric) const {
+    size_t chunk = device / DeviceStateStore::CHUNK_DEVICES;
+    if (chunk >= max_chunks_) {
+        return nullptr;
+    }
+    MetricWindow* windows = chunks_[static_cast<size_t>(metric)][chunk].load(std::memory_order_acquire);
+    return windows ? windows + device % DeviceStateStore::CHUNK_DEVICES : nullptr;
+}
+
+MetricWindow* MetricStatistics::allocate(uint32_t device, Metric metric) {
+    size_t chunk = device / DeviceStateStore::CHUNK_DEVICES;
+    if (chunk >= max_chunks_) {
+        return nullptr;
+    }
+    std::atomic<MetricWindow*>& slot = chunks_[static_cast<size_t>(metric)][chunk];
+
+    std::lock_guard<std::mutex> lock(grow_mutex_);
+    MetricWindow* windows = slot.load(std::memory_order_relaxed);
+    if (!windows) {
+        windows = new MetricWindow[DeviceStateStore::CHUNK_DEVICES]();
+        slot.store(windows, std::memory_order_release);
+    }
+    return windows + device % DeviceStateStore::CHUNK_DEVICES;
+}
+
+MetricStatistics::Score MetricStatistics::update(uint32_t device, Metric metric, float value, int64_t timestamp_ms) {
+    Score score;
+    if (std::isnan(value)) {
+        return score;
+    }
+    MetricWindow* w = window(device, metric);
+    if (!w && !(w = allocate(device, metric))) {
+        return score;
+    }
+
+    std::lock_guard<std::mutex> lock(locks_[device % LOCK_STRIPES]);
+    int hour = hourOfDay(timestamp_ms);
+
+    // Score against the history before this sample
+    if (w->samples > 0) {
+        bool seasonal = w->seasonal_samples[hour] >= MIN_SEASONAL_SAMPLES;
+        score.baseline = seasonal ? w->seasonal[hour] : w->mean;
+        float deviation = value - score.baseline;
+        if (w->samples >= MIN_SAMPLES) {
+            score.zscore = deviation / std::max(std::sqrt(w->residual_variance), MIN_STDDEV);
+        }
+        // Plain averages while the history is short, moving ones after
+        float alpha = std::max(ALPHA, 1.0f / (w->samples + 1));
+        w->residual_variance += alpha * (deviation * deviation - w->residual_variance);
+    }
+
+    w->samples++;
+    w->last = value;
+
+    float alpha = std::max(ALPHA, 1.0f / w->samples);
+    float difference = value - w->mean;
+    float increment = alpha * difference;
+    w->mean += increment;
+    w->variance = (1 - alpha) * (w->variance + difference * increment);
+
+    uint8_t& seen = w->seasonal_samples[hour];
+    w->seasonal[hour] = seen == 0 ? value : w->seasonal[hour] + SEASONAL_ALPHA * (value - w->seasonal[hour]);
+    if (seen < UINT8_MAX) seen++;
+
+    if (w->count == MetricWindow::SIZE) {
+        float oldest = w->values[w->head];
+        w->sum -= oldest;
+        w->sum_squares -= static_cast<double>(oldest) * oldest;
+    } else {
+        w->count++;
+    }
+    w->values[w->head] = value;
+    w->head = (w->head + 1) % MetricWindow::SIZE;
+    w->sum += value;
+    w->sum_squares += static_cast<double>(value) * value;
+
+    addQuantile(*w, value);
+    return score;
+}
+
+bool MetricStatistics::summary(uint32_t device, Metric metric, Summary& summary) const {
+    const MetricWindow* w = window(device, metric);
+    if (!w) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(locks_[device % LOCK_STRIPES]);
+    if (w->samples == 0) {
+        return false;
+    }
+
+    summary.samples = w->samples;
+    summary.last = w->last;
+    summary.window_mean = static_cast<float>(w->sum / w->count);
+    summary.window_stddev = static_cast<float>(
+        std::sqrt(std::max(0.0, w->sum_squares / w->count - (w->sum / w->count) * (w->sum / w->count))));
+    summary.window_min = *std::min_element(w->values, w->values + w->count);
+    summary.window_max = *std::max_element(w->values, w->values + w->count);
+    summary.mean = w->mean;
+    summary.stddev = std::sqrt(w->variance);
+    summary.p95 = quantile(*w);
+    return true;
+}
@@ -4,341 +4,356 @@
 #include <iostream>
 #include <sstream>
 #include <cmath>
+#include <cstdio>
+#include <iomanip>
+#include <algorithm>
 
 
-MetricsAnalyzer::MetricsAnalyzer(AlertManager* alert_manager)
-    : alert_manager_(alert_manager) {
+MetricsAnalyzer::MetricsAnalyzer(AlertManager* alert_manager, const AlertPolicy& alert_policy,
+                                 const PresencePolicy& presence_policy)
+    : alert_manager_(alert_manager), presence_(presence_policy), alert_suppressor_(alert_policy) {
     
 }
 
-void MetricsAnalyzer::processHardwareMetrics(const std::string& device_id, const nlohmann::json& metrics) {
-    std::lock_guard<std::mutex> lock(devices_mutex_);
+MetricsAnalyzer::~MetricsAnalyzer() {
+    // The reload threads use members destroyed before theirs
+    stopReload();
+    stopPresence();
+}
+
+void MetricsAnalyzer::processHardwareMetrics(const HardwareSample& sample) {
+    const std::string& device_id = sample.device_id;
     
-    // Check if device exists in our map, if not, initialize it
-    if (device_states_.find(device_id) == device_states_.end()) {
-        device_states_[device_id] = DeviceState();
+    // Store the sample in the device's columns; alerts are raised afterwards
+    // so readers of the device are not held up
+    int previous_gpio_state = -1;
+    uint32_t index = device_states_.intern(device_id);
+    if (index != DeviceStateStore::NO_DEVICE) {
+        int stored_gpio_state = device_states_.updateHardware(index, sample);
+        if (!stored_gpio_state) {
+            previous_gpio_state = stored_gpio_state;
+        }
     }
     
-    // Get reference to the device state
-    DeviceState& state = device_states_[device_id];
+    // Re-arms the device's timer; a device that had gone quiet is back
+    DevicePresence::Status was = presence_.seen(index, nowMs());
+    if (was == DevicePresence::Status::Stale || was == DevicePresence::Status::Offline) {
+        sendPresenceAlert(device_id, was, DevicePresence::Status::Online, 0);
+    }
     
-    // Store previous GPIO state for comparison
-    int previous_gpio_state = -1;
-    if (!state.gpio_state) {
-        try {
-            previous_gpio_state = state.gpio_state;
-        } catch (...) {
-            previous_gpio_state = -1;
-        }
+    // One table for the whole sample; the index is already known
+    using Metric = DeviceStateStore::Metric;
+    auto thresholds = thresholds_.current();
+    
+    MetricThreshold device_thresholds[DeviceStateStore::METRIC_COUNT] = {
+        thresholds->get(index, Metric::Cpu), thresholds->get(index, Metric::Memory), thresholds->get(index, Metric::Disk),
+    };
+    
+    // How unusual the values are for this device, for the anomaly rules
+    MetricStatistics::Score scores[DeviceStateStore::METRIC_COUNT];
+    if (index != DeviceStateStore::NO_DEVICE) {
+        scores[0] = statistics_.update(index, Metric::Cpu, sample.cpu_usage, sample.timestamp_ms);
+        scores[1] = statistics_.update(index, Metric::Memory, sample.memory_usage, sample.timestamp_ms);
+        scores[2] = statistics_.update(index, Metric::Disk, sample.disk_usage, sample.timestamp_ms);
     }
     
-    // Update device state with new hardware metrics
-    try {
-        if (metrics.contains("cpu_usage")) {
-            state.cpu_usage = metrics["cpu_usage"].get<std::string>();
-            analyzeCpuUsage(device_id, state.cpu_usage);
-        }
-        
-        if (metrics.contains("memory_usage")) {
-            state.memory_usage = metrics["memory_usage"].get<std::string>();
-            analyzeMemoryUsage(device_id, state.memory_usage);
-        }
-        
-        if (metrics.contains("disk_usage")) {
-            state.disk_usage = metrics["disk_usage"].get<std::string>();
-            analyzeDiskUsage(device_id, state.disk_usage);
-        }
-        
-        if (metrics.contains("usb_state")) {
-            state.usb_state = metrics["usb_state"].get<std::string>();
-            analyzeUsbState(device_id, state.usb_state);
-        }
-        
-        if (metrics.contains("gpio_state")) {
-                state.gpio_state = metrics["gpio_state"].get<int>();  // Expecting an integer for GPIO count or status
-                analyzeGpioState(device_id, state.gpio_state, previous_gpio_state); // Make sure previous_gpio_state is passed correctly
-            }
+    AlertRuleSet::Sample rule_sample;
+    rule_sample.source = AlertRuleSet::Source::Hardware;
+    rule_sample.hardware = &sample;
+    rule_sample.previous_gpio_state = previous_gpio_state;
+    rule_sample.thresholds = device_thresholds;
+    rule_sample.scores = scores;
+    
+    // Conditions are checked on every sample, alerts only sent when their
+    // state changes or a reminder is due; sent once the device is unlocked
+    std::vector<PendingAlert> outgoing;
+    {
+        auto alerts = alert_suppressor_.device(index, nowMs());
+        analyzeUsage(alerts, Metric::Cpu, sample.cpu_usage, device_thresholds[0], outgoing);
+        analyzeUsage(alerts, Metric::Memory, sample.memory_usage, device_thresholds[1], outgoing);
+        analyzeUsage(alerts, Metric::Disk, sample.disk_usage, device_thresholds[2], outgoing);
         
-        // Update timestamp
-        if (metrics.contains("timestamp")) {
-            state.last_hw_update = metrics["timestamp"].get<std::string>();
-        } else {
-            // Generate timestamp if not provided
-            auto now = std::chrono::system_clock::now();
-            auto now_time = std::chrono::system_clock::to_time_t(now);
-            std::stringstream ss;
-            ss << std::put_time(std::localtime(&now_time), "%Y-%m-%d %H:%M:%S");
-            state.last_hw_update = ss.str();
-        }
-    } catch (const std::exception& e) {
+        // Everything else is configured as alert rules
+        evaluateRules(index, alerts, rule_sample, outgoing);
     }
+    sendAlerts(device_id, outgoing);
 }
 
-void MetricsAnalyzer::processSoftwareMetrics(const std::string& device_id, const nlohmann::json& metrics) {
-    std::lock_guard<std::mutex> lock(devices_mutex_);
+void MetricsAnalyzer::processSoftwareMetrics(const SoftwareSample& sample) {
+    const std::string& device_id = sample.device_id;
     
-    // Check if device exists in our map, if not, initialize it
-    if (device_states_.find(device_id) == device_states_.end()) {
-        device_states_[device_id] = DeviceState();
+    uint32_t index = device_states_.intern(device_id);
+    if (index != DeviceStateStore::NO_DEVICE) {
+        device_states_.updateSoftware(index, sample);
     }
     
-    // Get reference to the device state
-    DeviceState& state = device_states_[device_id];
+    DevicePresence::Status was = presence_.seen(index, nowMs());
+    if (was == DevicePresence::Status::Stale || was == DevicePresence::Status::Offline) {
+        sendPresenceAlert(device_id, was, DevicePresence::Status::Online, 0);
+    }
     
-    // Update device state with new software metrics
-    try {
-        if (metrics.contains("ip_address")) {
-            state.ip_address = metrics["ip_address"].get<std::string>();
-        }
-        
-        if (metrics.contains("network_status")) {
-            state.network_status = metrics["network_status"].get<std::string>();
-            analyzeNetworkStatus(device_id, state.network_status);
-        }
-        
-        if (metrics.contains("services")) {
-            // Clear previous services state
-            state.services.clear();
-            
-            // Update with new services state
-            auto services = metrics["services"];
-            for (auto& [service, status] : services.items()) {
-                state.services[service] = status.get<std::string>();
-            }
-            
-            analyzeServices(device_id, state.services);
-        }
-        
-        // Update timestamp
-        if (metrics.contains("timestamp")) {
-            state.last_sw_update = metrics["timestamp"].get<std::string>();
-        } else {
-            // Generate timestamp if not provided
-            auto now = std::chrono::system_clock::now();
-            auto now_time = std::chrono::system_clock::to_time_t(now);
-            std::stringstream ss;
-            ss << std::put_time(std::localtime(&now_time), "%Y-%m-%d %H:%M:%S");
-            state.last_sw_update = ss.str();
-        }
-    } catch (const std::exception& e) {
+    AlertRuleSet::Sample rule_sample;
+    rule_sample.source = AlertRuleSet::Source::Software;
+    rule_sample.software = &sample;
+    
+    std::vector<PendingAlert> outgoing;
+    {
+        auto alerts = alert_suppressor_.device(index, nowMs());
+        evaluateRules(index, alerts, rule_sample, outgoing);
     }
+    sendAlerts(device_id, outgoing);
 }
 
-MetricsAnalyzer::DeviceState MetricsAnalyzer::getDeviceState(const std::string& device_id) {
-    std::lock_guard<std::mutex> lock(devices_mutex_);
-    
-    if (device_states_.find(device_id) != device_states_.end()) {
-        return device_states_[device_id];
+void MetricsAnalyzer::restoreDeviceState(const HardwareSample& hardware, const SoftwareSample& software) {
+    uint32_t index = device_states_.intern(hardware.device_id);
+    if (index == DeviceStateStore::NO_DEVICE) {
+        return;
     }
-    
+    if (hardware.timestamp_ms) {
+        device_states_.updateHardware(index, hardware);
+    }
+    if (software.timestamp_ms) {
+        device_states_.updateSoftware(index, software);
+    }
+}
+
+MetricsAnalyzer::DeviceState MetricsAnalyzer::getDeviceState(const std::string& device_id) const {
     // Return empty state if device not found
-    return DeviceState();
+    DeviceState state;
+    device_states_.get(device_id, state);
+    return state;
 }
 
-std::vector<std::string> MetricsAnalyzer::getAllDeviceIds() {
-    std::lock_guard<std::mutex> lock(devices_mutex_);
-    
+std::vector<std::string> MetricsAnalyzer::getAllDeviceIds() const {
+    return device_states_.deviceIds();
+}
+
+bool MetricsAnalyzer::getMetricStatistics(const std::string& device_id, DeviceStateStore::Metric metric,
+                                          MetricStatistics::Summary& summary) const {
+    uint32_t index = device_states_.find(device_id);
+    return index != DeviceStateStore::NO_DEVICE && statistics_.summary(index, metric, summary);
+}
+
+bool MetricsAnalyzer::getDevicePresence(const std::string& device_id, DevicePresence::Presence& presence) const {
+    return presence_.get(device_states_.find(device_id), nowMs(), presence);
+}
+
+std::vector<std::string> MetricsAnalyzer::getDevicesByPresence(DevicePresence::Status status) const {
     std::vector<std::string> device_ids;
-    device_ids.reserve(device_states_.size());
-    
-    for (const auto& [id, _] : device_states_) {
-        device_ids.push_back(id);
+    for (uint32_t index : presence_.devices(status)) {
+        device_ids.emplace_back(device_states_.deviceId(index));
     }
-    
+    std::sort(device_ids.begin(), device_ids.end());
     return device_ids;
 }
 
-void MetricsAnalyzer::analyzeCpuUsage(const std::string& device_id, const std::string& cpu_usage) {
-    float usage = extractPercentage(cpu_usage);
+bool MetricsAnalyzer::loadThresholds(const std::string& path, std::shared_ptr<MySQLConnectionPool> pool) {
+    return thresholds_.load(path, std::move(pool));
+}
+
+bool MetricsAnalyzer::loadAlertRules(const std::string& path) {
+    return alert_rules_.load(path);
+}
 
-    if (std::isnan(usage)) {
-        return;  // Invalid value, skip analysis
-    }
+void MetricsAnalyzer::startReload(std::chrono::seconds interval) {
+    // Devices already past a changed threshold are alerted right away
+    thresholds_.start(interval, [this]() { sweepThresholds(); });
+    alert_rules_.start(interval);
+}
 
-    float warning_threshold = thresholds_["cpu"]["warning"].get<float>();
-    float critical_threshold = thresholds_["cpu"]["critical"].get<float>();
-
-    if (usage >= critical_threshold) {
-        // Send critical alert with a single simple corrective command
-        alert_manager_->sendAlert(
-            device_id,
-            AlertManager::AlertSeverity::CRITICAL,
-            "HIGH_CPU_USAGE",
-            "CPU usage is critically high: " + cpu_usage,
-            "Check for runaway processes or resource leaks",
-            "top -b -n 1 | head -20"
-        );
-    } else if (usage >= warning_threshold) {
-        // Send warning alert (no corrective command)
-        alert_manager_->sendAlert(
-            device_id,
-            AlertManager::AlertSeverity::WARNING,
-            "ELEVATED_CPU_USAGE",
-            "CPU usage is elevated: " + cpu_usage,
-            "Monitor system performance and check active processes"
-            // No corrective command
-        );
-    }
+void MetricsAnalyzer::stopReload() {
+    thresholds_.stop();
+    alert_rules_.stop();
 }
 
-void MetricsAnalyzer::analyzeMemoryUsage(const std::string& device_id, const std::string& memory_usage) {
-    float usage = extractPercentage(memory_usage);
+void MetricsAnalyzer::startPresence() {
+    presence_.start([this](const std::vector<DevicePresence::Transition>& transitions) {
+        for (const auto& transition : transitions) {
+            sendPresenceAlert(std::string(device_states_.deviceId(transition.device)), transition.from, transition.to,
+                              transition.silent_ms);
+        }
+    });
+}
 
-    if (std::isnan(usage)) {
-        return;  // Invalid value, skip analysis
-    }
+void MetricsAnalyzer::stopPresence() {
+    presence_.stop();
+}
 
-    float warning_threshold = thresholds_["memory"]["warning"].get<float>();
-    float critical_threshold = thresholds_["memory"]["critical"].get<float>();
-
-    if (usage >= critical_threshold) {
-        // Send critical alert with a single simple corrective command
-        alert_manager_->sendAlert(
-            device_id,
-            AlertManager::AlertSeverity::CRITICAL,
-            "HIGH_MEMORY_USAGE",
-            "Memory usage is critically high: " + memory_usage,
-            "Check for memory leaks or increase available memory",
-            "free -m"
-        );
-    } else if (usage >= warning_threshold) {
-        // Send warning alert (no corrective command)
-        alert_manager_->sendAlert(
-            device_id,
-            AlertManager::AlertSeverity::WARNING,
-            "ELEVATED_MEMORY_USAGE",
-            "Memory usage is elevated: " + memory_usage,
-            "Monitor memory consumption and identify memory-intensive processes"
-            // No corrective command
-        );
+FleetThresholdSweep::Result MetricsAnalyzer::sweepThresholds() {
+    auto thresholds = thresholds_.current();
+    std::lock_guard<std::mutex> lock(sweep_mutex_);
+    auto result = sweep_.run(device_states_, *thresholds);
+    
+    // Rising transitions raise the same alerts as a sample would
+    int64_t now_ms = nowMs();
+    for (const auto& transition : result.transitions) {
+        if (transition.to <= transition.from) {
+            continue;
+        }
+        std::vector<PendingAlert> outgoing;
+        {
+            auto alerts = alert_suppressor_.device(transition.device, now_ms);
+            analyzeUsage(alerts, transition.metric, transition.value,
+                         thresholds->get(transition.device, transition.metric), outgoing);
+        }
+        sendAlerts(std::string(device_states_.deviceId(transition.device)), outgoing);
     }
+    return result;
 }
 
-void MetricsAnalyzer::analyzeDiskUsage(const std::string& device_id, const std::string& disk_usage) {
-    float usage = extractPercentage(disk_usage);
+void MetricsAnalyzer::analyzeCpuUsage(const std::string& device_id, double usage) {
+    analyzeUsage(device_id, DeviceStateStore::Metric::Cpu, usage);
+}
 
-    if (std::isnan(usage)) {
-        return;  // Invalid value, skip analysis
-    }
+void MetricsAnalyzer::analyzeMemoryUsage(const std::string& device_id, double usage) {
+    analyzeUsage(device_id, DeviceStateStore::Metric::Memory, usage);
+}
 
-    float warning_threshold = thresholds_["disk"]["warning"].get<float>();
-    float critical_threshold = thresholds_["disk"]["critical"].get<float>();
-
-    if (usage >= critical_threshold) {
-        // Send critical alert with a single simple corrective command
-        alert_manager_->sendAlert(
-            device_id,
-            AlertManager::AlertSeverity::CRITICAL,
-            "HIGH_DISK_USAGE",
-            "Disk usage is critically high: " + disk_usage,
-            "Free up disk space immediately or expand storage",
-            "df -h"
-        );
-    } else if (usage >= warning_threshold) {
-        // Send warning alert (no corrective command)
-        alert_manager_->sendAlert(
-            device_id,
-            AlertManager::AlertSeverity::WARNING,
-            "ELEVATED_DISK_USAGE",
-            "Disk usage is elevated: " + disk_usage,
-            "Cleanup unnecessary files or plan for storage expansion"
-            // No corrective command
-        );
-    }
+void MetricsAnalyzer::analyzeDiskUsage(const std::string& device_id, double usage) {
+    analyzeUsage(device_id, DeviceStateStore::Metric::Disk, usage);
 }
 
-void MetricsAnalyzer::analyzeUsbState(const std::string& device_id, const std::string& usb_state) {
-    if (usb_state != "none") {
-        if (usb_state.find("1d6b") == std::string::npos) {
-            std::cout << "[ALERT] USB peripheral detected on device " << device_id << std::endl;
-
-            if (alert_manager_) {
-            // Informational alert for USB connection
-            alert_manager_->sendAlert(
-                device_id,
-                AlertManager::AlertSeverity::INFO,
-                "USB_CONNECTED",
-                "USB device connected",
-                "You are not autorised to use extra USB peripheral "        );
-                }
-            }
-        }
+void MetricsAnalyzer::analyzeUsage(const std::string& device_id, DeviceStateStore::Metric metric, double usage) {
+    uint32_t index = device_states_.find(device_id);
+    MetricThreshold threshold = thresholds_.current()->get(index, metric);
+    
+    std::vector<PendingAlert> outgoing;
+    {
+        auto alerts = alert_suppressor_.device(index, nowMs());
+        analyzeUsage(alerts, metric, usage, threshold, outgoing);
     }
+    sendAlerts(device_id, outgoing);
+}
 
+namespace {
 
-void MetricsAnalyzer::analyzeGpioState(const std::string& device_id, int current_gpio_state, int previous_gpio_state) {
-    if (current_gpio_state != previous_gpio_state) {
-        std::cout << "[ALERT] New GPIO state detected on device " << device_id << std::endl;
+// Alerts of one usage metric; critical ones come with a single simple
+// corrective command, warnings with none
+struct UsageAlerts {
+    std::string key;
+    const char* critical_type;
+    const char* critical_description;
+    const char* critical_recommendation;
+    const char* command;
+    const char* warning_type;
+    const char* warning_description;
+    const char* warning_recommendation;
+};
 
-        alert_manager_->sendAlert(
-            device_id,
-            AlertManager::AlertSeverity::INFO,
-            "NEW_GPIO_DETECTED",
-            "New GPIO pins detected",
-            "Check the GPIO configuration"
-        );
+const UsageAlerts USAGE_ALERTS[DeviceStateStore::METRIC_COUNT] = {
+    {"cpu",
+     "HIGH_CPU_USAGE", "CPU usage is critically high: ", "Check for runaway processes or resource leaks",
+     "top -b -n 1 | head -20",
+     "ELEVATED_CPU_USAGE", "CPU usage is elevated: ", "Monitor system performance and check active processes"},
+    {"memory",
+     "HIGH_MEMORY_USAGE", "Memory usage is critically high: ", "Check for memory leaks or increase available memory",
+     "free -m",
+     "ELEVATED_MEMORY_USAGE", "Memory usage is elevated: ",
+     "Monitor memory consumption and identify memory-intensive processes"},
+    {"disk",
+     "HIGH_DISK_USAGE", "Disk usage is critically high: ", "Free up disk space immediately or expand storage",
+     "df -h",
+     "ELEVATED_DISK_USAGE", "Disk usage is elevated: ", "Cleanup unnecessary files or plan for storage expansion"},
+};
+
+AlertSuppressor::Level ruleLevel(AlertRuleSet::Severity severity) {
+    switch (severity) {
+        case AlertRuleSet::Severity::Info:     return AlertSuppressor::INFO;
+        case AlertRuleSet::Severity::Warning:  return AlertSuppressor::WARNING;
+        case AlertRuleSet::Severity::Critical: return AlertSuppressor::CRITICAL;
     }
+    return AlertSuppressor::WARNING;
 }
 
+} // namespace
+
+void MetricsAnalyzer::analyzeUsage(AlertSuppressor::Device& alerts, DeviceStateStore::Metric metric, double usage,
+                                   const MetricThreshold& threshold, std::vector<PendingAlert>& outgoing) {
+    if (std::isnan(usage)) {
+        return;  // Invalid value, skip analysis
+    }
+    
+    const UsageAlerts& texts = USAGE_ALERTS[static_cast<size_t>(metric)];
+    AlertSuppressor::Level level = alerts.metricLevel(texts.key, static_cast<float>(usage), threshold);
+    auto decision = alerts.observe(texts.key, level, level == AlertSuppressor::CRITICAL);
+    if (!decision.send) {
+        return;
+    }
+    
+    if (level == AlertSuppressor::CRITICAL) {
+        outgoing.push_back({level, texts.critical_type, texts.critical_description + formatPercentage(usage),
+                            texts.critical_recommendation, decision.with_command ? texts.command : ""});
+    } else {
+        outgoing.push_back({level, texts.warning_type, texts.warning_description + formatPercentage(usage),
+                            texts.warning_recommendation, ""});
+    }
+}
 
-void MetricsAnalyzer::analyzeServices(const std::string& device_id, const std::map<std::string, std::string>& services) {
-    std::vector<std::string> essential_services = {"mossquito", "ssh"}; // Define essential services
+void MetricsAnalyzer::evaluateRules(uint32_t index, AlertSuppressor::Device& alerts,
+                                    const AlertRuleSet::Sample& sample, std::vector<PendingAlert>& outgoing) {
+    // The rules live as long as their rule set is held
+    std::vector<const AlertRuleSet::Rule*> fired;
+    std::vector<const AlertRuleSet::Rule*> cleared;
+    auto rules = alert_rules_.evaluate(index, sample, fired, &cleared);
     
-    for (const auto& service_name : essential_services) {
-        auto it = services.find(service_name);
-        if (it != services.end()) {
-            if (it->second == "inactive") {
-                alert_manager_->sendAlert(
-                    device_id,
-                    AlertManager::AlertSeverity::CRITICAL,
-                    "SERVICE_DOWN",
-                    "Service " + service_name + " is inactive",
-                    "Check service logs and attempt to restart the service",
-                    "sudo systemctl restart " + service_name // <-- commande corrective
-                );
-            }
-        } else {
-            // Service not found, consider it inactive
-            alert_manager_->sendAlert(
-                device_id,
-                AlertManager::AlertSeverity::CRITICAL,
-                "SERVICE_DOWN",
-                "Service " + service_name + " is not found",
-                "Check service configuration and ensure it is running",
-                "sudo systemctl restart " + service_name // <-- commande corrective
-            );
+    for (const auto* rule : fired) {
+        auto decision = alerts.observe(rule->key, ruleLevel(rule->severity), !rule->command.empty());
+        if (decision.send) {
+            outgoing.push_back({ruleLevel(rule->severity), rule->type, rule->description, rule->recommendation,
+                                decision.with_command ? rule->command : ""});
         }
     }
+    for (const auto* rule : cleared) {
+        alerts.observe(rule->key, AlertSuppressor::CLEAR, false);
+    }
 }
-void MetricsAnalyzer::analyzeNetworkStatus(const std::string& device_id, const std::string& status) {
-    if (status == "inreachable") {
-        alert_manager_->sendAlert(
-            device_id,
-            AlertManager::AlertSeverity::CRITICAL,
-            "NETWORK_UNREACHABLE",
-            "Device network status reported as 'inreachable'",
-            "Verify network interfaces and ensure connectivity to the device"
-        );
+
+void MetricsAnalyzer::sendAlerts(const std::string& device_id, const std::vector<PendingAlert>& outgoing) {
+    for (const auto& alert : outgoing) {
+        AlertManager::AlertSeverity severity = AlertManager::AlertSeverity::INFO;
+        if (alert.level == AlertSuppressor::WARNING) {
+            severity = AlertManager::AlertSeverity::WARNING;
+        } else if (alert.level == AlertSuppressor::CRITICAL) {
+            severity = AlertManager::AlertSeverity::CRITICAL;
+        }
+        alert_manager_->sendAlert(device_id, severity, alert.type, alert.description, alert.recommendation,
+                                  alert.command);
     }
 }
 
-                                    
+void MetricsAnalyzer::sendPresenceAlert(const std::string& device_id, DevicePresence::Status from,
+                                        DevicePresence::Status to, int64_t silent_ms) {
+    // Transitions are rare by construction, so they bypass the suppressor
+    std::string silence = "No samples for " + std::to_string(silent_ms / 1000) + "s";
+    switch (to) {
+        case DevicePresence::Status::Stale:
+            alert_manager_->sendAlert(device_id, AlertManager::AlertSeverity::WARNING, "DEVICE_STALE",
+                                      silence + ", longer than the device usually takes",
+                                      "Check the device's network connection");
+            break;
+        case DevicePresence::Status::Offline:
+            alert_manager_->sendAlert(device_id, AlertManager::AlertSeverity::CRITICAL, "DEVICE_OFFLINE",
+                                      silence + ", the device is considered offline",
+                                      "Check that the device is powered and reachable");
+            break;
+        case DevicePresence::Status::Online:
+            alert_manager_->sendAlert(device_id, AlertManager::AlertSeverity::INFO, "DEVICE_ONLINE",
+                                      std::string("Device is reporting again after being ") +
+                                          (from == DevicePresence::Status::Offline ? "offline" : "stale"),
+                                      "No action needed");
+            break;
+        default:
+            break;
+    }
+}
 
+int64_t MetricsAnalyzer::nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
-float MetricsAnalyzer::extractPercentage(const std::string& percentage_str) {
-    try {
-        // Remove '%' character if present
-        std::string clean_str = percentage_str;
-        size_t percent_pos = clean_str.find('%');
-        if (percent_pos != std::string::npos) {
-            clean_str = clean_str.substr(0, percent_pos);
-        }
-        
-        // Convert to float
-        return std::stof(clean_str);
-    } catch (const std::exception& e) {
-        std::cerr << "Error extracting percentage from string '" << percentage_str 
-                  << "': " << e.what() << std::endl;
-        return std::nanf("");
-    }
+std::string MetricsAnalyzer::formatPercentage(double value) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.2f%%", value);
+    return buffer;
 }
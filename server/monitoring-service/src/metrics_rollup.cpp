@@ -0,0 +1,235 @@
+#include "metrics_rollup.h"
+#include <algorithm>
+#include <cmath>
+
+void PercentDistribution::add(double value) {
+    if (std::isnan(value)) {
+        return;
+    }
+
+    size_t bin = static_cast<size_t>(std::clamp(value, 0.0, 100.0));
+    bins_[bin]++;
+
+    if (count_ == 0) {
+        min_ = max_ = value;
+    } else {
+        min_ = std::min(min_, value);
+        max_ = std::max(max_, value);
+    }
+    count_++;
+    sum_ += value;
+}
+
+void PercentDistribution::merge(const PercentDistribution& other) {
+    if (other.count_ == 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < BINS; i++) {
+        bins_[i] += other.bins_[i];
+    }
+
+    if (count_ == 0) {
+        min_ = other.min_;
+        max_ = other.max_;
+    } else {
+        min_ = std::min(min_, other.min_);
+        max_ = std::max(max_, other.max_);
+    }
+    count_ += other.count_;
+    sum_ += other.sum_;
+}
+
+double PercentDistribution::percentile(double q) const {
+    if (count_ == 0) {
+        return std::nan("");
+    }
+
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * count_)));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BINS; i++) {
+        seen += bins_[i];
+        if (seen >= rank) {
+            // Upper edge of the bin, within the observed range
+            return std::clamp(static_cast<double>(i + 1), min_, max_);
+        }
+    }
+    return max_;
+}
+
+void PercentDistribution::encodeBins(std::string& out) const {
+    uint8_t used = 0;
+    for (uint32_t count : bins_) {
+        if (count) used++;
+    }
+
+    out.push_back(static_cast<char>(used));
+    for (size_t i = 0; i < BINS; i++) {
+        uint32_t count = bins_[i];
+        if (!count) continue;
+
+        out.push_back(static_cast<char>(i));
+        for (int shift = 0; shift < 32; shift += 8) {
+            out.push_back(static_cast<char>((count >> shift) & 0xFF));
+        }
+    }
+}
+
+bool PercentDistribution::decode(const char*& data, const char* end, double min, double max, double avg) {
+    if (data >= end) {
+        return false;
+    }
+
+    *this = PercentDistribution();
+    size_t used = static_cast<uint8_t>(*data++);
+    for (size_t i = 0; i < used; i++) {
+        if (end - data < 5) {
+            return false;
+        }
+
+        size_t bin = static_cast<uint8_t>(*data++);
+        uint32_t count = 0;
+        for (int shift = 0; shift < 32; shift += 8) {
+            count |= static_cast<uint32_t>(static_cast<uint8_t>(*data++)) << shift;
+        }
+        if (bin >= BINS) {
+            return false;
+        }
+        bins_[bin] = count;
+        count_ += count;
+    }
+
+    if (count_ > 0) {
+        min_ = min;
+        max_ = max;
+        sum_ = avg * count_;
+    }
+    return true;
+}
+
+std::string MetricsRollup::Bucket::encodeHistogram() const {
+    std::string out;
+    cpu.encodeBins(out);
+    memory.encodeBins(out);
+    disk.encodeBins(out);
+    return out;
+}
+
+bool MetricsRollup::Bucket::mergeStored(uint64_t stored_samples, const std::string& histogram,
+                                        const std::array<double, 9>& min_max_avg) {
+    const char* data = histogram.data();
+    const char* end = data + histogram.size();
+
+    PercentDistribution stored[3];
+    for (size_t i = 0; i < 3; i++) {
+        if (!stored[i].decode(data, end, min_max_avg[i * 3], min_max_avg[i * 3 + 1], min_max_avg[i * 3 + 2])) {
+            return false;
+        }
+    }
+
+    cpu.merge(stored[0]);
+    memory.merge(stored[1]);
+    disk.merge(stored[2]);
+    samples += stored_samples;
+    return true;
+}
+
+int64_t MetricsRollup::resolutionMs(Level level) {
+    switch (level) {
+        case Minute: return 60LL * 1000;
+        case Hour: return 3600LL * 1000;
+        default: return 86400LL * 1000;
+    }
+}
+
+const char* MetricsRollup::tableName(Level level) {
+    switch (level) {
+        case Minute: return "metrics_rollup_1m";
+        case Hour: return "metrics_rollup_1h";
+        default: return "metrics_rollup_1d";
+    }
+}
+
+MetricsRollup::MetricsRollup(int64_t started_ms) {
+    stored_before_.fill(started_ms);
+}
+
+void MetricsRollup::add(const HardwareSample& sample) {
+    if (std::isnan(sample.cpu_usage) && std::isnan(sample.memory_usage) && std::isnan(sample.disk_usage)) {
+        return;
+    }
+
+    for (size_t i = 0; i < LevelCount; i++) {
+        Level level = static_cast<Level>(i);
+        int64_t resolution = resolutionMs(level);
+        int64_t start = sample.timestamp_ms - sample.timestamp_ms % resolution;
+
+        auto [it, created] = buckets_[level].try_emplace(Key(sample.device_id, start));
+        Bucket& bucket = it->second;
+        if (created) {
+            bucket.device_id = sample.device_id;
+            bucket.start_ms = start;
+            bucket.loaded = start >= stored_before_[level];
+        }
+
+        bucket.samples++;
+        bucket.cpu.add(sample.cpu_usage);
+        bucket.memory.add(sample.memory_usage);
+        bucket.disk.add(sample.disk_usage);
+        bucket.dirty = true;
+    }
+}
+
+std::vector<MetricsRollup::Bucket*> MetricsRollup::bucketsToLoad(Level level) {
+    std::vector<Bucket*> result;
+    for (auto& [key, bucket] : buckets_[level]) {
+        if (!bucket.loaded) {
+            result.push_back(&bucket);
+        }
+    }
+    return result;
+}
+
+std::vector<const MetricsRollup::Bucket*> MetricsRollup::dirtyBuckets(Level level) const {
+    std::vector<const Bucket*> result;
+    for (const auto& [key, bucket] : buckets_[level]) {
+        if (bucket.dirty) {
+            result.push_back(&bucket);
+        }
+    }
+    return result;
+}
+
+void MetricsRollup::markWritten() {
+    for (auto& level : buckets_) {
+        for (auto& [key, bucket] : level) {
+            bucket.dirty = false;
+        }
+    }
+}
+
+void MetricsRollup::evict(int64_t now_ms) {
+    for (size_t i = 0; i < LevelCount; i++) {
+        int64_t resolution = resolutionMs(static_cast<Level>(i));
+
+        for (auto it = buckets_[i].begin(); it != buckets_[i].end();) {
+            const Bucket& bucket = it->second;
+            int64_t end = bucket.start_ms + resolution;
+            if (!bucket.dirty && bucket.loaded && end + resolution < now_ms) {
+                // Late samples for this bucket continue from the stored row
+                stored_before_[i] = std::max(stored_before_[i], end);
+                it = buckets_[i].erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+}
+
+size_t MetricsRollup::bucketCount() const {
+    size_t count = 0;
+    for (const auto& level : buckets_) {
+        count += level.size();
+    }
+    return count;
+}
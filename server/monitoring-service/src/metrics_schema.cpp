@@ -0,0 +1,720 @@
+#include "metrics_schema.h"
+#include "threshold_manager.h"
+#include <iostream>
+#include <ctime>
+#include <stdexcept>
+#include <cstdlib>
+
+// Tables range-partitioned by day on their ts column
+static const char* const PARTITIONED_TABLES[] = {
+    "hardware_info", "software_info", "software_services", "software_applications", "metrics_rollup_1m"
+};
+
+// Partition receiving rows past the last daily partition
+static const char* const FUTURE_PARTITION = "p_future";
+
+static const int64_t SECONDS_PER_DAY = 86400;
+
+using ColumnType = ColumnarArchive::ColumnType;
+
+struct ArchivedColumn {
+    const char* name;
+    const char* select;
+    ColumnType type;
+};
+
+// Columns exported from expired partitions; dictionary ids are resolved to
+// their text so archive files stand on their own
+struct ArchivedTable {
+    const char* table;
+    const char* joins;
+    std::vector<ArchivedColumn> columns;
+};
+
+static const std::vector<ArchivedTable>& archivedTables() {
+    static const std::vector<ArchivedTable> tables = {
+        {"hardware_info",
+         "LEFT JOIN attribute_dictionary du ON du.id = t.usb_state_id "
+         "LEFT JOIN attribute_dictionary dk ON dk.id = t.kernel_version_id "
+         "LEFT JOIN attribute_dictionary dm ON dm.id = t.hardware_model_id "
+         "LEFT JOIN attribute_dictionary df ON df.id = t.firmware_version_id",
+         {{"device_id", "t.device_id", ColumnType::Text},
+          {"ts", "TIMESTAMPDIFF(MICROSECOND, '1970-01-01', t.ts) DIV 1000", ColumnType::Timestamp},
+          {"cpu_usage", "t.cpu_usage", ColumnType::Percent},
+          {"memory_usage", "t.memory_usage", ColumnType::Percent},
+          {"disk_usage", "t.disk_usage", ColumnType::Percent},
+          {"usb_state", "COALESCE(du.value, t.usb_state)", ColumnType::Text},
+          {"gpio_state", "t.gpio_state", ColumnType::Integer},
+          {"kernel_version", "COALESCE(dk.value, t.kernel_version)", ColumnType::Text},
+          {"hardware_model", "COALESCE(dm.value, t.hardware_model)", ColumnType::Text},
+          {"firmware_version", "COALESCE(df.value, t.firmware_version)", ColumnType::Text}}},
+        {"software_info",
+         "LEFT JOIN attribute_dictionary dos ON dos.id = t.os_version_id "
+         "LEFT JOIN attribute_dictionary da ON da.id = t.applications_id "
+         "LEFT JOIN attribute_dictionary ds ON ds.id = t.services_id",
+         {{"device_id", "t.device_id", ColumnType::Text},
+          {"ts", "TIMESTAMPDIFF(MICROSECOND, '1970-01-01', t.ts) DIV 1000", ColumnType::Timestamp},
+          {"ip_address", "t.ip_address", ColumnType::Text},
+          {"uptime", "t.uptime", ColumnType::Text},
+          {"network_status", "t.network_status", ColumnType::Text},
+          {"os_version", "COALESCE(dos.value, t.os_version)", ColumnType::Text},
+          {"applications", "da.value", ColumnType::Text},
+          {"services", "ds.value", ColumnType::Text}}},
+    };
+    return tables;
+}
+
+static const ArchivedTable* archivedTable(const std::string& table) {
+    for (const auto& archived : archivedTables()) {
+        if (table == archived.table) return &archived;
+    }
+    return nullptr;
+}
+
+MetricsSchema::MetricsSchema(std::shared_ptr<MySQLConnectionPool> pool, const RetentionOptions& options,
+                             std::shared_ptr<ColumnarArchive> archive)
+    : pool_(std::move(pool)), options_(options), archive_(std::move(archive)), running_(false) {
+    if (!pool_) {
+        throw std::invalid_argument("MetricsSchema requires a connection pool");
+    }
+    if (options_.partitions_ahead < 1) options_.partitions_ahead = 1;
+}
+
+MetricsSchema::~MetricsSchema() {
+    stop();
+}
+
+const std::vector<MetricsSchema::Migration>& MetricsSchema::migrations() {
+    static const std::vector<Migration> list = {
+        {1, "typed, time-partitioned metrics tables", &MetricsSchema::createPartitionedTables},
+        {2, "1 minute / 1 hour / 1 day metrics rollups", &MetricsSchema::createRollupTables},
+        {3, "unique (device_id, ts) sample keys", &MetricsSchema::addSampleKeys},
+        {4, "latest state of every device", &MetricsSchema::createLatestStateTable},
+        {5, "dictionary-encoded device attributes", &MetricsSchema::createAttributeDictionary},
+        {6, "per-scope threshold rules", &MetricsSchema::createThresholdRules},
+    };
+    return list;
+}
+
+int MetricsSchema::currentVersion() {
+    auto conn = pool_->acquire();
+    if (!conn) return -1;
+
+    StatementParams params;
+    std::vector<PreparedStatementCache::Row> rows;
+    if (!conn->statements().query("schema_version.current",
+                                  "SELECT COALESCE(MAX(version), 0) FROM schema_version", params, rows) ||
+        rows.empty()) {
+        return -1;
+    }
+    return std::stoi(rows[0][0]);
+}
+
+bool MetricsSchema::migrate() {
+    {
+        auto conn = pool_->acquire();
+        if (!conn) return false;
+
+        const char* create_version_table =
+            "CREATE TABLE IF NOT EXISTS schema_version ("
+            "version INT PRIMARY KEY,"
+            "description VARCHAR(255),"
+            "applied_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP"
+            ")";
+        if (!conn->execute(create_version_table)) {
+            std::cerr << "Failed to create schema_version table" << std::endl;
+            return false;
+        }
+    }
+
+    int version = currentVersion();
+    if (version < 0) {
+        std::cerr << "Failed to read the metrics schema version" << std::endl;
+        return false;
+    }
+
+    for (const auto& migration : migrations()) {
+        if (migration.version <= version) {
+            continue;
+        }
+
+        auto conn = pool_->acquire();
+        if (!conn) return false;
+
+        std::cout << "Applying metrics schema version " << migration.version << ": "
+                  << migration.description << std::endl;
+        if (!(this->*migration.apply)(*conn)) {
+            std::cerr << "Metrics schema migration " << migration.version << " failed" << std::endl;
+            return false;
+        }
+
+        int32_t applied = migration.version;
+        std::string description = migration.description;
+        StatementParams params(2);
+        params.add(applied).add(description);
+        if (!conn->statements().execute("schema_version.insert",
+                                        "INSERT INTO schema_version (version, description) VALUES (?, ?)",
+                                        params)) {
+            return false;
+        }
+        version = migration.version;
+    }
+
+    std::cout << "Metrics schema at version " << version << std::endl;
+    return true;
+}
+
+bool MetricsSchema::createPartitionedTables(MySQLConnection& conn) {
+    // Tables of pre-versioning builds are kept aside; recent rows are copied
+    // below. Every step can run again after a migration that failed halfway:
+    // a table is only renamed while no _legacy table exists.
+    for (const char* table : {"hardware_info", "software_info"}) {
+        std::string name = table;
+        if (tableExists(conn, name) && !tableExists(conn, name + "_legacy") &&
+            !conn.execute("RENAME TABLE " + name + " TO " + name + "_legacy")) {
+            return false;
+        }
+    }
+
+    // Every unique key of a partitioned table has to include ts
+    std::string partitions = initialPartitions();
+
+    std::string create_hw_table =
+        "CREATE TABLE IF NOT EXISTS hardware_info ("
+        "id BIGINT NOT NULL AUTO_INCREMENT,"
+        "device_id VARCHAR(128) NOT NULL,"
+        "ts DATETIME(3) NOT NULL,"
+        "cpu_usage DECIMAL(5,2) NULL,"
+        "memory_usage DECIMAL(5,2) NULL,"
+        "disk_usage DECIMAL(5,2) NULL,"
+        "usb_state TEXT NULL,"
+        "gpio_state INT NULL,"
+        "kernel_version VARCHAR(64),"
+        "hardware_model VARCHAR(128),"
+        "firmware_version VARCHAR(128),"
+        "created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,"
+        "PRIMARY KEY (id, ts),"
+        "KEY idx_device_ts (device_id, ts)"
+        ") " + partitions;
+
+    std::string create_sw_table =
+        "CREATE TABLE IF NOT EXISTS software_info ("
+        "id BIGINT NOT NULL AUTO_INCREMENT,"
+        "device_id VARCHAR(128) NOT NULL,"
+        "ts DATETIME(3) NOT NULL,"
+        "ip_address VARCHAR(64),"
+        "uptime VARCHAR(64),"
+        "network_status VARCHAR(32),"
+        "os_version VARCHAR(128),"
+        "created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,"
+        "PRIMARY KEY (id, ts),"
+        "KEY idx_device_ts (device_id, ts)"
+        ") " + partitions;
+
+    // One row per service / application of a software sample, instead of
+    // "name:value;..." text blobs
+    std::string create_services_table =
+        "CREATE TABLE IF NOT EXISTS software_services ("
+        "device_id VARCHAR(128) NOT NULL,"
+        "ts DATETIME(3) NOT NULL,"
+        "service VARCHAR(128) NOT NULL,"
+        "status VARCHAR(32),"
+        "PRIMARY KEY (device_id, ts, service)"
+        ") " + partitions;
+
+    std::string create_apps_table =
+        "CREATE TABLE IF NOT EXISTS software_applications ("
+        "device_id VARCHAR(128) NOT NULL,"
+        "ts DATETIME(3) NOT NULL,"
+        "name VARCHAR(128) NOT NULL,"
+        "version VARCHAR(64),"
+        "PRIMARY KEY (device_id, ts, name)"
+        ") " + partitions;
+
+    if (!conn.execute(create_hw_table) || !conn.execute(create_sw_table) ||
+        !conn.execute(create_services_table) || !conn.execute(create_apps_table)) {
+        std::cerr << "Failed to create partitioned metrics tables" << std::endl;
+        return false;
+    }
+
+    bool legacy_hw = tableExists(conn, "hardware_info_legacy");
+    bool legacy_sw = tableExists(conn, "software_info_legacy");
+    if (!legacy_hw && !legacy_sw) {
+        return true;
+    }
+
+    // Nothing else writes these tables before version 1 is recorded, so rows
+    // in them were copied by an earlier attempt
+    StatementParams none;
+    std::vector<PreparedStatementCache::Row> copied;
+    if (!conn.statements().query("schema.legacy_copied",
+                                 "SELECT 1 FROM hardware_info UNION ALL SELECT 1 FROM software_info LIMIT 1",
+                                 none, copied)) {
+        return false;
+    }
+    if (!copied.empty()) {
+        return true;
+    }
+
+    // Copy what retention would keep. readable_date is the agent's local
+    // time in an unknown zone, so the sample time is the insertion time;
+    // application and service blobs stay in software_info_legacy.
+    // The cutoff is a UTC day and ts is stored in UTC, so created_at is read
+    // in UTC too.
+    std::string cutoff = dayString(today() - options_.retention_days);
+    const char* sample_time = "created_at";
+
+    std::string copy_hw =
+        std::string("INSERT INTO hardware_info (device_id, ts, cpu_usage, memory_usage, disk_usage, usb_state, "
+                    "gpio_state, kernel_version, hardware_model, firmware_version, created_at) "
+                    "SELECT device_id, ") + sample_time + ", cpu_usage, memory_usage, disk_usage, usb_state, "
+        "gpio_state, kernel_version, hardware_model, firmware_version, created_at "
+        "FROM hardware_info_legacy WHERE device_id IS NOT NULL AND created_at >= '" + cutoff + "'";
+
+    std::string copy_sw =
+        std::string("INSERT INTO software_info (device_id, ts, ip_address, uptime, network_status, os_version, created_at) "
+                    "SELECT device_id, ") + sample_time + ", ip_address, uptime, network_status, os_version, created_at "
+        "FROM software_info_legacy WHERE device_id IS NOT NULL AND created_at >= '" + cutoff + "'";
+
+    // Both tables are copied, or neither
+    bool ok = conn.execute("SET @legacy_time_zone = @@session.time_zone, time_zone = '+00:00'") &&
+              conn.execute("START TRANSACTION") &&
+              (!legacy_hw || conn.execute(copy_hw)) &&
+              (!legacy_sw || conn.execute(copy_sw)) &&
+              conn.execute("COMMIT");
+    if (!ok) {
+        std::cerr << "Failed to copy legacy metrics rows" << std::endl;
+        conn.execute("ROLLBACK");
+    }
+    conn.execute("SET time_zone = @legacy_time_zone");
+    return ok;
+}
+
+bool MetricsSchema::createRollupTables(MySQLConnection& conn) {
+    // ts is the start of the bucket. The histogram column holds the 1% bins
+    // the percentiles come from, so a bucket can be continued after a restart.
+    const char* columns =
+        "device_id VARCHAR(128) NOT NULL,"
+        "ts DATETIME NOT NULL,"
+        "samples INT UNSIGNED NOT NULL,"
+        "cpu_min DOUBLE NULL, cpu_max DOUBLE NULL, cpu_avg DOUBLE NULL, cpu_p95 DOUBLE NULL,"
+        "memory_min DOUBLE NULL, memory_max DOUBLE NULL, memory_avg DOUBLE NULL, memory_p95 DOUBLE NULL,"
+        "disk_min DOUBLE NULL, disk_max DOUBLE NULL, disk_avg DOUBLE NULL, disk_p95 DOUBLE NULL,"
+        "histogram BLOB NOT NULL,"
+        "PRIMARY KEY (device_id, ts)";
+
+    // Minute rollups follow the raw data retention, coarser ones are kept
+    std::string create_minute = std::string("CREATE TABLE IF NOT EXISTS metrics_rollup_1m (") + columns + ") " +
+                                initialPartitions();
+    std::string create_hour = std::string("CREATE TABLE IF NOT EXISTS metrics_rollup_1h (") + columns + ")";
+    std::string create_day = std::string("CREATE TABLE IF NOT EXISTS metrics_rollup_1d (") + columns + ")";
+
+    if (!conn.execute(create_minute) || !conn.execute(create_hour) || !conn.execute(create_day)) {
+        std::cerr << "Failed to create metrics rollup tables" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool MetricsSchema::addSampleKeys(MySQLConnection& conn) {
+    for (const char* table : {"hardware_info", "software_info"}) {
+        std::string name = table;
+
+        // Keep the first copy of every duplicated sample
+        std::string dedupe = "DELETE t FROM " + name + " t JOIN " + name + " k "
+                             "ON k.device_id = t.device_id AND k.ts = t.ts AND k.id < t.id";
+
+        // The unique key serves the range scans of the index it replaces
+        std::string rekey;
+        if (indexExists(conn, name, "idx_device_ts")) {
+            rekey = "DROP INDEX idx_device_ts";
+        }
+        if (!indexExists(conn, name, "uk_device_ts")) {
+            rekey += std::string(rekey.empty() ? "" : ", ") + "ADD UNIQUE KEY uk_device_ts (device_id, ts)";
+        }
+
+        if (!conn.execute(dedupe) || (!rekey.empty() && !conn.execute("ALTER TABLE " + name + " " + rekey))) {
+            std::cerr << "Failed to add the sample key of " << name << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MetricsSchema::createLatestStateTable(MySQLConnection& conn) {
+    // Newest hardware and software sample of each device, by sample time
+    const char* create_table =
+        "CREATE TABLE IF NOT EXISTS device_latest_state ("
+        "device_id VARCHAR(128) NOT NULL PRIMARY KEY,"
+        "hardware_ts DATETIME(3) NULL,"
+        "cpu_usage DECIMAL(5,2) NULL,"
+        "memory_usage DECIMAL(5,2) NULL,"
+        "disk_usage DECIMAL(5,2) NULL,"
+        "usb_state TEXT NULL,"
+        "gpio_state INT NULL,"
+        "kernel_version VARCHAR(64),"
+        "hardware_model VARCHAR(128),"
+        "firmware_version VARCHAR(128),"
+        "software_ts DATETIME(3) NULL,"
+        "ip_address VARCHAR(64),"
+        "uptime VARCHAR(64),"
+        "network_status VARCHAR(32),"
+        "os_version VARCHAR(128),"
+        "updated_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP ON UPDATE CURRENT_TIMESTAMP"
+        ")";
+
+    // Seed from the history once; (device_id, ts) is unique since version 3
+    const char* seed_hardware =
+        "INSERT INTO device_latest_state (device_id, hardware_ts, cpu_usage, memory_usage, disk_usage, usb_state, "
+        "gpio_state, kernel_version, hardware_model, firmware_version) "
+        "SELECT h.device_id, h.ts, h.cpu_usage, h.memory_usage, h.disk_usage, h.usb_state, h.gpio_state, "
+        "h.kernel_version, h.hardware_model, h.firmware_version FROM hardware_info h "
+        "JOIN (SELECT device_id, MAX(ts) AS ts FROM hardware_info GROUP BY device_id) latest "
+        "ON latest.device_id = h.device_id AND latest.ts = h.ts "
+        "ON DUPLICATE KEY UPDATE hardware_ts = VALUES(hardware_ts), cpu_usage = VALUES(cpu_usage), "
+        "memory_usage = VALUES(memory_usage), disk_usage = VALUES(disk_usage), usb_state = VALUES(usb_state), "
+        "gpio_state = VALUES(gpio_state), kernel_version = VALUES(kernel_version), "
+        "hardware_model = VALUES(hardware_model), firmware_version = VALUES(firmware_version)";
+
+    const char* seed_software =
+        "INSERT INTO device_latest_state (device_id, software_ts, ip_address, uptime, network_status, os_version) "
+        "SELECT s.device_id, s.ts, s.ip_address, s.uptime, s.network_status, s.os_version FROM software_info s "
+        "JOIN (SELECT device_id, MAX(ts) AS ts FROM software_info GROUP BY device_id) latest "
+        "ON latest.device_id = s.device_id AND latest.ts = s.ts "
+        "ON DUPLICATE KEY UPDATE software_ts = VALUES(software_ts), ip_address = VALUES(ip_address), "
+        "uptime = VALUES(uptime), network_status = VALUES(network_status), os_version = VALUES(os_version)";
+
+    if (!conn.execute(create_table) || !conn.execute(seed_hardware) || !conn.execute(seed_software)) {
+        std::cerr << "Failed to create device_latest_state" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool MetricsSchema::createAttributeDictionary(MySQLConnection& conn) {
+    // TEXT cannot be indexed whole, values are unique by their hash
+    const char* create_table =
+        "CREATE TABLE IF NOT EXISTS attribute_dictionary ("
+        "id INT UNSIGNED NOT NULL AUTO_INCREMENT PRIMARY KEY,"
+        "value MEDIUMTEXT NOT NULL,"
+        "value_hash BINARY(32) AS (UNHEX(SHA2(value, 256))) STORED NOT NULL,"
+        "UNIQUE KEY uk_value_hash (value_hash)"
+        ")";
+
+    if (!conn.execute(create_table)) {
+        std::cerr << "Failed to create attribute_dictionary" << std::endl;
+        return false;
+    }
+
+    // Rows reference the dictionary; the text columns stay for older rows and
+    // values that could not be interned, read them as COALESCE(d.value, text).
+    // Application lists and service maps are interned whole, as sorted JSON,
+    // instead of one software_applications / software_services row per entry.
+    static const std::pair<const char*, const char*> ID_COLUMNS[] = {
+        {"hardware_info", "usb_state_id"}, {"hardware_info", "kernel_version_id"},
+        {"hardware_info", "hardware_model_id"}, {"hardware_info", "firmware_version_id"},
+        {"software_info", "os_version_id"}, {"software_info", "applications_id"}, {"software_info", "services_id"},
+    };
+    for (const auto& [table, column] : ID_COLUMNS) {
+        if (!columnExists(conn, table, column) &&
+            !conn.execute(std::string("ALTER TABLE ") + table + " ADD COLUMN " + column + " INT UNSIGNED NULL")) {
+            std::cerr << "Failed to add " << table << "." << column << std::endl;
+            return false;
+        }
+    }
+
+    // Move the text of stored rows into the dictionary
+    static const std::pair<const char*, const char*> ENCODED_COLUMNS[] = {
+        {"hardware_info", "usb_state"}, {"hardware_info", "kernel_version"}, {"hardware_info", "hardware_model"},
+        {"hardware_info", "firmware_version"}, {"software_info", "os_version"},
+    };
+    for (const auto& [table, column] : ENCODED_COLUMNS) {
+        std::string t = table;
+        std::string c = column;
+        std::string intern = "INSERT IGNORE INTO attribute_dictionary (value) SELECT DISTINCT " + c + " FROM " + t +
+                             " WHERE " + c + " IS NOT NULL AND " + c + " <> ''";
+        std::string encode = "UPDATE " + t + " r JOIN attribute_dictionary d ON d.value_hash = UNHEX(SHA2(r." + c +
+                             ", 256)) SET r." + c + "_id = d.id, r." + c + " = NULL";
+
+        if (!conn.execute(intern) || !conn.execute(encode)) {
+            std::cerr << "Failed to dictionary-encode " << t << "." << c << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MetricsSchema::createThresholdRules(MySQLConnection& conn) {
+    // Also created by ThresholdManager, which does not depend on the metrics backend
+    return ThresholdManager::createTable(conn);
+}
+
+void MetricsSchema::start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_) return;
+    running_ = true;
+    maintenance_thread_ = std::thread(&MetricsSchema::maintenanceLoop, this);
+}
+
+void MetricsSchema::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) return;
+        running_ = false;
+    }
+    wakeup_.notify_all();
+    if (maintenance_thread_.joinable()) {
+        maintenance_thread_.join();
+    }
+}
+
+void MetricsSchema::maintenanceLoop() {
+    while (true) {
+        runMaintenance();
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (wakeup_.wait_for(lock, options_.maintenance_interval, [this]() { return !running_; })) {
+            return;
+        }
+    }
+}
+
+bool MetricsSchema::runMaintenance() {
+    auto conn = pool_->acquire();
+    if (!conn) return false;
+
+    bool ok = true;
+    for (const char* table : PARTITIONED_TABLES) {
+        ok = ensurePartitions(*conn, table) && ok;
+        ok = dropExpiredPartitions(*conn, table) && ok;
+    }
+    return ok;
+}
+
+bool MetricsSchema::tableExists(MySQLConnection& conn, const std::string& table) {
+    StatementParams params(1);
+    params.add(table);
+    std::vector<PreparedStatementCache::Row> rows;
+    return conn.statements().query("schema.table_exists",
+                                   "SELECT 1 FROM information_schema.TABLES "
+                                   "WHERE TABLE_SCHEMA = DATABASE() AND TABLE_NAME = ?",
+                                   params, rows) &&
+           !rows.empty();
+}
+
+bool MetricsSchema::indexExists(MySQLConnection& conn, const std::string& table, const std::string& index) {
+    StatementParams params(2);
+    params.add(table).add(index);
+    std::vector<PreparedStatementCache::Row> rows;
+    return conn.statements().query("schema.index_exists",
+                                   "SELECT 1 FROM information_schema.STATISTICS "
+                                   "WHERE TABLE_SCHEMA = DATABASE() AND TABLE_NAME = ? AND INDEX_NAME = ? LIMIT 1",
+                                   params, rows) &&
+           !rows.empty();
+}
+
+bool MetricsSchema::columnExists(MySQLConnection& conn, const std::string& table, const std::string& column) {
+    StatementParams params(2);
+    params.add(table).add(column);
+    std::vector<PreparedStatementCache::Row> rows;
+    return conn.statements().query("schema.column_exists",
+                                   "SELECT 1 FROM information_schema.COLUMNS "
+                                   "WHERE TABLE_SCHEMA = DATABASE() AND TABLE_NAME = ? AND COLUMN_NAME = ?",
+                                   params, rows) &&
+           !rows.empty();
+}
+
+bool MetricsSchema::listPartitions(MySQLConnection& conn, const std::string& table,
+                                   std::vector<Partition>& partitions) {
+    StatementParams params(1);
+    params.add(table);
+    std::vector<PreparedStatementCache::Row> rows;
+    if (!conn.statements().query("schema.partitions",
+                                 "SELECT PARTITION_NAME, PARTITION_DESCRIPTION FROM information_schema.PARTITIONS "
+                                 "WHERE TABLE_SCHEMA = DATABASE() AND TABLE_NAME = ? AND PARTITION_NAME IS NOT NULL "
+                                 "ORDER BY PARTITION_ORDINAL_POSITION",
+                                 params, rows)) {
+        return false;
+    }
+
+    for (auto& row : rows) {
+        // Descriptions look like '2025-06-24 00:00:00' or MAXVALUE
+        Partition partition;
+        partition.name = std::move(row[0]);
+        size_t quote = row[1].find('\'');
+        if (quote != std::string::npos && row[1].size() >= quote + 11) {
+            partition.upper_bound = row[1].substr(quote + 1, 10);
+        }
+        partitions.push_back(std::move(partition));
+    }
+    return true;
+}
+
+bool MetricsSchema::ensurePartitions(MySQLConnection& conn, const std::string& table) {
+    std::vector<Partition> partitions;
+    if (!listPartitions(conn, table, partitions) || partitions.empty()) {
+        return false;
+    }
+
+    // First day not covered by a daily partition yet
+    std::string last_bound;
+    for (const auto& partition : partitions) {
+        if (!partition.upper_bound.empty() && partition.upper_bound > last_bound) {
+            last_bound = partition.upper_bound;
+        }
+    }
+
+    int64_t last_day = today() + options_.partitions_ahead;
+    int64_t day = today();
+    while (day <= last_day && dayString(day) < last_bound) {
+        day++;
+    }
+    if (day > last_day) {
+        return true;
+    }
+
+    // Split the catch-all partition; it is empty unless clocks ran ahead
+    std::string query = "ALTER TABLE " + table + " REORGANIZE PARTITION " + FUTURE_PARTITION + " INTO (";
+    for (; day <= last_day; day++) {
+        query += "PARTITION " + partitionName(day) + " VALUES LESS THAN ('" + dayString(day + 1) + "'), ";
+    }
+    query += std::string("PARTITION ") + FUTURE_PARTITION + " VALUES LESS THAN (MAXVALUE))";
+    return conn.execute(query);
+}
+
+bool MetricsSchema::dropExpiredPartitions(MySQLConnection& conn, const std::string& table) {
+    std::vector<Partition> partitions;
+    if (!listPartitions(conn, table, partitions)) {
+        return false;
+    }
+
+    // A partition whose range ends before the cutoff holds only expired rows
+    std::string cutoff = dayString(today() - options_.retention_days);
+    std::string expired;
+    std::string lower_bound;
+    for (const auto& partition : partitions) {
+        if (!partition.upper_bound.empty() && partition.upper_bound <= cutoff) {
+            // Kept until its rows are in the archive
+            if (archive_ && archivedTable(table) && !archivePartition(conn, table, partition, lower_bound)) {
+                std::cerr << "Keeping partition " << table << "." << partition.name << ", archive export failed"
+                          << std::endl;
+                lower_bound = partition.upper_bound;
+                continue;
+            }
+            if (!expired.empty()) expired += ", ";
+            expired += partition.name;
+        }
+        lower_bound = partition.upper_bound;
+    }
+    if (expired.empty()) {
+        return true;
+    }
+
+    std::cout << "Dropping expired partitions of " << table << ": " << expired << std::endl;
+    return conn.execute("ALTER TABLE " + table + " DROP PARTITION " + expired);
+}
+
+bool MetricsSchema::archivePartition(MySQLConnection& conn, const std::string& table, const Partition& partition,
+                                     const std::string& lower_bound) {
+    const ArchivedTable* archived = archivedTable(table);
+
+    std::vector<ColumnarArchive::Column> columns;
+    std::string select;
+    for (const auto& column : archived->columns) {
+        columns.push_back({column.name, column.type});
+        if (!select.empty()) select += ", ";
+        select += column.select;
+    }
+
+    // Keyset pages along (device_id, ts), one row group each; the ts range
+    // prunes the scan to the partition
+    std::string sql = "SELECT " + select + " FROM " + table + " t " + archived->joins +
+                      " WHERE t.ts >= ? AND t.ts < ? AND (t.device_id > ? OR (t.device_id = ? AND t.ts > ?))"
+                      " ORDER BY t.device_id, t.ts LIMIT " + std::to_string(archive_->groupRows());
+    std::string id = "schema.archive." + table;
+
+    std::string error;
+    auto writer = archive_->create(table, partition.name, columns, error);
+    if (!writer) {
+        std::cerr << "Cannot archive " << table << "." << partition.name << ": " << error << std::endl;
+        return false;
+    }
+
+    int64_t from_ms = dayMs(lower_bound);
+    int64_t to_ms = dayMs(partition.upper_bound);
+    std::string last_device;
+    int64_t last_ts = from_ms;
+    size_t total = 0;
+    while (true) {
+        StatementParams params(5);
+        params.addDateTime(from_ms).addDateTime(to_ms).add(last_device).add(last_device).addDateTime(last_ts);
+        std::vector<PreparedStatementCache::Row> rows;
+        if (!conn.statements().query(id, sql.c_str(), params, rows)) {
+            return false;
+        }
+        if (rows.empty()) {
+            break;
+        }
+
+        if (!writer->append(rows, error)) {
+            std::cerr << "Cannot archive " << table << "." << partition.name << ": " << error << std::endl;
+            return false;
+        }
+        total += rows.size();
+        last_device = rows.back()[0];
+        last_ts = std::strtoll(rows.back()[1].c_str(), nullptr, 10);
+
+        if (rows.size() < archive_->groupRows()) {
+            break;
+        }
+    }
+
+    // An empty partition leaves no file behind
+    if (total == 0) {
+        return true;
+    }
+    if (!writer->finish(error)) {
+        std::cerr << "Cannot archive " << table << "." << partition.name << ": " << error << std::endl;
+        return false;
+    }
+    std::cout << "Archived " << total << " rows of " << table << "." << partition.name << std::endl;
+    return true;
+}
+
+std::string MetricsSchema::initialPartitions() const {
+    int64_t first = today();
+    std::string clause = "PARTITION BY RANGE COLUMNS(ts) (PARTITION p_history VALUES LESS THAN ('" +
+                         dayString(first) + "'), ";
+    for (int64_t day = first; day <= first + options_.partitions_ahead; day++) {
+        clause += "PARTITION " + partitionName(day) + " VALUES LESS THAN ('" + dayString(day + 1) + "'), ";
+    }
+    clause += std::string("PARTITION ") + FUTURE_PARTITION + " VALUES LESS THAN (MAXVALUE))";
+    return clause;
+}
+
+int64_t MetricsSchema::today() {
+    return static_cast<int64_t>(std::time(nullptr)) / SECONDS_PER_DAY;
+}
+
+std::string MetricsSchema::dayString(int64_t day) {
+    time_t seconds = static_cast<time_t>(day * SECONDS_PER_DAY);
+    struct tm utc;
+    gmtime_r(&seconds, &utc);
+
+    char buffer[16];
+    std::strftime(buffer, sizeof(buffer), "%Y-%m-%d", &utc);
+    return buffer;
+}
+
+int64_t MetricsSchema::dayMs(const std::string& day) {
+    struct tm utc = {};
+    if (day.empty() || !strptime(day.c_str(), "%Y-%m-%d", &utc)) {
+        return 0;
+    }
+    return static_cast<int64_t>(timegm(&utc)) * 1000;
+}
+
+std::string MetricsSchema::partitionName(int64_t day) {
+    std::string date = dayString(day);
+    return "p" + date.substr(0, 4) + date.substr(5, 2) + date.substr(8, 2);
+}
@@ -0,0 +1,620 @@
+#include "metrics_spool.h"
+#include "tsdb_codec.h"
+#include <iostream>
+#include <algorithm>
+#include <filesystem>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// On-disk structures are written in host byte order
+const uint32_t RECORD_MAGIC = 0x4C4F4F50;  // "POOL"
+
+struct RecordHeader {
+    uint32_t magic;
+    uint32_t crc;           // of everything after this field up to the end of the payload
+    uint32_t payload_len;
+    uint32_t rows;
+};
+
+struct Position {
+    uint64_t seq;
+    uint64_t offset;
+    uint32_t crc;           // of the fields above
+    uint32_t reserved;
+};
+
+static_assert(sizeof(RecordHeader) == 16, "unexpected RecordHeader layout");
+static_assert(sizeof(Position) == 24, "unexpected Position layout");
+
+const char* const SEGMENT_PREFIX = "segment-";
+const char* const SEGMENT_SUFFIX = ".spool";
+const char* const POSITION_FILE = "replay.pos";
+
+// Records larger than this are treated as corrupt
+const uint32_t MAX_PAYLOAD = 256u << 20;
+
+// Replay rate is measured over windows of this length
+const auto RATE_WINDOW = std::chrono::seconds(5);
+
+uint32_t recordCrc(const RecordHeader& header, const std::string& payload) {
+    uint32_t crc = crc32(&header.payload_len, sizeof(header) - offsetof(RecordHeader, payload_len));
+    return crc32(payload.data(), payload.size(), crc);
+}
+
+bool writeAll(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = ::write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool readAll(int fd, size_t offset, char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = ::pread(fd, data, len, static_cast<off_t>(offset));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (n == 0) {
+            return false;
+        }
+        data += n;
+        offset += static_cast<size_t>(n);
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// A new file only survives a crash once its directory entry is synced
+void syncDirectory(const std::string& directory) {
+    int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd >= 0) {
+        fsync(fd);
+        ::close(fd);
+    }
+}
+
+class RecordWriter {
+public:
+    explicit RecordWriter(std::string& out) : out_(out) {}
+
+    template <typename T>
+    void put(T value) {
+        out_.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    void put(const std::string& value) {
+        put(static_cast<uint32_t>(value.size()));
+        out_.append(value);
+    }
+
+private:
+    std::string& out_;
+};
+
+class RecordReader {
+public:
+    RecordReader(const char* data, size_t len) : data_(data), end_(data + len) {}
+
+    template <typename T>
+    bool get(T& value) {
+        if (static_cast<size_t>(end_ - data_) < sizeof(value)) return false;
+        std::memcpy(&value, data_, sizeof(value));
+        data_ += sizeof(value);
+        return true;
+    }
+
+    bool get(std::string& value) {
+        uint32_t len;
+        if (!get(len) || static_cast<size_t>(end_ - data_) < len) return false;
+        value.assign(data_, len);
+        data_ += len;
+        return true;
+    }
+
+    bool get(bool& value) {
+        uint8_t byte;
+        if (!get(byte)) return false;
+        value = byte != 0;
+        return true;
+    }
+
+    bool done() const { return data_ == end_; }
+
+private:
+    const char* data_;
+    const char* end_;
+};
+
+void encodeBatch(const SpoolBatch& batch, std::string& out) {
+    RecordWriter w(out);
+    w.put(batch.rollups_run);
+
+    w.put(static_cast<uint32_t>(batch.hardware.size()));
+    for (const auto& m : batch.hardware) {
+        w.put(m.device_id);
+        w.put(m.readable_date);
+        w.put(m.timestamp_ms);
+        w.put(m.cpu_usage);
+        w.put(m.memory_usage);
+        w.put(m.disk_usage);
+        w.put(m.usb_state);
+        w.put(static_cast<uint8_t>(m.has_usb_state));
+        w.put(static_cast<int32_t>(m.gpio_state));
+        w.put(static_cast<uint8_t>(m.has_gpio_state));
+        w.put(m.kernel_version);
+        w.put(m.hardware_model);
+        w.put(m.firmware_version);
+    }
+
+    w.put(static_cast<uint32_t>(batch.software.size()));
+    for (const auto& m : batch.software) {
+        w.put(m.device_id);
+        w.put(m.readable_date);
+        w.put(m.timestamp_ms);
+        w.put(m.ip_address);
+        w.put(m.uptime);
+        w.put(m.network_status);
+        w.put(m.os_version);
+
+        w.put(static_cast<uint32_t>(m.applications.size()));
+        for (const auto& app : m.applications) {
+            w.put(app.name);
+            w.put(app.version);
+        }
+        w.put(static_cast<uint32_t>(m.services.size()));
+        for (const auto& service : m.services) {
+            w.put(service.first);
+            w.put(service.second);
+        }
+        w.put(static_cast<uint8_t>(m.has_services));
+    }
+}
+
+bool decodeBatch(const std::string& payload, SpoolBatch& batch) {
+    RecordReader r(payload.data(), payload.size());
+    batch.hardware.clear();
+    batch.software.clear();
+
+    uint32_t count;
+    if (!r.get(batch.rollups_run) || !r.get(count)) return false;
+
+    batch.hardware.resize(std::min<uint32_t>(count, payload.size()));
+    if (batch.hardware.size() != count) return false;
+    for (auto& m : batch.hardware) {
+        int32_t gpio_state;
+        if (!r.get(m.device_id) || !r.get(m.readable_date) || !r.get(m.timestamp_ms) ||
+            !r.get(m.cpu_usage) || !r.get(m.memory_usage) || !r.get(m.disk_usage) ||
+            !r.get(m.usb_state) || !r.get(m.has_usb_state) || !r.get(gpio_state) || !r.get(m.has_gpio_state) ||
+            !r.get(m.kernel_version) || !r.get(m.hardware_model) || !r.get(m.firmware_version)) {
+            return false;
+        }
+        m.gpio_state = gpio_state;
+    }
+
+    if (!r.get(count)) return false;
+    batch.software.resize(std::min<uint32_t>(count, payload.size()));
+    if (batch.software.size() != count) return false;
+    for (auto& m : batch.software) {
+        if (!r.get(m.device_id) || !r.get(m.readable_date) || !r.get(m.timestamp_ms) ||
+            !r.get(m.ip_address) || !r.get(m.uptime) || !r.get(m.network_status) || !r.get(m.os_version)) {
+            return false;
+        }
+
+        uint32_t entries;
+        if (!r.get(entries) || entries > payload.size()) return false;
+        m.applications.resize(entries);
+        for (auto& app : m.applications) {
+            if (!r.get(app.name) || !r.get(app.version)) return false;
+        }
+        if (!r.get(entries) || entries > payload.size()) return false;
+        m.services.resize(entries);
+        for (auto& service : m.services) {
+            if (!r.get(service.first) || !r.get(service.second)) return false;
+        }
+        if (!r.get(m.has_services)) return false;
+    }
+    return r.done();
+}
+
+} // namespace
+
+MetricsSpool::MetricsSpool(const SpoolOptions& options)
+    : options_(options), total_bytes_(0), pending_rows_(0), pending_batches_(0),
+      write_fd_(-1), write_seq_(1), read_fd_(-1), read_seq_(0), read_offset_(0),
+      front_bytes_(0), front_rows_(0), position_fd_(-1),
+      spooled_rows_(0), replayed_rows_(0), rate_window_rows_(0), replay_rate_(0.0) {
+    if (options_.segment_bytes == 0) options_.segment_bytes = 1;
+}
+
+MetricsSpool::~MetricsSpool() {
+    closeRead();
+    if (write_fd_ >= 0) ::close(write_fd_);
+    if (position_fd_ >= 0) ::close(position_fd_);
+}
+
+bool MetricsSpool::open() {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    std::error_code ec;
+    fs::create_directories(options_.directory, ec);
+    if (ec) {
+        std::cerr << "Cannot create spool directory " << options_.directory << ": " << ec.message() << std::endl;
+        return false;
+    }
+
+    std::string position_path = (fs::path(options_.directory) / POSITION_FILE).string();
+    position_fd_ = ::open(position_path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (position_fd_ < 0) {
+        std::cerr << "Cannot open " << position_path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    std::vector<uint64_t> seqs;
+    for (const auto& entry : fs::directory_iterator(options_.directory, ec)) {
+        std::string name = entry.path().filename().string();
+        unsigned long long seq;
+        char suffix[16];
+        if (std::sscanf(name.c_str(), "segment-%llu%15s", &seq, suffix) == 2 && SEGMENT_SUFFIX == std::string(suffix)) {
+            seqs.push_back(seq);
+        }
+    }
+    if (ec) {
+        std::cerr << "Cannot list " << options_.directory << ": " << ec.message() << std::endl;
+        return false;
+    }
+    std::sort(seqs.begin(), seqs.end());
+
+    uint64_t position_seq = 0;
+    size_t position_offset = 0;
+    loadPosition(position_seq, position_offset);
+
+    for (uint64_t seq : seqs) {
+        // Replayed before the last shutdown
+        if (seq < position_seq) {
+            ::unlink(segmentPath(seq).c_str());
+            continue;
+        }
+
+        Segment segment;
+        if (!scanSegment(seq, seq == position_seq ? position_offset : 0, segment)) {
+            return false;
+        }
+        segments_[seq] = segment;
+        total_bytes_ += segment.bytes;
+        pending_rows_ += segment.rows;
+        pending_batches_ += segment.batches;
+    }
+
+    if (!segments_.empty()) {
+        read_seq_ = segments_.begin()->first;
+        read_offset_ = read_seq_ == position_seq ? position_offset : 0;
+        write_seq_ = segments_.rbegin()->first;
+    } else {
+        write_seq_ = std::max<uint64_t>(position_seq, seqs.empty() ? 0 : seqs.back()) + 1;
+        read_seq_ = write_seq_;
+        read_offset_ = 0;
+    }
+
+    std::cout << "Metrics spool " << options_.directory << ": " << pending_rows_ << " rows to replay in "
+              << segments_.size() << " segment(s)" << std::endl;
+    return true;
+}
+
+std::string MetricsSpool::segmentPath(uint64_t seq) const {
+    char name[64];
+    std::snprintf(name, sizeof(name), "%s%020llu%s", SEGMENT_PREFIX, static_cast<unsigned long long>(seq), SEGMENT_SUFFIX);
+    return (fs::path(options_.directory) / name).string();
+}
+
+bool MetricsSpool::scanSegment(uint64_t seq, size_t offset, Segment& segment) {
+    std::string path = segmentPath(seq);
+    int fd = ::open(path.c_str(), O_RDWR);
+    if (fd < 0) {
+        std::cerr << "Cannot open spool segment " << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    off_t end = lseek(fd, 0, SEEK_END);
+    size_t size = end < 0 ? 0 : static_cast<size_t>(end);
+
+    size_t pos = offset;
+    std::string payload;
+    uint32_t rows;
+    size_t bytes;
+    while (pos < size && readRecord(fd, pos, size, payload, rows, bytes)) {
+        segment.rows += rows;
+        segment.batches++;
+        pos += bytes;
+    }
+
+    // A record torn by a crash ends the segment; appends continue from there
+    if (pos < size) {
+        std::cerr << "Cutting " << size - pos << " unreadable bytes off spool segment " << path << std::endl;
+        if (ftruncate(fd, static_cast<off_t>(pos)) != 0) {
+            std::cerr << "Cannot truncate " << path << ": " << std::strerror(errno) << std::endl;
+            ::close(fd);
+            return false;
+        }
+        size = pos;
+    }
+
+    segment.bytes = size;
+    ::close(fd);
+    return true;
+}
+
+bool MetricsSpool::readRecord(int fd, size_t offset, size_t limit, std::string& payload, uint32_t& rows,
+                              size_t& bytes) {
+    RecordHeader header;
+    if (limit < offset + sizeof(header) || !readAll(fd, offset, reinterpret_cast<char*>(&header), sizeof(header))) {
+        return false;
+    }
+    if (header.magic != RECORD_MAGIC || header.payload_len > MAX_PAYLOAD ||
+        header.payload_len > limit - offset - sizeof(header)) {
+        return false;
+    }
+
+    payload.resize(header.payload_len);
+    if (!readAll(fd, offset + sizeof(header), &payload[0], payload.size()) || header.crc != recordCrc(header, payload)) {
+        return false;
+    }
+
+    rows = header.rows;
+    bytes = sizeof(header) + payload.size();
+    return true;
+}
+
+bool MetricsSpool::append(const SpoolBatch& batch) {
+    std::string record(sizeof(RecordHeader), '\0');
+    encodeBatch(batch, record);
+    std::string payload = record.substr(sizeof(RecordHeader));
+
+    RecordHeader header;
+    header.magic = RECORD_MAGIC;
+    header.payload_len = static_cast<uint32_t>(payload.size());
+    header.rows = static_cast<uint32_t>(batch.size());
+    header.crc = recordCrc(header, payload);
+    std::memcpy(&record[0], &header, sizeof(header));
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (total_bytes_ + record.size() > options_.max_bytes) {
+        std::cerr << "Metrics spool " << options_.directory << " is full (" << total_bytes_ / (1024 * 1024)
+                  << " MiB)" << std::endl;
+        return false;
+    }
+    if (write_fd_ < 0 && !openWriteSegment()) {
+        return false;
+    }
+
+    Segment& segment = segments_[write_seq_];
+    if (!writeAll(write_fd_, record.data(), record.size()) || fdatasync(write_fd_) != 0) {
+        std::cerr << "Cannot write spool segment " << segmentPath(write_seq_) << ": " << std::strerror(errno) << std::endl;
+        // Drop the partial record so the next append starts on a record boundary
+        if (ftruncate(write_fd_, static_cast<off_t>(segment.bytes)) != 0) {
+            ::close(write_fd_);
+            write_fd_ = -1;
+            write_seq_++;
+        }
+        return false;
+    }
+
+    segment.bytes += record.size();
+    segment.rows += batch.size();
+    segment.batches++;
+    total_bytes_ += record.size();
+    pending_rows_ += batch.size();
+    pending_batches_++;
+    spooled_rows_ += batch.size();
+
+    if (segment.bytes >= options_.segment_bytes) {
+        ::close(write_fd_);
+        write_fd_ = -1;
+        write_seq_++;
+    }
+    return true;
+}
+
+bool MetricsSpool::openWriteSegment() {
+    std::string path = segmentPath(write_seq_);
+    write_fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (write_fd_ < 0) {
+        std::cerr << "Cannot open spool segment " << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    syncDirectory(options_.directory);
+    segments_.try_emplace(write_seq_);
+    return true;
+}
+
+bool MetricsSpool::openReadSegment() {
+    std::string path = segmentPath(read_seq_);
+    read_fd_ = ::open(path.c_str(), O_RDONLY);
+    if (read_fd_ < 0) {
+        std::cerr << "Cannot open spool segment " << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void MetricsSpool::closeRead() {
+    if (read_fd_ >= 0) {
+        ::close(read_fd_);
+        read_fd_ = -1;
+    }
+}
+
+void MetricsSpool::removeSegment(uint64_t seq) {
+    auto it = segments_.find(seq);
+    if (it == segments_.end()) {
+        return;
+    }
+    if (seq == read_seq_) {
+        closeRead();
+    }
+    if (seq == write_seq_ && write_fd_ >= 0) {
+        ::close(write_fd_);
+        write_fd_ = -1;
+        write_seq_++;
+    }
+
+    total_bytes_ -= it->second.bytes;
+    pending_rows_ -= it->second.rows;
+    pending_batches_ -= it->second.batches;
+    segments_.erase(it);
+    ::unlink(segmentPath(seq).c_str());
+}
+
+bool MetricsSpool::empty() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending_batches_ == 0;
+}
+
+bool MetricsSpool::front(SpoolBatch& batch) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    while (!segments_.empty()) {
+        auto it = segments_.begin();
+        if (it->first != read_seq_) {
+            closeRead();
+            read_seq_ = it->first;
+            read_offset_ = 0;
+        }
+
+        Segment& segment = it->second;
+        if (segment.batches == 0) {
+            // Fully replayed; the segment being appended to stays
+            if (it->first == write_seq_ && write_fd_ >= 0) {
+                return false;
+            }
+            removeSegment(it->first);
+            continue;
+        }
+
+        if (read_fd_ < 0 && !openReadSegment()) {
+            return false;
+        }
+
+        std::string payload;
+        uint32_t rows;
+        size_t bytes;
+        if (readRecord(read_fd_, read_offset_, segment.bytes, payload, rows, bytes) && decodeBatch(payload, batch)) {
+            front_bytes_ = bytes;
+            front_rows_ = rows;
+            return true;
+        }
+
+        // It was valid when written or scanned, the disk lost it since
+        std::cerr << "Skipping " << segment.rows << " unreadable rows of spool segment " << segmentPath(read_seq_)
+                  << std::endl;
+        pending_rows_ -= segment.rows;
+        pending_batches_ -= segment.batches;
+        segment.rows = 0;
+        segment.batches = 0;
+        if (it->first == write_seq_ && write_fd_ >= 0) {
+            ::close(write_fd_);
+            write_fd_ = -1;
+            write_seq_++;
+        }
+    }
+    return false;
+}
+
+void MetricsSpool::pop() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (front_bytes_ == 0) {
+        return;
+    }
+
+    auto it = segments_.find(read_seq_);
+    if (it != segments_.end()) {
+        it->second.rows -= std::min(it->second.rows, front_rows_);
+        it->second.batches--;
+    }
+    pending_rows_ -= std::min(pending_rows_, front_rows_);
+    pending_batches_--;
+    read_offset_ += front_bytes_;
+    replayed_rows_ += front_rows_;
+
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_replay_ > RATE_WINDOW) {
+        rate_window_start_ = now;
+        rate_window_rows_ = 0;
+    }
+    last_replay_ = now;
+    rate_window_rows_ += front_rows_;
+    if (now - rate_window_start_ >= RATE_WINDOW) {
+        replay_rate_ = rate_window_rows_ / std::chrono::duration<double>(now - rate_window_start_).count();
+        rate_window_start_ = now;
+        rate_window_rows_ = 0;
+    }
+
+    front_bytes_ = 0;
+    front_rows_ = 0;
+
+    // Drained: drop every segment, the next append starts a new one
+    if (pending_batches_ == 0) {
+        while (!segments_.empty()) {
+            removeSegment(segments_.begin()->first);
+        }
+        read_seq_ = write_seq_;
+        read_offset_ = 0;
+    }
+
+    savePosition();
+}
+
+bool MetricsSpool::loadPosition(uint64_t& seq, size_t& offset) {
+    Position position;
+    if (!readAll(position_fd_, 0, reinterpret_cast<char*>(&position), sizeof(position)) ||
+        position.crc != crc32(&position, offsetof(Position, crc))) {
+        return false;
+    }
+    seq = position.seq;
+    offset = static_cast<size_t>(position.offset);
+    return true;
+}
+
+bool MetricsSpool::savePosition() {
+    Position position;
+    std::memset(&position, 0, sizeof(position));
+    position.seq = read_seq_;
+    position.offset = read_offset_;
+    position.crc = crc32(&position, offsetof(Position, crc));
+
+    // A lost position only means a batch is replayed twice
+    if (::pwrite(position_fd_, &position, sizeof(position), 0) != static_cast<ssize_t>(sizeof(position)) ||
+        fdatasync(position_fd_) != 0) {
+        std::cerr << "Cannot save the spool replay position: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+MetricsSpool::Stats MetricsSpool::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    Stats stats;
+    stats.pending_rows = pending_rows_;
+    stats.pending_batches = pending_batches_;
+    stats.bytes = total_bytes_;
+    stats.segments = segments_.size();
+    stats.spooled_rows = spooled_rows_;
+    stats.replayed_rows = replayed_rows_;
+    stats.replay_rows_per_sec = std::chrono::steady_clock::now() - last_replay_ > RATE_WINDOW ? 0.0 : replay_rate_;
+    return stats;
+}
@@ -1,251 +1,962 @@
 #include "mysql_metrics_storage.h"
 #include <mysql/mysql.h>
 #include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <cstdlib>
+#include <map>
+#include <set>
 
-MySQLMetricsStorage::MySQLMetricsStorage() {
-    conn_ = mysql_init(nullptr);
-    
-    // Première connexion sans sélectionner de base
-    std::cout << "Attempting to connect to MySQL..." << std::endl;
-    if (!mysql_real_connect(static_cast<MYSQL*>(conn_), "127.0.0.1", "root", "root", nullptr, 0, nullptr, 0)) {
-        std::cerr << "MySQL connection failed: " << mysql_error(static_cast<MYSQL*>(conn_)) << std::endl;
-        conn_ = nullptr;
-        return;
+// Multi-row INSERT of one table, prepared once per row count
+struct MySQLMetricsStorage::InsertStatement {
+    const char* id;
+    const char* head;   // INSERT INTO ... VALUES
+    const char* row;    // placeholders of one row
+    const char* tail;   // appended after the rows
+};
+
+// Samples are unique per (device_id, ts); a repeated sample replaces the stored one
+// Slowly-changing attributes are stored as attribute_dictionary ids; the text
+// columns are only filled when a value could not be interned.
+const MySQLMetricsStorage::InsertStatement MySQLMetricsStorage::HARDWARE_INSERT = {
+    "hardware_info.insert",
+    "INSERT INTO hardware_info (device_id, ts, cpu_usage, memory_usage, disk_usage, usb_state_id, usb_state, gpio_state, "
+    "kernel_version_id, kernel_version, hardware_model_id, hardware_model, firmware_version_id, firmware_version) VALUES ",
+    "(?,?,?,?,?,?,?,?,?,?,?,?,?,?)",
+    " ON DUPLICATE KEY UPDATE cpu_usage = VALUES(cpu_usage), memory_usage = VALUES(memory_usage), "
+    "disk_usage = VALUES(disk_usage), usb_state_id = VALUES(usb_state_id), usb_state = VALUES(usb_state), "
+    "gpio_state = VALUES(gpio_state), kernel_version_id = VALUES(kernel_version_id), "
+    "kernel_version = VALUES(kernel_version), hardware_model_id = VALUES(hardware_model_id), "
+    "hardware_model = VALUES(hardware_model), firmware_version_id = VALUES(firmware_version_id), "
+    "firmware_version = VALUES(firmware_version)"
+};
+
+const MySQLMetricsStorage::InsertStatement MySQLMetricsStorage::SOFTWARE_INSERT = {
+    "software_info.insert",
+    "INSERT INTO software_info (device_id, ts, ip_address, uptime, network_status, os_version_id, os_version, "
+    "applications_id, services_id) VALUES ",
+    "(?,?,?,?,?,?,?,?,?)",
+    " ON DUPLICATE KEY UPDATE ip_address = VALUES(ip_address), uptime = VALUES(uptime), "
+    "network_status = VALUES(network_status), os_version_id = VALUES(os_version_id), "
+    "os_version = VALUES(os_version), applications_id = VALUES(applications_id), services_id = VALUES(services_id)"
+};
+
+// Child rows of a sample whose application list or service map has no
+// dictionary id; keyed by their sample, a repeated entry keeps the last value
+const MySQLMetricsStorage::InsertStatement MySQLMetricsStorage::SERVICES_INSERT = {
+    "software_services.insert",
+    "INSERT INTO software_services (device_id, ts, service, status) VALUES ",
+    "(?,?,?,?)",
+    " ON DUPLICATE KEY UPDATE status = VALUES(status)"
+};
+
+const MySQLMetricsStorage::InsertStatement MySQLMetricsStorage::APPLICATIONS_INSERT = {
+    "software_applications.insert",
+    "INSERT INTO software_applications (device_id, ts, name, version) VALUES ",
+    "(?,?,?,?)",
+    " ON DUPLICATE KEY UPDATE version = VALUES(version)"
+};
+
+// Latest state upserts only replace what an older sample stored. The sample
+// time is assigned last, the conditions before it still see the stored one.
+#define IF_NEWER(stamp, column) \
+    column " = IF(" stamp " IS NULL OR VALUES(" stamp ") >= " stamp ", VALUES(" column "), " column ")"
+
+const MySQLMetricsStorage::InsertStatement MySQLMetricsStorage::LATEST_HARDWARE_UPSERT = {
+    "device_latest_state.hardware",
+    "INSERT INTO device_latest_state (device_id, hardware_ts, cpu_usage, memory_usage, disk_usage, usb_state, gpio_state, kernel_version, hardware_model, firmware_version) VALUES ",
+    "(?,?,?,?,?,?,?,?,?,?)",
+    " ON DUPLICATE KEY UPDATE "
+    IF_NEWER("hardware_ts", "cpu_usage") ", " IF_NEWER("hardware_ts", "memory_usage") ", "
+    IF_NEWER("hardware_ts", "disk_usage") ", " IF_NEWER("hardware_ts", "usb_state") ", "
+    IF_NEWER("hardware_ts", "gpio_state") ", " IF_NEWER("hardware_ts", "kernel_version") ", "
+    IF_NEWER("hardware_ts", "hardware_model") ", " IF_NEWER("hardware_ts", "firmware_version") ", "
+    IF_NEWER("hardware_ts", "hardware_ts")
+};
+
+const MySQLMetricsStorage::InsertStatement MySQLMetricsStorage::LATEST_SOFTWARE_UPSERT = {
+    "device_latest_state.software",
+    "INSERT INTO device_latest_state (device_id, software_ts, ip_address, uptime, network_status, os_version) VALUES ",
+    "(?,?,?,?,?,?)",
+    " ON DUPLICATE KEY UPDATE "
+    IF_NEWER("software_ts", "ip_address") ", " IF_NEWER("software_ts", "uptime") ", "
+    IF_NEWER("software_ts", "network_status") ", " IF_NEWER("software_ts", "os_version") ", "
+    IF_NEWER("software_ts", "software_ts")
+};
+
+#define ROLLUP_COLUMNS \
+    "(device_id, ts, samples, cpu_min, cpu_max, cpu_avg, cpu_p95, memory_min, memory_max, memory_avg, memory_p95, " \
+    "disk_min, disk_max, disk_avg, disk_p95, histogram) VALUES "
+#define ROLLUP_ROW "(?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?)"
+#define ROLLUP_UPDATE \
+    " ON DUPLICATE KEY UPDATE samples = VALUES(samples), " \
+    "cpu_min = VALUES(cpu_min), cpu_max = VALUES(cpu_max), cpu_avg = VALUES(cpu_avg), cpu_p95 = VALUES(cpu_p95), " \
+    "memory_min = VALUES(memory_min), memory_max = VALUES(memory_max), memory_avg = VALUES(memory_avg), " \
+    "memory_p95 = VALUES(memory_p95), disk_min = VALUES(disk_min), disk_max = VALUES(disk_max), " \
+    "disk_avg = VALUES(disk_avg), disk_p95 = VALUES(disk_p95), histogram = VALUES(histogram)"
+
+// Rollup rows carry the whole bucket state, so an upsert replaces it
+const MySQLMetricsStorage::InsertStatement MySQLMetricsStorage::ROLLUP_INSERTS[MetricsRollup::LevelCount] = {
+    {"metrics_rollup_1m.upsert", "INSERT INTO metrics_rollup_1m " ROLLUP_COLUMNS, ROLLUP_ROW, ROLLUP_UPDATE},
+    {"metrics_rollup_1h.upsert", "INSERT INTO metrics_rollup_1h " ROLLUP_COLUMNS, ROLLUP_ROW, ROLLUP_UPDATE},
+    {"metrics_rollup_1d.upsert", "INSERT INTO metrics_rollup_1d " ROLLUP_COLUMNS, ROLLUP_ROW, ROLLUP_UPDATE},
+};
+
+static int64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Stored NULLs read back as empty strings
+static double columnValue(const std::string& text) {
+    return text.empty() ? 0.0 : std::strtod(text.c_str(), nullptr);
+}
+
+// Columns of LATEST_HARDWARE_UPSERT; missing values are stored as NULL
+static void bindHardware(StatementParams& params, const HardwareSample& m) {
+    params.add(m.device_id).addDateTime(m.timestamp_ms);
+
+    for (double value : {m.cpu_usage, m.memory_usage, m.disk_usage}) {
+        if (std::isnan(value)) {
+            params.addNull();
+        } else {
+            params.add(value);
+        }
+    }
+    if (m.has_usb_state) {
+        params.add(m.usb_state);
+    } else {
+        params.addNull();
+    }
+    if (m.has_gpio_state) {
+        params.add(static_cast<int32_t>(m.gpio_state));
+    } else {
+        params.addNull();
     }
-    std::cout << "Connected to MySQL successfully" << std::endl;
 
-    initDatabase();
+    params.add(m.kernel_version)
+          .add(m.hardware_model)
+          .add(m.firmware_version);
+}
+
+// Columns of LATEST_SOFTWARE_UPSERT
+static void bindSoftware(StatementParams& params, const SoftwareSample& m) {
+    params.add(m.device_id)
+          .addDateTime(m.timestamp_ms)
+          .add(m.ip_address)
+          .add(m.uptime)
+          .add(m.network_status)
+          .add(m.os_version);
+}
+
+MySQLMetricsStorage::MySQLMetricsStorage(std::shared_ptr<MySQLConnectionPool> pool,
+                                         const WriteBufferOptions& options,
+                                         std::shared_ptr<MetricsSpool> spool,
+                                         std::shared_ptr<ColumnarArchive> archive)
+    : pool_(std::move(pool)), started_ms_(nowMs()), rollups_(started_ms_), options_(options),
+      spool_(std::move(spool)), replay_backoff_(100), replay_front_counted_(false), archive_(std::move(archive)),
+      buffered_rows_(0), closed_(false), recent_hardware_(options.dedup_window),
+      recent_software_(options.dedup_window), duplicates_dropped_(0) {
+    if (!pool_) {
+        throw std::invalid_argument("MySQLMetricsStorage requires a connection pool");
+    }
+    if (options_.batch_rows == 0) options_.batch_rows = 1;
+    if (options_.rows_per_statement == 0) options_.rows_per_statement = 1;
+    options_.max_buffered_rows = std::max(options_.max_buffered_rows, options_.batch_rows);
+
+    // Rows are accepted even while MySQL is down and written once it is back
+    flusher_ = std::thread(&MySQLMetricsStorage::flushLoop, this);
 }
 
 MySQLMetricsStorage::~MySQLMetricsStorage() {
-    if (conn_) mysql_close(static_cast<MYSQL*>(conn_));
+    close();
 }
 
-bool MySQLMetricsStorage::reconnect() {
-    std::lock_guard<std::mutex> lock(mysql_mutex_);
-    
-    if (conn_) {
-        mysql_close(static_cast<MYSQL*>(conn_));
+bool MySQLMetricsStorage::executeQuery(const std::string& query) {
+    auto conn = pool_->acquire();
+    return conn && conn->execute(query);
+}
+
+bool MySQLMetricsStorage::queryHardware(const std::string& device_id, int64_t from_ms, int64_t to_ms,
+                                        std::vector<HardwarePoint>& points) {
+    auto conn = pool_->acquire();
+    if (!conn) return false;
+
+    // Epoch milliseconds computed without the session time zone, ts is UTC
+    StatementParams params(3);
+    params.add(device_id).addDateTime(from_ms).addDateTime(to_ms);
+    std::vector<PreparedStatementCache::Row> rows;
+    if (!conn->statements().query("hardware_info.range",
+                                  "SELECT TIMESTAMPDIFF(MICROSECOND, '1970-01-01', ts) DIV 1000, "
+                                  "cpu_usage, memory_usage, disk_usage FROM hardware_info "
+                                  "WHERE device_id = ? AND ts >= ? AND ts < ? ORDER BY ts",
+                                  params, rows)) {
+        return false;
     }
-    
-    conn_ = mysql_init(nullptr);
-    if (!conn_) return false;
 
-    // Enable auto-reconnect
-    bool reconnect_flag = true;
-    mysql_options(static_cast<MYSQL*>(conn_), MYSQL_OPT_RECONNECT, &reconnect_flag);
-    
-    if (!mysql_real_connect(static_cast<MYSQL*>(conn_), "127.0.0.1", "root", "root", nullptr, 0, nullptr, 0)) {
-        std::cerr << "MySQL reconnection failed: " << mysql_error(static_cast<MYSQL*>(conn_)) << std::endl;
+    // Archived days first; a day exported but not dropped yet is in both
+    size_t first = points.size();
+    if (archive_ && !archive_->readHardware(device_id, from_ms, to_ms, points)) {
+        std::cerr << "Archived metrics of " << device_id << " are incomplete" << std::endl;
+    }
+    bool archived = points.size() > first;
+
+    points.reserve(points.size() + rows.size());
+    for (const auto& row : rows) {
+        HardwarePoint point;
+        point.timestamp_ms = std::strtoll(row[0].c_str(), nullptr, 10);
+        if (!row[1].empty()) point.cpu_usage = columnValue(row[1]);
+        if (!row[2].empty()) point.memory_usage = columnValue(row[2]);
+        if (!row[3].empty()) point.disk_usage = columnValue(row[3]);
+        points.push_back(point);
+    }
+
+    if (archived) {
+        auto begin = points.begin() + static_cast<std::ptrdiff_t>(first);
+        std::stable_sort(begin, points.end(), [](const HardwarePoint& a, const HardwarePoint& b) {
+            return a.timestamp_ms < b.timestamp_ms;
+        });
+        points.erase(std::unique(begin, points.end(), [](const HardwarePoint& a, const HardwarePoint& b) {
+            return a.timestamp_ms == b.timestamp_ms;
+        }), points.end());
+    }
+    return true;
+}
+
+bool MySQLMetricsStorage::insertHardwareInfo(const HardwareSample& sample, Completion done) {
+    std::unique_lock<std::mutex> lock(buffer_mutex_);
+    if (!waitForSpace(lock)) {
         return false;
     }
 
-    return initDatabase();
+    if (options_.dedup_window > 0 && recent_hardware_.seen(sample.device_id, sample.timestamp_ms)) {
+        duplicates_dropped_++;
+        lock.unlock();
+        // The first copy is buffered or stored, or fails and is delivered again
+        if (done) done(true);
+        return true;
+    }
+
+    buffer_.hardware.push_back({sample, std::move(done)});
+    buffered_rows_++;
+    if (buffer_.size() == 1) {
+        oldest_row_ = std::chrono::steady_clock::now();
+    }
+    if (buffer_.size() == 1 || buffer_.size() >= options_.batch_rows) {
+        buffer_ready_.notify_one();
+    }
+    return true;
 }
-bool MySQLMetricsStorage::initDatabase() {
-    if (!conn_) return false;
 
-    // Créer la base si elle n'existe pas
-    std::cout << "Creating database if not exists..." << std::endl;
-    if (mysql_query(static_cast<MYSQL*>(conn_), "CREATE DATABASE IF NOT EXISTS IOTSHADOW")) {
-        std::cerr << "Failed to create database: " << mysql_error(static_cast<MYSQL*>(conn_)) << std::endl;
+bool MySQLMetricsStorage::insertSoftwareInfo(const SoftwareSample& sample, Completion done) {
+    std::unique_lock<std::mutex> lock(buffer_mutex_);
+    if (!waitForSpace(lock)) {
         return false;
     }
 
-    // Sélectionner la base
-    std::cout << "Selecting database IOTSHADOW..." << std::endl;
-    if (mysql_select_db(static_cast<MYSQL*>(conn_), "IOTSHADOW")) {
-        std::cerr << "Failed to select database: " << mysql_error(static_cast<MYSQL*>(conn_)) << std::endl;
+    if (options_.dedup_window > 0 && recent_software_.seen(sample.device_id, sample.timestamp_ms)) {
+        duplicates_dropped_++;
+        lock.unlock();
+        // The first copy is buffered or stored, or fails and is delivered again
+        if (done) done(true);
+        return true;
+    }
+
+    buffer_.software.push_back({sample, std::move(done)});
+    buffered_rows_++;
+    if (buffer_.size() == 1) {
+        oldest_row_ = std::chrono::steady_clock::now();
+    }
+    if (buffer_.size() == 1 || buffer_.size() >= options_.batch_rows) {
+        buffer_ready_.notify_one();
+    }
+    return true;
+}
+
+bool MySQLMetricsStorage::waitForSpace(std::unique_lock<std::mutex>& lock) {
+    buffer_space_.wait(lock, [this]() {
+        return closed_ || buffered_rows_ < options_.max_buffered_rows;
+    });
+    return !closed_;
+}
+
+size_t MySQLMetricsStorage::bufferedRows() const {
+    std::lock_guard<std::mutex> lock(buffer_mutex_);
+    return buffered_rows_;
+}
+
+void MySQLMetricsStorage::close() {
+    {
+        std::lock_guard<std::mutex> lock(buffer_mutex_);
+        if (closed_) return;
+        closed_ = true;
+        if (duplicates_dropped_ > 0) {
+            std::cout << "Dropped " << duplicates_dropped_ << " duplicate metrics samples" << std::endl;
+        }
+    }
+    buffer_ready_.notify_all();
+    buffer_space_.notify_all();
+
+    // The flusher writes what is buffered once more before it exits
+    if (flusher_.joinable()) {
+        flusher_.join();
+    }
+}
+
+void MySQLMetricsStorage::flushLoop() {
+    while (true) {
+        Batch batch;
+        bool closing;
+        {
+            std::unique_lock<std::mutex> lock(buffer_mutex_);
+            bool due = true;
+
+            if (!spool_ || spool_->empty()) {
+                buffer_ready_.wait(lock, [this]() { return closed_ || buffer_.size() > 0; });
+
+                // Give the batch time to fill up, unless it already has
+                while (!closed_ && buffer_.size() < options_.batch_rows) {
+                    if (buffer_ready_.wait_until(lock, oldest_row_ + options_.flush_interval) == std::cv_status::timeout) {
+                        break;
+                    }
+                }
+            } else {
+                // Replay the spool in between, taking the buffer once a batch is due
+                auto deadline = replay_retry_at_;
+                if (buffer_.size() > 0) {
+                    deadline = std::min(deadline, oldest_row_ + options_.flush_interval);
+                }
+                buffer_ready_.wait_until(lock, deadline, [this]() {
+                    return closed_ || buffer_.size() >= options_.batch_rows;
+                });
+                due = closed_ || buffer_.size() >= options_.batch_rows ||
+                      (buffer_.size() > 0 && std::chrono::steady_clock::now() >= oldest_row_ + options_.flush_interval);
+            }
+
+            closing = closed_;
+            if (due) {
+                std::swap(batch, buffer_);
+            }
+        }
+
+        if (batch.size() > 0) {
+            writeBatch(batch, closing);
+
+            {
+                std::lock_guard<std::mutex> lock(buffer_mutex_);
+                buffered_rows_ -= batch.size();
+            }
+            buffer_space_.notify_all();
+        }
+
+        if (closing) {
+            return;
+        }
+
+        if (spool_ && std::chrono::steady_clock::now() >= replay_retry_at_) {
+            replaySpool();
+        }
+    }
+}
+
+void MySQLMetricsStorage::writeBatch(Batch& batch, bool last_attempt) {
+    // Rows queue up behind spooled ones so MySQL receives them in order
+    if (spool_ && !spool_->empty() && spoolBatch(batch, 0)) {
+        complete(batch, true);
+        return;
+    }
+
+    auto backoff = std::chrono::milliseconds(100);
+    while (true) {
+        if (commit(batch)) {
+            complete(batch, true);
+            return;
+        }
+
+        // Safe on local disk, the rows can be acknowledged
+        if (spool_ && spoolBatch(batch, batch.rollups_counted ? started_ms_ : 0)) {
+            complete(batch, true);
+            return;
+        }
+
+        // Nothing was acknowledged for these rows yet, so giving up on close
+        // only means the broker delivers them again
+        if (last_attempt) {
+            std::cerr << "MySQL unavailable, " << batch.size() << " buffered metrics rows not written" << std::endl;
+            complete(batch, false);
+            return;
+        }
+
+        std::cerr << "MySQL unavailable, retrying " << batch.size() << " metrics rows in "
+                  << backoff.count() << " ms" << std::endl;
+
+        std::unique_lock<std::mutex> lock(buffer_mutex_);
+        buffer_ready_.wait_for(lock, backoff, [this]() { return closed_; });
+        last_attempt = closed_;
+        backoff = std::min(backoff * 2, std::chrono::milliseconds(5000));
+    }
+}
+
+bool MySQLMetricsStorage::commit(Batch& batch) {
+    // A connection lost mid-batch is closed by the pool on release
+    auto conn = pool_->acquire();
+    if (!conn) {
         return false;
     }
 
-    // Création des tables - Updated schema to match data types
-    const char* create_hw_table =
-        "CREATE TABLE IF NOT EXISTS hardware_info ("
-        "id INT AUTO_INCREMENT PRIMARY KEY,"
-        "device_id VARCHAR(128),"
-        "readable_date VARCHAR(32),"
-        "cpu_usage DECIMAL(5,2),"  
-        "memory_usage DECIMAL(5,2),"  
-        "disk_usage DECIMAL(5,2),"  
-        "usb_state TEXT,"
-        "gpio_state INT,"  // Changed from VARCHAR(32) to INT
-        "kernel_version VARCHAR(64),"
-        "hardware_model VARCHAR(128),"
-        "firmware_version VARCHAR(128),"
-        "created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP"
-        ")";
-
-    if (mysql_query(static_cast<MYSQL*>(conn_), create_hw_table)) {
-        std::cerr << "Failed to create hardware_info table: " << mysql_error(static_cast<MYSQL*>(conn_)) << std::endl;
+    // Values that could not be interned are written as text instead
+    if (!resolveAttributes(*conn, batch) && conn->lost()) {
         return false;
     }
 
-    // Rest of the function (software table creation) remains unchanged
-    const char* create_sw_table =
-        "CREATE TABLE IF NOT EXISTS software_info ("
-        "id INT AUTO_INCREMENT PRIMARY KEY,"
-        "device_id VARCHAR(128),"
-        "readable_date VARCHAR(32),"
-        "ip_address VARCHAR(64),"
-        "uptime VARCHAR(64),"
-        "network_status VARCHAR(32),"
-        "os_version VARCHAR(128),"
-        "applications TEXT,"
-        "services TEXT,"
-        "created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP"
-        ")";
-
-    if (mysql_query(static_cast<MYSQL*>(conn_), create_sw_table)) {
-        std::cerr << "Failed to create software_info table: " << mysql_error(static_cast<MYSQL*>(conn_)) << std::endl;
+    // Rollups are updated once per batch; retries only rewrite the buckets
+    if (!batch.rollups_counted && !countRollups(*conn, batch)) {
         return false;
     }
-    return true;
+
+    bool connection_lost = true;
+    if (commitBatch(*conn, batch, connection_lost)) {
+        rollups_.markWritten();
+        rollups_.evict(nowMs());
+        return true;
+    }
+
+    // Rows MySQL rejects are dropped; a connection lost on the way leaves
+    // the whole batch to be retried or spooled
+    return !connection_lost && commitRowByRow(*conn, batch);
 }
-bool MySQLMetricsStorage::executeQuery(const std::string& query) {
-    std::lock_guard<std::mutex> lock(mysql_mutex_);
-    
-    if (!conn_) {
-        if (!reconnect()) return false;
-    }
-
-    if (mysql_query(static_cast<MYSQL*>(conn_), query.c_str())) {
-        // Check if connection was lost
-        if (mysql_errno(static_cast<MYSQL*>(conn_)) == CR_SERVER_LOST ||
-            mysql_errno(static_cast<MYSQL*>(conn_)) == CR_SERVER_GONE_ERROR) {
-            // Try to reconnect once
-            if (reconnect()) {
-                // Retry query after successful reconnection
-                if (!mysql_query(static_cast<MYSQL*>(conn_), query.c_str())) {
-                    return true;
-                }
+
+bool MySQLMetricsStorage::resolveAttributes(MySQLConnection& conn, Batch& batch) {
+    std::vector<const std::string*> values;
+    values.reserve(batch.hardware.size() * 4 + batch.software.size() * 3);
+
+    for (const auto& row : batch.hardware) {
+        const HardwareSample& m = row.sample;
+        if (m.has_usb_state) values.push_back(&m.usb_state);
+        values.push_back(&m.kernel_version);
+        values.push_back(&m.hardware_model);
+        values.push_back(&m.firmware_version);
+    }
+    for (auto& row : batch.software) {
+        row.applications = AttributeDictionary::applicationsValue(row.sample);
+        row.services = AttributeDictionary::servicesValue(row.sample);
+        values.push_back(&row.sample.os_version);
+        values.push_back(&row.applications);
+        values.push_back(&row.services);
+    }
+
+    return attributes_.resolve(conn, values);
+}
+
+bool MySQLMetricsStorage::countRollups(MySQLConnection& conn, Batch& batch) {
+    // Keys of the batch's samples, each counted once even if repeated
+    std::set<std::pair<std::string, int64_t>> keys;
+    for (const auto& row : batch.hardware) {
+        keys.emplace(row.sample.device_id, row.sample.timestamp_ms);
+    }
+    std::vector<const std::pair<std::string, int64_t>*> pending;
+    pending.reserve(keys.size());
+    for (const auto& key : keys) {
+        pending.push_back(&key);
+    }
+
+    // Keys already stored, e.g. redelivered after a restart
+    std::set<std::pair<std::string, int64_t>> stored;
+    for (size_t i = 0; i < pending.size();) {
+        size_t rows = statementRows(pending.size() - i);
+        std::string id = "hardware_info.exists." + std::to_string(rows);
+        std::string& sql = insert_sql_[id];
+        if (sql.empty()) {
+            sql = "SELECT device_id, TIMESTAMPDIFF(MICROSECOND, '1970-01-01', ts) DIV 1000 FROM hardware_info "
+                  "WHERE (device_id, ts) IN (";
+            for (size_t r = 0; r < rows; r++) {
+                sql += r > 0 ? ",(?,?)" : "(?,?)";
+            }
+            sql += ")";
+        }
+
+        StatementParams params(rows * 2);
+        for (size_t end = i + rows; i < end; i++) {
+            params.add(pending[i]->first).addDateTime(pending[i]->second);
+        }
+        std::vector<PreparedStatementCache::Row> found;
+        if (!conn.statements().query(id, sql.c_str(), params, found)) {
+            std::cerr << "Failed to look up stored samples: " << conn.statements().lastError() << std::endl;
+            if (conn.lost()) {
+                return false;
             }
+            // Counted as new, as before the lookup
+            break;
         }
-        std::cerr << "MySQL query error: " << mysql_error(static_cast<MYSQL*>(conn_)) << std::endl;
+        for (const auto& row : found) {
+            stored.emplace(row[0], std::strtoll(row[1].c_str(), nullptr, 10));
+        }
+    }
+
+    for (const auto& row : batch.hardware) {
+        std::pair<std::string, int64_t> key(row.sample.device_id, row.sample.timestamp_ms);
+        if (!stored.count(key) && keys.erase(key) > 0) {
+            rollups_.add(row.sample);
+        }
+    }
+    batch.rollups_counted = true;
+    return true;
+}
+
+bool MySQLMetricsStorage::spoolBatch(const Batch& batch, int64_t rollups_run) {
+    SpoolBatch spooled;
+    spooled.rollups_run = rollups_run;
+    spooled.hardware.reserve(batch.hardware.size());
+    for (const auto& row : batch.hardware) {
+        spooled.hardware.push_back(row.sample);
+    }
+    spooled.software.reserve(batch.software.size());
+    for (const auto& row : batch.software) {
+        spooled.software.push_back(row.sample);
+    }
+
+    bool first = spool_->empty();
+    if (!spool_->append(spooled)) {
         return false;
     }
+    if (first) {
+        std::cerr << "MySQL unavailable, spooling metrics to " << spool_->directory() << std::endl;
+        replay_retry_at_ = std::chrono::steady_clock::now() + replay_backoff_;
+    }
     return true;
 }
 
-// Helper function to escape SQL strings
-std::string MySQLMetricsStorage::escapeSqlString(const std::string& input) {
-    if (!conn_) return input;
-    
-    char* escaped = new char[input.length() * 2 + 1];
-    mysql_real_escape_string(static_cast<MYSQL*>(conn_), escaped, input.c_str(), input.length());
-    std::string result(escaped);
-    delete[] escaped;
-    return result;
+void MySQLMetricsStorage::replaySpool() {
+    if (spool_->empty()) {
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    auto deadline = now + options_.flush_interval;
+
+    SpoolBatch spooled;
+    while (spool_->front(spooled)) {
+        Batch batch;
+        batch.hardware.reserve(spooled.hardware.size());
+        for (auto& sample : spooled.hardware) {
+            batch.hardware.push_back({std::move(sample), nullptr});
+        }
+        batch.software.reserve(spooled.software.size());
+        for (auto& sample : spooled.software) {
+            batch.software.push_back({std::move(sample), nullptr});
+        }
+
+        // Batches spooled by an earlier run, or before a first commit attempt,
+        // are counted by their first commit attempt here
+        batch.rollups_counted = spooled.rollups_run == started_ms_ || replay_front_counted_;
+
+        if (!commit(batch)) {
+            replay_front_counted_ = batch.rollups_counted;
+            replay_retry_at_ = std::chrono::steady_clock::now() + replay_backoff_;
+            replay_backoff_ = std::min(replay_backoff_ * 2, std::chrono::milliseconds(5000));
+            return;
+        }
+
+        spool_->pop();
+        replay_front_counted_ = false;
+        replay_backoff_ = std::chrono::milliseconds(100);
+
+        now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+            break;
+        }
+    }
+
+    auto stats = spool_->getStats();
+    if (stats.pending_batches == 0) {
+        std::cout << "Metrics spool replayed, " << stats.replayed_rows << " rows written since start" << std::endl;
+    } else if (now - replay_reported_ >= std::chrono::seconds(10)) {
+        replay_reported_ = now;
+        std::cout << "Replaying metrics spool: " << stats.pending_rows << " rows left, "
+                  << static_cast<uint64_t>(stats.replay_rows_per_sec) << " rows/s" << std::endl;
+    }
 }
 
-bool MySQLMetricsStorage::insertHardwareInfo(const nlohmann::json& m) {
-    if (!conn_) {
-        std::cerr << "No MySQL connection available" << std::endl;
+bool MySQLMetricsStorage::commitBatch(MySQLConnection& conn, const Batch& batch, bool& connection_lost) {
+    MYSQL* mysql = conn.handle();
+
+    if (mysql_query(mysql, "START TRANSACTION")) {
+        std::cerr << "MySQL query error: " << mysql_error(mysql) << std::endl;
+        connection_lost = conn.lost();
         return false;
     }
 
-    // Handle string fields
-    std::string device_id = escapeSqlString(m.value("device_id", "unknown"));
-    std::string readable_date = escapeSqlString(m.value("readable_date", ""));
-    std::string usb_state = escapeSqlString(m.value("usb_state", ""));
-    std::string kernel_version = escapeSqlString(m.value("kernel_version", ""));
-    std::string hardware_model = escapeSqlString(m.value("hardware_model", ""));
-    std::string firmware_version = escapeSqlString(m.value("firmware_version", ""));
-
-    // Handle numeric fields
-    double cpu_usage = 0.0;
-    double memory_usage = 0.0;
-    double disk_usage = 0.0;
-    int gpio_state = 0;  // Now an integer
-
-    // Extract numeric values
-    if (m.contains("cpu_usage") && m["cpu_usage"].is_number()) {
-        cpu_usage = m["cpu_usage"].get<double>();
-    }
-    if (m.contains("memory_usage") && m["memory_usage"].is_number()) {
-        memory_usage = m["memory_usage"].get<double>();
-    }
-    if (m.contains("disk_usage") && m["disk_usage"].is_number()) {
-        disk_usage = m["disk_usage"].get<double>();
-    }
-
-    // Handle gpio_state as an integer
-    if (m.contains("gpio_state")) {
-        if (m["gpio_state"].is_number_integer()) {
-            gpio_state = m["gpio_state"].get<int>();  // Direct integer from JSON
-        } else if (m["gpio_state"].is_string()) {
-            try {
-                gpio_state = std::stoi(m["gpio_state"].get<std::string>());  // Convert string to int
-            } catch (const std::exception& e) {
-                std::cerr << "Error converting gpio_state to int: " << e.what() << std::endl;
-                gpio_state = 0;  // Default value on failure
+    std::vector<const HardwareSample*> hardware;
+    hardware.reserve(batch.hardware.size());
+    for (const auto& row : batch.hardware) {
+        hardware.push_back(&row.sample);
+    }
+    std::vector<const SoftwareSample*> software;
+    software.reserve(batch.software.size());
+    for (const auto& row : batch.software) {
+        software.push_back(&row.sample);
+    }
+
+    bool ok = insertHardware(conn, batch.hardware.data(), batch.hardware.size()) &&
+              insertSoftware(conn, batch.software.data(), batch.software.size()) &&
+              writeLatestState(conn, hardware, software) &&
+              writeRollups(conn);
+
+    if (ok && mysql_query(mysql, "COMMIT") == 0) {
+        return true;
+    }
+
+    std::cerr << "MySQL batch insert failed: " << (ok ? mysql_error(mysql) : conn.statements().lastError()) << std::endl;
+    connection_lost = conn.lost();
+    if (!connection_lost) {
+        mysql_query(mysql, "ROLLBACK");
+    }
+    return false;
+}
+
+bool MySQLMetricsStorage::commitRowByRow(MySQLConnection& conn, Batch& batch) {
+    // Rows written before a lost connection are upserted again on retry
+    size_t rejected = 0;
+    std::vector<const HardwareSample*> hardware;
+    for (auto& row : batch.hardware) {
+        if (insertHardware(conn, &row, 1)) {
+            hardware.push_back(&row.sample);
+        } else if (conn.lost()) {
+            return false;
+        } else {
+            rejected++;
+        }
+    }
+    std::vector<const SoftwareSample*> software;
+    for (auto& row : batch.software) {
+        if (insertSoftware(conn, &row, 1)) {
+            software.push_back(&row.sample);
+        } else if (conn.lost()) {
+            return false;
+        } else {
+            rejected++;
+        }
+    }
+
+    // Rejected rows would fail again on redelivery, so they are dropped like before
+    if (rejected > 0) {
+        std::cerr << "Dropped " << rejected << " metrics rows rejected by MySQL" << std::endl;
+    }
+
+    if (!writeLatestState(conn, hardware, software)) {
+        std::cerr << "Failed to update device_latest_state: " << conn.statements().lastError() << std::endl;
+        if (conn.lost()) {
+            return false;
+        }
+    }
+
+    // Buckets left dirty are written with the next batch
+    if (writeRollups(conn)) {
+        rollups_.markWritten();
+    }
+    return true;
+}
+
+void MySQLMetricsStorage::complete(Batch& batch, bool committed) {
+    for (auto& row : batch.hardware) {
+        if (row.done) row.done(committed);
+    }
+    for (auto& row : batch.software) {
+        if (row.done) row.done(committed);
+    }
+}
+
+size_t MySQLMetricsStorage::statementRows(size_t remaining) const {
+    if (remaining >= options_.rows_per_statement) {
+        return options_.rows_per_statement;
+    }
+
+    // Powers of two keep the number of distinct prepared statements small
+    size_t rows = 1;
+    while (rows * 2 <= remaining) {
+        rows *= 2;
+    }
+    return rows;
+}
+
+const std::string& MySQLMetricsStorage::insertSql(const InsertStatement& statement, size_t rows,
+                                                  const std::string& id) {
+    std::string& sql = insert_sql_[id];
+    if (sql.empty()) {
+        sql = statement.head;
+        for (size_t i = 0; i < rows; i++) {
+            if (i > 0) sql += ",";
+            sql += statement.row;
+        }
+        sql += statement.tail;
+    }
+    return sql;
+}
+
+bool MySQLMetricsStorage::insertRows(MySQLConnection& conn, const InsertStatement& statement, size_t count,
+                                     const std::function<void(StatementParams&, size_t)>& bind) {
+    for (size_t i = 0; i < count;) {
+        size_t rows = statementRows(count - i);
+
+        StatementParams params;
+        for (size_t end = i + rows; i < end; i++) {
+            bind(params, i);
+        }
+
+        std::string id = std::string(statement.id) + "." + std::to_string(rows);
+        if (!conn.statements().execute(id, insertSql(statement, rows, id).c_str(), params)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void MySQLMetricsStorage::bindAttribute(StatementParams& params, const std::string& value, bool present) {
+    uint32_t id = present ? attributes_.id(value) : 0;
+    if (id != 0) {
+        params.add(static_cast<int64_t>(id)).addNull();
+    } else if (present && !value.empty()) {
+        params.addNull().add(value);
+    } else {
+        params.addNull().addNull();
+    }
+}
+
+bool MySQLMetricsStorage::insertHardware(MySQLConnection& conn, const HardwareRow* rows, size_t count) {
+    return insertRows(conn, HARDWARE_INSERT, count, [this, rows](StatementParams& params, size_t i) {
+        const HardwareSample& m = rows[i].sample;
+        params.add(m.device_id).addDateTime(m.timestamp_ms);
+
+        // Missing values are stored as NULL
+        for (double value : {m.cpu_usage, m.memory_usage, m.disk_usage}) {
+            if (std::isnan(value)) {
+                params.addNull();
+            } else {
+                params.add(value);
             }
+        }
+        bindAttribute(params, m.usb_state, m.has_usb_state);
+        if (m.has_gpio_state) {
+            params.add(static_cast<int32_t>(m.gpio_state));
         } else {
-            std::cerr << "gpio_state is neither a number nor a convertible string" << std::endl;
+            params.addNull();
+        }
+        bindAttribute(params, m.kernel_version, true);
+        bindAttribute(params, m.hardware_model, true);
+        bindAttribute(params, m.firmware_version, true);
+    });
+}
+
+bool MySQLMetricsStorage::insertSoftware(MySQLConnection& conn, const SoftwareRow* rows, size_t count) {
+    bool ok = insertRows(conn, SOFTWARE_INSERT, count, [this, rows](StatementParams& params, size_t i) {
+        const SoftwareSample& m = rows[i].sample;
+        params.add(m.device_id)
+              .addDateTime(m.timestamp_ms)
+              .add(m.ip_address)
+              .add(m.uptime)
+              .add(m.network_status);
+        bindAttribute(params, m.os_version, true);
+
+        for (const std::string* value : {&rows[i].applications, &rows[i].services}) {
+            uint32_t id = attributes_.id(*value);
+            if (id != 0) {
+                params.add(static_cast<int64_t>(id));
+            } else {
+                params.addNull();
+            }
+        }
+    });
+    if (!ok) {
+        return false;
+    }
+
+    // (sample, entry index) of the services and applications that have no dictionary id
+    std::vector<std::pair<const SoftwareSample*, size_t>> services;
+    std::vector<std::pair<const SoftwareSample*, size_t>> applications;
+    for (size_t i = 0; i < count; i++) {
+        const SoftwareSample& m = rows[i].sample;
+        if (attributes_.id(rows[i].services) == 0) {
+            for (size_t j = 0; j < m.services.size(); j++) {
+                services.emplace_back(&m, j);
+            }
         }
+        if (attributes_.id(rows[i].applications) == 0) {
+            for (size_t j = 0; j < m.applications.size(); j++) {
+                applications.emplace_back(&m, j);
+            }
+        }
+    }
+
+    return insertRows(conn, SERVICES_INSERT, services.size(), [&services](StatementParams& params, size_t i) {
+               const SoftwareSample& m = *services[i].first;
+               const auto& service = m.services[services[i].second];
+               params.add(m.device_id).addDateTime(m.timestamp_ms).add(service.first).add(service.second);
+           }) &&
+           insertRows(conn, APPLICATIONS_INSERT, applications.size(),
+                      [&applications](StatementParams& params, size_t i) {
+               const SoftwareSample& m = *applications[i].first;
+               const auto& app = m.applications[applications[i].second];
+               params.add(m.device_id).addDateTime(m.timestamp_ms).add(app.name).add(app.version);
+           });
+}
+
+bool MySQLMetricsStorage::writeLatestState(MySQLConnection& conn,
+                                           const std::vector<const HardwareSample*>& hardware,
+                                           const std::vector<const SoftwareSample*>& software) {
+    // One upsert per device and batch, with its newest sample
+    std::map<std::string, const HardwareSample*> newest_hardware;
+    for (const HardwareSample* sample : hardware) {
+        auto& newest = newest_hardware[sample->device_id];
+        if (!newest || sample->timestamp_ms >= newest->timestamp_ms) {
+            newest = sample;
+        }
+    }
+    std::map<std::string, const SoftwareSample*> newest_software;
+    for (const SoftwareSample* sample : software) {
+        auto& newest = newest_software[sample->device_id];
+        if (!newest || sample->timestamp_ms >= newest->timestamp_ms) {
+            newest = sample;
+        }
+    }
+
+    std::vector<const HardwareSample*> hardware_rows;
+    hardware_rows.reserve(newest_hardware.size());
+    for (const auto& [device, sample] : newest_hardware) {
+        hardware_rows.push_back(sample);
     }
+    std::vector<const SoftwareSample*> software_rows;
+    software_rows.reserve(newest_software.size());
+    for (const auto& [device, sample] : newest_software) {
+        software_rows.push_back(sample);
+    }
+
+    return insertRows(conn, LATEST_HARDWARE_UPSERT, hardware_rows.size(),
+                      [&hardware_rows](StatementParams& params, size_t i) {
+               bindHardware(params, *hardware_rows[i]);
+           }) &&
+           insertRows(conn, LATEST_SOFTWARE_UPSERT, software_rows.size(),
+                      [&software_rows](StatementParams& params, size_t i) {
+               bindSoftware(params, *software_rows[i]);
+           });
+}
+
+bool MySQLMetricsStorage::queryLatestStates(std::vector<DeviceLatestState>& states) {
+    auto conn = pool_->acquire();
+    if (!conn) return false;
 
-    // Construct the SQL query
-    std::string query =
-        "INSERT INTO hardware_info (device_id, readable_date, cpu_usage, memory_usage, disk_usage, usb_state, gpio_state, kernel_version, hardware_model, firmware_version) VALUES ('" +
-        device_id + "','" +
-        readable_date + "'," +
-        std::to_string(cpu_usage) + "," +
-        std::to_string(memory_usage) + "," +
-        std::to_string(disk_usage) + ",'" +
-        usb_state + "'," +
-        std::to_string(gpio_state) + "," +  // Insert as number, no quotes
-        "'" + kernel_version + "','" +
-        hardware_model + "','" +
-        firmware_version + "')";
+    StatementParams params;
+    std::vector<PreparedStatementCache::Row> rows;
+    if (!conn->statements().query("device_latest_state.select",
+                                  "SELECT device_id, TIMESTAMPDIFF(MICROSECOND, '1970-01-01', hardware_ts) DIV 1000, "
+                                  "cpu_usage, memory_usage, disk_usage, usb_state, gpio_state, kernel_version, "
+                                  "hardware_model, firmware_version, "
+                                  "TIMESTAMPDIFF(MICROSECOND, '1970-01-01', software_ts) DIV 1000, "
+                                  "ip_address, uptime, network_status, os_version "
+                                  "FROM device_latest_state ORDER BY device_id",
+                                  params, rows)) {
+        return false;
+    }
 
-    return executeQuery(query);
+    states.reserve(states.size() + rows.size());
+    for (const auto& row : rows) {
+        DeviceLatestState state;
+        HardwareSample& hw = state.hardware;
+        hw.device_id = row[0];
+        hw.timestamp_ms = std::strtoll(row[1].c_str(), nullptr, 10);
+        if (!row[2].empty()) hw.cpu_usage = columnValue(row[2]);
+        if (!row[3].empty()) hw.memory_usage = columnValue(row[3]);
+        if (!row[4].empty()) hw.disk_usage = columnValue(row[4]);
+        hw.usb_state = row[5];
+        hw.has_usb_state = !row[5].empty();
+        hw.gpio_state = std::atoi(row[6].c_str());
+        hw.has_gpio_state = !row[6].empty();
+        hw.kernel_version = row[7];
+        hw.hardware_model = row[8];
+        hw.firmware_version = row[9];
+
+        SoftwareSample& sw = state.software;
+        sw.device_id = row[0];
+        sw.timestamp_ms = std::strtoll(row[10].c_str(), nullptr, 10);
+        sw.ip_address = row[11];
+        sw.uptime = row[12];
+        sw.network_status = row[13];
+        sw.os_version = row[14];
+        states.push_back(std::move(state));
+    }
+    return true;
+}
+
+bool MySQLMetricsStorage::loadRollups(MySQLConnection& conn) {
+    for (size_t i = 0; i < MetricsRollup::LevelCount; i++) {
+        auto level = static_cast<MetricsRollup::Level>(i);
+        std::string id = std::string(MetricsRollup::tableName(level)) + ".select";
+        std::string sql = std::string("SELECT samples, cpu_min, cpu_max, cpu_avg, memory_min, memory_max, memory_avg, "
+                                      "disk_min, disk_max, disk_avg, histogram FROM ") +
+                          MetricsRollup::tableName(level) + " WHERE device_id = ? AND ts = ?";
+
+        for (MetricsRollup::Bucket* bucket : rollups_.bucketsToLoad(level)) {
+            StatementParams params(2);
+            params.add(bucket->device_id).addDateTime(bucket->start_ms);
+            std::vector<PreparedStatementCache::Row> rows;
+            if (!conn.statements().query(id, sql.c_str(), params, rows)) {
+                return false;
+            }
+
+            if (!rows.empty()) {
+                const auto& row = rows[0];
+                std::array<double, 9> min_max_avg;
+                for (size_t c = 0; c < min_max_avg.size(); c++) {
+                    min_max_avg[c] = columnValue(row[c + 1]);
+                }
+                if (!bucket->mergeStored(std::strtoull(row[0].c_str(), nullptr, 10), row[10], min_max_avg)) {
+                    std::cerr << "Ignoring malformed histogram of " << MetricsRollup::tableName(level)
+                              << " for device " << bucket->device_id << std::endl;
+                }
+            }
+            bucket->loaded = true;
+        }
+    }
+    return true;
 }
 
-bool MySQLMetricsStorage::insertSoftwareInfo(const nlohmann::json& m) {
-    if (!conn_) {
-        std::cerr << "No MySQL connection available" << std::endl;
+bool MySQLMetricsStorage::writeRollups(MySQLConnection& conn) {
+    if (!loadRollups(conn)) {
         return false;
     }
 
-    // Log the full JSON for debugging
-    
-    std::string apps;
-    if (m.contains("applications")) {
-        for (const auto& app : m["applications"]) {
-            if (!apps.empty()) apps += ";";
-            apps += app.value("name", "") + ":" + app.value("version", "");
-        }
-    }
-    
-    std::string services;
-    if (m.contains("services")) {
-        for (auto& [k, v] : m["services"].items()) {
-            if (!services.empty()) services += ";";
-            services += k + ":" + v.get<std::string>();
-        }
-    }
-    
-    // Escape all string values
-    std::string device_id = escapeSqlString(m.value("device_id", "unknown"));
-    std::string readable_date = escapeSqlString(m.value("readable_date", ""));
-    std::string ip_address = escapeSqlString(m.value("ip_address", ""));
-    std::string uptime = escapeSqlString(m.value("uptime", ""));
-    std::string network_status = escapeSqlString(m.value("network_status", ""));
-    std::string os_version = escapeSqlString(m.value("os_version", ""));
-    apps = escapeSqlString(apps);
-    services = escapeSqlString(services);
-    
-    std::string query =
-        "INSERT INTO software_info (device_id, readable_date, ip_address, uptime, network_status, os_version, applications, services) VALUES ('" +
-        device_id + "','" +
-        readable_date + "','" +
-        ip_address + "','" +
-        uptime + "','" +
-        network_status + "','" +
-        os_version + "','" +
-        apps + "','" +
-        services + "')";
-        
-    return executeQuery(query);
-}
\ No newline at end of file
+    for (size_t i = 0; i < MetricsRollup::LevelCount; i++) {
+        auto buckets = rollups_.dirtyBuckets(static_cast<MetricsRollup::Level>(i));
+
+        // Encoded histograms have to outlive the execution
+        std::vector<std::string> histograms;
+        histograms.reserve(buckets.size());
+        for (const auto* bucket : buckets) {
+            histograms.push_back(bucket->encodeHistogram());
+        }
+
+        bool ok = insertRows(conn, ROLLUP_INSERTS[i], buckets.size(),
+                             [&buckets, &histograms](StatementParams& params, size_t b) {
+            const MetricsRollup::Bucket& bucket = *buckets[b];
+            params.add(bucket.device_id)
+                  .addDateTime(bucket.start_ms)
+                  .add(static_cast<int64_t>(bucket.samples));
+
+            for (const PercentDistribution* metric : {&bucket.cpu, &bucket.memory, &bucket.disk}) {
+                if (metric->count() == 0) {
+                    params.addNull().addNull().addNull().addNull();
+                } else {
+                    params.add(metric->min())
+                          .add(metric->max())
+                          .add(metric->avg())
+                          .add(metric->percentile(0.95));
+                }
+            }
+            params.add(histograms[b]);
+        });
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
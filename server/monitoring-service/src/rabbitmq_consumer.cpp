@@ -1,17 +1,50 @@
 #include "rabbitmq_consumer.h"
-#include "mysql_metrics_storage.h"
+#include "telemetry_parser.h"
 #include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
 #include <amqp_framing.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// JSON and protobuf agents publish to the same queues during migration
+static TelemetryParser::Format payloadFormat(const amqp_envelope_t& envelope) {
+    const amqp_basic_properties_t& props = envelope.message.properties;
+    if (!(props._flags & AMQP_BASIC_CONTENT_TYPE_FLAG)) {
+        return TelemetryParser::Format::Json;
+    }
+    return TelemetryParser::formatFromContentType(static_cast<const char*>(props.content_type.bytes),
+                                                  props.content_type.len);
+}
 
-static MySQLMetricsStorage mysql_storage;
+// Waiting for a full batch would stall once the prefetch window is exhausted
+static size_t effectiveAckBatch(const ConsumerOptions& options) {
+    if (options.prefetch_count > 0 && options.ack_batch_size >= options.prefetch_count) {
+        return std::max<size_t>(1, options.prefetch_count / 2);
+    }
+    return options.ack_batch_size;
+}
 
 RabbitMQConsumer::RabbitMQConsumer(const std::string& hostname, int port,
                                  const std::string& username, const std::string& password,
-                                 const std::string& hw_queue_name, const std::string& sw_queue_name)
+                                 const std::string& hw_queue_name, const std::string& sw_queue_name,
+                                 std::shared_ptr<MetricsStorage> storage,
+                                 const ConsumerOptions& options)
     : hostname_(hostname), port_(port), username_(username), password_(password),
-      hw_queue_name_(hw_queue_name), sw_queue_name_(sw_queue_name),
-      hw_conn_(nullptr), sw_conn_(nullptr), hw_channel_(1), sw_channel_(1),
-      running_(false) {
+      options_(options), storage_(std::move(storage)), conn_(nullptr),
+      worker_pool_(options.worker_count, options.worker_queue_capacity),
+      epoll_fd_(-1), wakeup_fd_(-1), running_(false) {
+    // One channel per queue on the shared connection
+    size_t ack_batch = effectiveAckBatch(options);
+    subscriptions_.push_back(std::make_unique<Subscription>(
+        hw_queue_name, 1, &RabbitMQConsumer::handleHardwareMessage, ack_batch, options.ack_flush_interval));
+    subscriptions_.push_back(std::make_unique<Subscription>(
+        sw_queue_name, 2, &RabbitMQConsumer::handleSoftwareMessage, ack_batch, options.ack_flush_interval));
 }
 
 RabbitMQConsumer::~RabbitMQConsumer() {
@@ -23,229 +56,483 @@ bool RabbitMQConsumer::start(HardwareMetricsCallback hw_callback, SoftwareMetric
         std::cerr << "RabbitMQ consumer already running" << std::endl;
         return false;
     }
-    
+
     hw_callback_ = hw_callback;
     sw_callback_ = sw_callback;
-    
+
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd_ < 0 || wakeup_fd_ < 0) {
+        std::cerr << "Failed to create consumer event loop: " << std::strerror(errno) << std::endl;
+        if (epoll_fd_ >= 0) close(epoll_fd_);
+        if (wakeup_fd_ >= 0) close(wakeup_fd_);
+        epoll_fd_ = wakeup_fd_ = -1;
+        return false;
+    }
+
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = wakeup_fd_;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wakeup_fd_, &ev);
+
     running_ = true;
-    
-    // Start consumer threads
-    hw_thread_ = std::thread(&RabbitMQConsumer::consumeHardwareMetrics, this);
-    sw_thread_ = std::thread(&RabbitMQConsumer::consumeSoftwareMetrics, this);
-    
+
+    // Workers must be up before the first delivery is dispatched
+    worker_pool_.start();
+
+    loop_thread_ = std::thread(&RabbitMQConsumer::run, this);
+
     return true;
 }
 
 void RabbitMQConsumer::stop() {
     if (running_) {
         running_ = false;
-        
-        // Wait for threads to finish
-        if (hw_thread_.joinable()) {
-            hw_thread_.join();
-        }
-        
-        if (sw_thread_.joinable()) {
-            sw_thread_.join();
-        }
-        
-        // Close connections
-        if (hw_conn_) {
-            amqp_channel_close(hw_conn_, hw_channel_, AMQP_REPLY_SUCCESS);
-            amqp_connection_close(hw_conn_, AMQP_REPLY_SUCCESS);
-            amqp_destroy_connection(hw_conn_);
-            hw_conn_ = nullptr;
-        }
-        
-        if (sw_conn_) {
-            amqp_channel_close(sw_conn_, sw_channel_, AMQP_REPLY_SUCCESS);
-            amqp_connection_close(sw_conn_, AMQP_REPLY_SUCCESS);
-            amqp_destroy_connection(sw_conn_);
-            sw_conn_ = nullptr;
+        wakeLoop();
+
+        // The loop drains in-flight messages and closes the connection
+        if (loop_thread_.joinable()) {
+            loop_thread_.join();
         }
+
+        // Nothing is acked past this point, so whatever is not written by
+        // the final flush is redelivered by the broker. The storage is only
+        // fed by this consumer, so closing it here is safe.
+        storage_->close();
+        worker_pool_.stop();
+
+        close(epoll_fd_);
+        close(wakeup_fd_);
+        epoll_fd_ = wakeup_fd_ = -1;
     }
 }
 
-void RabbitMQConsumer::consumeHardwareMetrics() {
-    // Connect to RabbitMQ
-    hw_conn_ = connectToRabbitMQ(hw_queue_name_, hw_channel_);
-    if (!hw_conn_) {
-        std::cerr << "Failed to connect to RabbitMQ for hardware metrics" << std::endl;
-        return;
-    }
+std::vector<IngestWorkerPool::WorkerStats> RabbitMQConsumer::getIngestStats() const {
+    return worker_pool_.getStats();
+}
 
-    // Set up basic consume
-    amqp_basic_consume(hw_conn_, hw_channel_, amqp_cstring_bytes(hw_queue_name_.c_str()),
-                       amqp_empty_bytes, 0, 0, 0, amqp_empty_table);
-    amqp_rpc_reply_t res = amqp_get_rpc_reply(hw_conn_);
-    if (!checkAMQPResponse(res, "Starting hardware metrics consumer")) {
-        return;
+void RabbitMQConsumer::run() {
+    auto backoff = options_.reconnect_initial_backoff;
+
+    while (running_) {
+        if (!openConnection()) {
+            closeConnection(false);
+            std::cerr << "RabbitMQ unavailable, retrying in " << backoff.count() << " ms" << std::endl;
+            waitForWakeup(backoff);
+            backoff = std::min(backoff * 2, options_.reconnect_max_backoff);
+            continue;
+        }
+
+        backoff = options_.reconnect_initial_backoff;
+
+        if (eventLoop()) {
+            // Stop requested
+            closeConnection(drainInFlight());
+        } else {
+            // Unacked deliveries of the lost connection are redelivered by the broker
+            std::cerr << "RabbitMQ connection lost, reconnecting" << std::endl;
+            closeConnection(false);
+        }
     }
 
-    std::cout << "Started consuming hardware metrics from queue " << hw_queue_name_ << std::endl;
+    std::cout << "Metrics consumer stopped" << std::endl;
+}
+
+bool RabbitMQConsumer::eventLoop() {
+    int sockfd = amqp_get_sockfd(conn_);
 
-    // Consume messages
     while (running_) {
-        amqp_envelope_t envelope;
-        struct timeval timeout;
-        timeout.tv_sec = 1;
-        timeout.tv_usec = 0;
+        // Only wake up on a timer while there is something left to ack
+        int timeout_ms = -1;
+        for (auto& sub : subscriptions_) {
+            if (sub->acks.hasPending()) {
+                timeout_ms = static_cast<int>(options_.ack_flush_interval.count());
+                break;
+            }
+        }
 
-        amqp_maybe_release_buffers(hw_conn_);
-        res = amqp_consume_message(hw_conn_, &envelope, &timeout, 0);
+        // Frames may already sit in librabbitmq's buffer without the socket being readable
+        if (amqp_data_in_buffer(conn_) || amqp_frames_enqueued(conn_)) {
+            timeout_ms = 0;
+        }
 
-        if (res.reply_type == AMQP_RESPONSE_NORMAL) {
-            // Extract message
-            std::string message(static_cast<char*>(envelope.message.body.bytes), envelope.message.body.len);
+        epoll_event events[2];
+        int n = epoll_wait(epoll_fd_, events, 2, timeout_ms);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "epoll_wait failed: " << std::strerror(errno) << std::endl;
+            return false;
+        }
 
-            try {
-                // Parse JSON
-                nlohmann::json json = nlohmann::json::parse(message);
+        bool readable = (n == 0 && timeout_ms == 0);
+        for (int i = 0; i < n; ++i) {
+            if (events[i].data.fd == wakeup_fd_) {
+                uint64_t value;
+                while (read(wakeup_fd_, &value, sizeof(value)) > 0) {}
+            } else if (events[i].data.fd == sockfd) {
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                    return false;
+                }
+                readable = true;
+            }
+        }
 
-                // Extract device ID
-                std::string device_id = json["device_id"];
+        if (readable && !readAvailable()) {
+            return false;
+        }
 
+        for (auto& sub : subscriptions_) {
+            if (!flushAcks(*sub)) {
+                return false;
+            }
+        }
+    }
 
-                // Call callback
-                hw_callback_(device_id, json);
-                bool ok = mysql_storage.insertHardwareInfo(json);
+    return true;
+}
 
-            } catch (const std::exception& e) {
-            }
+bool RabbitMQConsumer::readAvailable() {
+    do {
+        amqp_envelope_t envelope;
+        struct timeval no_wait;
+        no_wait.tv_sec = 0;
+        no_wait.tv_usec = 0;
 
-            // Acknowledge message
-            amqp_basic_ack(hw_conn_, hw_channel_, envelope.delivery_tag, 0);
+        amqp_maybe_release_buffers(conn_);
+        amqp_rpc_reply_t res = amqp_consume_message(conn_, &envelope, &no_wait, 0);
 
-            // Clean up
+        if (res.reply_type == AMQP_RESPONSE_NORMAL) {
+            dispatch(envelope);
             amqp_destroy_envelope(&envelope);
         } else if (res.reply_type == AMQP_RESPONSE_LIBRARY_EXCEPTION &&
                    res.library_error == AMQP_STATUS_TIMEOUT) {
-            // Timeout, just continue
+            // No complete frame yet, wait for the socket again
+            return true;
+        } else if (res.reply_type == AMQP_RESPONSE_LIBRARY_EXCEPTION &&
+                   res.library_error == AMQP_STATUS_UNEXPECTED_STATE) {
+            if (!handleUnexpectedFrame()) {
+                return false;
+            }
         } else {
-            // Error
-            std::cerr << "Error consuming hardware metrics: " << res.reply_type << std::endl;
-            break;
+            checkAMQPResponse(res, "Consuming message");
+            return false;
         }
-    }
+    } while (amqp_data_in_buffer(conn_) || amqp_frames_enqueued(conn_));
 
-    std::cout << "Hardware metrics consumer stopped" << std::endl;
+    return true;
 }
 
-void RabbitMQConsumer::consumeSoftwareMetrics() {
-    // Connect to RabbitMQ
-    sw_conn_ = connectToRabbitMQ(sw_queue_name_, sw_channel_);
-    if (!sw_conn_) {
-        std::cerr << "Failed to connect to RabbitMQ for software metrics" << std::endl;
-        return;
+bool RabbitMQConsumer::handleUnexpectedFrame() {
+    amqp_frame_t frame;
+    struct timeval no_wait;
+    no_wait.tv_sec = 0;
+    no_wait.tv_usec = 0;
+
+    int status = amqp_simple_wait_frame_noblock(conn_, &frame, &no_wait);
+    if (status == AMQP_STATUS_TIMEOUT) {
+        return true;
+    }
+    if (status != AMQP_STATUS_OK) {
+        std::cerr << "Reading frame: " << amqp_error_string2(status) << std::endl;
+        return false;
     }
 
-    // Set up basic consume
-    amqp_basic_consume(sw_conn_, sw_channel_, amqp_cstring_bytes(sw_queue_name_.c_str()),
-                       amqp_empty_bytes, 0, 0, 0, amqp_empty_table);
-    amqp_rpc_reply_t res = amqp_get_rpc_reply(sw_conn_);
-    if (!checkAMQPResponse(res, "Starting software metrics consumer")) {
-        return;
+    if (frame.frame_type != AMQP_FRAME_METHOD) {
+        return true;
     }
 
-    std::cout << "Started consuming software metrics from queue " << sw_queue_name_ << std::endl;
+    switch (frame.payload.method.id) {
+        case AMQP_CHANNEL_CLOSE_METHOD:
+            std::cerr << "Channel " << frame.channel << " closed by broker" << std::endl;
+            return false;
+        case AMQP_CONNECTION_CLOSE_METHOD:
+            std::cerr << "Connection closed by broker" << std::endl;
+            return false;
+        default:
+            return true;
+    }
+}
 
-    // Consume messages
-    while (running_) {
-        amqp_envelope_t envelope;
-        struct timeval timeout;
-        timeout.tv_sec = 1;
-        timeout.tv_usec = 0;
+void RabbitMQConsumer::dispatch(const amqp_envelope_t& envelope) {
+    for (auto& sub : subscriptions_) {
+        if (sub->channel == envelope.channel) {
+            (this->*(sub->handler))(*sub, envelope);
+            return;
+        }
+    }
 
-        amqp_maybe_release_buffers(sw_conn_);
-        res = amqp_consume_message(sw_conn_, &envelope, &timeout, 0);
+    std::cerr << "Delivery on unknown channel " << envelope.channel << std::endl;
+}
 
-        if (res.reply_type == AMQP_RESPONSE_NORMAL) {
-            // Extract message
-            std::string message(static_cast<char*>(envelope.message.body.bytes), envelope.message.body.len);
+void RabbitMQConsumer::handleHardwareMessage(Subscription& sub, const amqp_envelope_t& envelope) {
+    uint64_t delivery_tag = envelope.delivery_tag;
+    uint64_t generation = sub.acks.dispatched();
+    bool parsed = false;
+    bool dispatched = false;
+
+    // Decode straight from the delivery body; nothing is copied but the fields
+    HardwareSample sample;
+    std::string error;
+    if (TelemetryParser::parseHardware(payloadFormat(envelope),
+                                  static_cast<const char*>(envelope.message.body.bytes),
+                                  envelope.message.body.len, sample, error)) {
+        parsed = true;
+        std::string device_id = sample.device_id;
+
+        // Analysis and storage run on the worker owning this device;
+        // the message is acknowledged once its row is stored
+        Subscription* s = &sub;
+        dispatched = worker_pool_.submit(device_id, [this, s, sample = std::move(sample), delivery_tag, generation]() {
+            try {
+                hw_callback_(sample);
+            } catch (const std::exception& e) {
+                std::cerr << "Error processing hardware metrics from " << sample.device_id
+                          << ": " << e.what() << std::endl;
+            }
 
+            // Acknowledged once the row is committed by the write-behind buffer
+            storage_->insertHardwareInfo(sample, [this, s, delivery_tag, generation](bool committed) {
+                // A row that was not written goes back to the broker
+                if (committed ? s->acks.complete(delivery_tag, generation)
+                              : s->acks.reject(delivery_tag, generation)) {
+                    wakeLoop();
+                }
+            });
+        });
+    } else {
+        std::cerr << "Dropping malformed hardware metrics message: " << error << std::endl;
+    }
+
+    // Malformed messages are covered by the next cumulative ack; valid ones
+    // the workers refused are redelivered
+    if (!parsed) {
+        sub.acks.complete(delivery_tag, generation);
+    } else if (!dispatched) {
+        sub.acks.reject(delivery_tag, generation);
+    }
+}
+
+void RabbitMQConsumer::handleSoftwareMessage(Subscription& sub, const amqp_envelope_t& envelope) {
+    uint64_t delivery_tag = envelope.delivery_tag;
+    uint64_t generation = sub.acks.dispatched();
+    bool parsed = false;
+    bool dispatched = false;
+
+    // Decode straight from the delivery body; nothing is copied but the fields
+    SoftwareSample sample;
+    std::string error;
+    if (TelemetryParser::parseSoftware(payloadFormat(envelope),
+                                  static_cast<const char*>(envelope.message.body.bytes),
+                                  envelope.message.body.len, sample, error)) {
+        parsed = true;
+        std::string device_id = sample.device_id;
+
+        // Analysis and storage run on the worker owning this device;
+        // the message is acknowledged once its row is stored
+        Subscription* s = &sub;
+        dispatched = worker_pool_.submit(device_id, [this, s, sample = std::move(sample), delivery_tag, generation]() {
             try {
-                // Parse JSON
-                nlohmann::json json = nlohmann::json::parse(message);
+                sw_callback_(sample);
+            } catch (const std::exception& e) {
+                std::cerr << "Error processing software metrics from " << sample.device_id
+                          << ": " << e.what() << std::endl;
+            }
 
-                // Extract device ID
-                std::string device_id = json["device_id"];
+            // Acknowledged once the row is committed by the write-behind buffer
+            storage_->insertSoftwareInfo(sample, [this, s, delivery_tag, generation](bool committed) {
+                // A row that was not written goes back to the broker
+                if (committed ? s->acks.complete(delivery_tag, generation)
+                              : s->acks.reject(delivery_tag, generation)) {
+                    wakeLoop();
+                }
+            });
+        });
+    } else {
+        std::cerr << "Dropping malformed software metrics message: " << error << std::endl;
+    }
 
+    // Malformed messages are covered by the next cumulative ack; valid ones
+    // the workers refused are redelivered
+    if (!parsed) {
+        sub.acks.complete(delivery_tag, generation);
+    } else if (!dispatched) {
+        sub.acks.reject(delivery_tag, generation);
+    }
+}
 
+bool RabbitMQConsumer::flushAcks(Subscription& sub, bool force) {
+    // Requeued before an ack can cover them
+    sub.acks.takeRejected(sub.rejected);
+    for (uint64_t tag : sub.rejected) {
+        int status = amqp_basic_nack(conn_, sub.channel, tag, 0, 1);
+        if (status != AMQP_STATUS_OK) {
+            std::cerr << "Rejecting delivery: " << amqp_error_string2(status) << std::endl;
+            return false;
+        }
+    }
 
-                // Call callback
-                sw_callback_(device_id, json);
-                bool ok = mysql_storage.insertSoftwareInfo(json);
+    uint64_t delivery_tag = sub.acks.takeAckable(force);
+    if (delivery_tag == 0) {
+        return true;
+    }
 
-            } catch (const std::exception& e) {
-            }
+    // Acknowledges every delivery up to and including delivery_tag
+    int status = amqp_basic_ack(conn_, sub.channel, delivery_tag, 1);
+    if (status != AMQP_STATUS_OK) {
+        std::cerr << "Acknowledging deliveries: " << amqp_error_string2(status) << std::endl;
+        return false;
+    }
+    return true;
+}
 
-            // Acknowledge message
-            amqp_basic_ack(sw_conn_, sw_channel_, envelope.delivery_tag, 0);
+bool RabbitMQConsumer::drainInFlight() {
+    // Unacked messages are redelivered by the broker, so give up after a while
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
 
-            // Clean up
-            amqp_destroy_envelope(&envelope);
-        } else if (res.reply_type == AMQP_RESPONSE_LIBRARY_EXCEPTION &&
-                   res.library_error == AMQP_STATUS_TIMEOUT) {
-            // Timeout, just continue
-        } else {
-            // Error
-            break;
+    auto in_flight = [this]() {
+        for (auto& sub : subscriptions_) {
+            if (sub->acks.inFlight() > 0) return true;
+        }
+        return false;
+    };
+
+    while (in_flight() && std::chrono::steady_clock::now() < deadline) {
+        for (auto& sub : subscriptions_) {
+            if (!flushAcks(*sub)) {
+                return false;
+            }
         }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
     }
 
-    std::cout << "Software metrics consumer stopped" << std::endl;
+    for (auto& sub : subscriptions_) {
+        if (!flushAcks(*sub, true)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void RabbitMQConsumer::wakeLoop() {
+    uint64_t one = 1;
+    if (write(wakeup_fd_, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        std::cerr << "Failed to wake consumer loop: " << std::strerror(errno) << std::endl;
+    }
 }
 
-amqp_connection_state_t RabbitMQConsumer::connectToRabbitMQ(const std::string& queue_name, int& channel) {
+void RabbitMQConsumer::waitForWakeup(std::chrono::milliseconds timeout) {
+    pollfd pfd{};
+    pfd.fd = wakeup_fd_;
+    pfd.events = POLLIN;
+
+    if (poll(&pfd, 1, static_cast<int>(timeout.count())) > 0) {
+        uint64_t value;
+        while (read(wakeup_fd_, &value, sizeof(value)) > 0) {}
+    }
+}
+
+bool RabbitMQConsumer::openConnection() {
     // Create connection
-    amqp_connection_state_t conn = amqp_new_connection();
-    if (!conn) {
+    conn_ = amqp_new_connection();
+    if (!conn_) {
         std::cerr << "Failed to create AMQP connection" << std::endl;
-        return nullptr;
+        return false;
     }
-    
+
     // Create socket
-    amqp_socket_t* socket = amqp_tcp_socket_new(conn);
+    amqp_socket_t* socket = amqp_tcp_socket_new(conn_);
     if (!socket) {
         std::cerr << "Failed to create TCP socket" << std::endl;
-        amqp_destroy_connection(conn);
-        return nullptr;
+        return false;
     }
-    
+
     // Open socket
     int status = amqp_socket_open(socket, hostname_.c_str(), port_);
     if (status != AMQP_STATUS_OK) {
         std::cerr << "Failed to open TCP socket: " << status << std::endl;
-        amqp_destroy_connection(conn);
-        return nullptr;
+        return false;
     }
-    
+
     // Login
-    amqp_rpc_reply_t reply = amqp_login(conn, "/", 0, 131072, 0, AMQP_SASL_METHOD_PLAIN,
+    amqp_rpc_reply_t reply = amqp_login(conn_, "/", 0, 131072, 0, AMQP_SASL_METHOD_PLAIN,
                                        username_.c_str(), password_.c_str());
     if (!checkAMQPResponse(reply, "Logging in")) {
-        amqp_destroy_connection(conn);
-        return nullptr;
+        return false;
     }
-    
-    // Open channel
-    amqp_channel_open(conn, channel);
-    reply = amqp_get_rpc_reply(conn);
-    if (!checkAMQPResponse(reply, "Opening channel")) {
-        amqp_destroy_connection(conn);
-        return nullptr;
+
+    for (auto& sub : subscriptions_) {
+        // Open channel
+        amqp_channel_open(conn_, sub->channel);
+        reply = amqp_get_rpc_reply(conn_);
+        if (!checkAMQPResponse(reply, "Opening channel")) {
+            return false;
+        }
+
+        // Declare queue
+        amqp_queue_declare(conn_, sub->channel, amqp_cstring_bytes(sub->queue_name.c_str()),
+                          0, 1, 0, 0, amqp_empty_table);
+        reply = amqp_get_rpc_reply(conn_);
+        if (!checkAMQPResponse(reply, "Declaring queue")) {
+            return false;
+        }
+
+        // Bound the number of unacknowledged deliveries in flight
+        amqp_basic_qos(conn_, sub->channel, 0, options_.prefetch_count, 0);
+        reply = amqp_get_rpc_reply(conn_);
+        if (!checkAMQPResponse(reply, "Setting prefetch")) {
+            return false;
+        }
+
+        // Delivery tags restart on the new channel
+        sub->acks.reset();
+
+        // Set up basic consume
+        amqp_basic_consume(conn_, sub->channel, amqp_cstring_bytes(sub->queue_name.c_str()),
+                           amqp_empty_bytes, 0, 0, 0, amqp_empty_table);
+        reply = amqp_get_rpc_reply(conn_);
+        if (!checkAMQPResponse(reply, "Starting consumer")) {
+            return false;
+        }
+
+        std::cout << "Started consuming from queue " << sub->queue_name
+                  << " on channel " << sub->channel << std::endl;
     }
-    
-    // Declare queue
-    amqp_queue_declare(conn, channel, amqp_cstring_bytes(queue_name.c_str()),
-                      0, 1, 0, 0, amqp_empty_table);
-    reply = amqp_get_rpc_reply(conn);
-    if (!checkAMQPResponse(reply, "Declaring queue")) {
-        amqp_destroy_connection(conn);
-        return nullptr;
+
+    // Reads are driven by epoll, never block on the socket
+    int sockfd = amqp_get_sockfd(conn_);
+    int flags = fcntl(sockfd, F_GETFL, 0);
+    fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
+
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = sockfd;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, sockfd, &ev) < 0) {
+        std::cerr << "Failed to watch AMQP socket: " << std::strerror(errno) << std::endl;
+        return false;
     }
-    
-    return conn;
+
+    return true;
+}
+
+void RabbitMQConsumer::closeConnection(bool graceful) {
+    if (!conn_) {
+        return;
+    }
+
+    int sockfd = amqp_get_sockfd(conn_);
+    if (sockfd >= 0) {
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, sockfd, nullptr);
+    }
+
+    if (graceful) {
+        for (auto& sub : subscriptions_) {
+            amqp_channel_close(conn_, sub->channel, AMQP_REPLY_SUCCESS);
+        }
+        amqp_connection_close(conn_, AMQP_REPLY_SUCCESS);
+    }
+
+    amqp_destroy_connection(conn_);
+    conn_ = nullptr;
 }
 
 bool RabbitMQConsumer::checkAMQPResponse(amqp_rpc_reply_t x, const char* context) {
@@ -0,0 +1,22 @@
+#include "recent_sample_filter.h"
+#include <algorithm>
+
+RecentSampleFilter::RecentSampleFilter(size_t window) : window_(std::max<size_t>(window, 1)) {
+}
+
+bool RecentSampleFilter::seen(const std::string& device_id, int64_t timestamp_ms) {
+    Recent& recent = devices_[device_id];
+
+    // A few dozen integers, a linear scan beats any index
+    if (std::find(recent.times.begin(), recent.times.end(), timestamp_ms) != recent.times.end()) {
+        return true;
+    }
+
+    if (recent.times.size() < window_) {
+        recent.times.push_back(timestamp_ms);
+    } else {
+        recent.times[recent.next] = timestamp_ms;
+        recent.next = (recent.next + 1) % window_;
+    }
+    return false;
+}
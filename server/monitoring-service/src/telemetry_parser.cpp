@@ -0,0 +1,609 @@
+#include "telemetry_parser.h"
+#include "monitoring.pb.h"
+#include <charconv>
+#include <cstring>
+#include <cmath>
+#include <string_view>
+#include <chrono>
+
+namespace {
+
+// Forward-only reader over a JSON buffer that is not NUL-terminated
+class JsonCursor {
+public:
+    JsonCursor(const char* data, size_t len) : begin_(data), p_(data), end_(data + len) {}
+
+    const std::string& error() const { return error_; }
+
+    bool fail(const char* message) {
+        if (error_.empty()) {
+            error_ = std::string(message) + " at offset " + std::to_string(p_ - begin_);
+        }
+        return false;
+    }
+
+    void skipWhitespace() {
+        while (p_ < end_ && (*p_ == ' ' || *p_ == '\n' || *p_ == '\r' || *p_ == '\t')) {
+            ++p_;
+        }
+    }
+
+    char peek() {
+        skipWhitespace();
+        return p_ < end_ ? *p_ : '\0';
+    }
+
+    bool expect(char c) {
+        if (peek() != c) {
+            return fail("unexpected character");
+        }
+        ++p_;
+        return true;
+    }
+
+    bool atEnd() {
+        skipWhitespace();
+        return p_ == end_;
+    }
+
+    // Read a string value. Unescaped strings (the common case) are returned as a
+    // view into the message buffer; escaped ones are decoded into a reused
+    // scratch buffer, so the view is only valid until the next readString().
+    bool readString(std::string_view& out) {
+        if (!expect('"')) return false;
+
+        const char* quote = static_cast<const char*>(std::memchr(p_, '"', end_ - p_));
+        if (!quote) return fail("unterminated string");
+
+        if (!std::memchr(p_, '\\', quote - p_)) {
+            out = std::string_view(p_, quote - p_);
+            p_ = quote + 1;
+            return true;
+        }
+
+        scratch_.clear();
+        while (p_ < end_) {
+            char c = *p_++;
+            if (c == '"') {
+                out = scratch_;
+                return true;
+            }
+            if (c != '\\') {
+                scratch_.push_back(c);
+                continue;
+            }
+            if (p_ >= end_) break;
+            switch (*p_++) {
+                case '"': scratch_.push_back('"'); break;
+                case '\\': scratch_.push_back('\\'); break;
+                case '/': scratch_.push_back('/'); break;
+                case 'b': scratch_.push_back('\b'); break;
+                case 'f': scratch_.push_back('\f'); break;
+                case 'n': scratch_.push_back('\n'); break;
+                case 'r': scratch_.push_back('\r'); break;
+                case 't': scratch_.push_back('\t'); break;
+                case 'u': {
+                    uint32_t cp;
+                    if (!readHex4(cp)) return fail("invalid unicode escape");
+                    if (cp >= 0xDC00 && cp <= 0xDFFF) return fail("unpaired surrogate");
+                    // A high surrogate must be followed by a low one
+                    if (cp >= 0xD800 && cp <= 0xDBFF) {
+                        if (end_ - p_ < 6 || p_[0] != '\\' || p_[1] != 'u') return fail("unpaired surrogate");
+                        p_ += 2;
+                        uint32_t low;
+                        if (!readHex4(low)) return fail("invalid unicode escape");
+                        if (low < 0xDC00 || low > 0xDFFF) return fail("unpaired surrogate");
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    appendUtf8(cp);
+                    break;
+                }
+                default:
+                    return fail("invalid escape");
+            }
+        }
+        return fail("unterminated string");
+    }
+
+    // A number too large for a double reads as NaN
+    bool readNumber(double& out) {
+        skipWhitespace();
+        size_t len = numberLength();
+        if (len == 0) return fail("invalid number");
+        auto res = std::from_chars(p_, p_ + len, out);
+        if (res.ec == std::errc::result_out_of_range) {
+            out = std::nan("");
+        } else if (res.ec != std::errc() || res.ptr != p_ + len) {
+            return fail("invalid number");
+        }
+        p_ += len;
+        return true;
+    }
+
+    // Raw text of a number or literal (true/false/null), empty if the value
+    // is neither
+    std::string_view readToken() {
+        skipWhitespace();
+        size_t len = numberLength();
+        if (len == 0) {
+            for (std::string_view literal : {"true", "false", "null"}) {
+                if (static_cast<size_t>(end_ - p_) >= literal.size() &&
+                    std::memcmp(p_, literal.data(), literal.size()) == 0) {
+                    len = literal.size();
+                    break;
+                }
+            }
+        }
+        std::string_view token(p_, len);
+        p_ += len;
+        return token;
+    }
+
+    bool skipValue(int depth = 0) {
+        if (depth > 64) return fail("nesting too deep");
+
+        switch (peek()) {
+            case '"': {
+                std::string_view ignored;
+                return readString(ignored);
+            }
+            case '{':
+                return readObject([&](std::string_view) { return skipValue(depth + 1); });
+            case '[':
+                return readArray([&]() { return skipValue(depth + 1); });
+            case '\0':
+                return fail("unexpected end of message");
+            default:
+                return !readToken().empty() || fail("unexpected character");
+        }
+    }
+
+    // Calls on_member(key) for every member; the callback must consume the value.
+    // The key view is only valid until the callback reads another string.
+    template <typename F>
+    bool readObject(F&& on_member) {
+        if (!expect('{')) return false;
+        if (peek() == '}') {
+            ++p_;
+            return true;
+        }
+
+        while (true) {
+            std::string_view key;
+            if (!readString(key) || !expect(':')) return false;
+            if (!on_member(key)) return false;
+
+            char c = peek();
+            ++p_;
+            if (c == '}') return true;
+            if (c != ',') return fail("expected ',' or '}'");
+        }
+    }
+
+    template <typename F>
+    bool readArray(F&& on_element) {
+        if (!expect('[')) return false;
+        if (peek() == ']') {
+            ++p_;
+            return true;
+        }
+
+        while (true) {
+            if (!on_element()) return false;
+
+            char c = peek();
+            ++p_;
+            if (c == ']') return true;
+            if (c != ',') return fail("expected ',' or ']'");
+        }
+    }
+
+    // Any scalar as text: strings as-is, numbers and literals verbatim, null as empty
+    bool readScalar(std::string& out) {
+        char c = peek();
+        if (c == '"') {
+            std::string_view value;
+            if (!readString(value)) return false;
+            out.assign(value.data(), value.size());
+            return true;
+        }
+        if (c == '{' || c == '[') {
+            out.clear();
+            return skipValue();
+        }
+        std::string_view token = readToken();
+        if (token.empty()) return fail("expected value");
+        if (token == "null") {
+            out.clear();
+        } else {
+            out.assign(token.data(), token.size());
+        }
+        return true;
+    }
+
+    // Percentage given either as a number (66.63) or a string ("66.63%")
+    bool readPercentage(double& out) {
+        char c = peek();
+        if (c == '"') {
+            std::string_view value;
+            if (!readString(value)) return false;
+            out = parsePercentage(value);
+            return true;
+        }
+        if (c == '-' || (c >= '0' && c <= '9')) {
+            return readNumber(out);
+        }
+        out = std::nan("");
+        return skipValue();
+    }
+
+    // Integer given either as a number or a numeric string; fractions,
+    // exponents, literals and values out of int range are not valid
+    bool readInteger(int& out, bool& valid) {
+        std::string_view value;
+        if (peek() == '"') {
+            if (!readString(value)) return false;
+        } else {
+            value = readToken();
+            if (value.empty()) return fail("expected value");
+        }
+
+        auto res = std::from_chars(value.data(), value.data() + value.size(), out);
+        valid = res.ec == std::errc() && res.ptr == value.data() + value.size();
+        if (!valid) {
+            out = 0;
+        }
+        return true;
+    }
+
+private:
+    const char* begin_;
+    const char* p_;
+    const char* end_;
+    std::string scratch_;
+    std::string error_;
+
+    // Length of the JSON number at the cursor, 0 if there is none
+    size_t numberLength() const {
+        auto digit = [this](const char* p) { return p < end_ && *p >= '0' && *p <= '9'; };
+        const char* p = p_;
+        if (p < end_ && *p == '-') ++p;
+        if (!digit(p)) return 0;
+        if (*p == '0') {
+            ++p;
+        } else {
+            while (digit(p)) ++p;
+        }
+        if (p < end_ && *p == '.') {
+            if (!digit(++p)) return 0;
+            while (digit(p)) ++p;
+        }
+        if (p < end_ && (*p == 'e' || *p == 'E')) {
+            ++p;
+            if (p < end_ && (*p == '+' || *p == '-')) ++p;
+            if (!digit(p)) return 0;
+            while (digit(p)) ++p;
+        }
+        return p - p_;
+    }
+
+    bool readHex4(uint32_t& out) {
+        if (end_ - p_ < 4) return false;
+        auto res = std::from_chars(p_, p_ + 4, out, 16);
+        if (res.ec != std::errc() || res.ptr != p_ + 4) return false;
+        p_ += 4;
+        return true;
+    }
+
+    void appendUtf8(uint32_t cp) {
+        if (cp < 0x80) {
+            scratch_.push_back(static_cast<char>(cp));
+        } else if (cp < 0x800) {
+            scratch_.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+            scratch_.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else if (cp < 0x10000) {
+            scratch_.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+            scratch_.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            scratch_.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else {
+            scratch_.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+            scratch_.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+            scratch_.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            scratch_.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+    }
+
+    // "66.63", "66.63%" or "66.63 %"; anything else, nan and inf included, is NaN
+    static double parsePercentage(std::string_view text) {
+        while (!text.empty() && text.front() == ' ') text.remove_prefix(1);
+        while (!text.empty() && text.back() == ' ') text.remove_suffix(1);
+        if (!text.empty() && text.back() == '%') text.remove_suffix(1);
+        while (!text.empty() && text.back() == ' ') text.remove_suffix(1);
+
+        double value;
+        auto res = std::from_chars(text.data(), text.data() + text.size(), value);
+        if (res.ec != std::errc() || res.ptr != text.data() + text.size() || !std::isfinite(value)) {
+            return std::nan("");
+        }
+        return value;
+    }
+};
+
+bool readText(JsonCursor& cursor, std::string& out) {
+    return cursor.readScalar(out);
+}
+
+// Days since 1970-01-01 of a proleptic Gregorian date
+int64_t daysFromCivil(int64_t y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    unsigned yoe = static_cast<unsigned>(y - era * 400);
+    unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + static_cast<int64_t>(doe) - 719468;
+}
+
+// Digits only, no sign
+bool readDigits(std::string_view text, size_t& pos, size_t width, int& out) {
+    if (pos + width > text.size()) return false;
+    out = 0;
+    for (size_t i = 0; i < width; i++) {
+        char c = text[pos + i];
+        if (c < '0' || c > '9') return false;
+        out = out * 10 + (c - '0');
+    }
+    pos += width;
+    return true;
+}
+
+// Sample time of a message, or the time it was received when the agent
+// sent no usable readable_date or one without a UTC offset
+int64_t sampleTime(const std::string& readable_date) {
+    int64_t ms = TelemetryParser::parseReadableDate(readable_date);
+    if (ms >= 0) {
+        return ms;
+    }
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+int64_t TelemetryParser::parseReadableDate(std::string_view text) {
+    // Six numeric fields separated by any single non-digit:
+    // "2025-06-23_22-47-01" as sent by the agent, "2025-06-23 22:47:01" also accepted
+    static const size_t widths[6] = {4, 2, 2, 2, 2, 2};
+    int fields[6];
+    size_t pos = 0;
+
+    for (int i = 0; i < 6; i++) {
+        if (i > 0) {
+            if (pos >= text.size() || (text[pos] >= '0' && text[pos] <= '9')) return -1;
+            pos++;
+        }
+        if (!readDigits(text, pos, widths[i], fields[i])) return -1;
+    }
+
+    int year = fields[0], month = fields[1], day = fields[2];
+    int hour = fields[3], minute = fields[4], second = fields[5];
+    static const int month_days[12] = {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    if (month < 1 || month > 12 || day < 1 || day > month_days[month - 1] ||
+        (month == 2 && day == 29 && !leap) || hour > 23 || minute > 59 || second > 60) {
+        return -1;
+    }
+
+    // The agent's clock is in its own local time zone, which is not known
+    // here, so a date counts only with its offset: "Z", "+02:00" or "+0200"
+    if (pos == text.size()) return -1;
+    int offset_minutes = 0;
+    if (text[pos] == 'Z' && pos + 1 == text.size()) {
+        pos++;
+    } else if (text[pos] == '+' || text[pos] == '-') {
+        int sign = text[pos++] == '-' ? -1 : 1;
+        int offset_hours, offset_mins;
+        if (!readDigits(text, pos, 2, offset_hours)) return -1;
+        if (pos < text.size() && text[pos] == ':') pos++;
+        if (!readDigits(text, pos, 2, offset_mins)) return -1;
+        if (offset_hours > 23 || offset_mins > 59) return -1;
+        offset_minutes = sign * (offset_hours * 60 + offset_mins);
+    }
+    if (pos != text.size()) return -1;
+
+    int64_t days = daysFromCivil(year, month, day);
+    int64_t ms = ((days * 24 + hour) * 60 + minute - offset_minutes) * 60000 + static_cast<int64_t>(second) * 1000;
+    return ms >= 0 ? ms : -1;
+}
+
+bool TelemetryParser::parseHardware(const char* data, size_t len, HardwareSample& sample, std::string& error) {
+    JsonCursor cursor(data, len);
+
+    bool ok = cursor.readObject([&](std::string_view key) {
+        if (key == "device_id") return readText(cursor, sample.device_id);
+        if (key == "readable_date") return readText(cursor, sample.readable_date);
+        if (key == "cpu_usage") return cursor.readPercentage(sample.cpu_usage);
+        if (key == "memory_usage") return cursor.readPercentage(sample.memory_usage);
+        if (key == "disk_usage") return cursor.readPercentage(sample.disk_usage);
+        if (key == "usb_state") {
+            sample.has_usb_state = true;
+            return readText(cursor, sample.usb_state);
+        }
+        if (key == "gpio_state") return cursor.readInteger(sample.gpio_state, sample.has_gpio_state);
+        if (key == "kernel_version") return readText(cursor, sample.kernel_version);
+        if (key == "hardware_model") return readText(cursor, sample.hardware_model);
+        if (key == "firmware_version") return readText(cursor, sample.firmware_version);
+        return cursor.skipValue();
+    });
+
+    if (ok && !cursor.atEnd()) {
+        ok = cursor.fail("trailing data");
+    }
+    if (ok && sample.device_id.empty()) {
+        ok = cursor.fail("missing device_id");
+    }
+    if (ok) {
+        sample.timestamp_ms = sampleTime(sample.readable_date);
+    } else {
+        error = cursor.error();
+    }
+    return ok;
+}
+
+bool TelemetryParser::parseSoftware(const char* data, size_t len, SoftwareSample& sample, std::string& error) {
+    JsonCursor cursor(data, len);
+
+    bool ok = cursor.readObject([&](std::string_view key) {
+        if (key == "device_id") return readText(cursor, sample.device_id);
+        if (key == "readable_date") return readText(cursor, sample.readable_date);
+        if (key == "ip_address") return readText(cursor, sample.ip_address);
+        if (key == "uptime") return readText(cursor, sample.uptime);
+        if (key == "network_status") return readText(cursor, sample.network_status);
+        if (key == "os_version") return readText(cursor, sample.os_version);
+
+        if (key == "services") {
+            sample.has_services = true;
+            sample.services.clear();
+            return cursor.readObject([&](std::string_view name) {
+                sample.services.emplace_back(std::string(name), std::string());
+                return readText(cursor, sample.services.back().second);
+            });
+        }
+
+        // [{"name": ..., "version": ...}] as sent by the agent
+        if (key == "applications") {
+            sample.applications.clear();
+            return cursor.readArray([&]() {
+                SoftwareSample::Application app;
+                bool parsed = cursor.readObject([&](std::string_view field) {
+                    if (field == "name") return readText(cursor, app.name);
+                    if (field == "version") return readText(cursor, app.version);
+                    return cursor.skipValue();
+                });
+                sample.applications.push_back(std::move(app));
+                return parsed;
+            });
+        }
+
+        // {"name": "version"} as written to the agent's local logs
+        if (key == "application_binaries") {
+            sample.applications.clear();
+            return cursor.readObject([&](std::string_view name) {
+                sample.applications.push_back({std::string(name), std::string()});
+                return readText(cursor, sample.applications.back().version);
+            });
+        }
+
+        return cursor.skipValue();
+    });
+
+    if (ok && !cursor.atEnd()) {
+        ok = cursor.fail("trailing data");
+    }
+    if (ok && sample.device_id.empty()) {
+        ok = cursor.fail("missing device_id");
+    }
+    if (ok) {
+        sample.timestamp_ms = sampleTime(sample.readable_date);
+    } else {
+        error = cursor.error();
+    }
+    return ok;
+}
+
+TelemetryParser::Format TelemetryParser::formatFromContentType(const char* content_type, size_t len) {
+    std::string_view type(content_type, content_type ? len : 0);
+
+    // Ignore parameters such as "; proto=monitoring.HardwareMetrics"
+    size_t semicolon = type.find(';');
+    if (semicolon != std::string_view::npos) {
+        type = type.substr(0, semicolon);
+    }
+
+    if (type == "application/x-protobuf" || type == "application/protobuf") {
+        return Format::Protobuf;
+    }
+    return Format::Json;
+}
+
+bool TelemetryParser::parseHardware(Format format, const char* data, size_t len, HardwareSample& sample, std::string& error) {
+    if (format == Format::Protobuf) {
+        return parseHardwareProtobuf(data, len, sample, error);
+    }
+    return parseHardware(data, len, sample, error);
+}
+
+bool TelemetryParser::parseSoftware(Format format, const char* data, size_t len, SoftwareSample& sample, std::string& error) {
+    if (format == Format::Protobuf) {
+        return parseSoftwareProtobuf(data, len, sample, error);
+    }
+    return parseSoftware(data, len, sample, error);
+}
+
+bool TelemetryParser::parseHardwareProtobuf(const char* data, size_t len, HardwareSample& sample, std::string& error) {
+    monitoring::HardwareMetrics message;
+    if (!message.ParseFromArray(data, static_cast<int>(len))) {
+        error = "invalid HardwareMetrics message";
+        return false;
+    }
+    if (message.device_id().empty()) {
+        error = "missing device_id";
+        return false;
+    }
+
+    sample.device_id = std::move(*message.mutable_device_id());
+    sample.readable_date = std::move(*message.mutable_readable_date());
+    sample.timestamp_ms = sampleTime(sample.readable_date);
+
+    if (message.has_cpu_percent()) sample.cpu_usage = message.cpu_percent();
+    if (message.has_memory_percent()) sample.memory_usage = message.memory_percent();
+    if (message.has_disk_percent()) sample.disk_usage = message.disk_percent();
+
+    if (message.has_usb_devices()) {
+        sample.usb_state = std::move(*message.mutable_usb_devices());
+        sample.has_usb_state = true;
+    }
+    if (message.has_gpio_state()) {
+        sample.gpio_state = message.gpio_state();
+        sample.has_gpio_state = true;
+    }
+
+    sample.kernel_version = std::move(*message.mutable_kernel_version());
+    sample.hardware_model = std::move(*message.mutable_hardware_model());
+    sample.firmware_version = std::move(*message.mutable_firmware_version());
+    return true;
+}
+
+bool TelemetryParser::parseSoftwareProtobuf(const char* data, size_t len, SoftwareSample& sample, std::string& error) {
+    monitoring::SoftwareMetrics message;
+    if (!message.ParseFromArray(data, static_cast<int>(len))) {
+        error = "invalid SoftwareMetrics message";
+        return false;
+    }
+    if (message.device_id().empty()) {
+        error = "missing device_id";
+        return false;
+    }
+
+    sample.device_id = std::move(*message.mutable_device_id());
+    sample.readable_date = std::move(*message.mutable_readable_date());
+    sample.timestamp_ms = sampleTime(sample.readable_date);
+    sample.ip_address = std::move(*message.mutable_ip_address());
+    sample.uptime = std::move(*message.mutable_uptime());
+    sample.network_status = std::move(*message.mutable_network_status());
+    sample.os_version = std::move(*message.mutable_os_version());
+
+    sample.applications.clear();
+    sample.applications.reserve(message.applications_size());
+    for (auto& app : *message.mutable_applications()) {
+        sample.applications.push_back({std::move(*app.mutable_name()), std::move(*app.mutable_version())});
+    }
+
+    // proto3 maps carry no presence, so an empty map means "not reported"
+    sample.services.clear();
+    sample.services.reserve(message.services_size());
+    for (const auto& [name, status] : message.services()) {
+        sample.services.emplace_back(name, status);
+    }
+    sample.has_services = !sample.services.empty();
+    return true;
+}
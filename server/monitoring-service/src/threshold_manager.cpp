@@ -0,0 +1,292 @@
+#include "threshold_manager.h"
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <nlohmann/json.hpp>
+
+namespace fs = std::filesystem;
+using Metric = DeviceStateStore::Metric;
+using Scope = ThresholdRule::Scope;
+
+namespace {
+
+const char* const METRIC_NAMES[DeviceStateStore::METRIC_COUNT] = {"cpu", "memory", "disk"};
+
+bool metricFromName(const std::string& name, Metric& metric) {
+    for (size_t m = 0; m < DeviceStateStore::METRIC_COUNT; m++) {
+        if (name == METRIC_NAMES[m]) {
+            metric = static_cast<Metric>(m);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool scopeFromName(const std::string& name, Scope& scope) {
+    if (name == "global") scope = Scope::Global;
+    else if (name == "hardware_type") scope = Scope::HardwareType;
+    else if (name == "location") scope = Scope::Location;
+    else if (name == "device") scope = Scope::Device;
+    else return false;
+    return true;
+}
+
+float jsonThreshold(const nlohmann::json& metric, const char* field) {
+    auto it = metric.find(field);
+    return it != metric.end() && it->is_number() ? it->get<float>() : NAN;
+}
+
+// { "cpu": { "warning": 80, "critical": 95 }, ... } of one scope
+void readMetrics(const nlohmann::json& object, Scope scope, const std::string& value,
+                 std::vector<ThresholdRule>& rules) {
+    for (size_t m = 0; m < DeviceStateStore::METRIC_COUNT; m++) {
+        auto it = object.find(METRIC_NAMES[m]);
+        if (it == object.end() || !it->is_object()) {
+            continue;
+        }
+        ThresholdRule rule;
+        rule.scope = scope;
+        rule.value = value;
+        rule.metric = static_cast<Metric>(m);
+        rule.warning = jsonThreshold(*it, "warning");
+        rule.critical = jsonThreshold(*it, "critical");
+        rules.push_back(std::move(rule));
+    }
+}
+
+float columnThreshold(const std::string& value) {
+    return value.empty() ? NAN : std::strtof(value.c_str(), nullptr);
+}
+
+} // namespace
+
+ThresholdManager::ThresholdManager(DeviceStateStore& store)
+    : store_(store), version_(0), running_(false) {
+    table_ = ThresholdTable::compile({}, {}, store_, 0);
+}
+
+ThresholdManager::~ThresholdManager() {
+    stop();
+}
+
+bool ThresholdManager::load(const std::string& path, std::shared_ptr<MySQLConnectionPool> pool) {
+    std::lock_guard<std::mutex> lock(load_mutex_);
+    path_ = path;
+    pool_ = std::move(pool);
+    db_fingerprint_.clear();
+
+    // The metrics schema only creates the table with the MySQL metrics backend
+    if (pool_) {
+        auto conn = pool_->acquire();
+        if (conn) {
+            createTable(*conn);
+        }
+    }
+    return loadLocked();
+}
+
+bool ThresholdManager::createTable(MySQLConnection& conn) {
+    // NULL warning / critical keeps the value of the broader scope
+    const char* create_table =
+        "CREATE TABLE IF NOT EXISTS threshold_rules ("
+        "id INT AUTO_INCREMENT PRIMARY KEY,"
+        "scope ENUM('global', 'hardware_type', 'location', 'device') NOT NULL,"
+        "scope_value VARCHAR(255) NOT NULL DEFAULT '',"
+        "metric ENUM('cpu', 'memory', 'disk') NOT NULL,"
+        "warning DECIMAL(5,2) NULL,"
+        "critical DECIMAL(5,2) NULL,"
+        "updated_at TIMESTAMP(3) DEFAULT CURRENT_TIMESTAMP(3) ON UPDATE CURRENT_TIMESTAMP(3),"
+        "UNIQUE KEY uq_threshold_rules (scope, scope_value, metric)"
+        ")";
+
+    if (!conn.execute(create_table)) {
+        std::cerr << "Failed to create threshold_rules" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool ThresholdManager::reloadIfChanged() {
+    std::lock_guard<std::mutex> lock(load_mutex_);
+
+    bool changed = false;
+    if (!path_.empty()) {
+        std::error_code ec;
+        auto time = fs::last_write_time(path_, ec);
+        changed = !ec && time != file_time_;
+    }
+    if (!changed && pool_) {
+        std::string fingerprint;
+        changed = readFingerprint(fingerprint) && fingerprint != db_fingerprint_;
+    }
+    if (changed) {
+        return loadLocked();
+    }
+
+    // Devices that reported since get the rows of their profiles; until
+    // then they use the global thresholds
+    if (store_.size() != compiled_devices_) {
+        compileLocked();
+        return true;
+    }
+    return false;
+}
+
+bool ThresholdManager::loadLocked() {
+    std::vector<ThresholdRule> rules;
+    std::vector<DeviceProfile> devices;
+
+    std::error_code ec;
+    auto file_time = path_.empty() ? fs::file_time_type() : fs::last_write_time(path_, ec);
+    if (!readFile(rules)) {
+        return false;
+    }
+
+    // Without the tables, file rules still beat the defaults, but a table
+    // already loaded is not thrown away over a failed reload
+    std::string fingerprint;
+    if (pool_) {
+        if (!readFingerprint(fingerprint) || !readDatabase(rules, devices)) {
+            if (!db_fingerprint_.empty()) {
+                return false;
+            }
+            std::cerr << "Threshold rules from the database not available, using " << path_ << " only" << std::endl;
+            fingerprint.clear();
+        }
+    }
+
+    rules_ = std::move(rules);
+    profiles_ = std::move(devices);
+    compileLocked();
+    file_time_ = file_time;
+    db_fingerprint_ = fingerprint;
+
+    std::cout << "Thresholds version " << version_ << ": " << rules_.size() << " rule(s), "
+              << profiles_.size() << " device profile(s)" << std::endl;
+    return true;
+}
+
+void ThresholdManager::compileLocked() {
+    // Devices added while compiling are picked up by the next check
+    compiled_devices_ = store_.size();
+    std::atomic_store(&table_, ThresholdTable::compile(rules_, profiles_, store_, ++version_));
+}
+
+bool ThresholdManager::readFile(std::vector<ThresholdRule>& rules) {
+    if (path_.empty()) {
+        return true;
+    }
+
+    std::ifstream in(path_);
+    if (!in) {
+        std::cerr << "Cannot open thresholds file " << path_ << std::endl;
+        return false;
+    }
+    auto root = nlohmann::json::parse(in, nullptr, false);
+    if (root.is_discarded() || !root.is_object()) {
+        std::cerr << "Invalid thresholds file " << path_ << std::endl;
+        return false;
+    }
+
+    readMetrics(root, Scope::Global, "", rules);
+
+    static const std::pair<const char*, Scope> SCOPES[] = {
+        {"hardware_types", Scope::HardwareType}, {"locations", Scope::Location}, {"devices", Scope::Device},
+    };
+    for (const auto& [key, scope] : SCOPES) {
+        auto it = root.find(key);
+        if (it == root.end() || !it->is_object()) {
+            continue;
+        }
+        for (const auto& [name, object] : it->items()) {
+            if (object.is_object()) {
+                readMetrics(object, scope, name, rules);
+            }
+        }
+    }
+    return true;
+}
+
+bool ThresholdManager::readDatabase(std::vector<ThresholdRule>& rules, std::vector<DeviceProfile>& devices) {
+    auto conn = pool_->acquire();
+    if (!conn) return false;
+
+    StatementParams params;
+    std::vector<PreparedStatementCache::Row> rows;
+    if (!conn->statements().query("thresholds.rules",
+                                  "SELECT scope, scope_value, metric, warning, critical FROM threshold_rules ORDER BY id",
+                                  params, rows)) {
+        return false;
+    }
+    for (const auto& row : rows) {
+        ThresholdRule rule;
+        if (!scopeFromName(row[0], rule.scope) || !metricFromName(row[2], rule.metric)) {
+            continue;
+        }
+        rule.value = row[1];
+        rule.warning = columnThreshold(row[3]);
+        rule.critical = columnThreshold(row[4]);
+        rules.push_back(std::move(rule));
+    }
+
+    rows.clear();
+    if (!conn->statements().query("thresholds.devices",
+                                  "SELECT CAST(id AS CHAR), location, hardware_type FROM devices", params, rows)) {
+        return false;
+    }
+    devices.reserve(rows.size());
+    for (auto& row : rows) {
+        devices.push_back({std::move(row[0]), std::move(row[1]), std::move(row[2])});
+    }
+    return true;
+}
+
+bool ThresholdManager::readFingerprint(std::string& fingerprint) {
+    auto conn = pool_->acquire();
+    if (!conn) return false;
+
+    // Row counts catch deletes, update times catch changes
+    StatementParams params;
+    std::vector<PreparedStatementCache::Row> rows;
+    if (!conn->statements().query("thresholds.fingerprint",
+                                  "SELECT (SELECT CONCAT(COUNT(*), '/', COALESCE(MAX(updated_at), '')) FROM threshold_rules), "
+                                  "(SELECT CONCAT(COUNT(*), '/', COALESCE(MAX(updated_at), '')) FROM devices)",
+                                  params, rows) ||
+        rows.empty()) {
+        return false;
+    }
+    fingerprint = rows[0][0] + ";" + rows[0][1];
+    return true;
+}
+
+void ThresholdManager::start(std::chrono::seconds interval, std::function<void()> on_change) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_) return;
+    running_ = true;
+
+    reload_thread_ = std::thread([this, interval, on_change]() {
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                if (wakeup_.wait_for(lock, interval, [this]() { return !running_; })) {
+                    return;
+                }
+            }
+            if (reloadIfChanged() && on_change) {
+                on_change();
+            }
+        }
+    });
+}
+
+void ThresholdManager::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) return;
+        running_ = false;
+    }
+    wakeup_.notify_all();
+    if (reload_thread_.joinable()) {
+        reload_thread_.join();
+    }
+}
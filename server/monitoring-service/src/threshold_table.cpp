@@ -0,0 +1,128 @@
+#include "threshold_table.h"
+#include <algorithm>
+#include <map>
+#include <utility>
+
+const MetricThreshold ThresholdTable::DEFAULTS[ThresholdTable::METRIC_COUNT] = {
+    {80, 95},   // cpu
+    {85, 95},   // memory
+    {85, 95},   // disk
+};
+
+namespace {
+
+using Key = std::pair<ThresholdRule::Scope, std::string>;
+using Overrides = std::map<Key, std::vector<const ThresholdRule*>>;
+
+void apply(const ThresholdRule& rule, MetricThreshold& threshold) {
+    if (!std::isnan(rule.warning)) threshold.warning = rule.warning;
+    if (!std::isnan(rule.critical)) threshold.critical = rule.critical;
+}
+
+void applyScope(const Overrides& overrides, ThresholdRule::Scope scope, const std::string& value,
+                MetricThreshold (&thresholds)[ThresholdTable::METRIC_COUNT]) {
+    if (value.empty()) {
+        return;
+    }
+    auto it = overrides.find(Key(scope, value));
+    if (it == overrides.end()) {
+        return;
+    }
+    for (const auto* rule : it->second) {
+        apply(*rule, thresholds[static_cast<size_t>(rule->metric)]);
+    }
+}
+
+} // namespace
+
+std::shared_ptr<const ThresholdTable> ThresholdTable::compile(const std::vector<ThresholdRule>& rules,
+                                                              const std::vector<DeviceProfile>& devices,
+                                                              const DeviceStateStore& store, uint64_t version) {
+    auto table = std::make_shared<ThresholdTable>();
+    table->version_ = version;
+
+    // Later rules of the same scope and metric win
+    Overrides overrides;
+    for (size_t m = 0; m < METRIC_COUNT; m++) {
+        table->global_[m] = DEFAULTS[m];
+    }
+    for (const auto& rule : rules) {
+        if (rule.scope == ThresholdRule::Scope::Global) {
+            apply(rule, table->global_[static_cast<size_t>(rule.metric)]);
+        } else {
+            overrides[Key(rule.scope, rule.value)].push_back(&rule);
+        }
+    }
+
+    // Devices named only by a device rule still get their row
+    std::vector<DeviceProfile> profiles = devices;
+    for (const auto& [key, scoped] : overrides) {
+        if (key.first == ThresholdRule::Scope::Device) {
+            profiles.push_back({key.second, "", ""});
+        }
+    }
+
+    // Resolve every device with a rule of a narrower scope than global
+    std::vector<std::pair<uint32_t, std::vector<MetricThreshold>>> resolved;
+    for (const auto& profile : profiles) {
+        MetricThreshold thresholds[METRIC_COUNT];
+        std::copy(table->global_, table->global_ + METRIC_COUNT, thresholds);
+        applyScope(overrides, ThresholdRule::Scope::HardwareType, profile.hardware_type, thresholds);
+        applyScope(overrides, ThresholdRule::Scope::Location, profile.location, thresholds);
+        applyScope(overrides, ThresholdRule::Scope::Device, profile.device_id, thresholds);
+
+        bool specific = false;
+        for (size_t m = 0; m < METRIC_COUNT; m++) {
+            specific = specific || thresholds[m].warning != table->global_[m].warning ||
+                       thresholds[m].critical != table->global_[m].critical;
+        }
+        if (!specific) {
+            continue;
+        }
+
+        uint32_t index = store.find(profile.device_id);
+        if (index == DeviceStateStore::NO_DEVICE) {
+            continue;
+        }
+        resolved.emplace_back(index, std::vector<MetricThreshold>(thresholds, thresholds + METRIC_COUNT));
+        table->devices_ = std::max<size_t>(table->devices_, index + 1);
+    }
+
+    // Critical implies warning, also when configured the other way round
+    size_t padded = (table->devices_ + DeviceStateStore::CHUNK_DEVICES - 1) / DeviceStateStore::CHUNK_DEVICES *
+                    DeviceStateStore::CHUNK_DEVICES;
+    for (size_t m = 0; m < METRIC_COUNT; m++) {
+        MetricThreshold& global = table->global_[m];
+        global.warning = std::min(global.warning, global.critical);
+
+        table->warning_[m].assign(padded, global.warning);
+        table->critical_[m].assign(padded, global.critical);
+        table->global_warning_[m].assign(DeviceStateStore::CHUNK_DEVICES, global.warning);
+        table->global_critical_[m].assign(DeviceStateStore::CHUNK_DEVICES, global.critical);
+    }
+    for (const auto& [index, thresholds] : resolved) {
+        for (size_t m = 0; m < METRIC_COUNT; m++) {
+            table->warning_[m][index] = std::min(thresholds[m].warning, thresholds[m].critical);
+            table->critical_[m][index] = thresholds[m].critical;
+        }
+    }
+    return table;
+}
+
+MetricThreshold ThresholdTable::get(uint32_t index, Metric metric) const {
+    size_t m = static_cast<size_t>(metric);
+    if (index >= devices_) {
+        return global_[m];
+    }
+    return {warning_[m][index], critical_[m][index]};
+}
+
+const float* ThresholdTable::warning(Metric metric, uint32_t first) const {
+    size_t m = static_cast<size_t>(metric);
+    return first < devices_ ? warning_[m].data() + first : global_warning_[m].data();
+}
+
+const float* ThresholdTable::critical(Metric metric, uint32_t first) const {
+    size_t m = static_cast<size_t>(metric);
+    return first < devices_ ? critical_[m].data() + first : global_critical_[m].data();
+}
@@ -0,0 +1,349 @@
+#include "time_series_storage.h"
+#include <iostream>
+#include <algorithm>
+#include <filesystem>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+static const char* const SEGMENT_PREFIX = "block-";
+static const char* const SEGMENT_SUFFIX = ".tsdb";
+
+static int64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+TimeSeriesStorage::TimeSeriesStorage(const TimeSeriesOptions& options)
+    : options_(options), buffered_rows_(0), opened_(false), closed_(false), software_notice_(false) {
+    block_ms_ = std::chrono::duration_cast<std::chrono::milliseconds>(options_.block_duration).count();
+    if (block_ms_ <= 0) block_ms_ = 3600 * 1000;
+    if (options_.max_buffered_rows == 0) options_.max_buffered_rows = 1;
+}
+
+TimeSeriesStorage::~TimeSeriesStorage() {
+    close();
+}
+
+bool TimeSeriesStorage::open() {
+    std::error_code ec;
+    fs::create_directories(options_.directory, ec);
+    if (ec) {
+        std::cerr << "Cannot create time-series directory " << options_.directory << ": " << ec.message() << std::endl;
+        return false;
+    }
+
+    size_t bytes = 0;
+    for (const auto& entry : fs::directory_iterator(options_.directory, ec)) {
+        std::string name = entry.path().filename().string();
+
+        // Leftover of a compaction interrupted by a crash
+        if (name.size() > 8 && name.compare(name.size() - 8, 8, ".compact") == 0) {
+            fs::remove(entry.path(), ec);
+            continue;
+        }
+        if (name.rfind(SEGMENT_PREFIX, 0) != 0) {
+            continue;
+        }
+
+        std::string error;
+        auto segment = TsdbSegment::load(entry.path().string(), error);
+        if (!segment) {
+            std::cerr << "Skipping time-series block: " << error << std::endl;
+            continue;
+        }
+        bytes += segment->size();
+        segments_[segment->startMs()] = segment;
+    }
+    if (ec) {
+        std::cerr << "Cannot list " << options_.directory << ": " << ec.message() << std::endl;
+        return false;
+    }
+
+    std::cout << "Time-series store " << options_.directory << ": " << segments_.size() << " block(s), "
+              << bytes / 1024 << " KiB" << std::endl;
+
+    {
+        std::lock_guard<std::mutex> lock(buffer_mutex_);
+        opened_ = true;
+    }
+    last_maintenance_ = std::chrono::steady_clock::time_point();
+    flusher_ = std::thread(&TimeSeriesStorage::flushLoop, this);
+    return true;
+}
+
+bool TimeSeriesStorage::insertHardwareInfo(const HardwareSample& sample, Completion done) {
+    std::unique_lock<std::mutex> lock(buffer_mutex_);
+    buffer_space_.wait(lock, [this]() {
+        return closed_ || buffered_rows_ < options_.max_buffered_rows;
+    });
+    if (closed_ || !opened_) {
+        return false;
+    }
+
+    Pending pending;
+    pending.device_id = sample.device_id;
+    pending.point.timestamp_ms = sample.timestamp_ms;
+    pending.point.values[0] = sample.cpu_usage;
+    pending.point.values[1] = sample.memory_usage;
+    pending.point.values[2] = sample.disk_usage;
+    pending.done = std::move(done);
+
+    buffer_.push_back(std::move(pending));
+    buffered_rows_++;
+    if (buffer_.size() == 1) {
+        buffer_ready_.notify_one();
+    }
+    return true;
+}
+
+bool TimeSeriesStorage::insertSoftwareInfo(const SoftwareSample& sample, Completion done) {
+    {
+        std::lock_guard<std::mutex> lock(buffer_mutex_);
+        if (closed_ || !opened_) {
+            return false;
+        }
+    }
+
+    if (!software_notice_.exchange(true)) {
+        std::cout << "Time-series backend keeps hardware series only, software metrics of "
+                  << sample.device_id << " and other devices are not stored" << std::endl;
+    }
+    if (done) done(true);
+    return true;
+}
+
+size_t TimeSeriesStorage::bufferedRows() const {
+    std::lock_guard<std::mutex> lock(buffer_mutex_);
+    return buffered_rows_;
+}
+
+void TimeSeriesStorage::close() {
+    {
+        std::lock_guard<std::mutex> lock(buffer_mutex_);
+        if (closed_) return;
+        closed_ = true;
+    }
+    buffer_ready_.notify_all();
+    buffer_space_.notify_all();
+
+    if (flusher_.joinable()) {
+        flusher_.join();
+    }
+}
+
+void TimeSeriesStorage::flushLoop() {
+    while (true) {
+        // Compaction and retention run between writes, on this thread
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_maintenance_ >= std::chrono::minutes(1)) {
+            last_maintenance_ = now;
+            maintain();
+        }
+
+        std::vector<Pending> batch;
+        bool closing;
+        {
+            std::unique_lock<std::mutex> lock(buffer_mutex_);
+            buffer_ready_.wait_for(lock, std::chrono::seconds(60), [this]() { return closed_ || !buffer_.empty(); });
+
+            // Collect what arrives within one flush interval into one sync
+            if (!closed_ && !buffer_.empty()) {
+                buffer_ready_.wait_for(lock, options_.flush_interval, [this]() { return closed_; });
+            }
+
+            closing = closed_;
+            std::swap(batch, buffer_);
+        }
+
+        if (!batch.empty()) {
+            size_t count = batch.size();
+            writeBatch(batch, closing);
+            {
+                std::lock_guard<std::mutex> lock(buffer_mutex_);
+                buffered_rows_ -= count;
+            }
+            buffer_space_.notify_all();
+        }
+
+        if (closing) {
+            return;
+        }
+    }
+}
+
+void TimeSeriesStorage::writeBatch(std::vector<Pending>& batch, bool last_attempt) {
+    auto backoff = std::chrono::milliseconds(100);
+
+    while (true) {
+        if (appendBatch(batch)) {
+            complete(batch, true);
+            return;
+        }
+
+        // Nothing was acknowledged yet, the broker delivers these again
+        if (last_attempt) {
+            std::cerr << batch.size() << " buffered samples not written to the time-series store" << std::endl;
+            complete(batch, false);
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(buffer_mutex_);
+        buffer_ready_.wait_for(lock, backoff, [this]() { return closed_; });
+        last_attempt = closed_;
+        backoff = std::min(backoff * 2, std::chrono::milliseconds(5000));
+    }
+}
+
+bool TimeSeriesStorage::appendBatch(const std::vector<Pending>& batch) {
+    // block -> device -> points
+    std::map<int64_t, std::map<std::string, std::vector<SeriesPoint>>> blocks;
+    for (const auto& pending : batch) {
+        int64_t ts = pending.point.timestamp_ms;
+        int64_t start = ts - ((ts % block_ms_) + block_ms_) % block_ms_;
+        blocks[start][pending.device_id].push_back(pending.point);
+    }
+
+    // A retry appends the same points again; compaction and reads drop the copies
+    for (auto& [start, devices] : blocks) {
+        std::string error;
+        auto target = segment(start, error);
+        if (!target) {
+            std::cerr << "Time-series write failed: " << error << std::endl;
+            return false;
+        }
+
+        for (auto& [device, points] : devices) {
+            std::stable_sort(points.begin(), points.end(), [](const SeriesPoint& a, const SeriesPoint& b) {
+                return a.timestamp_ms < b.timestamp_ms;
+            });
+            if (!target->append(device, points, error)) {
+                std::cerr << "Time-series write failed: " << error << std::endl;
+                return false;
+            }
+        }
+
+        if (!target->sync(error)) {
+            std::cerr << "Time-series write failed: " << error << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+void TimeSeriesStorage::complete(std::vector<Pending>& batch, bool committed) {
+    for (auto& pending : batch) {
+        if (pending.done) pending.done(committed);
+    }
+}
+
+void TimeSeriesStorage::maintain() {
+    int64_t now = nowMs();
+    int64_t retention_ms = static_cast<int64_t>(options_.retention_days) * 86400 * 1000;
+    int64_t compaction_delay_ms = std::chrono::duration_cast<std::chrono::milliseconds>(options_.compaction_delay).count();
+
+    std::vector<std::shared_ptr<TsdbSegment>> segments;
+    {
+        std::shared_lock<std::shared_mutex> lock(segments_mutex_);
+        for (const auto& [start, segment] : segments_) {
+            segments.push_back(segment);
+        }
+    }
+
+    for (const auto& segment : segments) {
+        if (segment->endMs() + retention_ms < now) {
+            {
+                std::unique_lock<std::shared_mutex> lock(segments_mutex_);
+                segments_.erase(segment->startMs());
+            }
+            // Readers still holding the segment keep their mapping
+            ::unlink(segment->path().c_str());
+            std::cout << "Deleted expired time-series block " << segment->path() << std::endl;
+            continue;
+        }
+
+        if (segment->endMs() + compaction_delay_ms < now && segment->fragmented()) {
+            std::string error;
+            size_t before = segment->size();
+            auto compacted = segment->compact(error);
+            if (!compacted) {
+                std::cerr << "Time-series compaction failed: " << error << std::endl;
+                continue;
+            }
+
+            {
+                std::unique_lock<std::shared_mutex> lock(segments_mutex_);
+                segments_[segment->startMs()] = compacted;
+            }
+            std::cout << "Compacted time-series block " << segment->path() << ": " << before / 1024
+                      << " KiB -> " << compacted->size() / 1024 << " KiB" << std::endl;
+        }
+    }
+}
+
+bool TimeSeriesStorage::queryHardware(const std::string& device_id, int64_t from_ms, int64_t to_ms,
+                                      std::vector<HardwarePoint>& points) {
+    std::vector<std::shared_ptr<TsdbSegment>> overlapping;
+    {
+        std::shared_lock<std::shared_mutex> lock(segments_mutex_);
+        for (const auto& [start, segment] : segments_) {
+            if (segment->endMs() > from_ms && start < to_ms) {
+                overlapping.push_back(segment);
+            }
+        }
+    }
+
+    std::vector<SeriesPoint> series;
+    for (const auto& segment : overlapping) {
+        segment->read(device_id, from_ms, to_ms, series);
+    }
+
+    // Uncompacted blocks may hold late or retried points out of order
+    std::stable_sort(series.begin(), series.end(), [](const SeriesPoint& a, const SeriesPoint& b) {
+        return a.timestamp_ms < b.timestamp_ms;
+    });
+
+    points.reserve(points.size() + series.size());
+    for (size_t i = 0; i < series.size(); i++) {
+        if (i + 1 < series.size() && series[i + 1].timestamp_ms == series[i].timestamp_ms) {
+            continue;
+        }
+        HardwarePoint point;
+        point.timestamp_ms = series[i].timestamp_ms;
+        point.cpu_usage = series[i].values[0];
+        point.memory_usage = series[i].values[1];
+        point.disk_usage = series[i].values[2];
+        points.push_back(point);
+    }
+    return true;
+}
+
+size_t TimeSeriesStorage::diskUsage() const {
+    std::shared_lock<std::shared_mutex> lock(segments_mutex_);
+    size_t bytes = 0;
+    for (const auto& [start, segment] : segments_) {
+        bytes += segment->size();
+    }
+    return bytes;
+}
+
+std::shared_ptr<TsdbSegment> TimeSeriesStorage::segment(int64_t block_start, std::string& error) {
+    {
+        std::shared_lock<std::shared_mutex> lock(segments_mutex_);
+        auto it = segments_.find(block_start);
+        if (it != segments_.end()) {
+            return it->second;
+        }
+    }
+
+    auto created = TsdbSegment::open(segmentPath(block_start), block_start, block_start + block_ms_, error);
+    if (created) {
+        std::unique_lock<std::shared_mutex> lock(segments_mutex_);
+        segments_[block_start] = created;
+    }
+    return created;
+}
+
+std::string TimeSeriesStorage::segmentPath(int64_t block_start) const {
+    return (fs::path(options_.directory) / (SEGMENT_PREFIX + std::to_string(block_start) + SEGMENT_SUFFIX)).string();
+}
@@ -0,0 +1,240 @@
+#include "tsdb_codec.h"
+#include <cstring>
+
+void BitWriter::writeBit(bool bit) {
+    if (bits_ % 8 == 0) {
+        bytes_.push_back(0);
+    }
+    if (bit) {
+        bytes_.back() = static_cast<char>(bytes_.back() | (0x80 >> (bits_ % 8)));
+    }
+    bits_++;
+}
+
+void BitWriter::writeBits(uint64_t value, int count) {
+    // Most significant bit first
+    for (int i = count - 1; i >= 0; i--) {
+        writeBit((value >> i) & 1);
+    }
+}
+
+bool BitReader::readBit(bool& bit) {
+    if (bit_ >= len_ * 8) {
+        return false;
+    }
+    bit = (static_cast<uint8_t>(data_[bit_ / 8]) >> (7 - bit_ % 8)) & 1;
+    bit_++;
+    return true;
+}
+
+bool BitReader::readBits(int count, uint64_t& value) {
+    value = 0;
+    for (int i = 0; i < count; i++) {
+        bool bit;
+        if (!readBit(bit)) {
+            return false;
+        }
+        value = (value << 1) | (bit ? 1 : 0);
+    }
+    return true;
+}
+
+static uint64_t doubleBits(double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static double bitsDouble(uint64_t bits) {
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+void SeriesEncoder::append(const SeriesPoint& point) {
+    if (count_ == 0) {
+        writer_.writeBits(static_cast<uint64_t>(point.timestamp_ms), 64);
+        for (size_t i = 0; i < 3; i++) {
+            prev_values_[i] = doubleBits(point.values[i]);
+            writer_.writeBits(prev_values_[i], 64);
+        }
+        prev_ts_ = point.timestamp_ms;
+        count_++;
+        return;
+    }
+
+    int64_t delta = point.timestamp_ms - prev_ts_;
+    int64_t dod = delta - prev_delta_;
+
+    if (dod == 0) {
+        writer_.writeBit(false);
+    } else if (dod >= -63 && dod <= 64) {
+        writer_.writeBits(0b10, 2);
+        writer_.writeBits(static_cast<uint64_t>(dod + 63), 7);
+    } else if (dod >= -255 && dod <= 256) {
+        writer_.writeBits(0b110, 3);
+        writer_.writeBits(static_cast<uint64_t>(dod + 255), 9);
+    } else if (dod >= -2047 && dod <= 2048) {
+        writer_.writeBits(0b1110, 4);
+        writer_.writeBits(static_cast<uint64_t>(dod + 2047), 12);
+    } else {
+        writer_.writeBits(0b1111, 4);
+        writer_.writeBits(static_cast<uint64_t>(dod), 64);
+    }
+    prev_delta_ = delta;
+    prev_ts_ = point.timestamp_ms;
+
+    for (size_t i = 0; i < 3; i++) {
+        appendValue(i, point.values[i]);
+    }
+    count_++;
+}
+
+void SeriesEncoder::appendValue(size_t column, double value) {
+    uint64_t bits = doubleBits(value);
+    uint64_t x = bits ^ prev_values_[column];
+    prev_values_[column] = bits;
+
+    if (x == 0) {
+        writer_.writeBit(false);
+        return;
+    }
+    writer_.writeBit(true);
+
+    int leading = __builtin_clzll(x);
+    int trailing = __builtin_ctzll(x);
+    if (leading > 31) leading = 31;
+
+    // Reuse the previous window when the meaningful bits fit in it
+    if (prev_leading_[column] >= 0 && leading >= prev_leading_[column] && trailing >= prev_trailing_[column]) {
+        writer_.writeBit(false);
+        int meaningful = 64 - prev_leading_[column] - prev_trailing_[column];
+        writer_.writeBits(x >> prev_trailing_[column], meaningful);
+        return;
+    }
+
+    int meaningful = 64 - leading - trailing;
+    writer_.writeBit(true);
+    writer_.writeBits(static_cast<uint64_t>(leading), 5);
+    writer_.writeBits(static_cast<uint64_t>(meaningful == 64 ? 0 : meaningful), 6);
+    writer_.writeBits(x >> trailing, meaningful);
+
+    prev_leading_[column] = leading;
+    prev_trailing_[column] = trailing;
+}
+
+bool SeriesDecoder::next(SeriesPoint& point) {
+    if (remaining_ == 0) {
+        return false;
+    }
+
+    if (first_) {
+        uint64_t ts;
+        if (!reader_.readBits(64, ts)) return false;
+        prev_ts_ = static_cast<int64_t>(ts);
+        for (size_t i = 0; i < 3; i++) {
+            if (!reader_.readBits(64, prev_values_[i])) return false;
+        }
+        first_ = false;
+    } else {
+        // Count the leading ones of the delta-of-delta prefix
+        int ones = 0;
+        bool bit = true;
+        while (ones < 4) {
+            if (!reader_.readBit(bit)) return false;
+            if (!bit) break;
+            ones++;
+        }
+
+        uint64_t raw = 0;
+        int64_t dod = 0;
+        switch (ones) {
+            case 0:
+                break;
+            case 1:
+                if (!reader_.readBits(7, raw)) return false;
+                dod = static_cast<int64_t>(raw) - 63;
+                break;
+            case 2:
+                if (!reader_.readBits(9, raw)) return false;
+                dod = static_cast<int64_t>(raw) - 255;
+                break;
+            case 3:
+                if (!reader_.readBits(12, raw)) return false;
+                dod = static_cast<int64_t>(raw) - 2047;
+                break;
+            default:
+                if (!reader_.readBits(64, raw)) return false;
+                dod = static_cast<int64_t>(raw);
+                break;
+        }
+
+        prev_delta_ += dod;
+        prev_ts_ += prev_delta_;
+
+        for (size_t i = 0; i < 3; i++) {
+            double ignored;
+            if (!readValue(i, ignored)) return false;
+        }
+    }
+
+    point.timestamp_ms = prev_ts_;
+    for (size_t i = 0; i < 3; i++) {
+        point.values[i] = bitsDouble(prev_values_[i]);
+    }
+    remaining_--;
+    return true;
+}
+
+bool SeriesDecoder::readValue(size_t column, double& value) {
+    bool changed;
+    if (!reader_.readBit(changed)) return false;
+
+    if (changed) {
+        bool new_window;
+        if (!reader_.readBit(new_window)) return false;
+
+        if (new_window) {
+            uint64_t leading, meaningful;
+            if (!reader_.readBits(5, leading) || !reader_.readBits(6, meaningful)) return false;
+            prev_leading_[column] = static_cast<int>(leading);
+            prev_meaningful_[column] = meaningful == 0 ? 64 : static_cast<int>(meaningful);
+        } else if (prev_meaningful_[column] == 0) {
+            // Window reused before one was defined
+            return false;
+        }
+
+        int meaningful = prev_meaningful_[column];
+        int trailing = 64 - prev_leading_[column] - meaningful;
+        if (trailing < 0) return false;
+
+        uint64_t x;
+        if (!reader_.readBits(meaningful, x)) return false;
+        prev_values_[column] ^= x << trailing;
+    }
+
+    value = bitsDouble(prev_values_[column]);
+    return true;
+}
+
+uint32_t crc32(const void* data, size_t len, uint32_t crc) {
+    static uint32_t table[256];
+    static const bool initialized = []() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        return true;
+    }();
+    (void)initialized;
+
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
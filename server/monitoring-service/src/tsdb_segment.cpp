@@ -0,0 +1,375 @@
+#include "tsdb_segment.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// On-disk structures are written in host byte order
+const char FILE_MAGIC[8] = {'I', 'O', 'T', 'S', 'D', 'B', '0', '1'};
+const uint32_t CHUNK_MAGIC = 0x4B4E4843;  // "CHNK"
+
+struct FileHeader {
+    char magic[8];
+    int64_t start_ms;
+    int64_t end_ms;
+    uint32_t crc;       // of the fields above
+    uint32_t reserved;
+};
+
+struct ChunkHeader {
+    uint32_t magic;
+    uint32_t crc;       // of everything after this field up to the end of the payload
+    uint32_t payload_len;
+    uint32_t count;
+    int64_t min_ts;
+    int64_t max_ts;
+    uint16_t device_len;
+    uint16_t reserved;
+    uint32_t reserved2;
+};
+
+static_assert(sizeof(FileHeader) == 32, "unexpected FileHeader layout");
+static_assert(sizeof(ChunkHeader) == 40, "unexpected ChunkHeader layout");
+
+const size_t INITIAL_CAPACITY = 1 << 20;
+
+size_t align8(size_t n) {
+    return (n + 7) & ~static_cast<size_t>(7);
+}
+
+std::string systemError(const std::string& what, const std::string& path) {
+    return what + " " + path + ": " + std::strerror(errno);
+}
+
+} // namespace
+
+TsdbSegment::TsdbSegment(const std::string& path, int64_t start_ms, int64_t end_ms)
+    : path_(path), start_ms_(start_ms), end_ms_(end_ms),
+      data_(nullptr), capacity_(0), used_(0), synced_(0) {
+}
+
+TsdbSegment::~TsdbSegment() {
+    unmap();
+}
+
+std::shared_ptr<TsdbSegment> TsdbSegment::open(const std::string& path, int64_t start_ms, int64_t end_ms,
+                                               std::string& error) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) == 0) {
+        auto segment = load(path, error);
+        if (segment && (segment->start_ms_ != start_ms || segment->end_ms_ != end_ms)) {
+            error = "Block range of " + path + " does not match the configured block duration";
+            return nullptr;
+        }
+        return segment;
+    }
+
+    std::shared_ptr<TsdbSegment> segment(new TsdbSegment(path, start_ms, end_ms));
+    if (!segment->map(INITIAL_CAPACITY, error)) {
+        return nullptr;
+    }
+
+    FileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+    header.start_ms = start_ms;
+    header.end_ms = end_ms;
+    header.crc = crc32(&header, offsetof(FileHeader, crc));
+    std::memcpy(segment->data_, &header, sizeof(header));
+
+    segment->used_ = sizeof(FileHeader);
+    if (!segment->sync(error)) {
+        return nullptr;
+    }
+    return segment;
+}
+
+std::shared_ptr<TsdbSegment> TsdbSegment::load(const std::string& path, std::string& error) {
+    std::shared_ptr<TsdbSegment> segment(new TsdbSegment(path, 0, 0));
+    if (!segment->map(0, error)) {
+        return nullptr;
+    }
+
+    FileHeader header;
+    if (segment->capacity_ < sizeof(header)) {
+        error = "Truncated segment " + path;
+        return nullptr;
+    }
+    std::memcpy(&header, segment->data_, sizeof(header));
+    if (std::memcmp(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 ||
+        header.crc != crc32(&header, offsetof(FileHeader, crc))) {
+        error = "Not a segment file or corrupt header: " + path;
+        return nullptr;
+    }
+
+    segment->start_ms_ = header.start_ms;
+    segment->end_ms_ = header.end_ms;
+    segment->scan();
+    return segment;
+}
+
+bool TsdbSegment::map(size_t capacity, std::string& error) {
+    int fd = ::open(path_.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        error = systemError("Cannot open", path_);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        error = systemError("Cannot stat", path_);
+        ::close(fd);
+        return false;
+    }
+
+    size_t size = static_cast<size_t>(st.st_size);
+    if (size < capacity) {
+        if (ftruncate(fd, static_cast<off_t>(capacity)) != 0) {
+            error = systemError("Cannot grow", path_);
+            ::close(fd);
+            return false;
+        }
+        size = capacity;
+    }
+
+    // The mapping stays valid after the descriptor is closed
+    void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        error = systemError("Cannot map", path_);
+        return false;
+    }
+
+    unmap();
+    data_ = static_cast<char*>(data);
+    capacity_ = size;
+    return true;
+}
+
+void TsdbSegment::unmap() {
+    if (data_) {
+        munmap(data_, capacity_);
+        data_ = nullptr;
+        capacity_ = 0;
+    }
+}
+
+void TsdbSegment::scan() {
+    size_t offset = sizeof(FileHeader);
+
+    while (offset + sizeof(ChunkHeader) <= capacity_) {
+        ChunkHeader header;
+        std::memcpy(&header, data_ + offset, sizeof(header));
+        if (header.magic != CHUNK_MAGIC) {
+            break;
+        }
+
+        size_t total = sizeof(ChunkHeader) + header.device_len + header.payload_len;
+        if (total > capacity_ - offset) {
+            break;
+        }
+
+        // A chunk torn by a crash ends the valid part of the file
+        size_t covered = offsetof(ChunkHeader, payload_len);
+        if (header.crc != crc32(data_ + offset + covered, total - covered)) {
+            break;
+        }
+
+        std::string device(data_ + offset + sizeof(ChunkHeader), header.device_len);
+        index_[device].push_back({offset, header.count, header.min_ts, header.max_ts});
+        offset = align8(offset + total);
+    }
+
+    used_ = std::min(offset, capacity_);
+    synced_ = used_;
+}
+
+size_t TsdbSegment::size() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return used_;
+}
+
+bool TsdbSegment::append(const std::string& device_id, const std::vector<SeriesPoint>& points,
+                         std::string& error) {
+    if (points.empty()) {
+        return true;
+    }
+    if (device_id.size() > UINT16_MAX) {
+        error = "Device id too long for segment " + path_;
+        return false;
+    }
+
+    SeriesEncoder encoder;
+    for (const auto& point : points) {
+        encoder.append(point);
+    }
+    const std::string& payload = encoder.bytes();
+
+    ChunkHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = CHUNK_MAGIC;
+    header.payload_len = static_cast<uint32_t>(payload.size());
+    header.count = static_cast<uint32_t>(points.size());
+    header.min_ts = points.front().timestamp_ms;
+    header.max_ts = points.back().timestamp_ms;
+    header.device_len = static_cast<uint16_t>(device_id.size());
+
+    size_t total = sizeof(ChunkHeader) + device_id.size() + payload.size();
+
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+
+    size_t end = align8(used_ + total);
+    if (end > capacity_) {
+        size_t capacity = std::max(capacity_, INITIAL_CAPACITY);
+        while (capacity < end) {
+            capacity *= 2;
+        }
+        if (!map(capacity, error)) {
+            return false;
+        }
+    }
+
+    char* chunk = data_ + used_;
+    std::memcpy(chunk + sizeof(ChunkHeader), device_id.data(), device_id.size());
+    std::memcpy(chunk + sizeof(ChunkHeader) + device_id.size(), payload.data(), payload.size());
+    std::memcpy(chunk, &header, sizeof(header));
+
+    // The checksum goes in last, so a chunk is only valid once complete
+    size_t covered = offsetof(ChunkHeader, payload_len);
+    header.crc = crc32(chunk + covered, total - covered);
+    std::memcpy(chunk + offsetof(ChunkHeader, crc), &header.crc, sizeof(header.crc));
+
+    index_[device_id].push_back({used_, header.count, header.min_ts, header.max_ts});
+    used_ = end;
+    return true;
+}
+
+bool TsdbSegment::sync(std::string& error) {
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t from = synced_ & ~(page - 1);
+    if (used_ <= from) {
+        return true;
+    }
+
+    if (msync(data_ + from, used_ - from, MS_SYNC) != 0) {
+        error = systemError("Cannot sync", path_);
+        return false;
+    }
+    synced_ = used_;
+    return true;
+}
+
+void TsdbSegment::read(const std::string& device_id, int64_t from_ms, int64_t to_ms,
+                       std::vector<SeriesPoint>& points) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+
+    auto it = index_.find(device_id);
+    if (it == index_.end()) {
+        return;
+    }
+
+    std::vector<SeriesPoint> decoded;
+    for (const auto& chunk : it->second) {
+        if (chunk.max_ts < from_ms || chunk.min_ts >= to_ms) {
+            continue;
+        }
+
+        decoded.clear();
+        decodeChunk(chunk, decoded);
+        for (const auto& point : decoded) {
+            if (point.timestamp_ms >= from_ms && point.timestamp_ms < to_ms) {
+                points.push_back(point);
+            }
+        }
+    }
+}
+
+void TsdbSegment::decodeChunk(const ChunkRef& chunk, std::vector<SeriesPoint>& points) const {
+    ChunkHeader header;
+    std::memcpy(&header, data_ + chunk.offset, sizeof(header));
+
+    const char* payload = data_ + chunk.offset + sizeof(ChunkHeader) + header.device_len;
+    SeriesDecoder decoder(payload, header.payload_len, header.count);
+
+    SeriesPoint point;
+    while (decoder.next(point)) {
+        points.push_back(point);
+    }
+}
+
+bool TsdbSegment::fragmented() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    for (const auto& [device, chunks] : index_) {
+        if (chunks.size() > 1) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::shared_ptr<TsdbSegment> TsdbSegment::compact(std::string& error) const {
+    std::string temp_path = path_ + ".compact";
+    ::unlink(temp_path.c_str());
+
+    auto compacted = open(temp_path, start_ms_, end_ms_, error);
+    if (!compacted) {
+        return nullptr;
+    }
+
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+
+        std::vector<SeriesPoint> points;
+        for (const auto& [device, chunks] : index_) {
+            points.clear();
+            for (const auto& chunk : chunks) {
+                decodeChunk(chunk, points);
+            }
+
+            // Retried writes can store a point twice; the last copy wins
+            std::stable_sort(points.begin(), points.end(), [](const SeriesPoint& a, const SeriesPoint& b) {
+                return a.timestamp_ms < b.timestamp_ms;
+            });
+            std::vector<SeriesPoint> unique;
+            unique.reserve(points.size());
+            for (const auto& point : points) {
+                if (!unique.empty() && unique.back().timestamp_ms == point.timestamp_ms) {
+                    unique.back() = point;
+                } else {
+                    unique.push_back(point);
+                }
+            }
+
+            if (!compacted->append(device, unique, error)) {
+                ::unlink(temp_path.c_str());
+                return nullptr;
+            }
+        }
+    }
+
+    // Shrink the file to its content before it replaces the block
+    compacted->unmap();
+    if (::truncate(temp_path.c_str(), static_cast<off_t>(compacted->used_)) != 0 ||
+        !compacted->map(0, error)) {
+        if (error.empty()) error = systemError("Cannot truncate", temp_path);
+        ::unlink(temp_path.c_str());
+        return nullptr;
+    }
+
+    if (msync(compacted->data_, compacted->used_, MS_SYNC) != 0 ||
+        ::rename(temp_path.c_str(), path_.c_str()) != 0) {
+        error = systemError("Cannot replace", path_);
+        ::unlink(temp_path.c_str());
+        return nullptr;
+    }
+
+    compacted->path_ = path_;
+    compacted->synced_ = compacted->used_;
+    return compacted;
+}
@@ -0,0 +1,117 @@
+#include "ack_tracker.h"
+#include "test_util.h"
+#include <thread>
+
+static void testCumulative() {
+    AckTracker acks(3, std::chrono::hours(1));
+    uint64_t generation = 0;
+    for (int i = 0; i < 5; i++) {
+        generation = acks.dispatched();
+    }
+    CHECK(acks.inFlight() == 5);
+
+    // Out of order: nothing is ackable until the hole at 1 is filled
+    CHECK(!acks.complete(2, generation));
+    CHECK(!acks.complete(3, generation));
+    CHECK(acks.takeAckable() == 0);
+    CHECK(acks.takeAckable(true) == 0);
+
+    // 1..3 make a full batch
+    CHECK(acks.complete(1, generation));
+    CHECK(acks.takeAckable() == 3);
+    CHECK(acks.takeAckable(true) == 0);
+
+    // Below the batch size only a forced flush acks
+    CHECK(!acks.complete(4, generation));
+    CHECK(acks.takeAckable() == 0);
+    CHECK(acks.takeAckable(true) == 4);
+    CHECK(acks.hasPending());
+    acks.complete(5, generation);
+    CHECK(acks.takeAckable(true) == 5);
+    CHECK(acks.inFlight() == 0 && !acks.hasPending());
+}
+
+static void testFlushInterval() {
+    AckTracker acks(100, std::chrono::milliseconds(20));
+    uint64_t generation = acks.dispatched();
+    acks.complete(1, generation);
+    CHECK(acks.takeAckable() == 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    CHECK(acks.takeAckable() == 1);
+}
+
+static void testReject() {
+    AckTracker acks(1, std::chrono::hours(1));
+    uint64_t generation = 0;
+    for (int i = 0; i < 4; i++) {
+        generation = acks.dispatched();
+    }
+
+    // A rejected delivery no longer holds back later ones, but is taken
+    // before an ack can cover it
+    acks.complete(1, generation);
+    CHECK(acks.reject(2, generation));
+    acks.complete(3, generation);
+    CHECK(acks.takeAckable(true) == 1);
+
+    std::vector<uint64_t> rejected;
+    acks.takeRejected(rejected);
+    CHECK(rejected.size() == 1 && rejected[0] == 2);
+    CHECK(acks.takeAckable(true) == 3);
+
+    acks.takeRejected(rejected);
+    CHECK(rejected.empty());
+    acks.complete(4, generation);
+    CHECK(acks.takeAckable(true) == 4);
+    CHECK(acks.inFlight() == 0 && !acks.hasPending());
+}
+
+static void testGenerations() {
+    AckTracker acks(1, std::chrono::hours(1));
+    uint64_t old_generation = acks.dispatched();
+    acks.dispatched();
+
+    // Tags restart on a new channel; completions of the old one are ignored
+    acks.reset();
+    CHECK(!acks.complete(1, old_generation));
+    CHECK(!acks.reject(2, old_generation));
+    CHECK(acks.takeAckable(true) == 0);
+    CHECK(!acks.hasPending());
+
+    uint64_t generation = acks.dispatched();
+    CHECK(generation != old_generation);
+    CHECK(acks.complete(1, generation));
+    CHECK(acks.takeAckable() == 1);
+}
+
+static void testConcurrentCompletion() {
+    const uint64_t deliveries = 10000;
+    AckTracker acks(64, std::chrono::hours(1));
+    uint64_t generation = 0;
+    for (uint64_t i = 0; i < deliveries; i++) {
+        generation = acks.dispatched();
+    }
+
+    std::vector<std::thread> workers;
+    for (uint64_t w = 0; w < 4; w++) {
+        workers.emplace_back([&acks, generation, w]() {
+            for (uint64_t tag = deliveries - w; tag >= 1 && tag <= deliveries; tag -= 4) {
+                acks.complete(tag, generation);
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    CHECK(acks.inFlight() == 0);
+    CHECK(acks.takeAckable(true) == deliveries);
+}
+
+int main() {
+    testCumulative();
+    testFlushInterval();
+    testReject();
+    testGenerations();
+    testConcurrentCompletion();
+    return testResult("ack_tracker");
+}
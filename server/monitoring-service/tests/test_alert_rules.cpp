@@ -0,0 +1,194 @@
+#include "alert_rules.h"
+#include "test_util.h"
+#include <fstream>
+#include <filesystem>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+using Rules = std::shared_ptr<const AlertRuleSet>;
+using Fired = std::vector<const AlertRuleSet::Rule*>;
+
+static Rules compileRule(const std::string& when, std::string& error) {
+    nlohmann::json config = {{"rules", {{{"type", "TEST"}, {"when", when}}}}};
+    return AlertRuleSet::compile(config, 1, error);
+}
+
+static bool fired(const Fired& rules, const std::string& type) {
+    for (const auto* rule : rules) {
+        if (rule->type == type) return true;
+    }
+    return false;
+}
+
+static void testCompileErrors() {
+    const char* invalid[] = {
+        "cpu >", "cpu > \"x\"", "cpu and memory", "usb > \"a\"", "cpu > 1 and network == \"x\"",
+        "foo > 1", "1 > 0", "cpu > 90 for 0 samples", "cpu > 90 for 3", "service[ssh] == \"x\"",
+        "\"abc", "cpu > 90 )", "cpu # 3", "",
+    };
+    for (const char* when : invalid) {
+        std::string error;
+        CHECK(!compileRule(when, error));
+        CHECK(!error.empty());
+    }
+
+    // Nesting is bounded instead of overflowing the stack
+    std::string error;
+    CHECK(!compileRule(std::string(100000, '(') + "cpu > 1" + std::string(100000, ')'), error));
+    CHECK(!compileRule(std::string(100000, '!') + "(cpu > 1)", error));
+
+    // One bad rule fails the whole set
+    nlohmann::json config = {{"rules", {{{"type", "A"}, {"when", "cpu > 1"}}, {{"type", "B"}, {"when", "cpu >"}}}}};
+    CHECK(!AlertRuleSet::compile(config, 1, error));
+}
+
+static void testExpressions() {
+    HardwareSample hardware;
+    hardware.cpu_usage = 10;
+    hardware.has_usb_state = true;
+    hardware.usb_state = "abcd:1234";
+    MetricThreshold thresholds[3] = {{80, 95}, {85, 95}, {85, 95}};
+    MetricStatistics::Score scores[3];
+    scores[0].zscore = 1;
+    scores[0].baseline = 4;
+
+    AlertRuleSet::Sample sample;
+    sample.source = AlertRuleSet::Source::Hardware;
+    sample.hardware = &hardware;
+    sample.thresholds = thresholds;
+    sample.scores = scores;
+
+    std::string error;
+    Rules rules = compileRule("cpu > -cpu_baseline + 2 - -3 and starts_with(usb, \"abc\")", error);
+    CHECK(rules);
+    if (!rules) return;
+
+    Fired fired_rules;
+    rules->evaluate(sample, nullptr, fired_rules);
+    CHECK(fired_rules.size() == 1);
+
+    hardware.cpu_usage = 0.5;
+    fired_rules.clear();
+    rules->evaluate(sample, nullptr, fired_rules);
+    CHECK(fired_rules.empty());
+
+    // Rules reading a field the sample lacks are not evaluated
+    hardware.cpu_usage = 10;
+    scores[0].zscore = NAN;
+    fired_rules.clear();
+    rules->evaluate(sample, nullptr, fired_rules);
+    CHECK(fired_rules.empty());
+}
+
+static void testConsecutiveSamples() {
+    std::string error;
+    Rules rules = compileRule("cpu >= cpu_critical for 3 samples", error);
+    CHECK(rules && rules->counterCount() == 1);
+    if (!rules) return;
+
+    HardwareSample hardware;
+    hardware.cpu_usage = 96;
+    MetricThreshold thresholds[3] = {{80, 95}, {85, 95}, {85, 95}};
+    AlertRuleSet::Sample sample;
+    sample.source = AlertRuleSet::Source::Hardware;
+    sample.hardware = &hardware;
+    sample.thresholds = thresholds;
+
+    uint16_t counters[1] = {0};
+    size_t fired_count = 0;
+    for (int i = 0; i < 5; i++) {
+        Fired fired_rules;
+        rules->evaluate(sample, counters, fired_rules);
+        fired_count += fired_rules.size();
+    }
+    CHECK(fired_count == 3);
+
+    hardware.cpu_usage = 10;
+    Fired fired_rules, cleared;
+    rules->evaluate(sample, counters, fired_rules, &cleared);
+    CHECK(fired_rules.empty() && cleared.size() == 1 && counters[0] == 0);
+}
+
+static void testShippedRules(const std::string& path) {
+    AlertRuleEngine engine;
+    CHECK(engine.current()->size() == 0);
+    CHECK(engine.load(path));
+    CHECK(engine.current()->size() == 10);
+
+    HardwareSample hardware;
+    hardware.cpu_usage = 95;
+    hardware.has_usb_state = true;
+    hardware.usb_state = "1d6b:0002 Linux Foundation root hub";
+    hardware.has_gpio_state = true;
+    hardware.gpio_state = 3;
+    MetricThreshold thresholds[3] = {{80, 95}, {85, 95}, {85, 95}};
+
+    AlertRuleSet::Sample sample;
+    sample.source = AlertRuleSet::Source::Hardware;
+    sample.hardware = &hardware;
+    sample.previous_gpio_state = 3;
+    sample.thresholds = thresholds;
+
+    Fired fired_rules;
+    engine.evaluate(1, sample, fired_rules);
+    CHECK(fired_rules.empty());
+
+    hardware.usb_state = "abcd:1234";
+    sample.previous_gpio_state = -1;
+    fired_rules.clear();
+    engine.evaluate(1, sample, fired_rules);
+    CHECK(fired_rules.size() == 2 && fired(fired_rules, "USB_CONNECTED") && fired(fired_rules, "NEW_GPIO_DETECTED"));
+
+    SoftwareSample software;
+    software.has_services = true;
+    software.services = {{"ssh", "active"}};
+    software.network_status = "inreachable";
+    AlertRuleSet::Sample software_sample;
+    software_sample.source = AlertRuleSet::Source::Software;
+    software_sample.software = &software;
+
+    // Network down and mossquito missing
+    fired_rules.clear();
+    engine.evaluate(1, software_sample, fired_rules);
+    CHECK(fired_rules.size() == 2 && fired(fired_rules, "NETWORK_UNREACHABLE") && fired(fired_rules, "SERVICE_DOWN"));
+    for (const auto* rule : fired_rules) {
+        CHECK(rule->type != "SERVICE_DOWN" || rule->command == "sudo systemctl restart mossquito");
+    }
+}
+
+static void testReload() {
+    fs::path path = fs::temp_directory_path() / ("alert_rules_test_" + std::to_string(::getpid()) + ".json");
+    auto write = [&path](const std::string& text) {
+        std::ofstream(path) << text;
+        // Coarse file times would hide the change
+        fs::last_write_time(path, fs::last_write_time(path) + std::chrono::seconds(1));
+    };
+
+    AlertRuleEngine engine;
+    write(R"({"rules": [{"type": "A", "when": "cpu > 1"}]})");
+    CHECK(engine.load(path.string()));
+    CHECK(!engine.reloadIfChanged());
+
+    write(R"({"rules": [{"type": "A", "when": "cpu > 1"}, {"type": "B", "when": "memory > 1"}]})");
+    CHECK(engine.reloadIfChanged());
+    CHECK(engine.current()->size() == 2);
+
+    // A broken edit keeps the rules in use
+    write(R"({"rules": [{"type": "A", "when": "cpu >"}]})");
+    CHECK(!engine.reloadIfChanged());
+    CHECK(engine.current()->size() == 2);
+
+    fs::remove(path);
+    CHECK(!engine.load(path.string()));
+    CHECK(engine.current()->size() == 2);
+}
+
+int main(int argc, char** argv) {
+    testCompileErrors();
+    testExpressions();
+    testConsecutiveSamples();
+    testShippedRules(argc > 1 ? argv[1] : "config/alert_rules.json");
+    testReload();
+    return testResult("alert_rules");
+}
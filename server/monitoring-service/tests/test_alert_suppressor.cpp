@@ -0,0 +1,106 @@
+#include "alert_suppressor.h"
+#include "test_util.h"
+
+static void testMetricAlert() {
+    AlertSuppressor suppressor;
+    MetricThreshold threshold{70, 90};
+    int64_t now = 0;
+    auto step = [&](float value) {
+        AlertSuppressor::Device device = suppressor.device(1, now);
+        AlertSuppressor::Level level = device.metricLevel("cpu", value, threshold);
+        now += 10000;
+        return device.observe("cpu", level, level == AlertSuppressor::CRITICAL);
+    };
+
+    AlertSuppressor::Decision first = step(95);
+    CHECK(first.send && first.with_command);
+    for (int i = 0; i < 20; i++) {
+        CHECK(!step(95).send);
+    }
+
+    // Within the hysteresis it stays critical, below it de-escalates
+    CHECK(!step(87).send);
+    CHECK(step(80).send);
+
+    // Flapping around the warning threshold does not alert again
+    for (int i = 0; i < 10; i++) {
+        CHECK(!step(i % 2 ? 71 : 68).send);
+    }
+
+    // Cleared after 3 samples; back within the cooldown at a lower level
+    for (int i = 0; i < 3; i++) {
+        CHECK(!step(10).send);
+    }
+    CHECK(!step(75).send);
+
+    // A standing alert is repeated after the reminder interval
+    CHECK(!step(75).send);
+    now += 3600 * 1000;
+    CHECK(step(75).send);
+}
+
+static void testCooldownEscalation() {
+    AlertSuppressor suppressor;
+    int64_t now = 0;
+    auto observe = [&](AlertSuppressor::Level level) {
+        now += 10000;
+        return suppressor.device(1, now).observe("gpio", level, false).send;
+    };
+
+    CHECK(observe(AlertSuppressor::WARNING));
+    for (int i = 0; i < 3; i++) {
+        observe(AlertSuppressor::CLEAR);
+    }
+    // More severe than last time goes through the cooldown
+    CHECK(observe(AlertSuppressor::CRITICAL));
+
+    // After the cooldown the same level is sent again
+    for (int i = 0; i < 3; i++) {
+        observe(AlertSuppressor::CLEAR);
+    }
+    now += 600 * 1000;
+    CHECK(observe(AlertSuppressor::WARNING));
+}
+
+static void testRateLimits() {
+    AlertSuppressor suppressor;
+    int64_t now = 0;
+
+    // A burst of distinct alerts is capped at alert_burst
+    int sent = 0;
+    for (int i = 0; i < 30; i++) {
+        sent += suppressor.device(2, now).observe("k" + std::to_string(i), AlertSuppressor::WARNING, true).send;
+    }
+    CHECK(sent == 10);
+
+    // Commands are dropped from alerts once their bucket is empty
+    int commands = 0;
+    for (int i = 0; i < 5; i++) {
+        now += 60000;
+        AlertSuppressor::Decision decision =
+            suppressor.device(3, now).observe("c" + std::to_string(i), AlertSuppressor::CRITICAL, true);
+        CHECK(decision.send);
+        commands += decision.with_command;
+    }
+    CHECK(commands == 2);
+
+    // Other devices have their own buckets
+    CHECK(suppressor.device(4, now).observe("k0", AlertSuppressor::WARNING, true).send);
+}
+
+static void testUntracked() {
+    AlertSuppressor suppressor;
+    for (int i = 0; i < 20; i++) {
+        AlertSuppressor::Decision decision =
+            suppressor.device(DeviceStateStore::NO_DEVICE, 0).observe("x", AlertSuppressor::INFO, true);
+        CHECK(decision.send && decision.with_command);
+    }
+}
+
+int main() {
+    testMetricAlert();
+    testCooldownEscalation();
+    testRateLimits();
+    testUntracked();
+    return testResult("alert_suppressor");
+}
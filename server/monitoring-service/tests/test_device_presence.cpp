@@ -0,0 +1,154 @@
+#include "device_presence.h"
+#include "test_util.h"
+#include <algorithm>
+#include <random>
+
+using Status = DevicePresence::Status;
+using Transitions = std::vector<DevicePresence::Transition>;
+
+static PresencePolicy policy(int64_t interval_ms) {
+    PresencePolicy p;
+    p.expected_interval = std::chrono::milliseconds(interval_ms);
+    return p;
+}
+
+// Advance second by second until the device goes stale and then offline,
+// recording how long after its last sample each happened
+static void silence(DevicePresence& presence, int64_t& now, int64_t seconds, int64_t& stale_after, int64_t& offline_after) {
+    int64_t last = now;
+    stale_after = offline_after = 0;
+    Transitions transitions;
+    for (int64_t s = 0; s < seconds; s++) {
+        now += 1000;
+        presence.advance(now, transitions);
+        for (const auto& t : transitions) {
+            if (t.to == Status::Stale) stale_after = now - last;
+            if (t.to == Status::Offline) offline_after = now - last;
+        }
+        transitions.clear();
+    }
+}
+
+static void testStaleAndOffline() {
+    DevicePresence presence(policy(10000));
+    Transitions transitions;
+    int64_t now = 123456789;
+    presence.advance(now, transitions);
+
+    Status before = presence.seen(5, now);
+    CHECK(before == Status::Unknown);
+    for (int i = 0; i < 100; i++) {
+        now += 10000;
+        presence.advance(now, transitions);
+        CHECK(presence.seen(5, now) == Status::Online);
+    }
+    CHECK(transitions.empty());
+    CHECK(presence.count(Status::Online) == 1);
+
+    // 3 and 10 expected intervals, within a tick or two
+    int64_t stale_after, offline_after;
+    silence(presence, now, 200, stale_after, offline_after);
+    CHECK(stale_after >= 30000 && stale_after <= 32000);
+    CHECK(offline_after >= 100000 && offline_after <= 102000);
+    CHECK(presence.count(Status::Offline) == 1 && presence.count(Status::Online) == 0);
+    CHECK(presence.devices(Status::Offline) == std::vector<uint32_t>{5});
+
+    DevicePresence::Presence state;
+    CHECK(presence.get(5, now, state));
+    CHECK(state.status == Status::Offline && state.silent_ms >= 200000);
+    CHECK(state.expected_interval_ms == 10000);
+    CHECK(!presence.get(6, now, state));
+
+    // Back after the silence
+    CHECK(presence.seen(5, now) == Status::Offline);
+    CHECK(presence.count(Status::Online) == 1 && presence.count(Status::Offline) == 0);
+    CHECK(presence.get(5, now, state) && state.status == Status::Online);
+}
+
+static void testLearnedInterval() {
+    // Samples every 2 s teach a device a shorter interval than assumed
+    DevicePresence presence(policy(60000));
+    Transitions transitions;
+    int64_t now = 1000000;
+    presence.advance(now, transitions);
+    for (int i = 0; i < 200; i++) {
+        presence.seen(1, now);
+        now += 2000;
+        presence.advance(now, transitions);
+    }
+    DevicePresence::Presence state;
+    CHECK(presence.get(1, now, state) && state.expected_interval_ms < 4000);
+
+    int64_t stale_after, offline_after;
+    silence(presence, now, 60, stale_after, offline_after);
+    CHECK(stale_after > 0 && stale_after < 15000);
+    CHECK(offline_after > stale_after && offline_after < 40000);
+}
+
+static void testLongTimers() {
+    // Deadlines of hours sit in the upper levels of the wheel and cascade down
+    PresencePolicy p = policy(3600000);
+    p.tick = std::chrono::milliseconds(10000);
+    DevicePresence presence(p);
+    Transitions transitions;
+    int64_t now = 0;
+    presence.advance(now, transitions);
+    presence.seen(0, now);
+
+    int64_t stale_at = 0;
+    while (now < 4 * 3600000 && stale_at == 0) {
+        now += 10000;
+        presence.advance(now, transitions);
+        for (const auto& t : transitions) {
+            if (t.to == Status::Stale) stale_at = now;
+        }
+    }
+    CHECK(stale_at >= 3 * 3600000 && stale_at <= 3 * 3600000 + 20000);
+}
+
+static void testManyDevices() {
+    // 2000 devices with jittered 30 s intervals; every 100th stops halfway
+    const uint32_t devices = 2000;
+    DevicePresence presence(policy(30000));
+    Transitions transitions;
+    int64_t start = 5000000, now = start;
+    presence.advance(now, transitions);
+
+    std::mt19937 rng(1);
+    std::vector<int64_t> next(devices);
+    for (auto& at : next) {
+        at = now + rng() % 30000;
+    }
+    for (; now < start + 1800 * 1000; now += 1000) {
+        for (uint32_t i = 0; i < devices; i++) {
+            if (next[i] > now) continue;
+            if (i % 100 == 0 && now > start + 600 * 1000) {
+                next[i] = INT64_MAX;
+                continue;
+            }
+            presence.seen(i, now);
+            next[i] = now + 25000 + rng() % 10000;
+        }
+        presence.advance(now, transitions);
+    }
+
+    size_t false_alarms = 0;
+    for (const auto& t : transitions) {
+        if (t.device % 100 != 0) false_alarms++;
+    }
+    CHECK(false_alarms == 0);
+    CHECK(presence.count(Status::Offline) == devices / 100);
+    CHECK(presence.count(Status::Online) == devices - devices / 100);
+
+    std::vector<uint32_t> offline = presence.devices(Status::Offline);
+    std::sort(offline.begin(), offline.end());
+    CHECK(offline.size() == devices / 100 && offline.front() == 0 && offline.back() == devices - 100);
+}
+
+int main() {
+    testStaleAndOffline();
+    testLearnedInterval();
+    testLongTimers();
+    testManyDevices();
+    return testResult("device_presence");
+}
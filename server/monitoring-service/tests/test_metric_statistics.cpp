@@ -0,0 +1,80 @@
+#include "metric_statistics.h"
+#include "test_util.h"
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using Metric = MetricStatistics::Metric;
+
+static const int64_t HOUR_MS = 3600000;
+
+static void testPercentile() {
+    MetricStatistics statistics(100000);
+    std::mt19937 rng(7);
+    std::normal_distribution<float> normal(40, 3);
+    std::vector<float> values;
+    int64_t ts = 0;
+    int false_alarms = 0;
+    for (int i = 0; i < 20000; i++) {
+        float value = normal(rng);
+        values.push_back(value);
+        MetricStatistics::Score score = statistics.update(5, Metric::Cpu, value, ts);
+        ts += 60000;
+        if (i < static_cast<int>(MetricStatistics::MIN_SAMPLES) - 1) {
+            CHECK(std::isnan(score.zscore));
+        }
+        if (score.zscore >= 4) false_alarms++;
+    }
+    std::sort(values.begin(), values.end());
+    float p95 = values[values.size() * 95 / 100];
+
+    MetricStatistics::Summary summary;
+    CHECK(statistics.summary(5, Metric::Cpu, summary));
+    CHECK(summary.samples == 20000);
+    CHECK(std::fabs(summary.p95 - p95) < 0.5f);
+    CHECK(std::fabs(summary.mean - 40) < 1.5f && std::fabs(summary.stddev - 3) < 1.0f);
+    CHECK(summary.window_min <= summary.window_mean && summary.window_mean <= summary.window_max);
+    CHECK(false_alarms < 10);
+
+    MetricStatistics::Score spike = statistics.update(5, Metric::Cpu, 90, ts);
+    CHECK(spike.zscore > 4);
+    CHECK(std::fabs(spike.baseline - 40) < 2);
+}
+
+static void testSeasonal() {
+    // High every day at 03:00 UTC: usual then, anomalous two hours later
+    MetricStatistics statistics(100000);
+    for (int day = 0; day < 30; day++) {
+        for (int hour = 0; hour < 24; hour++) {
+            statistics.update(7, Metric::Disk, hour == 3 ? 80 : 20, (int64_t(day) * 24 + hour) * HOUR_MS);
+        }
+    }
+    MetricStatistics::Score score = statistics.update(7, Metric::Disk, 80, (int64_t(30) * 24 + 3) * HOUR_MS);
+    CHECK(score.zscore < 2);
+    CHECK(std::fabs(score.baseline - 80) < 5);
+
+    score = statistics.update(7, Metric::Disk, 80, (int64_t(30) * 24 + 5) * HOUR_MS);
+    CHECK(score.zscore > 4);
+    CHECK(std::fabs(score.baseline - 20) < 5);
+}
+
+static void testUnknown() {
+    MetricStatistics statistics(100000);
+    statistics.update(1, Metric::Cpu, 10, 0);
+
+    MetricStatistics::Summary summary;
+    CHECK(statistics.summary(1, Metric::Cpu, summary) && summary.samples == 1 && summary.last == 10);
+    CHECK(!statistics.summary(1, Metric::Memory, summary));
+    CHECK(!statistics.summary(9, Metric::Cpu, summary));
+    CHECK(!statistics.summary(99999999, Metric::Cpu, summary));
+
+    // Beyond the capacity nothing is kept
+    CHECK(std::isnan(statistics.update(99999999, Metric::Cpu, 10, 0).zscore));
+}
+
+int main() {
+    testPercentile();
+    testSeasonal();
+    testUnknown();
+    return testResult("metric_statistics");
+}
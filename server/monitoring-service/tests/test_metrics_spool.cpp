@@ -0,0 +1,130 @@
+#include "metrics_spool.h"
+#include "test_util.h"
+#include <filesystem>
+#include <fstream>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+static SpoolBatch makeBatch(int64_t run) {
+    SpoolBatch batch;
+    batch.rollups_run = run;
+    for (int i = 0; i < 10; i++) {
+        HardwareSample hardware;
+        hardware.device_id = "dev" + std::to_string(i);
+        hardware.timestamp_ms = run * 100 + i;
+        hardware.cpu_usage = i;
+        hardware.has_usb_state = true;
+        hardware.usb_state = "none";
+        batch.hardware.push_back(hardware);
+    }
+    SoftwareSample software;
+    software.device_id = "x";
+    software.applications.push_back({"nginx", "1.22"});
+    software.services.push_back({"ssh", "active"});
+    batch.software.push_back(software);
+    return batch;
+}
+
+static std::string lastSegment(const fs::path& directory) {
+    std::string last;
+    for (const auto& file : fs::directory_iterator(directory)) {
+        if (file.path().extension() == ".spool" && file.path().string() > last) {
+            last = file.path().string();
+        }
+    }
+    return last;
+}
+
+static void testReplay(const SpoolOptions& options) {
+    MetricsSpool spool(options);
+    CHECK(spool.open());
+    CHECK(spool.empty());
+    for (int run = 0; run < 50; run++) {
+        CHECK(spool.append(makeBatch(run)));
+    }
+    MetricsSpool::Stats stats = spool.getStats();
+    CHECK(stats.pending_batches == 50 && stats.pending_rows == 550);
+    CHECK(stats.segments > 1);
+
+    // Oldest first, across segments
+    SpoolBatch batch;
+    for (int run = 0; run < 20; run++) {
+        CHECK(spool.front(batch));
+        CHECK(batch.rollups_run == run);
+        CHECK(batch.hardware.size() == 10 && batch.hardware[3].timestamp_ms == run * 100 + 3);
+        CHECK(batch.hardware[3].device_id == "dev3" && batch.hardware[3].usb_state == "none");
+        CHECK(batch.software.size() == 1 && batch.software[0].services[0].second == "active");
+        CHECK(batch.software[0].applications[0].version == "1.22");
+        spool.pop();
+    }
+    CHECK(spool.getStats().pending_batches == 30);
+    CHECK(spool.getStats().segments < stats.segments);
+}
+
+static void testTornTail(const SpoolOptions& options) {
+    // A crash in the middle of an append
+    std::string last = lastSegment(options.directory);
+    CHECK(!last.empty());
+    std::ofstream(last, std::ios::app | std::ios::binary) << "garbagegarbage";
+
+    MetricsSpool spool(options);
+    CHECK(spool.open());
+
+    // The replay position survived and the torn record is cut off
+    SpoolBatch batch;
+    int replayed = 0;
+    int64_t expected = 20;
+    while (spool.front(batch)) {
+        CHECK(batch.rollups_run == expected++);
+        replayed++;
+        spool.pop();
+    }
+    CHECK(replayed == 30);
+    CHECK(spool.empty() && spool.getStats().replayed_rows == 330);
+
+    // Appends go on after the cut
+    CHECK(spool.append(makeBatch(100)));
+    CHECK(spool.front(batch) && batch.rollups_run == 100);
+    spool.pop();
+    CHECK(spool.empty());
+}
+
+static void testReopenEmpty(const SpoolOptions& options) {
+    MetricsSpool spool(options);
+    CHECK(spool.open());
+    CHECK(spool.empty());
+    SpoolBatch batch;
+    CHECK(!spool.front(batch));
+}
+
+static void testFull(SpoolOptions options) {
+    options.max_bytes = 8192;
+    MetricsSpool spool(options);
+    CHECK(spool.open());
+    bool refused = false;
+    for (int run = 0; run < 100 && !refused; run++) {
+        refused = !spool.append(makeBatch(run));
+    }
+    CHECK(refused);
+    CHECK(spool.getStats().bytes <= options.max_bytes);
+}
+
+int main() {
+    fs::path directory = fs::temp_directory_path() / ("metrics_spool_test_" + std::to_string(::getpid()));
+    fs::remove_all(directory);
+
+    SpoolOptions options;
+    options.directory = directory.string();
+    options.segment_bytes = 4096;
+
+    testReplay(options);
+    testTornTail(options);
+    testReopenEmpty(options);
+
+    fs::remove_all(directory);
+    testFull(options);
+
+    fs::remove_all(directory);
+    return testResult("metrics_spool");
+}
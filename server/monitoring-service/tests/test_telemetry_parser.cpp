@@ -0,0 +1,157 @@
+#include "telemetry_parser.h"
+#include "monitoring.pb.h"
+#include "test_util.h"
+#include <cmath>
+#include <cstring>
+
+static bool parseHardware(const std::string& json, HardwareSample& sample) {
+    sample = HardwareSample();
+    std::string error;
+    return TelemetryParser::parseHardware(json.data(), json.size(), sample, error);
+}
+
+static bool parseSoftware(const std::string& json, SoftwareSample& sample) {
+    sample = SoftwareSample();
+    std::string error;
+    return TelemetryParser::parseSoftware(json.data(), json.size(), sample, error);
+}
+
+static void testHardware() {
+    HardwareSample sample;
+    CHECK(parseHardware(R"({"device_id": "rpi-7", "readable_date": "2025-06-23_22-47-01Z",
+                            "cpu_usage": "66.63%", "memory_usage": 12.5, "disk_usage": null,
+                            "usb_state": "none", "gpio_state": "3", "kernel_version": "6.1",
+                            "extra": {"nested": [1, true, null, "x"]}})",
+                        sample));
+    CHECK(sample.device_id == "rpi-7");
+    CHECK(sample.cpu_usage == 66.63);
+    CHECK(sample.memory_usage == 12.5);
+    CHECK(std::isnan(sample.disk_usage));
+    CHECK(sample.has_usb_state && sample.usb_state == "none");
+    CHECK(sample.has_gpio_state && sample.gpio_state == 3);
+    CHECK(sample.kernel_version == "6.1");
+    CHECK(sample.timestamp_ms == 1750718821000);
+
+    // Escapes, surrogate pairs included
+    CHECK(parseHardware(R"({"device_id": "a\"bé😀"})", sample));
+    CHECK(sample.device_id == "a\"b\xC3\xA9\xF0\x9F\x98\x80");
+
+    CHECK(!parseHardware(R"({"cpu_usage": 10})", sample));
+    CHECK(!parseHardware(R"({"device_id": "a", "cpu_usage": )", sample));
+    CHECK(!parseHardware(R"({"device_id": "a"} x)", sample));
+}
+
+static void testStrictValues() {
+    HardwareSample sample;
+
+    // Only JSON numbers and literals
+    CHECK(!parseHardware(R"({"device_id": "a", "x": bogus})", sample));
+    CHECK(!parseHardware(R"({"device_id": "a", "x": truex})", sample));
+    CHECK(!parseHardware(R"({"device_id": "a", "x": 01})", sample));
+    CHECK(!parseHardware(R"({"device_id": "a", "x": 1.})", sample));
+    CHECK(!parseHardware(R"({"device_id": "a", "gpio_state": nan})", sample));
+    CHECK(parseHardware(R"({"device_id": "a", "x": [true, false, null, -1.5e3, 0]})", sample));
+
+    // Integers that do not fit or are not integers are invalid, not an error
+    CHECK(parseHardware(R"({"device_id": "a", "gpio_state": 1e300})", sample) && !sample.has_gpio_state);
+    CHECK(parseHardware(R"({"device_id": "a", "gpio_state": 2.5})", sample) && !sample.has_gpio_state);
+    CHECK(parseHardware(R"({"device_id": "a", "gpio_state": "99999999999"})", sample) && !sample.has_gpio_state);
+    CHECK(parseHardware(R"({"device_id": "a", "gpio_state": "error"})", sample) && !sample.has_gpio_state);
+    CHECK(parseHardware(R"({"device_id": "a", "gpio_state": -4})", sample) && sample.gpio_state == -4);
+
+    // Percentages that are not finite numbers read as NaN
+    CHECK(parseHardware(R"({"device_id": "a", "cpu_usage": 1e999})", sample) && std::isnan(sample.cpu_usage));
+    CHECK(parseHardware(R"({"device_id": "a", "cpu_usage": "nan%"})", sample) && std::isnan(sample.cpu_usage));
+    CHECK(parseHardware(R"({"device_id": "a", "cpu_usage": "12x"})", sample) && std::isnan(sample.cpu_usage));
+    CHECK(parseHardware(R"({"device_id": "a", "cpu_usage": " 66.5 % "})", sample) && sample.cpu_usage == 66.5);
+
+    // Surrogates must come in high, low pairs
+    CHECK(!parseHardware(R"({"device_id": "\ud800A"})", sample));
+    CHECK(!parseHardware(R"({"device_id": "\ud800"})", sample));
+    CHECK(!parseHardware(R"({"device_id": "\udc00"})", sample));
+}
+
+static void testSoftware() {
+    SoftwareSample sample;
+    CHECK(parseSoftware(R"({"device_id": "rpi-7", "ip_address": "10.0.0.2", "network_status": "reachable",
+                            "services": {"ssh": "active", "cron": "inactive"},
+                            "applications": [{"name": "nginx", "version": "1.22"}, {"name": "git"}]})",
+                        sample));
+    CHECK(sample.ip_address == "10.0.0.2");
+    CHECK(sample.has_services && sample.services.size() == 2 && sample.services[0].second == "active");
+    CHECK(sample.applications.size() == 2 && sample.applications[0].version == "1.22");
+    CHECK(sample.applications[1].name == "git" && sample.applications[1].version.empty());
+
+    CHECK(parseSoftware(R"({"device_id": "a", "application_binaries": {"bash": "5.2"}})", sample));
+    CHECK(sample.applications.size() == 1 && sample.applications[0].name == "bash");
+    CHECK(!sample.has_services);
+}
+
+static void testReadableDate() {
+    CHECK(TelemetryParser::parseReadableDate("2025-06-23_22-47-01Z") == 1750718821000);
+    CHECK(TelemetryParser::parseReadableDate("2025-06-23 22:47:01Z") == 1750718821000);
+    CHECK(TelemetryParser::parseReadableDate("2025-06-24_00-47-01+02:00") == 1750718821000);
+    CHECK(TelemetryParser::parseReadableDate("2025-06-23_20-47-01-0200") == 1750718821000);
+    CHECK(TelemetryParser::parseReadableDate("2024-02-29_00-00-00Z") > 0);
+
+    // The agent's local time, zone unknown
+    CHECK(TelemetryParser::parseReadableDate("2025-06-23_22-47-01") == -1);
+
+    CHECK(TelemetryParser::parseReadableDate("2025-06-23_22--1-01Z") == -1);
+    CHECK(TelemetryParser::parseReadableDate("2025-02-29_22-47-01Z") == -1);
+    CHECK(TelemetryParser::parseReadableDate("2025-04-31_22-47-01Z") == -1);
+    CHECK(TelemetryParser::parseReadableDate("2025-06-23_24-00-00Z") == -1);
+    CHECK(TelemetryParser::parseReadableDate("2025-06-23_22-47-01Zx") == -1);
+    CHECK(TelemetryParser::parseReadableDate("2025-06-23_22-47-01+2") == -1);
+    CHECK(TelemetryParser::parseReadableDate("1969-12-31_23-59-59Z") == -1);
+    CHECK(TelemetryParser::parseReadableDate("Error") == -1);
+}
+
+static void testProtobuf() {
+    const char* protobuf = "application/x-protobuf; proto=monitoring.HardwareMetrics";
+    CHECK(TelemetryParser::formatFromContentType(protobuf, std::strlen(protobuf)) ==
+          TelemetryParser::Format::Protobuf);
+    CHECK(TelemetryParser::formatFromContentType("application/json", 16) == TelemetryParser::Format::Json);
+    CHECK(TelemetryParser::formatFromContentType(nullptr, 0) == TelemetryParser::Format::Json);
+
+    monitoring::HardwareMetrics message;
+    message.set_device_id("rpi-7");
+    message.set_readable_date("2025-06-23_22-47-01Z");
+    message.set_cpu_percent(42.5);
+    message.set_gpio_state(2);
+    message.set_usb_devices("none");
+    std::string bytes = message.SerializeAsString();
+
+    HardwareSample sample;
+    std::string error;
+    CHECK(TelemetryParser::parseHardware(TelemetryParser::Format::Protobuf, bytes.data(), bytes.size(), sample, error));
+    CHECK(sample.device_id == "rpi-7" && sample.cpu_usage == 42.5);
+    CHECK(std::isnan(sample.memory_usage));
+    CHECK(sample.has_gpio_state && sample.gpio_state == 2);
+    CHECK(sample.has_usb_state && sample.usb_state == "none");
+    CHECK(sample.timestamp_ms == 1750718821000);
+
+    monitoring::SoftwareMetrics software;
+    software.set_device_id("rpi-7");
+    (*software.mutable_services())["ssh"] = "active";
+    auto* app = software.add_applications();
+    app->set_name("nginx");
+    app->set_version("1.22");
+    bytes = software.SerializeAsString();
+
+    SoftwareSample software_sample;
+    CHECK(TelemetryParser::parseSoftwareProtobuf(bytes.data(), bytes.size(), software_sample, error));
+    CHECK(software_sample.has_services && software_sample.services.size() == 1);
+    CHECK(software_sample.applications.size() == 1 && software_sample.applications[0].name == "nginx");
+
+    CHECK(!TelemetryParser::parseHardwareProtobuf("\xff\xff", 2, sample, error));
+}
+
+int main() {
+    testHardware();
+    testStrictValues();
+    testSoftware();
+    testReadableDate();
+    testProtobuf();
+    return testResult("telemetry_parser");
+}
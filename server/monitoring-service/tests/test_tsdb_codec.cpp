@@ -0,0 +1,111 @@
+#include "tsdb_codec.h"
+#include "test_util.h"
+#include <cmath>
+#include <cstring>
+#include <random>
+
+static bool sameBits(double a, double b) {
+    return std::memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+static bool roundTrip(const std::vector<SeriesPoint>& points, size_t* bytes = nullptr) {
+    SeriesEncoder encoder;
+    for (const auto& point : points) {
+        encoder.append(point);
+    }
+    if (bytes) {
+        *bytes = encoder.bytes().size();
+    }
+
+    SeriesDecoder decoder(encoder.bytes().data(), encoder.bytes().size(), encoder.count());
+    SeriesPoint point;
+    for (const auto& expected : points) {
+        if (!decoder.next(point) || point.timestamp_ms != expected.timestamp_ms) {
+            return false;
+        }
+        for (size_t i = 0; i < 3; i++) {
+            if (!sameBits(point.values[i], expected.values[i])) {
+                return false;
+            }
+        }
+    }
+    return !decoder.next(point);
+}
+
+static void testBits() {
+    BitWriter writer;
+    writer.writeBit(true);
+    writer.writeBits(0x5, 3);
+    writer.writeBits(0xDEADBEEFCAFEF00D, 64);
+    CHECK(writer.bitCount() == 68);
+    CHECK(writer.bytes().size() == 9);
+
+    BitReader reader(writer.bytes().data(), writer.bytes().size());
+    bool bit;
+    uint64_t value;
+    CHECK(reader.readBit(bit) && bit);
+    CHECK(reader.readBits(3, value) && value == 0x5);
+    CHECK(reader.readBits(64, value) && value == 0xDEADBEEFCAFEF00D);
+
+    // The padding of the last byte, then nothing
+    CHECK(reader.readBits(4, value) && value == 0);
+    CHECK(!reader.readBit(bit));
+}
+
+static void testSeries() {
+    // Regular one-minute samples with slowly changing values
+    std::vector<SeriesPoint> regular;
+    for (int i = 0; i < 1000; i++) {
+        regular.push_back({1750000000000 + i * 60000LL, {40.0 + (i % 7) * 0.25, 61.5, 33.0 + i / 100}});
+    }
+    size_t bytes = 0;
+    CHECK(roundTrip(regular, &bytes));
+    CHECK(bytes < regular.size() * 4);
+
+    // Jitter, gaps, clock steps back, NaN and extreme values
+    std::mt19937 rng(3);
+    std::vector<SeriesPoint> irregular;
+    int64_t ts = 1750000000000;
+    for (int i = 0; i < 1000; i++) {
+        ts += static_cast<int64_t>(rng() % 120000) - (i % 50 == 0 ? 3600000 : 0);
+        double cpu = (rng() % 10000) / 100.0;
+        irregular.push_back({ts, {cpu, i % 10 == 0 ? std::nan("") : -cpu, i % 100 == 0 ? 1e308 : 0.0}});
+    }
+    CHECK(roundTrip(irregular));
+
+    CHECK(roundTrip({}));
+    CHECK(roundTrip({{0, {0.0, -0.0, INFINITY}}}));
+}
+
+static void testCorrupt() {
+    SeriesEncoder encoder;
+    for (int i = 0; i < 100; i++) {
+        encoder.append({i * 1000LL, {double(i), 1.0, 2.0}});
+    }
+
+    // A truncated series ends early instead of returning garbage
+    std::string bytes = encoder.bytes();
+    SeriesDecoder decoder(bytes.data(), bytes.size() / 2, encoder.count());
+    SeriesPoint point;
+    size_t decoded = 0;
+    while (decoder.next(point)) {
+        decoded++;
+    }
+    CHECK(decoded > 0 && decoded < encoder.count());
+}
+
+static void testCrc() {
+    CHECK(crc32("123456789", 9) == 0xCBF43926);
+    CHECK(crc32("", 0) == 0);
+
+    // Incremental
+    CHECK(crc32("6789", 4, crc32("12345", 5)) == 0xCBF43926);
+}
+
+int main() {
+    testBits();
+    testSeries();
+    testCorrupt();
+    testCrc();
+    return testResult("tsdb_codec");
+}
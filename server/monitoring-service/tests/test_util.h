@@ -0,0 +1,27 @@
+#pragma once
+
+#include <iostream>
+
+// Checks for the unit tests: a failed check is reported and the remaining
+// ones still run; the test exits non-zero if any failed
+inline int& testFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+            testFailures()++; \
+        } \
+    } while (0)
+
+inline int testResult(const char* name) {
+    if (testFailures() > 0) {
+        std::cerr << name << ": " << testFailures() << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << name << ": ok" << std::endl;
+    return 0;
+}
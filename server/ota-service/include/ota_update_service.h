@@ -26,7 +26,7 @@ struct UpdateStatus {
 
 class OTAUpdateService {
 public:
-    explicit OTAUpdateService(const std::string& storage_path);
+    OTAUpdateService(const std::string& storage_path, std::shared_ptr<DBHandler> db);
     ~OTAUpdateService();
 
     // Méthodes principales
@@ -40,6 +40,6 @@ public:
 
 private:
     std::string file_storage_path;
-    std::unique_ptr<DBHandler> db_handler;
+    std::shared_ptr<DBHandler> db_handler;
 };
 
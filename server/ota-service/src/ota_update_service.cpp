@@ -8,18 +8,13 @@
 #include <iomanip>
 #include <mysql/mysql.h>
 
-OTAUpdateService::OTAUpdateService(const std::string& storage_path) 
-    : file_storage_path(storage_path) {
+OTAUpdateService::OTAUpdateService(const std::string& storage_path, std::shared_ptr<DBHandler> db)
+    : file_storage_path(storage_path), db_handler(std::move(db)) {
     // Create directory structure
     std::filesystem::create_directories(storage_path);
     std::filesystem::create_directories(storage_path + "/current");
     std::filesystem::create_directories(storage_path + "/rollback");
     
-    // Initialize DB handler with default parameters
-    db_handler = std::make_unique<DBHandler>();
-    if (!db_handler->InitializeDatabase()) {
-        std::cerr << "Failed to initialize database" << std::endl;
-    }
 }
 
 OTAUpdateService::~OTAUpdateService() = default;
@@ -59,51 +54,66 @@ bool OTAUpdateService::UploadUpdatePackage(const UpdatePackage& package, const s
     outfile.write(file_data.data(), file_data.size());
     outfile.close();
 
-    std::stringstream ss;
-    ss << "INSERT INTO updates (app_name, version, file_path, checksum) VALUES ("
-       << "'" << package.app_name << "',"
-       << "'" << package.version << "',"
-       << "'" << full_path << "',"
-       << "'" << package.checksum << "')";
-    return db_handler->Execute(ss.str());
+    auto conn = db_handler->connection();
+    if (!conn) return false;
+
+    StatementParams params(4);
+    params.add(package.app_name)
+          .add(package.version)
+          .add(full_path)
+          .add(package.checksum);
+    return conn->statements().execute(
+        "updates.insert",
+        "INSERT INTO updates (app_name, version, file_path, checksum) VALUES (?, ?, ?, ?)",
+        params);
 }
 
 std::vector<UpdatePackage> OTAUpdateService::GetAvailableUpdates(int32_t device_id, const std::string& app_name, const std::string& current_version) {
     std::vector<UpdatePackage> updates;
-    std::string query = "SELECT app_name, version, file_path, checksum FROM updates WHERE app_name='" + app_name + "' AND version > '" + current_version + "'";
-    MYSQL_RES* res = db_handler->Query(query);
-    if (!res) {
+    auto conn = db_handler->connection();
+    if (!conn) return updates;
+
+    StatementParams params(2);
+    params.add(app_name).add(current_version);
+    std::vector<PreparedStatementCache::Row> rows;
+    if (!conn->statements().query(
+            "updates.available",
+            "SELECT app_name, version, file_path, checksum FROM updates WHERE app_name = ? AND version > ?",
+            params, rows)) {
         std::cerr << "Failed to fetch updates from DB" << std::endl;
         return updates;
     }
-    MYSQL_ROW row;
-    while ((row = mysql_fetch_row(res))) {
+    for (auto& row : rows) {
         UpdatePackage pkg;
-        pkg.app_name   = row[0] ? row[0] : "";
-        pkg.version    = row[1] ? row[1] : "";
-        pkg.file_path  = row[2] ? row[2] : "";
-        pkg.checksum   = row[3] ? row[3] : "";
+        pkg.app_name   = std::move(row[0]);
+        pkg.version    = std::move(row[1]);
+        pkg.file_path  = std::move(row[2]);
+        pkg.checksum   = std::move(row[3]);
         updates.push_back(pkg);
     }
-    mysql_free_result(res);
     return updates;
 }
 
 bool OTAUpdateService::DownloadUpdate(int32_t device_id, const std::string& app_name, std::vector<char>& file_data) {
-    std::string query = "SELECT file_path FROM updates WHERE app_name='" + app_name + "' ORDER BY version DESC LIMIT 1";
-    MYSQL_RES* res = db_handler->Query(query);
-    if (!res) {
+    auto conn = db_handler->connection();
+    if (!conn) return false;
+
+    StatementParams params(1);
+    params.add(app_name);
+    std::vector<PreparedStatementCache::Row> rows;
+    if (!conn->statements().query(
+            "updates.latest_file",
+            "SELECT file_path FROM updates WHERE app_name = ? ORDER BY version DESC LIMIT 1",
+            params, rows)) {
         std::cerr << "Failed to fetch file path from DB" << std::endl;
         return false;
     }
-    MYSQL_ROW row = mysql_fetch_row(res);
-    if (!row || !row[0]) {
-        mysql_free_result(res);
+    if (rows.empty() || rows[0][0].empty()) {
         std::cerr << "No file found for app: " << app_name << std::endl;
         return false;
     }
-    std::string file_path = row[0];
-    mysql_free_result(res);
+    std::string file_path = rows[0][0];
+    conn = MySQLConnectionPool::Lease();
 
     std::ifstream infile(file_path, std::ios::binary);
     if (!infile.is_open()) {
@@ -116,13 +126,19 @@ bool OTAUpdateService::DownloadUpdate(int32_t device_id, const std::string& app_
 }
 
 bool OTAUpdateService::ReportUpdateStatus(const UpdateStatus& status) {
-    std::stringstream ss;
-    ss << "INSERT INTO update_status (device_id, app_name, current_version, target_version, status, error_message) VALUES ("
-       << status.device_id << ","
-       << "'" << status.app_name << "',"
-       << "'" << status.current_version << "',"
-       << "'" << status.target_version << "',"
-       << "'" << status.status << "',"
-       << "'" << status.error_message << "')";
-    return db_handler->Execute(ss.str());
+    auto conn = db_handler->connection();
+    if (!conn) return false;
+
+    StatementParams params(6);
+    params.add(status.device_id)
+          .add(status.app_name)
+          .add(status.current_version)
+          .add(status.target_version)
+          .add(status.status)
+          .add(status.error_message);
+    return conn->statements().execute(
+        "update_status.insert",
+        "INSERT INTO update_status (device_id, app_name, current_version, target_version, status, error_message) "
+        "VALUES (?, ?, ?, ?, ?, ?)",
+        params);
 }
\ No newline at end of file
@@ -5,12 +5,8 @@
 ProvisioningServiceImpl::ProvisioningServiceImpl(std::shared_ptr<DBHandler> db_manager,
                                                std::shared_ptr<JWTUtils> jwt_manager)
     : db_manager_(db_manager), jwt_manager_(jwt_manager) {
-    try {
-        DBHandler db;
-        std::cout << "✓ Service de provisionnement initialisé avec succès" << std::endl;
-    } catch (const std::runtime_error& e) {
-        std::cerr << "✗ Erreur critique: Impossible d'initialiser la base de données: " << e.what() << std::endl;
-    }
+    // The database is initialized once by the DBHandler shared with the other services
+    std::cout << "✓ Service de provisionnement initialisé avec succès" << std::endl;
 }
 
 // ============================================================================